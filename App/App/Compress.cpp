@@ -0,0 +1,176 @@
+#include "Compress.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+static const size_t LZ4_MIN_MATCH = 4;
+static const size_t LZ4_LAST_LITERALS = 5;   // The block must end with at least this many literals
+static const size_t LZ4_MATCH_FIND_LIMIT = 12; // No match may start within this distance of the end
+static const size_t LZ4_MAX_OFFSET = 65535;
+static const int LZ4_HASH_BITS = 14;
+
+static inline uint32_t Read32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t HashSequence(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+// Lengths of 15 or more spill into extra bytes: 255 each, then the remainder.
+static inline unsigned char* WriteLength(unsigned char* out, size_t length) {
+    while (length >= 255) {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = (unsigned char)length;
+    return out;
+}
+
+static unsigned char* WriteSequence(unsigned char* out, const unsigned char* literals, size_t literalLength,
+    size_t offset, size_t matchLength) {
+    unsigned char* token = out++;
+    *token = (unsigned char)((literalLength >= 15 ? 15 : literalLength) << 4);
+    if (literalLength >= 15) out = WriteLength(out, literalLength - 15);
+    if (literalLength) memcpy(out, literals, literalLength);
+    out += literalLength;
+
+    if (matchLength == 0) return out; // final literal-only sequence
+
+    *out++ = (unsigned char)offset;
+    *out++ = (unsigned char)(offset >> 8);
+    size_t extra = matchLength - LZ4_MIN_MATCH;
+    *token |= (unsigned char)(extra >= 15 ? 15 : extra);
+    if (extra >= 15) out = WriteLength(out, extra - 15);
+    return out;
+}
+
+size_t Lz4Compress(const unsigned char* src, size_t len, unsigned char* dst, size_t dstCapacity) {
+    if (dstCapacity < Lz4CompressBound(len)) return 0;
+
+    unsigned char* out = dst;
+    size_t anchor = 0;
+
+    if (len > LZ4_MATCH_FIND_LIMIT) {
+        // Positions are stored +1 so that 0 means empty.
+        thread_local std::vector<uint32_t> table;
+        table.assign((size_t)1 << LZ4_HASH_BITS, 0);
+
+        size_t matchFindEnd = len - LZ4_MATCH_FIND_LIMIT;
+        size_t matchEnd = len - LZ4_LAST_LITERALS;
+        size_t pos = 0;
+        while (pos < matchFindEnd) {
+            uint32_t sequence = Read32(src + pos);
+            uint32_t& slot = table[HashSequence(sequence)];
+            size_t candidate = slot;
+            slot = (uint32_t)(pos + 1);
+
+            if (candidate == 0 || pos - (candidate - 1) > LZ4_MAX_OFFSET || Read32(src + candidate - 1) != sequence) {
+                // Step faster through data that keeps missing, as the reference encoder does.
+                pos += 1 + ((pos - anchor) >> 6);
+                continue;
+            }
+
+            size_t match = candidate - 1;
+            while (pos > anchor && match > 0 && src[pos - 1] == src[match - 1]) {
+                pos--;
+                match--;
+            }
+            size_t length = LZ4_MIN_MATCH;
+            while (pos + length < matchEnd && src[pos + length] == src[match + length]) length++;
+
+            out = WriteSequence(out, src + anchor, pos - anchor, pos - match, length);
+            pos += length;
+            anchor = pos;
+            if (pos >= 2 && pos - 2 < matchFindEnd) {
+                table[HashSequence(Read32(src + pos - 2))] = (uint32_t)(pos - 1);
+            }
+        }
+    }
+
+    out = WriteSequence(out, src + anchor, len - anchor, 0, 0);
+    return (size_t)(out - dst);
+}
+
+static inline bool ReadLength(const unsigned char*& in, const unsigned char* end, size_t& length) {
+    unsigned char b;
+    do {
+        if (in >= end) return false;
+        b = *in++;
+        length += b;
+    } while (b == 255);
+    return true;
+}
+
+bool Lz4Decompress(const unsigned char* src, size_t len, unsigned char* dst, size_t rawSize) {
+    const unsigned char* in = src;
+    const unsigned char* inEnd = src + len;
+    size_t produced = 0;
+
+    while (in < inEnd) {
+        unsigned char token = *in++;
+
+        size_t literalLength = token >> 4;
+        if (literalLength == 15 && !ReadLength(in, inEnd, literalLength)) return false;
+        if (literalLength > (size_t)(inEnd - in) || literalLength > rawSize - produced) return false;
+        if (literalLength) memcpy(dst + produced, in, literalLength);
+        in += literalLength;
+        produced += literalLength;
+
+        if (in == inEnd) break; // the last sequence carries literals only
+
+        if (inEnd - in < 2) return false;
+        size_t offset = (size_t)in[0] | ((size_t)in[1] << 8);
+        in += 2;
+        if (offset == 0 || offset > produced) return false;
+
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && !ReadLength(in, inEnd, matchLength)) return false;
+        matchLength += LZ4_MIN_MATCH;
+        if (matchLength > rawSize - produced) return false;
+
+        unsigned char* out = dst + produced;
+        const unsigned char* from = out - offset;
+        if (offset >= matchLength) {
+            memcpy(out, from, matchLength);
+        } else {
+            // Overlapping copy repeats the last offset bytes; it must go byte by byte.
+            for (size_t i = 0; i < matchLength; i++) out[i] = from[i];
+        }
+        produced += matchLength;
+    }
+
+    return produced == rawSize;
+}
+
+double SampleEntropyBits(const unsigned char* data, size_t len) {
+    const size_t SAMPLE_COUNT = 4;
+    const size_t SAMPLE_BYTES = 1024;
+    if (len == 0) return 0;
+
+    size_t counts[256] = {};
+    size_t total = 0;
+    if (len <= SAMPLE_COUNT * SAMPLE_BYTES) {
+        for (size_t i = 0; i < len; i++) counts[data[i]]++;
+        total = len;
+    } else {
+        size_t stride = (len - SAMPLE_BYTES) / (SAMPLE_COUNT - 1);
+        for (size_t s = 0; s < SAMPLE_COUNT; s++) {
+            const unsigned char* sample = data + s * stride;
+            for (size_t i = 0; i < SAMPLE_BYTES; i++) counts[sample[i]]++;
+        }
+        total = SAMPLE_COUNT * SAMPLE_BYTES;
+    }
+
+    double entropy = 0;
+    for (size_t count : counts) {
+        if (count == 0) continue;
+        double p = (double)count / total;
+        entropy -= p * std::log2(p);
+    }
+    return entropy;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+
+// LZ4 block format (no frame header, no checksum): the relay inflates it with the same
+// few dozen lines, so no codec library is needed on either side.
+
+// Worst-case compressed size of len input bytes.
+inline size_t Lz4CompressBound(size_t len) {
+    return len + len / 255 + 16;
+}
+
+// Returns the compressed size, or 0 if the result would not fit in dstCapacity.
+size_t Lz4Compress(const unsigned char* src, size_t len, unsigned char* dst, size_t dstCapacity);
+
+// Succeeds only if src decodes to exactly rawSize bytes without reading or writing out of
+// bounds, so it is safe on untrusted input.
+bool Lz4Decompress(const unsigned char* src, size_t len, unsigned char* dst, size_t rawSize);
+
+// Shannon entropy in bits per byte over a few evenly spaced samples of the data. Already
+// compressed formats (zip, jpg, mp4) sit just under 8.
+double SampleEntropyBits(const unsigned char* data, size_t len);
@@ -0,0 +1,71 @@
+#include "Cpu.h"
+
+#ifdef LYNX_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+static void Cpuid(int leaf, int subleaf, unsigned int regs[4]) {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuidex(info, leaf, subleaf);
+    for (int i = 0; i < 4; i++) regs[i] = (unsigned int)info[i];
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+LYNX_TARGET("xsave")
+static unsigned long long ReadXcr0() {
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned int lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((unsigned long long)hi << 32) | lo;
+#endif
+}
+
+static CpuFeatures DetectCpuFeatures() {
+    CpuFeatures features;
+    unsigned int regs[4];
+
+    Cpuid(0, 0, regs);
+    unsigned int maxLeaf = regs[0];
+
+    Cpuid(1, 0, regs);
+    features.sse2 = (regs[3] & (1u << 26)) != 0;
+    features.ssse3 = (regs[2] & (1u << 9)) != 0;
+    features.sse41 = (regs[2] & (1u << 19)) != 0;
+    bool osxsave = (regs[2] & (1u << 27)) != 0;
+    if (!osxsave || maxLeaf < 7) return features;
+
+    // The CPU flags alone aren't enough: the OS must also save the wider registers.
+    unsigned long long xcr0 = ReadXcr0();
+    bool ymmState = (xcr0 & 0x06) == 0x06;
+    bool zmmState = (xcr0 & 0xE6) == 0xE6;
+
+    Cpuid(7, 0, regs);
+    features.avx2 = ymmState && (regs[1] & (1u << 5)) != 0;
+    features.avx512f = zmmState && (regs[1] & (1u << 16)) != 0;
+    bool avx512bw = (regs[1] & (1u << 30)) != 0;
+    bool avx512vbmi = (regs[2] & (1u << 1)) != 0;
+    features.avx512vbmi = features.avx512f && avx512bw && avx512vbmi;
+    return features;
+}
+
+const CpuFeatures& GetCpuFeatures() {
+    static const CpuFeatures features = DetectCpuFeatures();
+    return features;
+}
+
+#else
+
+const CpuFeatures& GetCpuFeatures() {
+    static const CpuFeatures features;
+    return features;
+}
+
+#endif // LYNX_X86
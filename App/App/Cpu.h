@@ -0,0 +1,28 @@
+#pragma once
+
+// Runtime ISA detection shared by the SIMD kernels (Base64, hashing). Each kernel family
+// picks its best implementation once from these flags.
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define LYNX_X86 1
+#include <immintrin.h>
+#endif
+
+// MSVC lets any function use any intrinsic; GCC and Clang need the ISA enabled per function.
+#if defined(LYNX_X86) && !defined(_MSC_VER)
+#define LYNX_TARGET(isa) __attribute__((target(isa)))
+#else
+#define LYNX_TARGET(isa)
+#endif
+
+struct CpuFeatures {
+    bool sse2 = false;
+    bool ssse3 = false;
+    bool sse41 = false;
+    bool avx2 = false;
+    bool avx512f = false;
+    bool avx512vbmi = false;  // Also implies AVX-512BW
+};
+
+// Detected on first call; all false on non-x86 builds.
+const CpuFeatures& GetCpuFeatures();
@@ -0,0 +1,716 @@
+#include "Deflate.h"
+
+#include <algorithm>
+#include <cstring>
+
+static const int DEFLATE_MAX_BITS = 15;
+static const int CODE_LENGTH_MAX_BITS = 7;
+static const int LITERAL_LENGTH_CODES = 286;   // 0-255 literals, 256 end of block, 257-285 lengths
+static const int DISTANCE_CODES = 30;
+static const int CODE_LENGTH_CODES = 19;
+static const int END_OF_BLOCK = 256;
+static const size_t MIN_MATCH = 3;
+static const size_t MAX_MATCH = 258;
+static const size_t MAX_STORED = 65535;
+static const int HASH_BITS = 15;
+static const int MAX_CHAIN = 64;                // Candidates tried per position
+static const size_t NICE_MATCH = 128;           // Long enough to stop looking
+static const int FAST_BITS = 9;                 // Codes up to this long decode with one table lookup
+static const size_t DECODER_RETAIN_BYTES = 1024 * 1024;
+
+static const uint16_t LENGTH_BASE[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const unsigned char LENGTH_EXTRA[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t DISTANCE_BASE[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const unsigned char DISTANCE_EXTRA[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+static const unsigned char CODE_LENGTH_ORDER[CODE_LENGTH_CODES] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+// The tail a sync flush ends in; RFC 7692 strips it from every message.
+static const unsigned char SYNC_TAIL[4] = { 0x00, 0x00, 0xFF, 0xFF };
+
+static inline int LengthCode(size_t length) {
+    return (int)(std::upper_bound(LENGTH_BASE, LENGTH_BASE + 28, (uint16_t)length) - LENGTH_BASE) - 1 +
+        (length == MAX_MATCH ? 1 : 0);
+}
+
+static inline int DistanceCode(size_t distance) {
+    return (int)(std::upper_bound(DISTANCE_BASE, DISTANCE_BASE + 30, (uint16_t)distance) - DISTANCE_BASE) - 1;
+}
+
+// Huffman codes are sent starting from their most significant bit.
+static inline uint32_t ReverseBits(uint32_t code, int length) {
+    uint32_t reversed = 0;
+    for (int i = 0; i < length; i++) {
+        reversed = (reversed << 1) | (code & 1);
+        code >>= 1;
+    }
+    return reversed;
+}
+
+// Canonical codes (RFC 1951 3.2.2), bit-reversed ready to send. Returns false if the lengths
+// over-subscribe the code space.
+static bool CanonicalCodes(const unsigned char* lengths, int count, uint32_t* codes) {
+    int lengthCount[DEFLATE_MAX_BITS + 1] = {};
+    for (int i = 0; i < count; i++) lengthCount[lengths[i]]++;
+    lengthCount[0] = 0;
+
+    int left = 1;
+    uint32_t next[DEFLATE_MAX_BITS + 1] = {};
+    uint32_t code = 0;
+    for (int bits = 1; bits <= DEFLATE_MAX_BITS; bits++) {
+        left = (left << 1) - lengthCount[bits];
+        if (left < 0) return false;
+        code = (code + lengthCount[bits - 1]) << 1;
+        next[bits] = code;
+    }
+    for (int i = 0; i < count; i++) {
+        codes[i] = lengths[i] ? ReverseBits(next[lengths[i]]++, lengths[i]) : 0;
+    }
+    return true;
+}
+
+// Huffman code lengths for the frequencies, none longer than maxBits. Rather than exact
+// length limiting, an over-long tree is rebuilt from flattened frequencies; it rarely happens
+// and costs a fraction of a percent when it does.
+static void BuildLengths(const uint32_t* freqs, int count, int maxBits, unsigned char* lengths) {
+    std::vector<uint32_t> weights(freqs, freqs + count);
+    std::vector<int> leaves;
+    std::vector<uint64_t> weight;
+    std::vector<int> parent;
+    for (;;) {
+        leaves.clear();
+        for (int i = 0; i < count; i++) {
+            lengths[i] = 0;
+            if (weights[i]) leaves.push_back(i);
+        }
+        size_t n = leaves.size();
+        if (n == 0) return;
+        if (n == 1) {
+            lengths[leaves[0]] = 1;
+            return;
+        }
+        std::sort(leaves.begin(), leaves.end(), [&](int a, int b) {
+            return weights[a] != weights[b] ? weights[a] < weights[b] : a < b;
+        });
+
+        // Leaves are nodes 0..n-1 in weight order and merged nodes follow, which come out in
+        // weight order too, so the two lightest are always at the front of one run or the other.
+        weight.assign(2 * n - 1, 0);
+        parent.assign(2 * n - 1, 0);
+        for (size_t i = 0; i < n; i++) weight[i] = weights[leaves[i]];
+        size_t nextLeaf = 0, nextMerged = n;
+        for (size_t node = n; node < 2 * n - 1; node++) {
+            for (int pick = 0; pick < 2; pick++) {
+                size_t child = (nextLeaf < n && (nextMerged >= node || weight[nextLeaf] <= weight[nextMerged]))
+                    ? nextLeaf++ : nextMerged++;
+                weight[node] += weight[child];
+                parent[child] = (int)node;
+            }
+        }
+
+        // Parents come after their children, so one backwards pass gives every depth.
+        std::vector<int> depth(2 * n - 1, 0);
+        int deepest = 0;
+        for (size_t node = 2 * n - 2; node-- > 0;) {
+            depth[node] = depth[parent[node]] + 1;
+            if (node < n) deepest = std::max(deepest, depth[node]);
+        }
+        if (deepest <= maxBits) {
+            for (size_t i = 0; i < n; i++) lengths[leaves[i]] = (unsigned char)depth[i];
+            return;
+        }
+        for (uint32_t& w : weights) {
+            if (w) w = (w >> 1) | 1;
+        }
+    }
+}
+
+// zlib rejects an incomplete code-length code, and a distance code of fewer than two codes
+// is only tolerated, so those always get at least two 1-bit codes.
+static void EnsureTwoCodes(unsigned char* lengths, int count) {
+    int used = 0;
+    for (int i = 0; i < count; i++) used += lengths[i] ? 1 : 0;
+    if (used >= 2) return;
+    if (used == 0) lengths[0] = 1;
+    lengths[lengths[0] ? 1 : 0] = 1;
+}
+
+// ============ Encoder ============
+
+struct DeflateEncoder::BitWriter {
+    std::string& out;
+    uint64_t bits = 0;
+    int count = 0;
+
+    explicit BitWriter(std::string& out) : out(out) {}
+
+    void Put(uint32_t value, int n) {
+        bits |= (uint64_t)value << count;
+        count += n;
+        while (count >= 8) {
+            out.push_back((char)(bits & 0xFF));
+            bits >>= 8;
+            count -= 8;
+        }
+    }
+
+    void AlignToByte() {
+        if (count > 0) out.push_back((char)(bits & 0xFF));
+        bits = 0;
+        count = 0;
+    }
+};
+
+static inline uint32_t HashAt(const unsigned char* p) {
+    uint32_t sequence = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16);
+    return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+DeflateEncoder::DeflateEncoder(int windowBits, bool contextTakeover)
+    : m_windowSize((size_t)1 << std::min(std::max(windowBits, DEFLATE_MIN_WINDOW_BITS), DEFLATE_MAX_WINDOW_BITS)),
+      m_contextTakeover(contextTakeover),
+      m_buffer(2 * m_windowSize),
+      m_head((size_t)1 << HASH_BITS, 0),
+      m_prev(m_windowSize, 0) {}
+
+void DeflateEncoder::Compress(const unsigned char* data, size_t size, std::string& out) {
+    BitWriter writer(out);
+    if (!m_contextTakeover) m_floor = m_end;
+
+    size_t offset = 0;
+    while (offset < size) {
+        if (m_end == m_buffer.size()) Slide();
+        size_t take = std::min(size - offset, m_buffer.size() - m_end);
+        memcpy(&m_buffer[m_end], data + offset, take);
+        size_t start = m_end;
+        m_end += take;
+        offset += take;
+
+        Tokenize(start, m_end);
+        WriteBlock(writer, start, m_end);
+    }
+
+    // Sync flush: an empty stored block, whose LEN and NLEN are the tail left off.
+    writer.Put(0, 3);
+    writer.AlignToByte();
+}
+
+// Drops the older window. Positions are kept +1 so that 0 means none; anything that
+// pointed into the dropped half becomes none.
+void DeflateEncoder::Slide() {
+    uint32_t window = (uint32_t)m_windowSize;
+    memmove(&m_buffer[0], &m_buffer[m_windowSize], m_windowSize);
+    m_end -= m_windowSize;
+    m_floor = m_floor > m_windowSize ? m_floor - m_windowSize : 0;
+    for (uint32_t& pos : m_head) pos = pos > window ? pos - window : 0;
+    for (uint32_t& pos : m_prev) pos = pos > window ? pos - window : 0;
+}
+
+void DeflateEncoder::Insert(size_t pos, size_t end) {
+    if (pos + MIN_MATCH > end) return;
+    uint32_t& head = m_head[HashAt(&m_buffer[pos])];
+    m_prev[pos & (m_windowSize - 1)] = head;
+    head = (uint32_t)(pos + 1);
+}
+
+// Longest earlier match for the bytes at pos, 0 if none reaches MIN_MATCH. Call before
+// inserting pos itself.
+size_t DeflateEncoder::FindMatch(size_t pos, size_t end, size_t& distance) const {
+    if (pos + MIN_MATCH > end) return 0;
+    size_t maxLength = std::min(MAX_MATCH, end - pos);
+    size_t limit = std::max(pos >= m_windowSize ? pos - m_windowSize + 1 : 0, m_floor);
+    const unsigned char* current = &m_buffer[pos];
+
+    size_t best = 0;
+    uint32_t candidate = m_head[HashAt(current)];
+    for (int chain = MAX_CHAIN; candidate != 0 && chain > 0; chain--) {
+        size_t match = candidate - 1;
+        if (match < limit || match >= pos) break;
+        const unsigned char* earlier = &m_buffer[match];
+        if (earlier[best] == current[best] && earlier[0] == current[0]) {
+            size_t length = 0;
+            while (length < maxLength && earlier[length] == current[length]) length++;
+            if (length > best) {
+                best = length;
+                distance = pos - match;
+                if (best >= NICE_MATCH || best == maxLength) break;
+            }
+        }
+        candidate = m_prev[match & (m_windowSize - 1)];
+    }
+    return best >= MIN_MATCH ? best : 0;
+}
+
+// LZ77 with one step of lazy matching: a match is only taken if the next position does
+// not start a longer one.
+void DeflateEncoder::Tokenize(size_t start, size_t end) {
+    m_tokens.clear();
+    size_t pos = start;
+    size_t pendingLength = 0, pendingDistance = 0;
+    while (pos < end) {
+        size_t distance = 0;
+        size_t length = FindMatch(pos, end, distance);
+        Insert(pos, end);
+
+        if (pendingLength && pendingLength >= length) {
+            // The match found one position back wins; it started at pos - 1.
+            m_tokens.push_back({ (uint16_t)pendingLength, (uint16_t)pendingDistance });
+            size_t matchEnd = pos - 1 + pendingLength;
+            for (pos++; pos < matchEnd; pos++) Insert(pos, end);
+            pendingLength = 0;
+            continue;
+        }
+        if (pendingLength) m_tokens.push_back({ m_buffer[pos - 1], 0 });
+
+        if (length >= NICE_MATCH) {
+            m_tokens.push_back({ (uint16_t)length, (uint16_t)distance });
+            size_t matchEnd = pos + length;
+            for (pos++; pos < matchEnd; pos++) Insert(pos, end);
+            pendingLength = 0;
+        } else if (length) {
+            pendingLength = length;
+            pendingDistance = distance;
+            pos++;
+        } else {
+            m_tokens.push_back({ m_buffer[pos], 0 });
+            pendingLength = 0;
+            pos++;
+        }
+    }
+    if (pendingLength) m_tokens.push_back({ (uint16_t)pendingLength, (uint16_t)pendingDistance });
+}
+
+// Writes the tokens of [start, end) as one stored, fixed or dynamic block, whichever is smallest.
+void DeflateEncoder::WriteBlock(BitWriter& writer, size_t start, size_t end) {
+    uint32_t literalFreqs[LITERAL_LENGTH_CODES] = {};
+    uint32_t distanceFreqs[DISTANCE_CODES] = {};
+    for (const Token& token : m_tokens) {
+        if (token.distance == 0) {
+            literalFreqs[token.literalOrLength]++;
+        } else {
+            literalFreqs[257 + LengthCode(token.literalOrLength)]++;
+            distanceFreqs[DistanceCode(token.distance)]++;
+        }
+    }
+    literalFreqs[END_OF_BLOCK] = 1;
+
+    // Dynamic codes
+    unsigned char literalLengths[LITERAL_LENGTH_CODES];
+    unsigned char distanceLengths[DISTANCE_CODES];
+    BuildLengths(literalFreqs, LITERAL_LENGTH_CODES, DEFLATE_MAX_BITS, literalLengths);
+    BuildLengths(distanceFreqs, DISTANCE_CODES, DEFLATE_MAX_BITS, distanceLengths);
+    EnsureTwoCodes(distanceLengths, DISTANCE_CODES);
+
+    int literalCount = LITERAL_LENGTH_CODES;
+    while (literalCount > 257 && literalLengths[literalCount - 1] == 0) literalCount--;
+    int distanceCount = DISTANCE_CODES;
+    while (distanceCount > 1 && distanceLengths[distanceCount - 1] == 0) distanceCount--;
+
+    // The code lengths themselves, run-length coded with symbols 16-18.
+    struct CodeLengthSymbol {
+        unsigned char symbol;
+        unsigned char extra;
+    };
+    std::vector<unsigned char> allLengths(literalLengths, literalLengths + literalCount);
+    allLengths.insert(allLengths.end(), distanceLengths, distanceLengths + distanceCount);
+    std::vector<CodeLengthSymbol> runs;
+    uint32_t codeLengthFreqs[CODE_LENGTH_CODES] = {};
+    for (size_t i = 0; i < allLengths.size();) {
+        unsigned char length = allLengths[i];
+        size_t run = 1;
+        while (i + run < allLengths.size() && allLengths[i + run] == length) run++;
+        i += run;
+        if (length == 0) {
+            while (run >= 11) {
+                size_t n = std::min(run, (size_t)138);
+                runs.push_back({ 18, (unsigned char)(n - 11) });
+                run -= n;
+            }
+            if (run >= 3) {
+                runs.push_back({ 17, (unsigned char)(run - 3) });
+                run = 0;
+            }
+        } else {
+            runs.push_back({ length, 0 });
+            run--;
+            while (run >= 3) {
+                size_t n = std::min(run, (size_t)6);
+                runs.push_back({ 16, (unsigned char)(n - 3) });
+                run -= n;
+            }
+        }
+        for (; run > 0; run--) runs.push_back({ length, 0 });
+    }
+    for (const CodeLengthSymbol& run : runs) codeLengthFreqs[run.symbol]++;
+    unsigned char codeLengthLengths[CODE_LENGTH_CODES];
+    BuildLengths(codeLengthFreqs, CODE_LENGTH_CODES, CODE_LENGTH_MAX_BITS, codeLengthLengths);
+    EnsureTwoCodes(codeLengthLengths, CODE_LENGTH_CODES);
+    int codeLengthCount = CODE_LENGTH_CODES;
+    while (codeLengthCount > 4 && codeLengthLengths[CODE_LENGTH_ORDER[codeLengthCount - 1]] == 0) codeLengthCount--;
+
+    // Sizes in bits of the three ways to send the block.
+    static const unsigned char CODE_LENGTH_EXTRA[CODE_LENGTH_CODES] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 3, 7 };
+    unsigned char fixedLiteralLengths[LITERAL_LENGTH_CODES];
+    for (int i = 0; i < LITERAL_LENGTH_CODES; i++) {
+        fixedLiteralLengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+    }
+    uint64_t dynamicBits = 3 + 5 + 5 + 4 + 3 * (uint64_t)codeLengthCount;
+    for (int i = 0; i < CODE_LENGTH_CODES; i++) {
+        dynamicBits += (uint64_t)codeLengthFreqs[i] * (codeLengthLengths[i] + CODE_LENGTH_EXTRA[i]);
+    }
+    uint64_t fixedBits = 3;
+    for (int i = 0; i < LITERAL_LENGTH_CODES; i++) {
+        uint64_t extra = i > 256 ? LENGTH_EXTRA[i - 257] : 0;
+        dynamicBits += (uint64_t)literalFreqs[i] * (literalLengths[i] + extra);
+        fixedBits += (uint64_t)literalFreqs[i] * (fixedLiteralLengths[i] + extra);
+    }
+    for (int i = 0; i < DISTANCE_CODES; i++) {
+        dynamicBits += (uint64_t)distanceFreqs[i] * (distanceLengths[i] + DISTANCE_EXTRA[i]);
+        fixedBits += (uint64_t)distanceFreqs[i] * (5 + DISTANCE_EXTRA[i]);
+    }
+    size_t rawSize = end - start;
+    uint64_t storedBits = (uint64_t)((rawSize + MAX_STORED - 1) / MAX_STORED) * (3 + 7 + 32) + 8 * (uint64_t)rawSize;
+
+    if (storedBits <= fixedBits && storedBits <= dynamicBits) {
+        for (size_t offset = 0; offset < rawSize;) {
+            size_t chunk = std::min(rawSize - offset, MAX_STORED);
+            writer.Put(0, 3);                    // BFINAL 0, BTYPE 00
+            writer.AlignToByte();
+            writer.Put((uint32_t)chunk, 16);
+            writer.Put((uint32_t)(~chunk & 0xFFFF), 16);
+            writer.out.append((const char*)&m_buffer[start + offset], chunk);
+            offset += chunk;
+        }
+        return;
+    }
+
+    uint32_t literalCodes[LITERAL_LENGTH_CODES];
+    uint32_t distanceCodes[DISTANCE_CODES];
+    const unsigned char* useLiteralLengths = literalLengths;
+    const unsigned char* useDistanceLengths = distanceLengths;
+    static const unsigned char FIXED_DISTANCE_LENGTHS[DISTANCE_CODES] = {
+        5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5 };
+    if (fixedBits <= dynamicBits) {
+        // Codes 286 and 287 are never sent but take their share of the fixed code space.
+        unsigned char lengths[288];
+        uint32_t codes[288];
+        memcpy(lengths, fixedLiteralLengths, LITERAL_LENGTH_CODES);
+        lengths[286] = lengths[287] = 8;
+        CanonicalCodes(lengths, 288, codes);
+        memcpy(literalCodes, codes, sizeof(literalCodes));
+        CanonicalCodes(FIXED_DISTANCE_LENGTHS, DISTANCE_CODES, distanceCodes);
+        useLiteralLengths = fixedLiteralLengths;
+        useDistanceLengths = FIXED_DISTANCE_LENGTHS;
+        writer.Put(1 << 1, 3);                   // BFINAL 0, BTYPE 01
+    } else {
+        uint32_t codeLengthCodes[CODE_LENGTH_CODES];
+        CanonicalCodes(literalLengths, LITERAL_LENGTH_CODES, literalCodes);
+        CanonicalCodes(distanceLengths, DISTANCE_CODES, distanceCodes);
+        CanonicalCodes(codeLengthLengths, CODE_LENGTH_CODES, codeLengthCodes);
+        writer.Put(2 << 1, 3);                   // BFINAL 0, BTYPE 10
+        writer.Put((uint32_t)(literalCount - 257), 5);
+        writer.Put((uint32_t)(distanceCount - 1), 5);
+        writer.Put((uint32_t)(codeLengthCount - 4), 4);
+        for (int i = 0; i < codeLengthCount; i++) writer.Put(codeLengthLengths[CODE_LENGTH_ORDER[i]], 3);
+        for (const CodeLengthSymbol& run : runs) {
+            writer.Put(codeLengthCodes[run.symbol], codeLengthLengths[run.symbol]);
+            if (CODE_LENGTH_EXTRA[run.symbol]) writer.Put(run.extra, CODE_LENGTH_EXTRA[run.symbol]);
+        }
+    }
+
+    for (const Token& token : m_tokens) {
+        if (token.distance == 0) {
+            writer.Put(literalCodes[token.literalOrLength], useLiteralLengths[token.literalOrLength]);
+            continue;
+        }
+        int lengthCode = LengthCode(token.literalOrLength);
+        writer.Put(literalCodes[257 + lengthCode], useLiteralLengths[257 + lengthCode]);
+        if (LENGTH_EXTRA[lengthCode]) writer.Put(token.literalOrLength - LENGTH_BASE[lengthCode], LENGTH_EXTRA[lengthCode]);
+        int distanceCode = DistanceCode(token.distance);
+        writer.Put(distanceCodes[distanceCode], useDistanceLengths[distanceCode]);
+        if (DISTANCE_EXTRA[distanceCode]) writer.Put(token.distance - DISTANCE_BASE[distanceCode], DISTANCE_EXTRA[distanceCode]);
+    }
+    writer.Put(literalCodes[END_OF_BLOCK], useLiteralLengths[END_OF_BLOCK]);
+}
+
+// ============ Decoder ============
+
+namespace {
+
+// Reads the message and then the stripped tail, least significant bit first.
+struct BitReader {
+    const unsigned char* data;
+    size_t size;
+    size_t pos = 0;
+    size_t tailPos = 0;
+    uint64_t bits = 0;
+    int count = 0;
+
+    BitReader(const unsigned char* data, size_t size) : data(data), size(size) {}
+
+    void Refill() {
+        while (count <= 56) {
+            unsigned char byte;
+            if (pos < size) byte = data[pos++];
+            else if (tailPos < sizeof(SYNC_TAIL)) byte = SYNC_TAIL[tailPos++];
+            else break;
+            bits |= (uint64_t)byte << count;
+            count += 8;
+        }
+    }
+
+    bool Get(int n, uint32_t& value) {
+        if (count < n) Refill();
+        if (count < n) return false;
+        value = (uint32_t)(bits & ((1ull << n) - 1));
+        bits >>= n;
+        count -= n;
+        return true;
+    }
+
+    void AlignToByte() {
+        bits >>= count & 7;
+        count -= count & 7;
+    }
+
+    // Whole bytes read so far, message and tail together; only meaningful once aligned.
+    size_t Consumed() const {
+        return pos + tailPos - (size_t)count / 8;
+    }
+};
+
+struct HuffmanTable {
+    uint16_t fast[1 << FAST_BITS];               // symbol << 4 | length, 0 for longer codes
+    uint16_t count[DEFLATE_MAX_BITS + 1];
+    uint16_t symbols[288];
+
+    bool Build(const unsigned char* lengths, int n) {
+        uint32_t codes[288];
+        if (!CanonicalCodes(lengths, n, codes)) return false;
+        memset(count, 0, sizeof(count));
+        for (int i = 0; i < n; i++) count[lengths[i]]++;
+        count[0] = 0;
+
+        uint16_t offsets[DEFLATE_MAX_BITS + 2] = {};
+        for (int bits = 1; bits <= DEFLATE_MAX_BITS; bits++) offsets[bits + 1] = offsets[bits] + count[bits];
+        memset(fast, 0, sizeof(fast));
+        for (int i = 0; i < n; i++) {
+            if (!lengths[i]) continue;
+            symbols[offsets[lengths[i]]++] = (uint16_t)i;
+            if (lengths[i] <= FAST_BITS) {
+                for (uint32_t slot = codes[i]; slot < (1u << FAST_BITS); slot += 1u << lengths[i]) {
+                    fast[slot] = (uint16_t)(i << 4 | lengths[i]);
+                }
+            }
+        }
+        return true;
+    }
+
+    // -1 on a code the table does not have or at the end of input.
+    int Decode(BitReader& reader) const {
+        if (reader.count < DEFLATE_MAX_BITS) reader.Refill();
+        uint16_t entry = fast[reader.bits & ((1u << FAST_BITS) - 1)];
+        if (entry) {
+            int length = entry & 15;
+            if (length > reader.count) return -1;
+            reader.bits >>= length;
+            reader.count -= length;
+            return entry >> 4;
+        }
+
+        // Canonical decoding one bit at a time (as zlib's puff does) for the rare long codes.
+        int code = 0, first = 0, index = 0;
+        for (int bits = 1; bits <= DEFLATE_MAX_BITS; bits++) {
+            uint32_t bit;
+            if (!reader.Get(1, bit)) return -1;
+            code |= (int)bit;
+            if (code - count[bits] < first) return symbols[index + (code - first)];
+            index += count[bits];
+            first = (first + count[bits]) << 1;
+            code <<= 1;
+        }
+        return -1;
+    }
+};
+
+struct FixedTables {
+    HuffmanTable literals;
+    HuffmanTable distances;
+
+    FixedTables() {
+        unsigned char lengths[288];
+        for (int i = 0; i < 288; i++) lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+        literals.Build(lengths, 288);
+        memset(lengths, 5, 32);
+        distances.Build(lengths, 32);
+    }
+};
+
+} // namespace
+
+DeflateDecoder::DeflateDecoder(bool contextTakeover) : m_contextTakeover(contextTakeover) {}
+
+bool DeflateDecoder::Decompress(const unsigned char* data, size_t size, size_t maxSize, const unsigned char*& out, size_t& outSize) {
+    static const FixedTables fixed;
+
+    // Keep the window of the previous message for back-references (32 KB covers any window size).
+    const size_t windowSize = (size_t)1 << DEFLATE_MAX_WINDOW_BITS;
+    size_t keep = m_contextTakeover ? std::min(m_size, windowSize) : 0;
+    if (keep) memmove(m_buffer.data(), m_buffer.data() + m_size - keep, keep);
+    m_size = m_history = keep;
+    // Grows as needed from a guess at the usual ratio; a huge message's buffer is not kept.
+    size_t guess = keep + std::min(size * 4 + 1024, maxSize);
+    if (m_buffer.size() > DECODER_RETAIN_BYTES && guess <= DECODER_RETAIN_BYTES) {
+        m_buffer.resize(guess);
+        m_buffer.shrink_to_fit();
+    }
+    if (m_buffer.size() < guess) m_buffer.resize(guess);
+
+    BitReader reader(data, size);
+    auto reserve = [&](size_t n) {
+        if (m_size + n - m_history > maxSize) return false;
+        if (m_size + n > m_buffer.size()) m_buffer.resize(std::max(m_size + n, m_buffer.size() * 2));
+        return true;
+    };
+
+    HuffmanTable literals, distances;
+    bool finished = false;                       // A final block was read; only the flush may follow
+    for (;;) {
+        uint32_t final, type;
+        if (!reader.Get(1, final) || !reader.Get(2, type)) return false;
+        if (finished && type != 0) return false;
+
+        if (type == 0) {
+            uint32_t length, inverse;
+            reader.AlignToByte();
+            // The sync flush: an empty stored block whose LEN and NLEN are exactly the tail.
+            bool flush = reader.Consumed() == reader.size;
+            if (!reader.Get(16, length) || !reader.Get(16, inverse) || length != (~inverse & 0xFFFF)) return false;
+            if (flush) break;
+            if (finished) return false;
+            if (!reserve(length)) return false;
+            // Whole bytes still in the bit buffer first, then straight from the input.
+            uint32_t byte;
+            while (length && reader.count >= 8) {
+                reader.Get(8, byte);
+                m_buffer[m_size++] = (unsigned char)byte;
+                length--;
+            }
+            size_t direct = std::min((size_t)length, reader.size - reader.pos);
+            memcpy(&m_buffer[m_size], reader.data + reader.pos, direct);
+            reader.pos += direct;
+            m_size += direct;
+            length -= (uint32_t)direct;
+            for (; length; length--) {
+                if (!reader.Get(8, byte)) return false;
+                m_buffer[m_size++] = (unsigned char)byte;
+            }
+        } else if (type == 1 || type == 2) {
+            const HuffmanTable* literalTable = &fixed.literals;
+            const HuffmanTable* distanceTable = &fixed.distances;
+            if (type == 2) {
+                uint32_t literalCount, distanceCount, codeLengthCount;
+                if (!reader.Get(5, literalCount) || !reader.Get(5, distanceCount) || !reader.Get(4, codeLengthCount)) return false;
+                literalCount += 257;
+                distanceCount += 1;
+                codeLengthCount += 4;
+                if (literalCount > LITERAL_LENGTH_CODES || distanceCount > DISTANCE_CODES) return false;
+
+                unsigned char codeLengthLengths[CODE_LENGTH_CODES] = {};
+                for (uint32_t i = 0; i < codeLengthCount; i++) {
+                    uint32_t length;
+                    if (!reader.Get(3, length)) return false;
+                    codeLengthLengths[CODE_LENGTH_ORDER[i]] = (unsigned char)length;
+                }
+                HuffmanTable codeLengthTable;
+                if (!codeLengthTable.Build(codeLengthLengths, CODE_LENGTH_CODES)) return false;
+
+                unsigned char lengths[LITERAL_LENGTH_CODES + DISTANCE_CODES];
+                uint32_t total = literalCount + distanceCount;
+                for (uint32_t i = 0; i < total;) {
+                    int symbol = codeLengthTable.Decode(reader);
+                    if (symbol < 0) return false;
+                    if (symbol < 16) {
+                        lengths[i++] = (unsigned char)symbol;
+                        continue;
+                    }
+                    uint32_t repeat;
+                    unsigned char value = 0;
+                    if (symbol == 16) {
+                        if (i == 0 || !reader.Get(2, repeat)) return false;
+                        value = lengths[i - 1];
+                        repeat += 3;
+                    } else if (symbol == 17) {
+                        if (!reader.Get(3, repeat)) return false;
+                        repeat += 3;
+                    } else {
+                        if (!reader.Get(7, repeat)) return false;
+                        repeat += 11;
+                    }
+                    if (i + repeat > total) return false;
+                    while (repeat--) lengths[i++] = value;
+                }
+                if (lengths[END_OF_BLOCK] == 0) return false;
+                if (!literals.Build(lengths, (int)literalCount) || !distances.Build(lengths + literalCount, (int)distanceCount)) return false;
+                literalTable = &literals;
+                distanceTable = &distances;
+            }
+
+            for (;;) {
+                int symbol = literalTable->Decode(reader);
+                if (symbol < 0) return false;
+                if (symbol < END_OF_BLOCK) {
+                    if (!reserve(1)) return false;
+                    m_buffer[m_size++] = (unsigned char)symbol;
+                    continue;
+                }
+                if (symbol == END_OF_BLOCK) break;
+
+                symbol -= 257;
+                if (symbol >= 29) return false;
+                uint32_t extra = 0;
+                if (LENGTH_EXTRA[symbol] && !reader.Get(LENGTH_EXTRA[symbol], extra)) return false;
+                size_t length = LENGTH_BASE[symbol] + extra;
+
+                symbol = distanceTable->Decode(reader);
+                if (symbol < 0 || symbol >= DISTANCE_CODES) return false;
+                extra = 0;
+                if (DISTANCE_EXTRA[symbol] && !reader.Get(DISTANCE_EXTRA[symbol], extra)) return false;
+                size_t distance = DISTANCE_BASE[symbol] + extra;
+                if (distance > m_size || !reserve(length)) return false;
+
+                unsigned char* to = &m_buffer[m_size];
+                const unsigned char* from = to - distance;
+                if (distance >= length) {
+                    memcpy(to, from, length);
+                } else {
+                    for (size_t i = 0; i < length; i++) to[i] = from[i];
+                }
+                m_size += length;
+            }
+        } else {
+            return false;
+        }
+
+        // Every message ends in the sync flush, even after a final block, where RFC 7692 has
+        // the sender append it on a byte boundary. Running out of input anywhere else (a
+        // truncated message) fails on the next read.
+        if (final) {
+            finished = true;
+            reader.AlignToByte();
+        }
+    }
+
+    out = m_buffer.data() + m_history;
+    outSize = m_size - m_history;
+    return true;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Raw DEFLATE (RFC 1951) as WebSocket permessage-deflate (RFC 7692) uses it: each message
+// ends in a sync flush so the peer can inflate it on its own, and with context takeover
+// both sides keep the last window of data so later messages can refer back to earlier ones.
+
+const int DEFLATE_MIN_WINDOW_BITS = 8;
+const int DEFLATE_MAX_WINDOW_BITS = 15;
+
+class DeflateEncoder {
+public:
+    // Back-references reach at most 2^windowBits - 1 bytes; without context takeover, never
+    // past the start of the current message.
+    DeflateEncoder(int windowBits, bool contextTakeover);
+
+    // Appends the compressed message to out, minus the 00 00 FF FF a sync flush ends in.
+    void Compress(const unsigned char* data, size_t size, std::string& out);
+
+private:
+    struct BitWriter;
+    struct Token {
+        uint16_t literalOrLength;
+        uint16_t distance;                       // 0 for a literal
+    };
+
+    void Slide();
+    void Insert(size_t pos, size_t end);
+    size_t FindMatch(size_t pos, size_t end, size_t& distance) const;
+    void Tokenize(size_t start, size_t end);
+    void WriteBlock(BitWriter& writer, size_t start, size_t end);
+
+    size_t m_windowSize;
+    bool m_contextTakeover;
+    std::vector<unsigned char> m_buffer;         // Two windows: history, then the input being compressed
+    size_t m_end = 0;
+    size_t m_floor = 0;                          // Matches never reach below this
+    std::vector<uint32_t> m_head;                // Per hash: latest position + 1, 0 for none
+    std::vector<uint32_t> m_prev;                // Per window slot: previous position + 1 with the same hash
+    std::vector<Token> m_tokens;
+};
+
+class DeflateDecoder {
+public:
+    explicit DeflateDecoder(bool contextTakeover);
+
+    // Inflates one message; the stripped 00 00 FF FF tail is implied, so the message must end
+    // in that sync flush (after a final block too). out points into the decoder and stays valid until
+    // the next call. Fails on malformed or truncated input or once the message would exceed
+    // maxSize bytes, so it is safe on untrusted input.
+    bool Decompress(const unsigned char* data, size_t size, size_t maxSize, const unsigned char*& out, size_t& outSize);
+
+private:
+    bool m_contextTakeover;
+    std::vector<unsigned char> m_buffer;         // History window, then the message being inflated
+    size_t m_size = 0;
+    size_t m_history = 0;
+};
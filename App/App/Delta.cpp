@@ -0,0 +1,185 @@
+#include "Delta.h"
+#include "Hash.h"
+
+static const size_t DELTA_MIN_DEFAULT_BLOCK = 1024;
+static const size_t DELTA_MAX_DEFAULT_BLOCK = 128 * 1024;
+
+size_t DeltaDefaultBlockSize(unsigned long long fileSize) {
+    size_t blockSize = DELTA_MIN_DEFAULT_BLOCK;
+    while (blockSize < DELTA_MAX_DEFAULT_BLOCK && (unsigned long long)blockSize * blockSize < fileSize) blockSize <<= 1;
+    return blockSize;
+}
+
+// a and b are kept mod 2^32 and only reduced to 16 bits here, which rolling relies on.
+static inline uint32_t PackWeak(uint32_t a, uint32_t b) {
+    return (a & 0xFFFF) | (b << 16);
+}
+
+static inline uint32_t WeakTag(uint32_t weak) {
+    return (weak ^ (weak >> 16)) & 0xFFFF;
+}
+
+static void SumWindow(const unsigned char* data, size_t len, uint32_t& a, uint32_t& b) {
+    a = 0;
+    b = 0;
+    for (size_t i = 0; i < len; i++) {
+        a += data[i];
+        b += a; // summing the running a weighs x[i] by (len - i)
+    }
+}
+
+uint32_t DeltaWeakChecksum(const unsigned char* data, size_t len) {
+    uint32_t a, b;
+    SumWindow(data, len, a, b);
+    return PackWeak(a, b);
+}
+
+void DeltaAppendSignatures(const unsigned char* data, size_t len, size_t blockSize, std::vector<unsigned char>& out) {
+    for (size_t pos = 0; pos < len; pos += blockSize) {
+        size_t size = len - pos < blockSize ? len - pos : blockSize;
+        uint32_t weak = DeltaWeakChecksum(data + pos, size);
+        uint64_t strong = Xxh64(data + pos, size);
+        for (int i = 0; i < 4; i++) out.push_back((unsigned char)(weak >> (8 * i)));
+        for (int i = 0; i < 8; i++) out.push_back((unsigned char)(strong >> (8 * i)));
+    }
+}
+
+DeltaMatcher::DeltaMatcher(const unsigned char* signatures, size_t blockSize, unsigned long long basisSize)
+    : m_blockSize(blockSize), m_tagStart(0x10001, 0) {
+    m_blockCount = (size_t)DeltaBlockCount(basisSize, blockSize);
+    m_lastBlockSize = m_blockCount ? (size_t)(basisSize - (unsigned long long)(m_blockCount - 1) * blockSize) : 0;
+    size_t fullBlocks = m_lastBlockSize == blockSize ? m_blockCount : m_blockCount - (m_blockCount ? 1 : 0);
+
+    auto parse = [&](size_t block) {
+        const unsigned char* p = signatures + block * DELTA_SIGNATURE_BYTES;
+        Entry entry;
+        entry.weak = 0;
+        entry.strong = 0;
+        for (int i = 0; i < 4; i++) entry.weak |= (uint32_t)p[i] << (8 * i);
+        for (int i = 0; i < 8; i++) entry.strong |= (uint64_t)p[4 + i] << (8 * i);
+        entry.block = (uint32_t)block;
+        return entry;
+    };
+
+    // Counting sort by tag, so a lookup only walks the few entries sharing 16 bits.
+    std::vector<Entry> parsed;
+    parsed.reserve(fullBlocks);
+    for (size_t block = 0; block < fullBlocks; block++) {
+        parsed.push_back(parse(block));
+        m_tagStart[WeakTag(parsed.back().weak) + 1]++;
+    }
+    for (size_t tag = 1; tag < m_tagStart.size(); tag++) m_tagStart[tag] += m_tagStart[tag - 1];
+
+    m_entries.resize(fullBlocks);
+    m_entryOf.resize(fullBlocks);
+    std::vector<uint32_t> fill(m_tagStart.begin(), m_tagStart.end() - 1);
+    for (const Entry& entry : parsed) {
+        uint32_t slot = fill[WeakTag(entry.weak)]++;
+        m_entries[slot] = entry;
+        m_entryOf[entry.block] = slot;
+    }
+
+    if (fullBlocks < m_blockCount) m_last = parse(m_blockCount - 1);
+}
+
+bool DeltaMatcher::Matches(size_t entry, const unsigned char* window, size_t len, uint32_t weak) const {
+    return m_entries[entry].weak == weak && m_entries[entry].strong == Xxh64(window, len);
+}
+
+// Tries the block after the previous match first, so an unchanged stretch stays one run
+// even when the old copy has duplicate blocks.
+long long DeltaMatcher::FindBlock(const unsigned char* window, uint32_t weak, long long preferred) const {
+    if (preferred >= 0 && (size_t)preferred < m_entryOf.size()) {
+        size_t entry = m_entryOf[(size_t)preferred];
+        if (Matches(entry, window, m_blockSize, weak)) return preferred;
+    }
+
+    uint32_t tag = WeakTag(weak);
+    bool hashed = false;
+    uint64_t strong = 0;
+    for (uint32_t i = m_tagStart[tag]; i < m_tagStart[tag + 1]; i++) {
+        if (m_entries[i].weak != weak) continue;
+        if (!hashed) {
+            strong = Xxh64(window, m_blockSize);
+            hashed = true;
+        }
+        if (m_entries[i].strong == strong) return m_entries[i].block;
+    }
+    return -1;
+}
+
+bool DeltaMatcher::Scan(const unsigned char* data, size_t len, const std::function<bool(const DeltaOp&)>& emit) const {
+    const size_t B = m_blockSize;
+    size_t literalStart = 0;
+    DeltaOp run;
+    bool pendingRun = false;
+
+    auto flushRun = [&]() {
+        if (!pendingRun) return true;
+        pendingRun = false;
+        return emit(run);
+    };
+    auto literalUpTo = [&](size_t end) {
+        if (end <= literalStart) return true;
+        if (!flushRun()) return false;
+        DeltaOp op;
+        op.offset = literalStart;
+        op.length = end - literalStart;
+        return emit(op);
+    };
+    auto copyBlock = [&](unsigned long long block) {
+        if (pendingRun && run.block + run.count == block) {
+            run.count++;
+            return true;
+        }
+        if (!flushRun()) return false;
+        run = DeltaOp();
+        run.copy = true;
+        run.block = block;
+        run.count = 1;
+        pendingRun = true;
+        return true;
+    };
+
+    if (!m_entries.empty()) {
+        uint32_t a = 0, b = 0;
+        bool primed = false;
+        long long preferred = -1;
+        size_t pos = 0;
+        while (pos + B <= len) {
+            if (!primed) {
+                SumWindow(data + pos, B, a, b);
+                primed = true;
+            }
+
+            long long block = FindBlock(data + pos, PackWeak(a, b), preferred);
+            if (block >= 0) {
+                if (!literalUpTo(pos) || !copyBlock((unsigned long long)block)) return false;
+                pos += B;
+                literalStart = pos;
+                preferred = block + 1;
+                primed = false;
+                continue;
+            }
+
+            if (pos + B < len) {
+                uint32_t out = data[pos];
+                a += data[pos + B] - out;
+                b += a - (uint32_t)B * out;
+            }
+            pos++;
+        }
+    }
+
+    // The old copy's short last block can only line up with the very end of the new one.
+    size_t tailStart = len;
+    if (m_lastBlockSize && m_lastBlockSize < B && len - literalStart >= m_lastBlockSize) {
+        const unsigned char* tail = data + len - m_lastBlockSize;
+        if (DeltaWeakChecksum(tail, m_lastBlockSize) == m_last.weak && Xxh64(tail, m_lastBlockSize) == m_last.strong) {
+            tailStart = len - m_lastBlockSize;
+        }
+    }
+    if (!literalUpTo(tailStart)) return false;
+    if (tailStart < len && !copyBlock(m_last.block)) return false;
+    return flushRun();
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// rsync-style delta encoding. The side holding the old copy describes it as one signature
+// per block (weak rolling checksum + XXH64); the side holding the new copy slides a window
+// over it and turns every run that matches a block into a reference, sending only the bytes
+// in between.
+//
+// Signature table: DELTA_SIGNATURE_BYTES per block, little-endian u32 weak then u64 strong.
+// The last block may be short; it is hashed over its actual length.
+//
+// Weak checksum over a window x[0..L): a = sum(x[i]), b = sum((L - i) * x[i]), both mod 2^16,
+// weak = a | (b << 16). This is rsync's, so it can be rolled one byte at a time.
+
+const size_t DELTA_SIGNATURE_BYTES = 12;
+
+// sqrt(fileSize) rounded up to a power of two, kept between 1 KB and 128 KB.
+size_t DeltaDefaultBlockSize(unsigned long long fileSize);
+
+inline unsigned long long DeltaBlockCount(unsigned long long fileSize, size_t blockSize) {
+    return (fileSize + blockSize - 1) / blockSize;
+}
+
+uint32_t DeltaWeakChecksum(const unsigned char* data, size_t len);
+
+// Appends the signatures of data, cut into blockSize blocks, to out. Call repeatedly with
+// consecutive pieces that are multiples of blockSize except the last.
+void DeltaAppendSignatures(const unsigned char* data, size_t len, size_t blockSize, std::vector<unsigned char>& out);
+
+// One instruction of a delta: copy blocks [block, block + count) of the old copy, or take
+// length new bytes starting at offset in the new copy.
+struct DeltaOp {
+    bool copy = false;
+    unsigned long long block = 0;
+    unsigned long long count = 0;
+    unsigned long long offset = 0;
+    unsigned long long length = 0;
+};
+
+class DeltaMatcher {
+public:
+    // signatures holds DeltaBlockCount(basisSize, blockSize) entries.
+    DeltaMatcher(const unsigned char* signatures, size_t blockSize, unsigned long long basisSize);
+
+    // Emits ops that rebuild data from the old copy, merging runs of consecutive blocks.
+    // Stops early, returning false, once emit does.
+    bool Scan(const unsigned char* data, size_t len, const std::function<bool(const DeltaOp&)>& emit) const;
+
+private:
+    struct Entry {
+        uint32_t weak;
+        uint64_t strong;
+        uint32_t block;
+    };
+
+    bool Matches(size_t entry, const unsigned char* window, size_t len, uint32_t weak) const;
+    long long FindBlock(const unsigned char* window, uint32_t weak, long long preferred) const;
+
+    size_t m_blockSize;
+    size_t m_blockCount;
+    size_t m_lastBlockSize;
+    std::vector<Entry> m_entries;      // Full-size blocks, grouped by weak-checksum tag
+    std::vector<uint32_t> m_tagStart;  // m_entries[m_tagStart[tag] .. m_tagStart[tag + 1]) share a tag
+    std::vector<size_t> m_entryOf;     // Block index -> position in m_entries
+    Entry m_last = {};                 // The short final block, if the old copy has one
+};
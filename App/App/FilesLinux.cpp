@@ -0,0 +1,620 @@
+// Linux file backend: the Platform.h file, enumeration and change-notification calls over
+// POSIX files, readdir and inotify. Windows semantics the core relies on are kept: links are
+// described rather than followed, dot files are hidden, and a directory watch reports
+// renames as from/to pairs.
+
+#include "Agent.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// ============ Errors ============
+
+namespace {
+
+thread_local int t_lastErrno = 0;
+
+bool Fail(int error) {
+    t_lastErrno = error;
+    return false;
+}
+
+bool FailErrno() {
+    return Fail(errno);
+}
+
+bool Succeed() {
+    t_lastErrno = 0;
+    return true;
+}
+
+} // namespace
+
+FileError LastFileError() {
+    switch (t_lastErrno) {
+    case 0: return FileError::None;
+    case ENOENT:
+    case ENOTDIR: return FileError::NotFound;
+    case EACCES:
+    case EPERM:
+    case EISDIR:
+    case EROFS: return FileError::AccessDenied;
+    case EEXIST: return FileError::Exists;
+    case ENOTEMPTY: return FileError::NotEmpty;
+    case EXDEV: return FileError::CrossDevice;
+    default: return FileError::Other;
+    }
+}
+
+unsigned long LastFileErrorCode() {
+    return (unsigned long)t_lastErrno;
+}
+
+// ============ Paths ============
+
+namespace {
+
+std::string NativePath(const std::wstring& path) {
+    return WideToUtf8(path);
+}
+
+unsigned long long UnixNs(const struct timespec& time) {
+    if (time.tv_sec < 0) return 0;
+    return (unsigned long long)time.tv_sec * 1000000000ULL + (unsigned long long)time.tv_nsec;
+}
+
+struct timespec ToTimespec(unsigned long long ns) {
+    struct timespec time;
+    time.tv_sec = (time_t)(ns / 1000000000ULL);
+    time.tv_nsec = (long)(ns % 1000000000ULL);
+    return time;
+}
+
+const char* BaseName(const std::string& path) {
+    size_t slash = path.find_last_of('/');
+    return slash == std::string::npos ? path.c_str() : path.c_str() + slash + 1;
+}
+
+// A link is described, not followed, but counts as a directory when it points at one, as a
+// junction does on Windows. A file its owner can't write is read-only.
+FileInfo InfoOf(const struct stat& st, const char* name, int dirFd, const char* linkPath) {
+    FileInfo info;
+    if (S_ISLNK(st.st_mode)) {
+        info.isLink = true;
+        struct stat target;
+        bool followed = dirFd >= 0 ? fstatat(dirFd, linkPath, &target, 0) == 0 : stat(linkPath, &target) == 0;
+        info.isDir = followed && S_ISDIR(target.st_mode);
+    } else {
+        info.isDir = S_ISDIR(st.st_mode);
+    }
+    if (name[0] == '.' && strcmp(name, ".") != 0 && strcmp(name, "..") != 0) info.attributes |= PATH_ATTR_HIDDEN;
+    if (!S_ISLNK(st.st_mode) && !(st.st_mode & S_IWUSR)) info.attributes |= PATH_ATTR_READONLY;
+    info.size = S_ISREG(st.st_mode) ? (unsigned long long)st.st_size : 0;
+    info.createdAt = UnixNs(st.st_ctim);         // No birth time in stat
+    info.accessedAt = UnixNs(st.st_atim);
+    info.modifiedAt = UnixNs(st.st_mtim);
+    return info;
+}
+
+} // namespace
+
+bool PathGetInfo(const std::wstring& path, FileInfo& info) {
+    std::string native = NativePath(path);
+    struct stat st;
+    if (lstat(native.c_str(), &st) != 0) return FailErrno();
+    info = InfoOf(st, BaseName(native), -1, native.c_str());
+    return Succeed();
+}
+
+bool PathDeleteFile(const std::wstring& path) {
+    std::string native = NativePath(path);
+    struct stat st;
+    if (lstat(native.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) return Fail(EISDIR);
+    return unlink(native.c_str()) == 0 ? Succeed() : FailErrno();
+}
+
+bool PathRemoveDir(const std::wstring& path) {
+    std::string native = NativePath(path);
+    if (rmdir(native.c_str()) == 0) return Succeed();
+    int error = errno;
+    struct stat st;
+    if (error == ENOTDIR && lstat(native.c_str(), &st) == 0 && S_ISLNK(st.st_mode)) {
+        return unlink(native.c_str()) == 0 ? Succeed() : FailErrno();
+    }
+    return Fail(error);
+}
+
+bool PathCreateDir(const std::wstring& path) {
+    return mkdir(NativePath(path).c_str(), 0777) == 0 ? Succeed() : FailErrno();
+}
+
+bool PathCreateDirs(const std::wstring& path) {
+    std::string native = NativePath(path);
+    struct stat st;
+    if (stat(native.c_str(), &st) == 0) return S_ISDIR(st.st_mode) ? Succeed() : Fail(EEXIST);
+    for (size_t slash = native.find('/', 1); ; slash = native.find('/', slash + 1)) {
+        std::string prefix = native.substr(0, slash);
+        if (!prefix.empty() && mkdir(prefix.c_str(), 0777) != 0 && errno != EEXIST) return FailErrno();
+        if (slash == std::string::npos) break;
+    }
+    if (stat(native.c_str(), &st) != 0) return FailErrno();
+    return S_ISDIR(st.st_mode) ? Succeed() : Fail(EEXIST);
+}
+
+// Only read-only has a counterpart, the write bits; hidden is the name and system doesn't exist.
+bool PathSetAttributes(const std::wstring& path, unsigned attributes) {
+    std::string native = NativePath(path);
+    struct stat st;
+    if (lstat(native.c_str(), &st) != 0) return FailErrno();
+    if (S_ISLNK(st.st_mode)) return Succeed();
+    mode_t mode = st.st_mode & 07777;
+    mode = (attributes & PATH_ATTR_READONLY) ? mode & ~(mode_t)(S_IWUSR | S_IWGRP | S_IWOTH) : mode | S_IWUSR;
+    return chmod(native.c_str(), mode) == 0 ? Succeed() : FailErrno();
+}
+
+bool PathMove(const std::wstring& from, const std::wstring& to, unsigned flags) {
+    std::string source = NativePath(from);
+    std::string target = NativePath(to);
+    bool replace = (flags & PATH_MOVE_REPLACE) != 0;
+    int result = replace ? rename(source.c_str(), target.c_str()) :
+        renameat2(AT_FDCWD, source.c_str(), AT_FDCWD, target.c_str(), RENAME_NOREPLACE);
+    if (result != 0 && errno == EINVAL && !replace) {
+        // File systems without RENAME_NOREPLACE: check, then rename.
+        struct stat st;
+        if (lstat(target.c_str(), &st) == 0) return Fail(EEXIST);
+        result = rename(source.c_str(), target.c_str());
+    }
+    if (result != 0) return FailErrno();
+    if (flags & PATH_MOVE_WRITE_THROUGH) {
+        // The rename is an entry in the target's directory, so that is what goes to disk.
+        size_t slash = target.find_last_of('/');
+        std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : target.substr(0, slash);
+        int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        bool synced = fd >= 0 && fsync(fd) == 0;
+        int error = errno;
+        if (fd >= 0) close(fd);
+        if (!synced) return Fail(error);
+    }
+    return Succeed();
+}
+
+std::wstring GetTempDirectory() {
+    const char* dir = getenv("TMPDIR");
+    std::wstring path = Utf8ToWide(dir && *dir ? dir : "/tmp");
+    if (path.back() != PATH_SEPARATOR) path += PATH_SEPARATOR;
+    return path;
+}
+
+// ============ File Handles ============
+
+struct File {
+    int fd = -1;
+    std::string path;
+};
+
+File* FileOpen(const std::wstring& path, FileMode mode, unsigned hints) {
+    std::string native = NativePath(path);
+    int flags = O_CLOEXEC | O_NOCTTY | O_NONBLOCK;   // Non-blocking so a FIFO can't hang the open
+    switch (mode) {
+    case FileMode::Read:
+    case FileMode::ReadShared: flags |= O_RDONLY; break;
+    case FileMode::Create: flags |= O_RDWR | O_CREAT | O_TRUNC; break;
+    case FileMode::CreateNew: flags |= O_RDWR | O_CREAT | O_EXCL; break;
+    case FileMode::OpenOrCreate: flags |= O_RDWR | O_CREAT; break;
+    }
+    int fd = open(native.c_str(), flags, 0666);
+    if (fd < 0) {
+        FailErrno();
+        return nullptr;
+    }
+    // Directories, pipes and devices have no Windows counterpart here and would block or
+    // never end, so only regular files are opened.
+    struct stat st;
+    int error = fstat(fd, &st) != 0 ? errno : S_ISDIR(st.st_mode) ? EISDIR : !S_ISREG(st.st_mode) ? EACCES : 0;
+    if (error) {
+        close(fd);
+        Fail(error);
+        return nullptr;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    if (hints & FILE_HINT_SEQUENTIAL) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (hints & FILE_HINT_RANDOM) posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+
+    File* file = new File();
+    file->fd = fd;
+    file->path = std::move(native);
+    Succeed();
+    return file;
+}
+
+void FileClose(File* file) {
+    if (!file) return;
+    close(file->fd);
+    delete file;
+}
+
+bool FileRead(File* file, void* buffer, size_t size, size_t& bytesRead) {
+    bytesRead = 0;
+    ssize_t done;
+    do {
+        done = read(file->fd, buffer, size);
+    } while (done < 0 && errno == EINTR);
+    if (done < 0) return FailErrno();
+    bytesRead = (size_t)done;
+    return Succeed();
+}
+
+bool FileReadAt(File* file, void* buffer, size_t size, unsigned long long offset, size_t& bytesRead) {
+    bytesRead = 0;
+    ssize_t done;
+    do {
+        done = pread(file->fd, buffer, size, (off_t)offset);
+    } while (done < 0 && errno == EINTR);
+    if (done < 0) return FailErrno();
+    bytesRead = (size_t)done;
+    return Succeed();
+}
+
+bool FileWrite(File* file, const void* data, size_t size) {
+    const char* at = (const char*)data;
+    while (size > 0) {
+        ssize_t done = write(file->fd, at, size);
+        if (done < 0 && errno == EINTR) continue;
+        if (done <= 0) return done < 0 ? FailErrno() : Fail(EIO);
+        at += done;
+        size -= (size_t)done;
+    }
+    return Succeed();
+}
+
+bool FileGetSize(File* file, unsigned long long& size) {
+    struct stat st;
+    if (fstat(file->fd, &st) != 0) return FailErrno();
+    size = (unsigned long long)st.st_size;
+    return Succeed();
+}
+
+bool FileSeek(File* file, unsigned long long offset) {
+    return lseek(file->fd, (off_t)offset, SEEK_SET) >= 0 ? Succeed() : FailErrno();
+}
+
+bool FileSetEnd(File* file, unsigned long long size) {
+    return ftruncate(file->fd, (off_t)size) == 0 ? Succeed() : FailErrno();
+}
+
+bool FileReserve(File* file, unsigned long long size) {
+    return size == 0 || fallocate(file->fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)size) == 0 ? Succeed() : FailErrno();
+}
+
+bool FileFlush(File* file) {
+    return fsync(file->fd) == 0 ? Succeed() : FailErrno();
+}
+
+bool FileGetInfo(File* file, FileInfo& info) {
+    struct stat st;
+    if (fstat(file->fd, &st) != 0) return FailErrno();
+    info = InfoOf(st, BaseName(file->path), -1, file->path.c_str());
+    return Succeed();
+}
+
+bool FileSetTimes(File* file, unsigned long long /*createdAt*/, unsigned long long accessedAt, unsigned long long modifiedAt) {
+    struct timespec times[2];
+    times[0].tv_nsec = UTIME_OMIT;
+    times[1].tv_nsec = UTIME_OMIT;
+    if (accessedAt) times[0] = ToTimespec(accessedAt);
+    if (modifiedAt) times[1] = ToTimespec(modifiedAt);
+    return futimens(file->fd, times) == 0 ? Succeed() : FailErrno();
+}
+
+bool FileGetIdentity(File* file, FileIdentity& identity) {
+    struct stat st;
+    if (fstat(file->fd, &st) != 0) return FailErrno();
+    identity.volume = (unsigned long long)st.st_dev;
+    identity.index = (unsigned long long)st.st_ino;
+    return Succeed();
+}
+
+const void* FileMapView(File* file, size_t size) {
+    void* view = mmap(nullptr, size, PROT_READ, MAP_SHARED, file->fd, 0);
+    if (view == MAP_FAILED) {
+        FailErrno();
+        return nullptr;
+    }
+    Succeed();
+    return view;
+}
+
+void FileUnmapView(const void* view, size_t size) {
+    if (view) munmap((void*)view, size);
+}
+
+// ============ Enumeration ============
+
+struct DirScan {
+    DIR* dir = nullptr;
+    std::string pattern;                         // Empty matches everything
+};
+
+DirScan* DirScanOpen(const std::wstring& dir, const std::wstring& pattern) {
+    DIR* handle = opendir(NativePath(dir).c_str());
+    if (!handle) {
+        FailErrno();
+        return nullptr;
+    }
+    DirScan* scan = new DirScan();
+    scan->dir = handle;
+    if (pattern != L"*") scan->pattern = NativePath(pattern);
+    Succeed();
+    return scan;
+}
+
+bool DirScanNext(DirScan* scan, std::wstring& name, FileInfo& info) {
+    while (dirent* entry = readdir(scan->dir)) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        if (!scan->pattern.empty() && fnmatch(scan->pattern.c_str(), entry->d_name, FNM_CASEFOLD) != 0) continue;
+        struct stat st;
+        if (fstatat(dirfd(scan->dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue; // Gone since readdir
+        name = Utf8ToWide(entry->d_name);
+        info = InfoOf(st, entry->d_name, dirfd(scan->dir), entry->d_name);
+        return true;
+    }
+    return false;
+}
+
+void DirScanClose(DirScan* scan) {
+    if (!scan) return;
+    closedir(scan->dir);
+    delete scan;
+}
+
+// ============ Change Notifications ============
+
+namespace {
+
+const uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | IN_ATTRIB |
+    IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK;
+
+// What a change takes in a Windows notification buffer, so bufferBytes means the same here.
+size_t RecordBytes(size_t nameLength) {
+    return (3 * sizeof(uint32_t) + nameLength * sizeof(char16_t) + 3) & ~(size_t)3;
+}
+
+void Drain(int fd) {
+    char scratch[4096];
+    while (read(fd, scratch, sizeof(scratch)) > 0) {}
+}
+
+struct Watch {
+    int wd = -1;
+    std::vector<DirChange> backlog;              // Not handed to a wait yet
+    size_t backlogBytes = 0;
+    bool overflowed = false;
+    bool ended = false;
+    bool queued = false;                         // Its id is in DirWatcher::ready
+};
+
+} // namespace
+
+// One inotify instance for every watch. Events are gathered per watch between waits, and
+// a watch with something to report is queued once until a wait hands that out.
+struct DirWatcher {
+    int inotifyFd = -1;
+    int wakeFd = -1;
+    size_t bufferBytes = 0;
+    std::mutex mutex;                            // DirWatchAdd and DirWatchRemove come from other threads
+    std::unordered_map<unsigned long long, Watch> watches;
+    std::unordered_map<int, std::vector<unsigned long long>> ids; // By inotify watch; one directory may be added twice
+    std::deque<unsigned long long> ready;
+
+    void Queue(unsigned long long id, Watch& watch) {
+        if (watch.queued) return;
+        watch.queued = true;
+        ready.push_back(id);
+    }
+
+    void Forget(unsigned long long id, int wd) {
+        auto it = ids.find(wd);
+        if (it == ids.end()) return;
+        auto& list = it->second;
+        for (size_t i = 0; i < list.size(); i++) {
+            if (list[i] != id) continue;
+            list.erase(list.begin() + i);
+            break;
+        }
+        if (list.empty()) {
+            ids.erase(it);
+            inotify_rm_watch(inotifyFd, wd);
+        }
+    }
+
+    void ReadEvents();
+};
+
+// inotify reports a rename as a MOVED_FROM/MOVED_TO pair sharing a cookie. A pair within one
+// directory becomes the RenamedFrom/RenamedTo pair Windows reports; a name moved out of the
+// directory was removed as far as it can tell, and one moved in was added. Called with mutex held.
+void DirWatcher::ReadEvents() {
+    alignas(struct inotify_event) char events[64 * 1024];
+    ssize_t length = read(inotifyFd, events, sizeof(events));
+    if (length <= 0) return;
+
+    std::unordered_map<uint32_t, std::pair<unsigned long long, size_t>> movedFrom; // Cookie -> backlog record
+    for (char* at = events; at < events + length;) {
+        const inotify_event* event = (const inotify_event*)at;
+        at += sizeof(inotify_event) + event->len;
+
+        if (event->mask & IN_Q_OVERFLOW) {
+            for (auto& entry : watches) {
+                entry.second.overflowed = true;
+                Queue(entry.first, entry.second);
+            }
+            continue;
+        }
+        auto it = ids.find(event->wd);
+        if (it == ids.end()) continue;           // Removed meanwhile
+        for (unsigned long long id : it->second) {
+            Watch& watch = watches[id];
+            Queue(id, watch);
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED | IN_UNMOUNT)) {
+                watch.ended = true;
+                continue;
+            }
+            if (event->len == 0 || watch.overflowed) continue;
+
+            DirChange change;
+            change.name = Utf8ToWide(event->name);
+            change.kind = (event->mask & (IN_CREATE | IN_MOVED_TO)) ? DirChangeKind::Added :
+                (event->mask & (IN_DELETE | IN_MOVED_FROM)) ? DirChangeKind::Removed : DirChangeKind::Modified;
+            if (event->mask & IN_MOVED_TO) {
+                auto from = movedFrom.find(event->cookie);
+                if (from != movedFrom.end() && from->second.first == id) {
+                    watch.backlog[from->second.second].kind = DirChangeKind::RenamedFrom;
+                    change.kind = DirChangeKind::RenamedTo;
+                }
+            }
+            if (event->mask & IN_MOVED_FROM) movedFrom[event->cookie] = { id, watch.backlog.size() };
+            watch.backlogBytes += RecordBytes(change.name.size());
+            watch.backlog.push_back(std::move(change));
+            // What a Windows buffer couldn't hold is lost there, so the backlog stops here too.
+            if (watch.backlogBytes > bufferBytes) watch.overflowed = true;
+        }
+    }
+}
+
+DirWatcher* DirWatcherCreate(size_t bufferBytes) {
+    DirWatcher* watcher = new DirWatcher();
+    watcher->bufferBytes = bufferBytes;
+    watcher->inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    watcher->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (watcher->inotifyFd < 0 || watcher->wakeFd < 0) {
+        FailErrno();
+        DirWatcherClose(watcher);
+        return nullptr;
+    }
+    return watcher;
+}
+
+bool DirWatchAdd(DirWatcher* watcher, const std::wstring& dir, unsigned long long id) {
+    std::lock_guard<std::mutex> lock(watcher->mutex);
+    int wd = inotify_add_watch(watcher->inotifyFd, NativePath(dir).c_str(), WATCH_MASK);
+    if (wd < 0) return FailErrno();
+    watcher->watches[id].wd = wd;
+    watcher->ids[wd].push_back(id);
+    return Succeed();
+}
+
+void DirWatchRemove(DirWatcher* watcher, unsigned long long id) {
+    std::lock_guard<std::mutex> lock(watcher->mutex);
+    auto it = watcher->watches.find(id);
+    if (it == watcher->watches.end()) return;
+    watcher->Forget(id, it->second.wd);
+    watcher->watches.erase(it);
+}
+
+DirWatchEvent DirWatcherWait(DirWatcher* watcher, unsigned long long& id, std::vector<DirChange>& changes) {
+    changes.clear();
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(watcher->mutex);
+            while (!watcher->ready.empty()) {
+                id = watcher->ready.front();
+                watcher->ready.pop_front();
+                auto it = watcher->watches.find(id);
+                if (it == watcher->watches.end()) continue; // Removed since it was queued
+                Watch& watch = it->second;
+                watch.queued = false;
+                if (watch.ended) {
+                    watcher->Forget(id, watch.wd);
+                    watcher->watches.erase(it);
+                    return DirWatchEvent::Ended;
+                }
+                bool overflowed = watch.overflowed;
+                if (!overflowed && watch.backlog.empty()) continue;
+                if (!overflowed) changes.swap(watch.backlog);
+                watch.backlog.clear();
+                watch.backlogBytes = 0;
+                watch.overflowed = false;
+                return overflowed ? DirWatchEvent::Overflow : DirWatchEvent::Changes;
+            }
+        }
+
+        pollfd fds[2] = { { watcher->inotifyFd, POLLIN, 0 }, { watcher->wakeFd, POLLIN, 0 } };
+        if (poll(fds, 2, -1) < 0) continue;      // EINTR
+        if (fds[1].revents) {
+            Drain(watcher->wakeFd);
+            return DirWatchEvent::Woken;
+        }
+        std::lock_guard<std::mutex> lock(watcher->mutex);
+        watcher->ReadEvents();
+    }
+}
+
+void DirWatcherWake(DirWatcher* watcher) {
+    uint64_t one = 1;
+    if (write(watcher->wakeFd, &one, sizeof(one)) < 0) {}
+}
+
+void DirWatcherClose(DirWatcher* watcher) {
+    if (!watcher) return;
+    if (watcher->inotifyFd >= 0) close(watcher->inotifyFd);
+    if (watcher->wakeFd >= 0) close(watcher->wakeFd);
+    delete watcher;
+}
+
+struct DirNotifier {
+    int inotifyFd = -1;                          // -1 when only woken
+    int wakeFd = -1;                             // Never drained, so a wake stays
+};
+
+DirNotifier* DirNotifierOpen(const std::wstring& dir) {
+    int wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeFd < 0) {
+        FailErrno();
+        return nullptr;
+    }
+    DirNotifier* notifier = new DirNotifier();
+    notifier->wakeFd = wakeFd;
+    if (!dir.empty()) {
+        notifier->inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (notifier->inotifyFd >= 0 && inotify_add_watch(notifier->inotifyFd, NativePath(dir).c_str(), WATCH_MASK | IN_CLOSE_WRITE) < 0) {
+            close(notifier->inotifyFd);
+            notifier->inotifyFd = -1;
+        }
+    }
+    return notifier;
+}
+
+bool DirNotifierWait(DirNotifier* notifier, int timeoutMs) {
+    pollfd fds[2] = { { notifier->wakeFd, POLLIN, 0 }, { notifier->inotifyFd, POLLIN, 0 } };
+    int ready = poll(fds, notifier->inotifyFd >= 0 ? 2 : 1, timeoutMs);
+    if (ready <= 0 || fds[0].revents) return false;
+    Drain(notifier->inotifyFd);
+    return true;
+}
+
+void DirNotifierWake(DirNotifier* notifier) {
+    uint64_t one = 1;
+    if (write(notifier->wakeFd, &one, sizeof(one)) < 0) {}
+}
+
+void DirNotifierClose(DirNotifier* notifier) {
+    if (!notifier) return;
+    if (notifier->inotifyFd >= 0) close(notifier->inotifyFd);
+    close(notifier->wakeFd);
+    delete notifier;
+}
@@ -0,0 +1,902 @@
+#include "Hash.h"
+#include "Cpu.h"
+
+#include <cstdio>
+#include <cstring>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+static const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t Rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t Read64(const unsigned char* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t Read32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// ============ XXH64 ============
+
+static inline uint64_t Round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc = Rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t MergeRound(uint64_t acc, uint64_t value) {
+    acc ^= Round(0, value);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+Xxh64State::Xxh64State(uint64_t seed) : m_seed(seed) {
+    m_acc[0] = seed + PRIME64_1 + PRIME64_2;
+    m_acc[1] = seed + PRIME64_2;
+    m_acc[2] = seed;
+    m_acc[3] = seed - PRIME64_1;
+}
+
+void Xxh64State::Update(const void* data, size_t len) {
+    const unsigned char* p = (const unsigned char*)data;
+    m_totalLen += len;
+
+    if (m_buffered + len < sizeof(m_buffer)) {
+        if (len) memcpy(m_buffer + m_buffered, p, len);
+        m_buffered += len;
+        return;
+    }
+
+    if (m_buffered) {
+        size_t fill = sizeof(m_buffer) - m_buffered;
+        memcpy(m_buffer + m_buffered, p, fill);
+        for (int i = 0; i < 4; i++) m_acc[i] = Round(m_acc[i], Read64(m_buffer + i * 8));
+        p += fill;
+        len -= fill;
+        m_buffered = 0;
+    }
+
+    while (len >= 32) {
+        for (int i = 0; i < 4; i++) m_acc[i] = Round(m_acc[i], Read64(p + i * 8));
+        p += 32;
+        len -= 32;
+    }
+
+    if (len) memcpy(m_buffer, p, len);
+    m_buffered = len;
+}
+
+uint64_t Xxh64State::Digest() const {
+    uint64_t h;
+    if (m_totalLen >= 32) {
+        h = Rotl64(m_acc[0], 1) + Rotl64(m_acc[1], 7) + Rotl64(m_acc[2], 12) + Rotl64(m_acc[3], 18);
+        for (int i = 0; i < 4; i++) h = MergeRound(h, m_acc[i]);
+    } else {
+        h = m_seed + PRIME64_5;
+    }
+    h += m_totalLen;
+
+    const unsigned char* p = m_buffer;
+    size_t len = m_buffered;
+    while (len >= 8) {
+        h ^= Round(0, Read64(p));
+        h = Rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+        p += 8;
+        len -= 8;
+    }
+    if (len >= 4) {
+        h ^= (uint64_t)Read32(p) * PRIME64_1;
+        h = Rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+        len -= 4;
+    }
+    while (len > 0) {
+        h ^= (*p) * PRIME64_5;
+        h = Rotl64(h, 11) * PRIME64_1;
+        p++;
+        len--;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t Xxh64(const void* data, size_t len, uint64_t seed) {
+    Xxh64State state(seed);
+    state.Update(data, len);
+    return state.Digest();
+}
+
+// ============ XXH3 ============
+
+static const uint64_t PRIME32_1 = 0x9E3779B1U;
+static const uint64_t PRIME32_2 = 0x85EBCA77U;
+static const uint64_t PRIME32_3 = 0xC2B2AE3DU;
+static const uint64_t PRIME_MX1 = 0x165667919E3779F9ULL;
+static const uint64_t PRIME_MX2 = 0x9FB21C651E98DF25ULL;
+
+static const size_t XXH3_SECRET_SIZE = 192;
+static const size_t XXH3_STRIPE_LEN = 64;
+static const size_t XXH3_SECRET_CONSUME_RATE = 8;
+static const size_t XXH3_STRIPES_PER_BLOCK = (XXH3_SECRET_SIZE - XXH3_STRIPE_LEN) / XXH3_SECRET_CONSUME_RATE;
+static const size_t XXH3_BLOCK_LEN = XXH3_STRIPE_LEN * XXH3_STRIPES_PER_BLOCK;
+static const size_t XXH3_MIDSIZE_MAX = 240;
+
+alignas(64) static const unsigned char XXH3_SECRET[XXH3_SECRET_SIZE] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+static inline uint64_t Mul128Fold64(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t product = (__uint128_t)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    uint64_t high;
+    uint64_t low = _umul128(a, b, &high);
+    return low ^ high;
+#else
+    uint64_t loLo = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+    uint64_t hiLo = (a >> 32) * (b & 0xFFFFFFFF);
+    uint64_t loHi = (a & 0xFFFFFFFF) * (b >> 32);
+    uint64_t hiHi = (a >> 32) * (b >> 32);
+    uint64_t cross = (loLo >> 32) + (hiLo & 0xFFFFFFFF) + loHi;
+    uint64_t upper = (hiLo >> 32) + (cross >> 32) + hiHi;
+    uint64_t lower = (cross << 32) | (loLo & 0xFFFFFFFF);
+    return lower ^ upper;
+#endif
+}
+
+static inline uint32_t Swap32(uint32_t x) {
+    return (x << 24) | ((x << 8) & 0x00FF0000) | ((x >> 8) & 0x0000FF00) | (x >> 24);
+}
+
+static inline uint64_t Swap64(uint64_t x) {
+    return ((uint64_t)Swap32((uint32_t)x) << 32) | Swap32((uint32_t)(x >> 32));
+}
+
+static inline uint64_t Xxh64Avalanche(uint64_t h) {
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+static inline uint64_t Xxh3Avalanche(uint64_t h) {
+    h ^= h >> 37;
+    h *= PRIME_MX1;
+    h ^= h >> 32;
+    return h;
+}
+
+static inline uint64_t Rrmxmx(uint64_t h, uint64_t len) {
+    h ^= Rotl64(h, 49) ^ Rotl64(h, 24);
+    h *= PRIME_MX2;
+    h ^= (h >> 35) + len;
+    h *= PRIME_MX2;
+    h ^= h >> 28;
+    return h;
+}
+
+static inline uint64_t Mix16B(const unsigned char* input, const unsigned char* secret) {
+    return Mul128Fold64(Read64(input) ^ Read64(secret), Read64(input + 8) ^ Read64(secret + 8));
+}
+
+static uint64_t Xxh3Short(const unsigned char* p, size_t len) {
+    const unsigned char* secret = XXH3_SECRET;
+    if (len > 8) {
+        uint64_t low = Read64(p) ^ (Read64(secret + 24) ^ Read64(secret + 32));
+        uint64_t high = Read64(p + len - 8) ^ (Read64(secret + 40) ^ Read64(secret + 48));
+        uint64_t acc = len + Swap64(low) + high + Mul128Fold64(low, high);
+        return Xxh3Avalanche(acc);
+    }
+    if (len >= 4) {
+        uint64_t input = Read32(p + len - 4) + ((uint64_t)Read32(p) << 32);
+        return Rrmxmx(input ^ (Read64(secret + 8) ^ Read64(secret + 16)), len);
+    }
+    if (len > 0) {
+        uint32_t combined = ((uint32_t)p[0] << 16) | ((uint32_t)p[len >> 1] << 24) | p[len - 1] | ((uint32_t)len << 8);
+        return Xxh64Avalanche(combined ^ (uint64_t)(Read32(secret) ^ Read32(secret + 4)));
+    }
+    return Xxh64Avalanche(Read64(secret + 56) ^ Read64(secret + 64));
+}
+
+static uint64_t Xxh3Medium(const unsigned char* p, size_t len) {
+    const unsigned char* secret = XXH3_SECRET;
+    uint64_t acc = len * PRIME64_1;
+    if (len <= 128) {
+        if (len > 32) {
+            if (len > 64) {
+                if (len > 96) {
+                    acc += Mix16B(p + 48, secret + 96);
+                    acc += Mix16B(p + len - 64, secret + 112);
+                }
+                acc += Mix16B(p + 32, secret + 64);
+                acc += Mix16B(p + len - 48, secret + 80);
+            }
+            acc += Mix16B(p + 16, secret + 32);
+            acc += Mix16B(p + len - 32, secret + 48);
+        }
+        acc += Mix16B(p, secret);
+        acc += Mix16B(p + len - 16, secret + 16);
+        return Xxh3Avalanche(acc);
+    }
+
+    size_t rounds = len / 16;
+    for (size_t i = 0; i < 8; i++) acc += Mix16B(p + 16 * i, secret + 16 * i);
+    acc = Xxh3Avalanche(acc);
+    for (size_t i = 8; i < rounds; i++) acc += Mix16B(p + 16 * i, secret + 16 * (i - 8) + 3);
+    acc += Mix16B(p + len - 16, secret + 136 - 17);
+    return Xxh3Avalanche(acc);
+}
+
+// Inputs over XXH3_MIDSIZE_MAX run 8 lanes of accumulators over 64-byte stripes, scrambled
+// after every 1 KB block. The kernels below only differ in how wide they do each step.
+typedef void (*Xxh3LongFn)(uint64_t acc[8], const unsigned char* input, size_t len);
+
+// The stripe walk shared by every kernel, which inline their own ACCUMULATE and SCRAMBLE.
+#define XXH3_LONG_LOOP(ACCUMULATE, SCRAMBLE)                                                   \
+    do {                                                                                       \
+        size_t blocks = (len - 1) / XXH3_BLOCK_LEN;                                            \
+        for (size_t n = 0; n < blocks; n++) {                                                  \
+            const unsigned char* block = input + n * XXH3_BLOCK_LEN;                           \
+            for (size_t s = 0; s < XXH3_STRIPES_PER_BLOCK; s++) {                              \
+                ACCUMULATE(block + s * XXH3_STRIPE_LEN, XXH3_SECRET + s * XXH3_SECRET_CONSUME_RATE); \
+            }                                                                                  \
+            SCRAMBLE(XXH3_SECRET + XXH3_SECRET_SIZE - XXH3_STRIPE_LEN);                        \
+        }                                                                                      \
+        size_t stripes = ((len - 1) - blocks * XXH3_BLOCK_LEN) / XXH3_STRIPE_LEN;              \
+        const unsigned char* tail = input + blocks * XXH3_BLOCK_LEN;                           \
+        for (size_t s = 0; s < stripes; s++) {                                                 \
+            ACCUMULATE(tail + s * XXH3_STRIPE_LEN, XXH3_SECRET + s * XXH3_SECRET_CONSUME_RATE); \
+        }                                                                                      \
+        ACCUMULATE(input + len - XXH3_STRIPE_LEN, XXH3_SECRET + XXH3_SECRET_SIZE - XXH3_STRIPE_LEN - 7); \
+    } while (0)
+
+static void Xxh3LongScalar(uint64_t acc[8], const unsigned char* input, size_t len) {
+#define ACCUMULATE(in, key)                                                                    \
+    for (int i = 0; i < 8; i++) {                                                              \
+        uint64_t value = Read64((in) + 8 * i);                                                 \
+        uint64_t keyed = value ^ Read64((key) + 8 * i);                                        \
+        acc[i ^ 1] += value;                                                                   \
+        acc[i] += (keyed & 0xFFFFFFFF) * (keyed >> 32);                                        \
+    }
+#define SCRAMBLE(key)                                                                          \
+    for (int i = 0; i < 8; i++) {                                                              \
+        uint64_t a = acc[i];                                                                   \
+        a ^= a >> 47;                                                                          \
+        a ^= Read64((key) + 8 * i);                                                            \
+        acc[i] = a * PRIME32_1;                                                                \
+    }
+    XXH3_LONG_LOOP(ACCUMULATE, SCRAMBLE);
+#undef ACCUMULATE
+#undef SCRAMBLE
+}
+
+#ifdef LYNX_X86
+
+// Each 64-bit lane: acc += swap(data) + lo32(data ^ key) * hi32(data ^ key), where swap
+// exchanges neighbouring lanes; scrambling multiplies both halves by PRIME32_1.
+LYNX_TARGET("sse2")
+static void Xxh3LongSse2(uint64_t acc[8], const unsigned char* input, size_t len) {
+    __m128i a[4];
+    for (int i = 0; i < 4; i++) a[i] = _mm_loadu_si128((const __m128i*)acc + i);
+    const __m128i prime = _mm_set1_epi32((int)PRIME32_1);
+#define ACCUMULATE(in, key)                                                                    \
+    for (int i = 0; i < 4; i++) {                                                              \
+        __m128i data = _mm_loadu_si128((const __m128i*)(in) + i);                             \
+        __m128i keyed = _mm_xor_si128(data, _mm_loadu_si128((const __m128i*)(key) + i));      \
+        __m128i product = _mm_mul_epu32(keyed, _mm_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1))); \
+        __m128i swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));                   \
+        a[i] = _mm_add_epi64(a[i], _mm_add_epi64(product, swapped));                           \
+    }
+#define SCRAMBLE(key)                                                                          \
+    for (int i = 0; i < 4; i++) {                                                              \
+        __m128i x = _mm_xor_si128(a[i], _mm_srli_epi64(a[i], 47));                             \
+        x = _mm_xor_si128(x, _mm_loadu_si128((const __m128i*)(key) + i));                     \
+        __m128i low = _mm_mul_epu32(x, prime);                                                 \
+        __m128i high = _mm_mul_epu32(_mm_shuffle_epi32(x, _MM_SHUFFLE(0, 3, 0, 1)), prime);   \
+        a[i] = _mm_add_epi64(low, _mm_slli_epi64(high, 32));                                   \
+    }
+    XXH3_LONG_LOOP(ACCUMULATE, SCRAMBLE);
+#undef ACCUMULATE
+#undef SCRAMBLE
+    for (int i = 0; i < 4; i++) _mm_storeu_si128((__m128i*)acc + i, a[i]);
+}
+
+LYNX_TARGET("avx2")
+static void Xxh3LongAvx2(uint64_t acc[8], const unsigned char* input, size_t len) {
+    __m256i a[2];
+    for (int i = 0; i < 2; i++) a[i] = _mm256_loadu_si256((const __m256i*)acc + i);
+    const __m256i prime = _mm256_set1_epi32((int)PRIME32_1);
+#define ACCUMULATE(in, key)                                                                    \
+    for (int i = 0; i < 2; i++) {                                                              \
+        __m256i data = _mm256_loadu_si256((const __m256i*)(in) + i);                          \
+        __m256i keyed = _mm256_xor_si256(data, _mm256_loadu_si256((const __m256i*)(key) + i)); \
+        __m256i product = _mm256_mul_epu32(keyed, _mm256_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1))); \
+        __m256i swapped = _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));                \
+        a[i] = _mm256_add_epi64(a[i], _mm256_add_epi64(product, swapped));                     \
+    }
+#define SCRAMBLE(key)                                                                          \
+    for (int i = 0; i < 2; i++) {                                                              \
+        __m256i x = _mm256_xor_si256(a[i], _mm256_srli_epi64(a[i], 47));                       \
+        x = _mm256_xor_si256(x, _mm256_loadu_si256((const __m256i*)(key) + i));               \
+        __m256i low = _mm256_mul_epu32(x, prime);                                              \
+        __m256i high = _mm256_mul_epu32(_mm256_shuffle_epi32(x, _MM_SHUFFLE(0, 3, 0, 1)), prime); \
+        a[i] = _mm256_add_epi64(low, _mm256_slli_epi64(high, 32));                             \
+    }
+    XXH3_LONG_LOOP(ACCUMULATE, SCRAMBLE);
+#undef ACCUMULATE
+#undef SCRAMBLE
+    for (int i = 0; i < 2; i++) _mm256_storeu_si256((__m256i*)acc + i, a[i]);
+}
+
+LYNX_TARGET("avx512f")
+static void Xxh3LongAvx512(uint64_t acc[8], const unsigned char* input, size_t len) {
+    __m512i a = _mm512_loadu_si512(acc);
+    const __m512i prime = _mm512_set1_epi32((int)PRIME32_1);
+    // Zero-masking forms with every lane selected: GCC's unmasked wrappers pass an
+    // uninitialized source through and warn. Same instructions either way.
+    const __mmask8 q = 0xFF;
+    const __mmask16 d = 0xFFFF;
+#define ACCUMULATE(in, key)                                                                    \
+    {                                                                                          \
+        __m512i data = _mm512_loadu_si512(in);                                                 \
+        __m512i keyed = _mm512_xor_si512(data, _mm512_loadu_si512(key));                       \
+        __m512i product = _mm512_maskz_mul_epu32(q, keyed, _mm512_maskz_shuffle_epi32(d, keyed, (_MM_PERM_ENUM)_MM_SHUFFLE(0, 3, 0, 1))); \
+        __m512i swapped = _mm512_maskz_shuffle_epi32(d, data, (_MM_PERM_ENUM)_MM_SHUFFLE(1, 0, 3, 2)); \
+        a = _mm512_add_epi64(a, _mm512_add_epi64(product, swapped));                           \
+    }
+#define SCRAMBLE(key)                                                                          \
+    {                                                                                          \
+        __m512i x = _mm512_xor_si512(a, _mm512_maskz_srli_epi64(q, a, 47));                    \
+        x = _mm512_xor_si512(x, _mm512_loadu_si512(key));                                      \
+        __m512i low = _mm512_maskz_mul_epu32(q, x, prime);                                     \
+        __m512i high = _mm512_maskz_mul_epu32(q, _mm512_maskz_shuffle_epi32(d, x, (_MM_PERM_ENUM)_MM_SHUFFLE(0, 3, 0, 1)), prime); \
+        a = _mm512_add_epi64(low, _mm512_maskz_slli_epi64(q, high, 32));                       \
+    }
+    XXH3_LONG_LOOP(ACCUMULATE, SCRAMBLE);
+#undef ACCUMULATE
+#undef SCRAMBLE
+    _mm512_storeu_si512(acc, a);
+}
+
+#endif // LYNX_X86
+
+static uint64_t Xxh3Long(const unsigned char* input, size_t len, Xxh3LongFn kernel) {
+    alignas(64) uint64_t acc[8] = {
+        PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3, PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1
+    };
+    kernel(acc, input, len);
+
+    uint64_t result = len * PRIME64_1;
+    const unsigned char* secret = XXH3_SECRET + 11;
+    for (int i = 0; i < 4; i++) {
+        result += Mul128Fold64(acc[2 * i] ^ Read64(secret + 16 * i), acc[2 * i + 1] ^ Read64(secret + 16 * i + 8));
+    }
+    return Xxh3Avalanche(result);
+}
+
+// ============ BLAKE3 ============
+
+static const uint32_t BLAKE3_IV[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+static const size_t BLAKE3_BLOCK_LEN = 64;
+static const size_t BLAKE3_CHUNK_LEN = 1024;
+static const size_t BLAKE3_MAX_DEPTH = 54;  // 2^54 chunks is past any file size
+
+static const uint32_t BLAKE3_CHUNK_START = 1 << 0;
+static const uint32_t BLAKE3_CHUNK_END = 1 << 1;
+static const uint32_t BLAKE3_PARENT = 1 << 2;
+static const uint32_t BLAKE3_ROOT = 1 << 3;
+
+// Message word order for each of the 7 rounds: round r + 1 applies the BLAKE3 permutation
+// to round r.
+struct Blake3Schedule {
+    unsigned char words[7][16];
+};
+
+static constexpr Blake3Schedule MakeBlake3Schedule() {
+    constexpr unsigned char permutation[16] = { 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 };
+    Blake3Schedule schedule = {};
+    for (int i = 0; i < 16; i++) schedule.words[0][i] = (unsigned char)i;
+    for (int r = 1; r < 7; r++) {
+        for (int i = 0; i < 16; i++) schedule.words[r][i] = schedule.words[r - 1][permutation[i]];
+    }
+    return schedule;
+}
+
+static constexpr Blake3Schedule BLAKE3_SCHEDULE = MakeBlake3Schedule();
+
+static inline uint32_t Rotr32(uint32_t x, int r) {
+    return (x >> r) | (x << (32 - r));
+}
+
+static inline void Blake3G(uint32_t* v, int a, int b, int c, int d, uint32_t x, uint32_t y) {
+    v[a] = v[a] + v[b] + x;
+    v[d] = Rotr32(v[d] ^ v[a], 16);
+    v[c] = v[c] + v[d];
+    v[b] = Rotr32(v[b] ^ v[c], 12);
+    v[a] = v[a] + v[b] + y;
+    v[d] = Rotr32(v[d] ^ v[a], 8);
+    v[c] = v[c] + v[d];
+    v[b] = Rotr32(v[b] ^ v[c], 7);
+}
+
+// out[0..8) is the next chaining value; out[8..16) only matters for root output.
+static void Blake3Compress(const uint32_t cv[8], const uint32_t block[16], uint64_t counter,
+    uint32_t blockLen, uint32_t flags, uint32_t out[16]) {
+    uint32_t v[16] = {
+        cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+        BLAKE3_IV[0], BLAKE3_IV[1], BLAKE3_IV[2], BLAKE3_IV[3],
+        (uint32_t)counter, (uint32_t)(counter >> 32), blockLen, flags
+    };
+    for (int r = 0; r < 7; r++) {
+        const unsigned char* s = BLAKE3_SCHEDULE.words[r];
+        Blake3G(v, 0, 4, 8, 12, block[s[0]], block[s[1]]);
+        Blake3G(v, 1, 5, 9, 13, block[s[2]], block[s[3]]);
+        Blake3G(v, 2, 6, 10, 14, block[s[4]], block[s[5]]);
+        Blake3G(v, 3, 7, 11, 15, block[s[6]], block[s[7]]);
+        Blake3G(v, 0, 5, 10, 15, block[s[8]], block[s[9]]);
+        Blake3G(v, 1, 6, 11, 12, block[s[10]], block[s[11]]);
+        Blake3G(v, 2, 7, 8, 13, block[s[12]], block[s[13]]);
+        Blake3G(v, 3, 4, 9, 14, block[s[14]], block[s[15]]);
+    }
+    for (int i = 0; i < 8; i++) {
+        out[i] = v[i] ^ v[i + 8];
+        out[i + 8] = v[i + 8] ^ cv[i];
+    }
+}
+
+static inline void LoadBlockWords(const unsigned char* p, size_t len, uint32_t words[16]) {
+    unsigned char padded[BLAKE3_BLOCK_LEN] = {};
+    if (len) memcpy(padded, p, len);
+    for (int i = 0; i < 16; i++) words[i] = Read32(padded + 4 * i);
+}
+
+// Hashes `chunks` whole 1 KB chunks, numbered from counter, into 8-word chaining values.
+typedef void (*Blake3ChunksFn)(const unsigned char* input, size_t chunks, uint64_t counter, uint32_t* cvs);
+
+static void Blake3ChunksScalar(const unsigned char* input, size_t chunks, uint64_t counter, uint32_t* cvs) {
+    for (size_t c = 0; c < chunks; c++) {
+        uint32_t cv[8];
+        memcpy(cv, BLAKE3_IV, sizeof(cv));
+        for (size_t b = 0; b < BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN; b++) {
+            uint32_t words[16], out[16];
+            LoadBlockWords(input + c * BLAKE3_CHUNK_LEN + b * BLAKE3_BLOCK_LEN, BLAKE3_BLOCK_LEN, words);
+            uint32_t flags = (b == 0 ? BLAKE3_CHUNK_START : 0u) | (b == 15 ? BLAKE3_CHUNK_END : 0u);
+            Blake3Compress(cv, words, counter + c, BLAKE3_BLOCK_LEN, flags, out);
+            memcpy(cv, out, sizeof(cv));
+        }
+        memcpy(cvs + 8 * c, cv, sizeof(cv));
+    }
+}
+
+#ifdef LYNX_X86
+
+// The SIMD kernels run one chunk per 32-bit lane. Blocks are transposed on load so that
+// vector i holds message word i of every chunk, and the G function runs lane-wise.
+
+#define BLAKE3_ROUND(G, v, m, s)                                                               \
+    G(v[0], v[4], v[8], v[12], m[s[0]], m[s[1]]);                                              \
+    G(v[1], v[5], v[9], v[13], m[s[2]], m[s[3]]);                                              \
+    G(v[2], v[6], v[10], v[14], m[s[4]], m[s[5]]);                                             \
+    G(v[3], v[7], v[11], v[15], m[s[6]], m[s[7]]);                                             \
+    G(v[0], v[5], v[10], v[15], m[s[8]], m[s[9]]);                                             \
+    G(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);                                           \
+    G(v[2], v[7], v[8], v[13], m[s[12]], m[s[13]]);                                            \
+    G(v[3], v[4], v[9], v[14], m[s[14]], m[s[15]])
+
+LYNX_TARGET("sse4.1")
+static inline void Transpose4(__m128i& a, __m128i& b, __m128i& c, __m128i& d) {
+    __m128i ab01 = _mm_unpacklo_epi32(a, b);
+    __m128i ab23 = _mm_unpackhi_epi32(a, b);
+    __m128i cd01 = _mm_unpacklo_epi32(c, d);
+    __m128i cd23 = _mm_unpackhi_epi32(c, d);
+    a = _mm_unpacklo_epi64(ab01, cd01);
+    b = _mm_unpackhi_epi64(ab01, cd01);
+    c = _mm_unpacklo_epi64(ab23, cd23);
+    d = _mm_unpackhi_epi64(ab23, cd23);
+}
+
+LYNX_TARGET("sse4.1")
+static void Blake3Hash4Sse41(const unsigned char* input, uint64_t counter, uint32_t* cvs) {
+    const __m128i rot16 = _mm_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const __m128i rot8 = _mm_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12);
+#define G4(a, b, c, d, x, y)                                                                   \
+    a = _mm_add_epi32(_mm_add_epi32(a, b), x);                                                 \
+    d = _mm_shuffle_epi8(_mm_xor_si128(d, a), rot16);                                          \
+    c = _mm_add_epi32(c, d);                                                                   \
+    b = _mm_xor_si128(b, c);                                                                   \
+    b = _mm_or_si128(_mm_srli_epi32(b, 12), _mm_slli_epi32(b, 20));                            \
+    a = _mm_add_epi32(_mm_add_epi32(a, b), y);                                                 \
+    d = _mm_shuffle_epi8(_mm_xor_si128(d, a), rot8);                                           \
+    c = _mm_add_epi32(c, d);                                                                   \
+    b = _mm_xor_si128(b, c);                                                                   \
+    b = _mm_or_si128(_mm_srli_epi32(b, 7), _mm_slli_epi32(b, 25))
+
+    __m128i h[8];
+    for (int i = 0; i < 8; i++) h[i] = _mm_set1_epi32((int)BLAKE3_IV[i]);
+    const __m128i counterLow = _mm_setr_epi32((int)counter, (int)(counter + 1), (int)(counter + 2), (int)(counter + 3));
+    const __m128i counterHigh = _mm_setr_epi32((int)(counter >> 32), (int)((counter + 1) >> 32),
+        (int)((counter + 2) >> 32), (int)((counter + 3) >> 32));
+
+    for (size_t b = 0; b < BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN; b++) {
+        __m128i m[16];
+        for (int q = 0; q < 4; q++) {
+            for (int lane = 0; lane < 4; lane++) {
+                m[4 * q + lane] = _mm_loadu_si128((const __m128i*)(input + lane * BLAKE3_CHUNK_LEN + b * BLAKE3_BLOCK_LEN) + q);
+            }
+            Transpose4(m[4 * q], m[4 * q + 1], m[4 * q + 2], m[4 * q + 3]);
+        }
+
+        uint32_t flags = (b == 0 ? BLAKE3_CHUNK_START : 0u) | (b == 15 ? BLAKE3_CHUNK_END : 0u);
+        __m128i v[16] = {
+            h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7],
+            _mm_set1_epi32((int)BLAKE3_IV[0]), _mm_set1_epi32((int)BLAKE3_IV[1]),
+            _mm_set1_epi32((int)BLAKE3_IV[2]), _mm_set1_epi32((int)BLAKE3_IV[3]),
+            counterLow, counterHigh, _mm_set1_epi32((int)BLAKE3_BLOCK_LEN), _mm_set1_epi32((int)flags)
+        };
+        for (int r = 0; r < 7; r++) {
+            const unsigned char* s = BLAKE3_SCHEDULE.words[r];
+            BLAKE3_ROUND(G4, v, m, s);
+        }
+        for (int i = 0; i < 8; i++) h[i] = _mm_xor_si128(v[i], v[i + 8]);
+    }
+#undef G4
+
+    Transpose4(h[0], h[1], h[2], h[3]);
+    Transpose4(h[4], h[5], h[6], h[7]);
+    for (int lane = 0; lane < 4; lane++) {
+        _mm_storeu_si128((__m128i*)(cvs + 8 * lane), h[lane]);
+        _mm_storeu_si128((__m128i*)(cvs + 8 * lane + 4), h[4 + lane]);
+    }
+}
+
+LYNX_TARGET("sse4.1")
+static void Blake3ChunksSse41(const unsigned char* input, size_t chunks, uint64_t counter, uint32_t* cvs) {
+    size_t c = 0;
+    for (; c + 4 <= chunks; c += 4) Blake3Hash4Sse41(input + c * BLAKE3_CHUNK_LEN, counter + c, cvs + 8 * c);
+    Blake3ChunksScalar(input + c * BLAKE3_CHUNK_LEN, chunks - c, counter + c, cvs + 8 * c);
+}
+
+// Rows are 8 vectors of 8 words; afterwards vector i holds word i of every row.
+LYNX_TARGET("avx2")
+static inline void Transpose8(__m256i* v) {
+    __m256i ab0145 = _mm256_unpacklo_epi32(v[0], v[1]);
+    __m256i ab2367 = _mm256_unpackhi_epi32(v[0], v[1]);
+    __m256i cd0145 = _mm256_unpacklo_epi32(v[2], v[3]);
+    __m256i cd2367 = _mm256_unpackhi_epi32(v[2], v[3]);
+    __m256i ef0145 = _mm256_unpacklo_epi32(v[4], v[5]);
+    __m256i ef2367 = _mm256_unpackhi_epi32(v[4], v[5]);
+    __m256i gh0145 = _mm256_unpacklo_epi32(v[6], v[7]);
+    __m256i gh2367 = _mm256_unpackhi_epi32(v[6], v[7]);
+    __m256i abcd04 = _mm256_unpacklo_epi64(ab0145, cd0145);
+    __m256i abcd15 = _mm256_unpackhi_epi64(ab0145, cd0145);
+    __m256i abcd26 = _mm256_unpacklo_epi64(ab2367, cd2367);
+    __m256i abcd37 = _mm256_unpackhi_epi64(ab2367, cd2367);
+    __m256i efgh04 = _mm256_unpacklo_epi64(ef0145, gh0145);
+    __m256i efgh15 = _mm256_unpackhi_epi64(ef0145, gh0145);
+    __m256i efgh26 = _mm256_unpacklo_epi64(ef2367, gh2367);
+    __m256i efgh37 = _mm256_unpackhi_epi64(ef2367, gh2367);
+    v[0] = _mm256_permute2x128_si256(abcd04, efgh04, 0x20);
+    v[1] = _mm256_permute2x128_si256(abcd15, efgh15, 0x20);
+    v[2] = _mm256_permute2x128_si256(abcd26, efgh26, 0x20);
+    v[3] = _mm256_permute2x128_si256(abcd37, efgh37, 0x20);
+    v[4] = _mm256_permute2x128_si256(abcd04, efgh04, 0x31);
+    v[5] = _mm256_permute2x128_si256(abcd15, efgh15, 0x31);
+    v[6] = _mm256_permute2x128_si256(abcd26, efgh26, 0x31);
+    v[7] = _mm256_permute2x128_si256(abcd37, efgh37, 0x31);
+}
+
+LYNX_TARGET("avx2")
+static void Blake3Hash8Avx2(const unsigned char* input, uint64_t counter, uint32_t* cvs) {
+    const __m256i rot16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+        2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const __m256i rot8 = _mm256_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12,
+        1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12);
+#define G8(a, b, c, d, x, y)                                                                   \
+    a = _mm256_add_epi32(_mm256_add_epi32(a, b), x);                                           \
+    d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rot16);                                    \
+    c = _mm256_add_epi32(c, d);                                                                \
+    b = _mm256_xor_si256(b, c);                                                                \
+    b = _mm256_or_si256(_mm256_srli_epi32(b, 12), _mm256_slli_epi32(b, 20));                   \
+    a = _mm256_add_epi32(_mm256_add_epi32(a, b), y);                                           \
+    d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rot8);                                     \
+    c = _mm256_add_epi32(c, d);                                                                \
+    b = _mm256_xor_si256(b, c);                                                                \
+    b = _mm256_or_si256(_mm256_srli_epi32(b, 7), _mm256_slli_epi32(b, 25))
+
+    __m256i h[8];
+    for (int i = 0; i < 8; i++) h[i] = _mm256_set1_epi32((int)BLAKE3_IV[i]);
+    alignas(32) uint32_t low[8], high[8];
+    for (int lane = 0; lane < 8; lane++) {
+        low[lane] = (uint32_t)(counter + lane);
+        high[lane] = (uint32_t)((counter + lane) >> 32);
+    }
+    const __m256i counterLow = _mm256_load_si256((const __m256i*)low);
+    const __m256i counterHigh = _mm256_load_si256((const __m256i*)high);
+
+    for (size_t b = 0; b < BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN; b++) {
+        __m256i m[16];
+        for (int lane = 0; lane < 8; lane++) {
+            const __m256i* block = (const __m256i*)(input + lane * BLAKE3_CHUNK_LEN + b * BLAKE3_BLOCK_LEN);
+            m[lane] = _mm256_loadu_si256(block);
+            m[8 + lane] = _mm256_loadu_si256(block + 1);
+        }
+        Transpose8(m);
+        Transpose8(m + 8);
+
+        uint32_t flags = (b == 0 ? BLAKE3_CHUNK_START : 0u) | (b == 15 ? BLAKE3_CHUNK_END : 0u);
+        __m256i v[16] = {
+            h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7],
+            _mm256_set1_epi32((int)BLAKE3_IV[0]), _mm256_set1_epi32((int)BLAKE3_IV[1]),
+            _mm256_set1_epi32((int)BLAKE3_IV[2]), _mm256_set1_epi32((int)BLAKE3_IV[3]),
+            counterLow, counterHigh, _mm256_set1_epi32((int)BLAKE3_BLOCK_LEN), _mm256_set1_epi32((int)flags)
+        };
+        for (int r = 0; r < 7; r++) {
+            const unsigned char* s = BLAKE3_SCHEDULE.words[r];
+            BLAKE3_ROUND(G8, v, m, s);
+        }
+        for (int i = 0; i < 8; i++) h[i] = _mm256_xor_si256(v[i], v[i + 8]);
+    }
+#undef G8
+
+    Transpose8(h);
+    for (int lane = 0; lane < 8; lane++) _mm256_storeu_si256((__m256i*)(cvs + 8 * lane), h[lane]);
+}
+
+LYNX_TARGET("avx2")
+static void Blake3ChunksAvx2(const unsigned char* input, size_t chunks, uint64_t counter, uint32_t* cvs) {
+    size_t c = 0;
+    for (; c + 8 <= chunks; c += 8) Blake3Hash8Avx2(input + c * BLAKE3_CHUNK_LEN, counter + c, cvs + 8 * c);
+    Blake3ChunksSse41(input + c * BLAKE3_CHUNK_LEN, chunks - c, counter + c, cvs + 8 * c);
+}
+
+#endif // LYNX_X86
+
+// Everything needed to produce a node's chaining value or, for the root, the digest.
+struct Blake3Output {
+    uint32_t cv[8];
+    uint32_t block[16];
+    uint64_t counter;
+    uint32_t blockLen;
+    uint32_t flags;
+
+    void ChainingValue(uint32_t out[8]) const {
+        uint32_t full[16];
+        Blake3Compress(cv, block, counter, blockLen, flags, full);
+        memcpy(out, full, 8 * sizeof(uint32_t));
+    }
+};
+
+static Blake3Output Blake3ParentOutput(const uint32_t left[8], const uint32_t right[8]) {
+    Blake3Output output;
+    memcpy(output.cv, BLAKE3_IV, sizeof(output.cv));
+    memcpy(output.block, left, 8 * sizeof(uint32_t));
+    memcpy(output.block + 8, right, 8 * sizeof(uint32_t));
+    output.counter = 0;
+    output.blockLen = BLAKE3_BLOCK_LEN;
+    output.flags = BLAKE3_PARENT;
+    return output;
+}
+
+// The last chunk may be partial (or empty), so it is walked block by block here.
+static Blake3Output Blake3ChunkOutput(const unsigned char* chunk, size_t len, uint64_t counter) {
+    size_t blocks = len == 0 ? 1 : (len + BLAKE3_BLOCK_LEN - 1) / BLAKE3_BLOCK_LEN;
+    Blake3Output output;
+    memcpy(output.cv, BLAKE3_IV, sizeof(output.cv));
+    for (size_t b = 0; b + 1 < blocks; b++) {
+        uint32_t words[16], out[16];
+        LoadBlockWords(chunk + b * BLAKE3_BLOCK_LEN, BLAKE3_BLOCK_LEN, words);
+        Blake3Compress(output.cv, words, counter, BLAKE3_BLOCK_LEN, b == 0 ? BLAKE3_CHUNK_START : 0u, out);
+        memcpy(output.cv, out, sizeof(output.cv));
+    }
+    size_t lastLen = len - (blocks - 1) * BLAKE3_BLOCK_LEN;
+    LoadBlockWords(chunk + (blocks - 1) * BLAKE3_BLOCK_LEN, lastLen, output.block);
+    output.counter = counter;
+    output.blockLen = (uint32_t)lastLen;
+    output.flags = (blocks == 1 ? BLAKE3_CHUNK_START : 0u) | BLAKE3_CHUNK_END;
+    return output;
+}
+
+static void Blake3WithKernel(const unsigned char* input, size_t len, unsigned char out[BLAKE3_OUT_BYTES], Blake3ChunksFn kernel) {
+    size_t chunks = len == 0 ? 1 : (len + BLAKE3_CHUNK_LEN - 1) / BLAKE3_CHUNK_LEN;
+
+    // Every chunk but the last is whole and goes through the SIMD kernel in batches. A
+    // chunk's chaining value is merged into its parents as soon as its subtree is complete,
+    // which keeps the stack at one entry per set bit of the chunk count.
+    uint32_t stack[BLAKE3_MAX_DEPTH][8];
+    size_t depth = 0;
+    const size_t BATCH = 16;
+    uint32_t cvs[BATCH * 8];
+    for (size_t done = 0; done + 1 < chunks;) {
+        size_t batch = chunks - 1 - done < BATCH ? chunks - 1 - done : BATCH;
+        kernel(input + done * BLAKE3_CHUNK_LEN, batch, done, cvs);
+        for (size_t i = 0; i < batch; i++) {
+            uint32_t cv[8];
+            memcpy(cv, cvs + 8 * i, sizeof(cv));
+            for (uint64_t total = done + i + 1; (total & 1) == 0; total >>= 1) {
+                Blake3ParentOutput(stack[--depth], cv).ChainingValue(cv);
+            }
+            memcpy(stack[depth++], cv, sizeof(cv));
+        }
+        done += batch;
+    }
+
+    size_t lastStart = (chunks - 1) * BLAKE3_CHUNK_LEN;
+    Blake3Output output = Blake3ChunkOutput(input + lastStart, len - lastStart, chunks - 1);
+    while (depth > 0) {
+        uint32_t cv[8];
+        output.ChainingValue(cv);
+        output = Blake3ParentOutput(stack[--depth], cv);
+    }
+
+    uint32_t root[16];
+    Blake3Compress(output.cv, output.block, 0, output.blockLen, output.flags | BLAKE3_ROOT, root);
+    for (size_t i = 0; i < BLAKE3_OUT_BYTES; i++) out[i] = (unsigned char)(root[i / 4] >> (8 * (i % 4)));
+}
+
+// ============ Dispatch ============
+
+struct HashKernels {
+    const char* xxh3Name;
+    Xxh3LongFn xxh3Long;
+    const char* blake3Name;
+    Blake3ChunksFn blake3Chunks;
+};
+
+static HashKernels SelectHashKernels() {
+    HashKernels kernels = { "scalar", Xxh3LongScalar, "scalar", Blake3ChunksScalar };
+#ifdef LYNX_X86
+    const CpuFeatures& cpu = GetCpuFeatures();
+    if (cpu.sse2) kernels = { "sse2", Xxh3LongSse2, kernels.blake3Name, kernels.blake3Chunks };
+    if (cpu.sse41) kernels = { kernels.xxh3Name, kernels.xxh3Long, "sse41", Blake3ChunksSse41 };
+    if (cpu.avx2) kernels = { "avx2", Xxh3LongAvx2, "avx2", Blake3ChunksAvx2 };
+    if (cpu.avx512f) kernels = { "avx512", Xxh3LongAvx512, kernels.blake3Name, kernels.blake3Chunks };
+#endif
+    return kernels;
+}
+
+static const HashKernels& ActiveHashKernels() {
+    static const HashKernels kernels = SelectHashKernels();
+    return kernels;
+}
+
+uint64_t Xxh3_64(const void* data, size_t len) {
+    const unsigned char* p = (const unsigned char*)data;
+    if (len <= 16) return Xxh3Short(p, len);
+    if (len <= XXH3_MIDSIZE_MAX) return Xxh3Medium(p, len);
+    return Xxh3Long(p, len, ActiveHashKernels().xxh3Long);
+}
+
+void Blake3(const void* data, size_t len, unsigned char out[BLAKE3_OUT_BYTES]) {
+    Blake3WithKernel((const unsigned char*)data, len, out, ActiveHashKernels().blake3Chunks);
+}
+
+const char* Xxh3KernelName() {
+    return ActiveHashKernels().xxh3Name;
+}
+
+const char* Blake3KernelName() {
+    return ActiveHashKernels().blake3Name;
+}
+
+// ============ SHA-1 ============
+
+// Only for the WebSocket handshake (RFC 6455 section 4.2.2), which fixes the algorithm;
+// it is not offered as a file hash.
+static inline uint32_t Rotl32(uint32_t x, int r) {
+    return (x << r) | (x >> (32 - r));
+}
+
+static void Sha1Block(uint32_t state[5], const unsigned char* block) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)block[4 * i] << 24) | ((uint32_t)block[4 * i + 1] << 16) |
+            ((uint32_t)block[4 * i + 2] << 8) | block[4 * i + 3];
+    }
+    for (int i = 16; i < 80; i++) w[i] = Rotl32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        uint32_t t = Rotl32(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = Rotl32(b, 30);
+        b = a;
+        a = t;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+void Sha1(const void* data, size_t len, unsigned char out[SHA1_OUT_BYTES]) {
+    const unsigned char* p = (const unsigned char*)data;
+    uint32_t state[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    size_t full = len / 64 * 64;
+    for (size_t offset = 0; offset < full; offset += 64) Sha1Block(state, p + offset);
+
+    // The tail, a 0x80 byte, zeros, and the message length in bits, big-endian.
+    unsigned char last[128] = {};
+    size_t tail = len - full;
+    memcpy(last, p + full, tail);
+    last[tail] = 0x80;
+    size_t lastLen = tail < 56 ? 64 : 128;
+    uint64_t bits = (uint64_t)len * 8;
+    for (int i = 0; i < 8; i++) last[lastLen - 1 - i] = (unsigned char)(bits >> (8 * i));
+    for (size_t offset = 0; offset < lastLen; offset += 64) Sha1Block(state, last + offset);
+
+    for (int i = 0; i < 5; i++) {
+        out[4 * i] = (unsigned char)(state[i] >> 24);
+        out[4 * i + 1] = (unsigned char)(state[i] >> 16);
+        out[4 * i + 2] = (unsigned char)(state[i] >> 8);
+        out[4 * i + 3] = (unsigned char)state[i];
+    }
+}
+
+// ============ Formatting ============
+
+std::string FormatHash64(uint64_t hash) {
+    char text[17];
+    snprintf(text, sizeof(text), "%016llx", (unsigned long long)hash);
+    return text;
+}
+
+std::string FormatHashBytes(const unsigned char* bytes, size_t len) {
+    static const char digits[] = "0123456789abcdef";
+    std::string text(len * 2, '0');
+    for (size_t i = 0; i < len; i++) {
+        text[2 * i] = digits[bytes[i] >> 4];
+        text[2 * i + 1] = digits[bytes[i] & 15];
+    }
+    return text;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Content hashes, bit-exact with the reference implementations so any peer can check our
+// digests with a stock library:
+//   XXH64          - block signatures of delta transfers
+//   XXH3-64        - fast file hashing (SSE2/AVX2/AVX-512 accumulate kernels)
+//   BLAKE3-256     - cryptographic file hashing (SSE4.1/AVX2 kernels hash 4/8 chunks at once)
+// SIMD kernels are picked once by CPUID on first use.
+
+class Xxh64State {
+public:
+    explicit Xxh64State(uint64_t seed = 0);
+    void Update(const void* data, size_t len);
+    uint64_t Digest() const;
+
+private:
+    uint64_t m_acc[4];
+    uint64_t m_seed;
+    uint64_t m_totalLen = 0;
+    unsigned char m_buffer[32];
+    size_t m_buffered = 0;
+};
+
+uint64_t Xxh64(const void* data, size_t len, uint64_t seed = 0);
+
+// XXH3_64bits(): seed 0, default secret.
+uint64_t Xxh3_64(const void* data, size_t len);
+
+const size_t BLAKE3_OUT_BYTES = 32;
+
+// Unkeyed BLAKE3 with the default 32-byte output.
+void Blake3(const void* data, size_t len, unsigned char out[BLAKE3_OUT_BYTES]);
+
+const size_t SHA1_OUT_BYTES = 20;
+
+// SHA-1, for the WebSocket handshake only.
+void Sha1(const void* data, size_t len, unsigned char out[SHA1_OUT_BYTES]);
+
+// 16 lowercase hex digits, the form xxhsum prints.
+std::string FormatHash64(uint64_t hash);
+
+// Lowercase hex of a byte digest, the form b3sum prints.
+std::string FormatHashBytes(const unsigned char* bytes, size_t len);
+
+// Names of the kernels Xxh3_64 and Blake3 dispatch to.
+const char* Xxh3KernelName();
+const char* Blake3KernelName();
@@ -0,0 +1,379 @@
+// Linux network backend: the Platform.h completion API over an epoll socket loop, with TLS
+// through OpenSSL when built with it. Kept apart from PlatformLinux.cpp so the WebSocket
+// client can be linked and tested without the rest of the agent.
+
+#include "Platform.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#ifdef LYNX_HAVE_OPENSSL
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#endif
+
+// ============ Network ============
+
+// The completion API over epoll: NetWait first tries the outstanding operations and only waits
+// for the readiness one of them reported it needs. With TLS both directions go through one SSL
+// object, which is fine because everything runs on the thread calling NetWait. The epoll set
+// and the wake eventfd live as long as the process, so NetWake is safe at any time.
+
+namespace {
+
+const size_t TLS_RECORD_BYTES = 16 * 1024;       // Smaller pieces of a write are coalesced up to this
+
+int CreateWakeEvent(int epoll) {
+    int wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = wakeFd;
+    epoll_ctl(epoll, EPOLL_CTL_ADD, wakeFd, &event);
+    return wakeFd;
+}
+
+int g_epoll = epoll_create1(EPOLL_CLOEXEC);
+int g_wakeFd = CreateWakeEvent(g_epoll);
+
+// What an operation that would block waits for: 0 to try it, else EPOLLIN or EPOLLOUT. TLS
+// reads can need the socket writable and writes readable, so this is per operation.
+typedef uint32_t NetWant;
+
+class NetConnection {
+public:
+    ~NetConnection() {
+#ifdef LYNX_HAVE_OPENSSL
+        if (m_ssl) {
+            SSL_shutdown(m_ssl);                 // close_notify, best effort on a non-blocking socket
+            SSL_free(m_ssl);
+        }
+        if (m_ctx) SSL_CTX_free(m_ctx);
+#endif
+        if (m_fd >= 0) close(m_fd);
+    }
+
+    bool Connect(const std::string& host, int port) {
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* addresses = nullptr;
+        int result = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses);
+        if (result != 0) {
+            printf("getaddrinfo failed: %s\n", gai_strerror(result));
+            return false;
+        }
+        for (addrinfo* address = addresses; address && m_fd < 0; address = address->ai_next) {
+            m_fd = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+            if (m_fd < 0) continue;
+            if (connect(m_fd, address->ai_addr, address->ai_addrlen) != 0) {
+                close(m_fd);
+                m_fd = -1;
+            }
+        }
+        freeaddrinfo(addresses);
+        if (m_fd < 0) {
+            printf("connect failed: %d\n", errno);
+            return false;
+        }
+        int one = 1;
+        setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) | O_NONBLOCK);
+        return true;
+    }
+
+    bool StartTls(const std::string& host) {
+#ifdef LYNX_HAVE_OPENSSL
+        m_ctx = SSL_CTX_new(TLS_client_method());
+        if (!m_ctx) return false;
+        m_ssl = SSL_new(m_ctx);
+        if (!m_ssl) return false;
+        SSL_set_fd(m_ssl, m_fd);
+        SSL_set_tlsext_host_name(m_ssl, host.c_str());
+        // A write that would block is retried later from the same iovec or staging buffer.
+        SSL_set_mode(m_ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+        for (;;) {
+            int result = SSL_connect(m_ssl);
+            if (result == 1) return true;
+            int error = SSL_get_error(m_ssl, result);
+            if (error == SSL_ERROR_WANT_READ) WaitFor(POLLIN);
+            else if (error == SSL_ERROR_WANT_WRITE) WaitFor(POLLOUT);
+            else {
+                printf("TLS handshake failed: %s\n", ERR_error_string(ERR_get_error(), nullptr));
+                return false;
+            }
+        }
+#else
+        (void)host;
+        printf("TLS requested but this build has no OpenSSL\n");
+        return false;
+#endif
+    }
+
+    void StartRead(void* buffer, size_t size) {
+        m_readBuffer = (char*)buffer;
+        m_readSize = size;
+        m_readPending = true;
+        m_readWant = 0;
+    }
+
+    void StartWrite(const NetBuffer* buffers, size_t count) {
+        m_write.clear();
+        for (size_t i = 0; i < count; i++) {
+            if (buffers[i].size > 0) m_write.push_back({ (void*)buffers[i].data, buffers[i].size });
+        }
+        m_writeIndex = 0;
+        m_staged.clear();
+        m_stagedSent = 0;
+        m_writePending = true;
+        m_writeWant = 0;
+    }
+
+    // Moves the outstanding operations as far as they go without blocking.
+    void Progress(NetEvents& events) {
+#ifdef LYNX_HAVE_OPENSSL
+        // Records a write pulled in may already hold what the read waits for.
+        if (m_ssl && m_readWant == EPOLLIN && SSL_has_pending(m_ssl)) m_readWant = 0;
+#endif
+        if (m_readPending && m_readWant == 0) {
+            long result = Read();
+            if (result >= 0) {
+                events.readDone = true;
+                events.readBytes = (size_t)result;
+                m_readPending = false;
+            } else if (result == NET_FAILED) {
+                events.failed = true;
+            }
+        }
+        if (m_writePending && m_writeWant == 0) {
+            int result = Write();
+            if (result > 0) {
+                events.writeDone = true;
+                m_writePending = false;
+            } else if (result < 0) {
+                events.failed = true;
+            }
+        }
+    }
+
+    // Epoll events the blocked operations need; only changed when they differ.
+    void UpdateInterest() {
+        uint32_t interest = (m_readPending ? m_readWant : 0) | (m_writePending ? m_writeWant : 0);
+        if (interest == m_interest) return;
+        epoll_event event = {};
+        event.events = interest;
+        event.data.fd = m_fd;
+        epoll_ctl(g_epoll, EPOLL_CTL_MOD, m_fd, &event);
+        m_interest = interest;
+    }
+
+    void OnReady(uint32_t events) {
+        // An error or hang-up is found out by trying again.
+        if (events & (EPOLLERR | EPOLLHUP)) events |= EPOLLIN | EPOLLOUT;
+        if (m_readWant & events) m_readWant = 0;
+        if (m_writeWant & events) m_writeWant = 0;
+    }
+
+    int fd() const { return m_fd; }
+
+private:
+    static const long NET_WOULD_BLOCK = -1;
+    static const long NET_FAILED = -2;
+
+    // Bytes read, 0 at the end of the stream, or NET_WOULD_BLOCK with m_readWant set.
+    long Read() {
+#ifdef LYNX_HAVE_OPENSSL
+        if (m_ssl) {
+            int result = SSL_read(m_ssl, m_readBuffer, (int)std::min<size_t>(m_readSize, INT32_MAX));
+            if (result > 0) return result;
+            int error = SSL_get_error(m_ssl, result);
+            if (error == SSL_ERROR_ZERO_RETURN) return 0;
+            return Blocked(error, m_readWant) ? NET_WOULD_BLOCK : NET_FAILED;
+        }
+#endif
+        for (;;) {
+            ssize_t result = recv(m_fd, m_readBuffer, m_readSize, 0);
+            if (result >= 0) return (long)result;
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return NET_FAILED;
+            m_readWant = EPOLLIN;
+            return NET_WOULD_BLOCK;
+        }
+    }
+
+    // 1 once everything is sent, 0 when it would block (m_writeWant set), -1 on failure.
+    int Write() {
+#ifdef LYNX_HAVE_OPENSSL
+        if (m_ssl) return WriteTls();
+#endif
+        while (m_writeIndex < m_write.size()) {
+            msghdr message = {};
+            message.msg_iov = &m_write[m_writeIndex];
+            message.msg_iovlen = std::min<size_t>(m_write.size() - m_writeIndex, IOV_MAX);
+            ssize_t sent = sendmsg(m_fd, &message, MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EINTR) continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+                m_writeWant = EPOLLOUT;
+                return 0;
+            }
+            Advance((size_t)sent);
+        }
+        return 1;
+    }
+
+    void Advance(size_t bytes) {
+        while (bytes > 0) {
+            iovec& piece = m_write[m_writeIndex];
+            size_t take = std::min(bytes, piece.iov_len);
+            piece.iov_base = (char*)piece.iov_base + take;
+            piece.iov_len -= take;
+            bytes -= take;
+            if (piece.iov_len == 0) m_writeIndex++;
+        }
+    }
+
+#ifdef LYNX_HAVE_OPENSSL
+    // SSL_write takes one buffer. Pieces of a record's size or more are written in place;
+    // smaller ones (frame headers, short messages) are staged together so they don't each
+    // become a record of their own.
+    int WriteTls() {
+        for (;;) {
+            const char* chunk;
+            size_t chunkSize;
+            bool staged = m_stagedSent < m_staged.size();
+            if (staged) {
+                chunk = m_staged.data() + m_stagedSent;
+                chunkSize = m_staged.size() - m_stagedSent;
+            } else if (m_writeIndex == m_write.size()) {
+                return 1;
+            } else if (m_write[m_writeIndex].iov_len >= TLS_RECORD_BYTES) {
+                chunk = (const char*)m_write[m_writeIndex].iov_base;
+                chunkSize = m_write[m_writeIndex].iov_len;
+            } else {
+                m_staged.clear();
+                m_stagedSent = 0;
+                while (m_writeIndex < m_write.size() && m_staged.size() < TLS_RECORD_BYTES) {
+                    const iovec& piece = m_write[m_writeIndex];
+                    size_t take = std::min(piece.iov_len, TLS_RECORD_BYTES - m_staged.size());
+                    m_staged.insert(m_staged.end(), (const char*)piece.iov_base, (const char*)piece.iov_base + take);
+                    Advance(take);
+                }
+                continue;
+            }
+
+            int result = SSL_write(m_ssl, chunk, (int)std::min<size_t>(chunkSize, INT32_MAX));
+            if (result <= 0) return Blocked(SSL_get_error(m_ssl, result), m_writeWant) ? 0 : -1;
+            if (staged) m_stagedSent += (size_t)result;
+            else Advance((size_t)result);
+        }
+    }
+
+    static bool Blocked(int error, NetWant& want) {
+        if (error == SSL_ERROR_WANT_READ) want = EPOLLIN;
+        else if (error == SSL_ERROR_WANT_WRITE) want = EPOLLOUT;
+        else return false;
+        return true;
+    }
+#endif
+
+    // Only for the blocking TLS handshake.
+    void WaitFor(short events) {
+        pollfd pfd = { m_fd, events, 0 };
+        while (poll(&pfd, 1, -1) < 0 && errno == EINTR) {}
+    }
+
+    int m_fd = -1;
+#ifdef LYNX_HAVE_OPENSSL
+    SSL_CTX* m_ctx = nullptr;
+    SSL* m_ssl = nullptr;
+#endif
+    uint32_t m_interest = 0;
+
+    char* m_readBuffer = nullptr;
+    size_t m_readSize = 0;
+    bool m_readPending = false;
+    NetWant m_readWant = 0;
+
+    std::vector<iovec> m_write;
+    size_t m_writeIndex = 0;
+    std::vector<char> m_staged;
+    size_t m_stagedSent = 0;
+    bool m_writePending = false;
+    NetWant m_writeWant = 0;
+};
+
+NetConnection* g_net = nullptr;
+
+} // namespace
+
+bool NetConnect(const std::string& host, int port, bool useTls) {
+    NetConnection* connection = new NetConnection();
+    if (!connection->Connect(host, port) || (useTls && !connection->StartTls(host))) {
+        delete connection;
+        return false;
+    }
+    epoll_event event = {};
+    event.data.fd = connection->fd();
+    epoll_ctl(g_epoll, EPOLL_CTL_ADD, connection->fd(), &event);
+    g_net = connection;
+    return true;
+}
+
+bool NetStartRead(void* buffer, size_t size) {
+    if (!g_net || size == 0) return false;
+    g_net->StartRead(buffer, size);
+    return true;
+}
+
+bool NetStartWrite(const NetBuffer* buffers, size_t count) {
+    if (!g_net) return false;
+    g_net->StartWrite(buffers, count);
+    return true;
+}
+
+void NetWait(int timeoutMs, NetEvents& events) {
+    events = NetEvents();
+    if (g_net) {
+        g_net->Progress(events);
+        if (events.readDone || events.writeDone || events.failed) return;
+        g_net->UpdateInterest();
+    }
+
+    epoll_event ready[2];
+    int count = epoll_wait(g_epoll, ready, 2, timeoutMs);
+    for (int i = 0; i < count; i++) {
+        if (ready[i].data.fd == g_wakeFd) {
+            uint64_t value;
+            if (read(g_wakeFd, &value, sizeof(value)) < 0) {}
+        } else if (g_net) {
+            g_net->OnReady(ready[i].events);
+        }
+    }
+    if (g_net) g_net->Progress(events);
+}
+
+void NetWake() {
+    uint64_t one = 1;
+    if (write(g_wakeFd, &one, sizeof(one)) < 0) {}
+}
+
+void NetClose() {
+    if (!g_net) return;
+    epoll_ctl(g_epoll, EPOLL_CTL_DEL, g_net->fd(), nullptr);
+    delete g_net;
+    g_net = nullptr;
+}
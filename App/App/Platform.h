@@ -0,0 +1,285 @@
+#pragma once
+
+// The seam between the agent core and the operating system: everything the core needs from
+// the OS is declared here and implemented once per platform (PlatformWin.cpp; PlatformLinux.cpp,
+// FilesLinux.cpp and NetLinux.cpp). Paths are wide strings in the platform's own syntax.
+
+#ifdef _WIN32
+// Target Windows 10 or later (Required for PseudoConsole/ConPTY)
+#define _WIN32_WINNT 0x0A00
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <windows.h>
+#include <shlobj.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+// ============ Files ============
+
+#ifdef _WIN32
+const wchar_t PATH_SEPARATOR = L'\\';
+const wchar_t* const PATH_SEPARATORS = L"\\/";   // Windows accepts either when splitting a path
+const size_t PATH_ROOT_LENGTH = 3;               // "C:\"
+#else
+const wchar_t PATH_SEPARATOR = L'/';
+const wchar_t* const PATH_SEPARATORS = L"/";     // A backslash is an ordinary name character
+const size_t PATH_ROOT_LENGTH = 1;               // "/"
+#endif
+
+// What "drives" lists: the drive letters on Windows, "/" elsewhere.
+std::vector<std::string> ListDriveRoots();
+
+// Runs read over a mapped file view; false when the view faulted instead. A read error under
+// a mapping (a share going away, a bad sector, a file truncated meanwhile) raises an in-page
+// exception on Windows and SIGBUS elsewhere rather than failing a call, so read must not own
+// anything that needs unwinding.
+bool ReadMappedView(const std::function<void()>& read);
+
+// Why the last Path*, File* or DirScan* call on this thread failed.
+enum class FileError {
+    None,
+    NotFound,                                    // The file or a directory on its path
+    Exists,
+    AccessDenied,                                // Including a file where a directory was expected, or the reverse
+    NotEmpty,
+    CrossDevice,                                 // A move that would have to copy
+    Other,
+};
+
+FileError LastFileError();
+unsigned long LastFileErrorCode();               // The system's own code (GetLastError, errno), for messages
+
+enum PathAttribute : unsigned {
+    PATH_ATTR_READONLY = 1 << 0,                 // Elsewhere: the owner can't write it
+    PATH_ATTR_HIDDEN = 1 << 1,                   // Elsewhere: the name starts with a dot
+    PATH_ATTR_SYSTEM = 1 << 2,                   // Windows only
+};
+
+// Times are nanoseconds since the Unix epoch. Where there is no creation time (Linux) the
+// change time stands in for it.
+struct FileInfo {
+    bool isDir = false;                          // Also set for a link to a directory
+    bool isLink = false;                         // Symlink, junction or other reparse point
+    unsigned attributes = 0;                     // PathAttribute bits
+    unsigned long long size = 0;                 // 0 for a directory
+    unsigned long long createdAt = 0;
+    unsigned long long accessedAt = 0;
+    unsigned long long modifiedAt = 0;
+};
+
+// Describes path itself, not what a link at path points to.
+bool PathGetInfo(const std::wstring& path, FileInfo& info);
+bool PathDeleteFile(const std::wstring& path);   // A link to a directory is removed by PathRemoveDir
+bool PathRemoveDir(const std::wstring& path);    // Empty directories only
+bool PathCreateDir(const std::wstring& path);    // Fails with Exists when anything is there already
+bool PathCreateDirs(const std::wstring& path);   // Every missing level; true if already a directory
+// Replaces exactly the PathAttribute bits; those the platform has no counterpart for are ignored.
+bool PathSetAttributes(const std::wstring& path, unsigned attributes);
+
+enum PathMoveFlags : unsigned {
+    PATH_MOVE_REPLACE = 1 << 0,                  // Otherwise an existing target fails with Exists
+    PATH_MOVE_WRITE_THROUGH = 1 << 1,            // Returns once the rename is on disk
+};
+
+// Renames within a volume; across volumes it fails with CrossDevice rather than copying.
+bool PathMove(const std::wstring& from, const std::wstring& to, unsigned flags = 0);
+std::wstring GetTempDirectory();                 // Ends with a separator
+
+// An open regular file. Readers never lock writers out; Read lets the file be renamed or
+// deleted meanwhile, ReadShared also lets it be written. Writers let others read.
+struct File;
+
+enum class FileMode {
+    Read,
+    ReadShared,
+    Create,                                      // Truncates an existing file
+    CreateNew,                                   // Fails with Exists when the file is there
+    OpenOrCreate,                                // Keeps what an existing file holds
+};
+
+enum FileHint : unsigned {
+    FILE_HINT_SEQUENTIAL = 1 << 0,
+    FILE_HINT_RANDOM = 1 << 1,
+    // Bypasses the cache on Windows: reads and writes must then be whole sectors into
+    // sector-aligned memory. Ignored elsewhere.
+    FILE_HINT_UNBUFFERED = 1 << 2,
+};
+
+File* FileOpen(const std::wstring& path, FileMode mode, unsigned hints = 0); // Null on failure
+void FileClose(File* file);
+bool FileRead(File* file, void* buffer, size_t size, size_t& bytesRead);      // 0 bytes at the end
+// Reads at offset. On Windows it also moves the position FileRead continues from.
+bool FileReadAt(File* file, void* buffer, size_t size, unsigned long long offset, size_t& bytesRead);
+bool FileWrite(File* file, const void* data, size_t size);                     // All of it or fails
+bool FileGetSize(File* file, unsigned long long& size);
+bool FileSeek(File* file, unsigned long long offset);
+bool FileSetEnd(File* file, unsigned long long size);                          // Truncates or extends
+// Reserves space for size bytes without changing the end, so a large write doesn't fragment.
+bool FileReserve(File* file, unsigned long long size);
+bool FileFlush(File* file);                                                    // Down to the disk
+bool FileGetInfo(File* file, FileInfo& info);
+// 0 leaves a time as it is; the creation time can only be set on Windows.
+bool FileSetTimes(File* file, unsigned long long createdAt, unsigned long long accessedAt, unsigned long long modifiedAt);
+
+// Names a file whatever path reaches it: volume and file index, or device and inode.
+struct FileIdentity {
+    unsigned long long volume = 0;
+    unsigned long long index = 0;
+
+    bool operator==(const FileIdentity& other) const { return volume == other.volume && index == other.index; }
+};
+
+bool FileGetIdentity(File* file, FileIdentity& identity);
+
+// Maps the first size bytes of a non-empty file read-only; the view outlives the file. Null on failure.
+const void* FileMapView(File* file, size_t size);
+void FileUnmapView(const void* view, size_t size);
+
+// Enumerates a directory, "." and ".." left out. pattern is a wildcard ("*.log") matched
+// case-insensitively against every name, directories included; empty matches everything.
+// A directory nothing in matches is an empty scan, not a failure.
+struct DirScan;
+
+DirScan* DirScanOpen(const std::wstring& dir, const std::wstring& pattern = std::wstring()); // Null on failure
+bool DirScanNext(DirScan* scan, std::wstring& name, FileInfo& info);           // False at the end
+void DirScanClose(DirScan* scan);
+
+// Watches directories (not their subdirectories) for changes, read from one thread through
+// DirWatcherWait. Each watch is named by an id of the caller's choosing, and records changes
+// from the moment DirWatchAdd returns.
+struct DirWatcher;
+
+enum class DirChangeKind {
+    Added,
+    Removed,
+    Modified,
+    RenamedFrom,                                 // Followed by its RenamedTo
+    RenamedTo,
+};
+
+struct DirChange {
+    DirChangeKind kind;
+    std::wstring name;
+};
+
+enum class DirWatchEvent {
+    Changes,
+    Overflow,                                    // Changes were lost; the watch goes on
+    Ended,                                       // The directory went away; the watch is gone
+    Woken,                                       // By DirWatcherWake
+};
+
+// bufferBytes bounds what one watch holds between two waits before it overflows.
+DirWatcher* DirWatcherCreate(size_t bufferBytes);
+bool DirWatchAdd(DirWatcher* watcher, const std::wstring& dir, unsigned long long id);
+// A report already on its way for id may still be returned by a wait after this.
+void DirWatchRemove(DirWatcher* watcher, unsigned long long id);
+DirWatchEvent DirWatcherWait(DirWatcher* watcher, unsigned long long& id, std::vector<DirChange>& changes);
+void DirWatcherWake(DirWatcher* watcher);        // Any thread
+void DirWatcherClose(DirWatcher* watcher);       // Once nothing waits any more
+
+// Tells one thread that something in a directory changed, without saying what. An empty or
+// unwatchable dir gives a notifier that only DirNotifierWake ends a wait of.
+struct DirNotifier;
+
+DirNotifier* DirNotifierOpen(const std::wstring& dir);
+// True when a change arrived within timeoutMs; false on timeout or once woken.
+bool DirNotifierWait(DirNotifier* notifier, int timeoutMs);
+void DirNotifierWake(DirNotifier* notifier);     // Any thread; every later wait returns at once
+void DirNotifierClose(DirNotifier* notifier);
+
+// ============ Time ============
+
+// Milliseconds on a clock that never goes back, for intervals and deadlines.
+inline unsigned long long MonotonicMs() {
+    return (unsigned long long)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// ============ Process ============
+
+void PlatformInit();                             // Once, before anything else runs
+void PlatformThreadInit();                       // On each worker thread (COM on Windows)
+void PlatformThreadExit();
+std::wstring GetExecutablePath();
+bool SetAutoStart(const std::wstring& appPath);
+bool CreateAutoRestartTask(const std::wstring& appPath);
+void PerformUpdate(const std::string& updateUrl); // Progress and failures go out as update_status
+void RestartSystem();
+void ShutdownSystem();
+
+// ============ Host Info & Metrics ============
+
+struct NetStats {
+    double upKBps;
+    double downKBps;
+};
+
+void InitMetrics();
+double GetCpuUsage();                            // Percent, all cores
+int GetRamUsage();                               // Percent in use
+int GetDiskUsage();                              // Percent in use of the system volume
+NetStats GetNetworkUsage();                      // Rates since the previous call
+std::string GetHWID();
+std::string GetDeviceName();
+std::string GetOSVersion();
+unsigned long long GetSystemUptime();            // Milliseconds since boot
+
+// ============ Terminal ============
+
+// A shell on a pseudo-terminal: ConPTY running cmd.exe on Windows, $SHELL on a POSIX PTY elsewhere.
+struct Pty;
+
+Pty* PtyOpen(int cols, int rows);
+// Bytes read; 0 when nothing arrived within a short wait, -1 once the shell is gone.
+int PtyRead(Pty* pty, char* buffer, size_t size);
+bool PtyWrite(Pty* pty, const char* data, size_t size);
+void PtyResize(Pty* pty, int cols, int rows);
+void PtyClose(Pty* pty);                         // Ends the shell
+
+// ============ Network ============
+
+// One client connection, driven from a single thread. The API is completion style so the
+// same loop runs over epoll and IOCP: a read or a gathered write is started and NetWait
+// reports when it has finished. At most one read and one write are outstanding at a time,
+// and their buffers must stay untouched until they complete.
+
+struct NetBuffer {
+    const void* data;
+    size_t size;
+};
+
+struct NetEvents {
+    bool readDone = false;
+    size_t readBytes = 0;                        // 0 when the peer closed the connection
+    bool writeDone = false;                      // Every byte of the write was sent
+    bool failed = false;                         // The connection is broken; nothing more completes
+};
+
+// Connects to host:port, blocking; with useTls the TLS handshake is done as well. The server
+// certificate is not verified.
+bool NetConnect(const std::string& host, int port, bool useTls);
+bool NetStartRead(void* buffer, size_t size);
+bool NetStartWrite(const NetBuffer* buffers, size_t count);
+// Waits up to timeoutMs for completions; returns early when NetWake is called.
+void NetWait(int timeoutMs, NetEvents& events);
+void NetWake();                                  // Any thread, even while nothing is connected
+void NetClose();                                 // Cancels whatever is outstanding
+
+// ============ Media ============
+
+// Empty results (and streams that end at once) where the platform has no capture backend.
+std::vector<unsigned char> CaptureScreenPng();
+std::vector<std::string> EnumerateWebcams();
+std::vector<std::string> EnumerateMicrophones();
+// Whether StreamFrameLoop can capture mediaType ("screen", "cam" or "mic") here.
+bool MediaStreamSupported(const std::string& mediaType);
+// Runs until runningFlag clears; frames count toward channel (0 for none).
+void StreamFrameLoop(std::string streamType, std::atomic<bool>& runningFlag, std::string mediaType, int deviceIndex, unsigned int channel);
@@ -0,0 +1,373 @@
+// Linux backend: a forkpty shell and /proc metrics; the socket loop is in NetLinux.cpp. There
+// is no capture backend, no self-update and no autostart; Platform.h describes what each
+// function promises.
+
+#include "Agent.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pty.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/statvfs.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// ============ Process ============
+
+void PlatformInit() {
+    // A peer that goes away must fail the send, not kill the agent.
+    signal(SIGPIPE, SIG_IGN);
+}
+
+void PlatformThreadInit() {}
+
+void PlatformThreadExit() {}
+
+std::wstring GetExecutablePath() {
+    char path[4096];
+    ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (length <= 0) return std::wstring();
+    return Utf8ToWide(std::string(path, (size_t)length));
+}
+
+std::vector<std::string> ListDriveRoots() {
+    return { "/" };
+}
+
+// A fault under a mapping raises SIGBUS on the faulting thread; the handler jumps back to
+// the ReadMappedView frame that thread is in.
+thread_local sigjmp_buf* t_mappedReadJump = nullptr;
+
+void MappedReadFault(int signal, siginfo_t* /*info*/, void* /*context*/) {
+    if (t_mappedReadJump) siglongjmp(*t_mappedReadJump, 1);
+    // Not ours: fall back to the default action, which ends the process.
+    ::signal(signal, SIG_DFL);
+    raise(signal);
+}
+
+bool ReadMappedView(const std::function<void()>& read) {
+    static std::once_flag installed;
+    std::call_once(installed, []() {
+        struct sigaction action = {};
+        action.sa_sigaction = MappedReadFault;
+        action.sa_flags = SA_SIGINFO | SA_NODEFER;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGBUS, &action, nullptr);
+    });
+
+    sigjmp_buf jump;
+    sigjmp_buf* outer = t_mappedReadJump;
+    if (sigsetjmp(jump, 1) != 0) {
+        t_mappedReadJump = outer;
+        return false;
+    }
+    t_mappedReadJump = &jump;
+    read();
+    t_mappedReadJump = outer;
+    return true;
+}
+
+void RestartSystem() {
+    if (system("shutdown -r now") != 0) printf("shutdown -r failed\n");
+}
+
+void ShutdownSystem() {
+    if (system("shutdown -h now") != 0) printf("shutdown -h failed\n");
+}
+
+// Installing a service is left to the system's own tools (a systemd unit with Restart=always
+// covers both); the agent doesn't write one itself.
+bool SetAutoStart(const std::wstring& /*appPath*/) {
+    return true;
+}
+
+bool CreateAutoRestartTask(const std::wstring& /*appPath*/) {
+    return true;
+}
+
+void PerformUpdate(const std::string& updateUrl) {
+    printf("Update requested from %s, not supported on Linux\n", updateUrl.c_str());
+    json resp;
+    resp["type"] = "update_status";
+    resp["stage"] = "error";
+    resp["success"] = false;
+    resp["error"] = "Self-update is not supported on Linux";
+    SendWsMessage(resp);
+}
+
+// ============ Host Info & Metrics ============
+
+struct CpuTimes {
+    unsigned long long busy = 0;
+    unsigned long long total = 0;
+};
+
+CpuTimes g_lastCpu;
+unsigned long long lastNetUp = 0;
+unsigned long long lastNetDown = 0;
+unsigned long long lastNetCheck = 0;
+
+// The aggregate "cpu" line of /proc/stat: user nice system idle iowait irq softirq steal.
+CpuTimes ReadCpuTimes() {
+    CpuTimes times;
+    std::ifstream stat("/proc/stat");
+    std::string label;
+    stat >> label;
+    if (label != "cpu") return times;
+    unsigned long long value;
+    for (int field = 0; field < 8 && stat >> value; field++) {
+        times.total += value;
+        if (field != 3 && field != 4) times.busy += value; // idle and iowait
+    }
+    return times;
+}
+
+void InitMetrics() {
+    g_lastCpu = ReadCpuTimes();
+}
+
+double GetCpuUsage() {
+    CpuTimes now = ReadCpuTimes();
+    unsigned long long total = now.total - g_lastCpu.total;
+    unsigned long long busy = now.busy - g_lastCpu.busy;
+    g_lastCpu = now;
+    return total == 0 ? 0.0 : busy * 100.0 / total;
+}
+
+int GetRamUsage() {
+    std::ifstream meminfo("/proc/meminfo");
+    std::string key;
+    unsigned long long value = 0;
+    unsigned long long total = 0;
+    unsigned long long available = 0;
+    std::string unit;
+    while (meminfo >> key >> value) {
+        std::getline(meminfo, unit);
+        if (key == "MemTotal:") total = value;
+        else if (key == "MemAvailable:") available = value;
+    }
+    if (total == 0) return 0;
+    return (int)((total - available) * 100 / total);
+}
+
+int GetDiskUsage() {
+    struct statvfs fs;
+    if (statvfs("/", &fs) != 0 || fs.f_blocks == 0) return 0;
+    return (int)((1.0 - (double)fs.f_bfree / fs.f_blocks) * 100.0);
+}
+
+NetStats GetNetworkUsage() {
+    std::ifstream dev("/proc/net/dev");
+    std::string line;
+    unsigned long long totalTx = 0;
+    unsigned long long totalRx = 0;
+    // Two header lines, then "iface: rx_bytes ... (8 receive fields) tx_bytes ...".
+    for (int lineNo = 0; std::getline(dev, line); lineNo++) {
+        size_t colon = line.find(':');
+        if (lineNo < 2 || colon == std::string::npos) continue;
+        std::string name = line.substr(0, colon);
+        name.erase(0, name.find_first_not_of(' '));
+        if (name == "lo") continue;
+        std::istringstream fields(line.substr(colon + 1));
+        unsigned long long value;
+        std::vector<unsigned long long> values;
+        while (fields >> value) values.push_back(value);
+        if (values.size() < 9) continue;
+        totalRx += values[0];
+        totalTx += values[8];
+    }
+
+    unsigned long long now = MonotonicMs();
+    double timeDiff = (now - lastNetCheck) / 1000.0;
+    if (timeDiff < 0.1) return { 0, 0 }; // Too fast
+
+    double upSpeed = 0;
+    double downSpeed = 0;
+
+    if (lastNetCheck != 0) {
+        upSpeed = (totalTx - lastNetUp) / timeDiff / 1024.0; // KB/s
+        downSpeed = (totalRx - lastNetDown) / timeDiff / 1024.0; // KB/s
+    }
+
+    lastNetUp = totalTx;
+    lastNetDown = totalRx;
+    lastNetCheck = now;
+
+    return { upSpeed, downSpeed };
+}
+
+std::string ReadFirstLine(const char* path) {
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    return line;
+}
+
+// The systemd/D-Bus machine id, stable across reboots; the host name where there is none.
+std::string GetHWID() {
+    std::string id = ReadFirstLine("/etc/machine-id");
+    if (id.empty()) id = ReadFirstLine("/var/lib/dbus/machine-id");
+    return id.empty() ? GetDeviceName() : id;
+}
+
+std::string GetDeviceName() {
+    char name[256] = {};
+    if (gethostname(name, sizeof(name) - 1) != 0) return "Unknown";
+    return name;
+}
+
+std::string GetOSVersion() {
+    std::ifstream release("/etc/os-release");
+    std::string line;
+    while (std::getline(release, line)) {
+        if (line.compare(0, 12, "PRETTY_NAME=") != 0) continue;
+        std::string name = line.substr(12);
+        if (name.size() >= 2 && name.front() == '"' && name.back() == '"') name = name.substr(1, name.size() - 2);
+        return name;
+    }
+    return "Linux (Unknown)";
+}
+
+// Get System Uptime in MS
+unsigned long long GetSystemUptime() {
+    struct timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    return (unsigned long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// ============ Terminal ============
+
+struct Pty {
+    int master = -1;
+    pid_t shell = -1;
+};
+
+Pty* PtyOpen(int cols, int rows) {
+    struct winsize size = {};
+    size.ws_col = (unsigned short)cols;
+    size.ws_row = (unsigned short)rows;
+
+    int master = -1;
+    pid_t pid = forkpty(&master, nullptr, nullptr, &size);
+    if (pid < 0) {
+        printf("forkpty failed: %d\n", errno);
+        return nullptr;
+    }
+    if (pid == 0) {
+        const char* shell = getenv("SHELL");
+        if (!shell || !*shell) shell = "/bin/sh";
+        setenv("TERM", "xterm-256color", 1);
+        execl(shell, shell, "-i", (char*)nullptr);
+        _exit(127);
+    }
+    fcntl(master, F_SETFD, FD_CLOEXEC);
+
+    Pty* pty = new Pty();
+    pty->master = master;
+    pty->shell = pid;
+    printf("Shell started (pid %d)\n", (int)pid);
+    return pty;
+}
+
+int PtyRead(Pty* pty, char* buffer, size_t size) {
+    pollfd pfd = { pty->master, POLLIN, 0 };
+    int ready = poll(&pfd, 1, 100);
+    if (ready < 0) return errno == EINTR ? 0 : -1;
+    if (ready == 0) return 0;
+
+    ssize_t bytesRead = read(pty->master, buffer, size);
+    if (bytesRead > 0) return (int)bytesRead;
+    if (bytesRead < 0 && (errno == EINTR || errno == EAGAIN)) return 0;
+    // EIO once the last process on the terminal has exited.
+    int status = 0;
+    if (waitpid(pty->shell, &status, WNOHANG) == pty->shell) {
+        printf("Shell process exited with code: %d\n", WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+        pty->shell = -1;
+    }
+    return -1;
+}
+
+bool PtyWrite(Pty* pty, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(pty->master, data, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+void PtyResize(Pty* pty, int cols, int rows) {
+    struct winsize size = {};
+    size.ws_col = (unsigned short)cols;
+    size.ws_row = (unsigned short)rows;
+    ioctl(pty->master, TIOCSWINSZ, &size);
+}
+
+void PtyClose(Pty* pty) {
+    if (!pty) return;
+    if (pty->shell > 0) {
+        kill(pty->shell, SIGHUP);
+        for (int i = 0; i < 20 && waitpid(pty->shell, nullptr, WNOHANG) == 0; i++) usleep(50 * 1000);
+        if (waitpid(pty->shell, nullptr, WNOHANG) == 0) {
+            kill(pty->shell, SIGKILL);
+            waitpid(pty->shell, nullptr, 0);
+        }
+    }
+    if (pty->master >= 0) close(pty->master);
+    delete pty;
+}
+
+// ============ Media ============
+
+// No capture backend yet: screenshots come back empty, no devices are listed, and stream
+// requests are refused before StreamFrameLoop is ever started. Should one get here anyway it
+// ends at once with the same error.
+
+std::vector<unsigned char> CaptureScreenPng() {
+    return {};
+}
+
+std::vector<std::string> EnumerateWebcams() {
+    return {};
+}
+
+std::vector<std::string> EnumerateMicrophones() {
+    return {};
+}
+
+bool MediaStreamSupported(const std::string& /*mediaType*/) {
+    return false;
+}
+
+void StreamFrameLoop(std::string /*streamType*/, std::atomic<bool>& runningFlag, std::string mediaType, int /*deviceIndex*/, unsigned int /*channel*/) {
+    runningFlag = false;
+    json resp;
+    resp["type"] = "stream_status";
+    resp["stream"] = mediaType;
+    resp["success"] = false;
+    resp["error"] = "Streaming " + mediaType + " is not supported on this platform";
+    SendWsMessage(resp);
+}
+
+int main() {
+    PlatformInit();
+    return RunAgent();
+}
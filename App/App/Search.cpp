@@ -0,0 +1,164 @@
+#include "Search.h"
+#include "Cpu.h"
+
+#include <cstring>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static inline unsigned char LowerAscii(unsigned char c) {
+    return c >= 'A' && c <= 'Z' ? (unsigned char)(c + 32) : c;
+}
+
+static inline unsigned char UpperAscii(unsigned char c) {
+    return c >= 'a' && c <= 'z' ? (unsigned char)(c - 32) : c;
+}
+
+static inline unsigned CountTrailingZeros(unsigned mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+static inline bool Verify(const unsigned char* p, const LiteralFinder::Pattern& pattern) {
+    if (!pattern.ignoreCase) return memcmp(p, pattern.needle, pattern.length) == 0;
+    for (size_t i = 0; i < pattern.length; i++) {
+        if (LowerAscii(p[i]) != pattern.needle[i]) return false;
+    }
+    return true;
+}
+
+// Plain loop from start; also finishes the SIMD kernels' last partial block.
+static size_t FindTail(const unsigned char* data, size_t size, size_t start, const LiteralFinder::Pattern& pattern) {
+    size_t lastStart = size - pattern.length;
+    for (size_t i = start; i <= lastStart; i++) {
+        unsigned char a = data[i];
+        unsigned char b = data[i + pattern.length - 1];
+        if ((a == pattern.first[0] || a == pattern.first[1]) && (b == pattern.last[0] || b == pattern.last[1]) && Verify(data + i, pattern)) {
+            return i;
+        }
+    }
+    return size;
+}
+
+// ============ Kernels ============
+
+typedef size_t (*FindFn)(const unsigned char* data, size_t size, const LiteralFinder::Pattern& pattern);
+
+// The C runtime's memchr is already vectorized, so an exact search leans on it.
+static size_t FindScalar(const unsigned char* data, size_t size, const LiteralFinder::Pattern& pattern) {
+    if (pattern.ignoreCase) return FindTail(data, size, 0, pattern);
+    size_t lastStart = size - pattern.length;
+    const unsigned char* p = data;
+    const unsigned char* end = data + lastStart + 1;
+    while (p < end && (p = (const unsigned char*)memchr(p, pattern.first[0], end - p)) != nullptr) {
+        if (p[pattern.length - 1] == pattern.last[0] && Verify(p, pattern)) return p - data;
+        p++;
+    }
+    return size;
+}
+
+#ifdef LYNX_X86
+
+LYNX_TARGET("sse2")
+static size_t FindSse2(const unsigned char* data, size_t size, const LiteralFinder::Pattern& pattern) {
+    const __m128i first0 = _mm_set1_epi8((char)pattern.first[0]);
+    const __m128i first1 = _mm_set1_epi8((char)pattern.first[1]);
+    const __m128i last0 = _mm_set1_epi8((char)pattern.last[0]);
+    const __m128i last1 = _mm_set1_epi8((char)pattern.last[1]);
+    size_t lastStart = size - pattern.length;
+    size_t i = 0;
+    for (; i + 16 <= lastStart + 1; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(data + i + pattern.length - 1));
+        __m128i firstHit = _mm_or_si128(_mm_cmpeq_epi8(a, first0), _mm_cmpeq_epi8(a, first1));
+        __m128i lastHit = _mm_or_si128(_mm_cmpeq_epi8(b, last0), _mm_cmpeq_epi8(b, last1));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(firstHit, lastHit));
+        while (mask) {
+            size_t candidate = i + CountTrailingZeros(mask);
+            if (Verify(data + candidate, pattern)) return candidate;
+            mask &= mask - 1;
+        }
+    }
+    return FindTail(data, size, i, pattern);
+}
+
+LYNX_TARGET("avx2")
+static size_t FindAvx2(const unsigned char* data, size_t size, const LiteralFinder::Pattern& pattern) {
+    const __m256i first0 = _mm256_set1_epi8((char)pattern.first[0]);
+    const __m256i first1 = _mm256_set1_epi8((char)pattern.first[1]);
+    const __m256i last0 = _mm256_set1_epi8((char)pattern.last[0]);
+    const __m256i last1 = _mm256_set1_epi8((char)pattern.last[1]);
+    size_t lastStart = size - pattern.length;
+    size_t i = 0;
+    for (; i + 32 <= lastStart + 1; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(data + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(data + i + pattern.length - 1));
+        __m256i firstHit = _mm256_or_si256(_mm256_cmpeq_epi8(a, first0), _mm256_cmpeq_epi8(a, first1));
+        __m256i lastHit = _mm256_or_si256(_mm256_cmpeq_epi8(b, last0), _mm256_cmpeq_epi8(b, last1));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(firstHit, lastHit));
+        while (mask) {
+            size_t candidate = i + CountTrailingZeros(mask);
+            if (Verify(data + candidate, pattern)) return candidate;
+            mask &= mask - 1;
+        }
+    }
+    return FindTail(data, size, i, pattern);
+}
+
+#endif
+
+// ============ Dispatch ============
+
+struct LiteralKernel {
+    const char* name;
+    FindFn find;
+};
+
+static LiteralKernel SelectLiteralKernel() {
+    LiteralKernel kernel = { "scalar", FindScalar };
+#ifdef LYNX_X86
+    const CpuFeatures& cpu = GetCpuFeatures();
+    if (cpu.sse2) kernel = { "sse2", FindSse2 };
+    if (cpu.avx2) kernel = { "avx2", FindAvx2 };
+#endif
+    return kernel;
+}
+
+static const LiteralKernel& ActiveLiteralKernel() {
+    static const LiteralKernel kernel = SelectLiteralKernel();
+    return kernel;
+}
+
+LiteralFinder::LiteralFinder(const std::string& needle, bool ignoreCase) : m_needle(needle) {
+    if (ignoreCase) {
+        for (char& c : m_needle) c = (char)LowerAscii((unsigned char)c);
+    }
+    m_pattern.needle = nullptr;                  // Set per call, so copies stay valid
+    m_pattern.length = m_needle.size();
+    m_pattern.ignoreCase = ignoreCase;
+    if (m_needle.empty()) return;
+    unsigned char first = (unsigned char)m_needle.front();
+    unsigned char last = (unsigned char)m_needle.back();
+    m_pattern.first[0] = first;
+    m_pattern.first[1] = ignoreCase ? UpperAscii(first) : first;
+    m_pattern.last[0] = last;
+    m_pattern.last[1] = ignoreCase ? UpperAscii(last) : last;
+}
+
+size_t LiteralFinder::Find(const unsigned char* data, size_t size) const {
+    if (m_pattern.length == 0) return 0;
+    if (size < m_pattern.length) return size;
+    Pattern pattern = m_pattern;
+    pattern.needle = (const unsigned char*)m_needle.data();
+    return ActiveLiteralKernel().find(data, size, pattern);
+}
+
+const char* LiteralSearchKernelName() {
+    return ActiveLiteralKernel().name;
+}
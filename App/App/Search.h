@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Byte-literal search for the content grep of "search". Candidates are positions where the
+// needle's first and last bytes both match, tested 16 or 32 at a time (SSE2/AVX2), and only
+// those are compared in full, so text that never contains the needle is skimmed at memory
+// speed. ignoreCase folds ASCII letters only. The kernel is picked once by CPUID.
+
+class LiteralFinder {
+public:
+    LiteralFinder(const std::string& needle, bool ignoreCase);
+
+    // Offset of the first match in data, or size when there is none.
+    size_t Find(const unsigned char* data, size_t size) const;
+
+    size_t length() const { return m_needle.size(); }
+
+    // Both cases of the first and last byte, and the needle lowered when ignoring case.
+    struct Pattern {
+        const unsigned char* needle;
+        size_t length;
+        bool ignoreCase;
+        unsigned char first[2];
+        unsigned char last[2];
+    };
+
+private:
+    std::string m_needle;
+    Pattern m_pattern;
+};
+
+// Name of the kernel LiteralFinder::Find dispatches to.
+const char* LiteralSearchKernelName();
@@ -0,0 +1,269 @@
+#include "Tar.h"
+
+#include <cstdio>
+#include <cstring>
+
+static const size_t TAR_NAME_BYTES = 100;
+static const unsigned long long TAR_MAX_OCTAL_SIZE = 077777777777ULL; // 11 octal digits
+static const size_t TAR_MAX_EXTENSION_BYTES = 1024 * 1024;           // Longer PAX/GNU name data is refused
+
+// Field offsets of a ustar header block.
+static const size_t TAR_NAME = 0;
+static const size_t TAR_MODE = 100;
+static const size_t TAR_UID = 108;
+static const size_t TAR_GID = 116;
+static const size_t TAR_SIZE = 124;
+static const size_t TAR_MTIME = 136;
+static const size_t TAR_CHECKSUM = 148;
+static const size_t TAR_TYPE = 156;
+static const size_t TAR_MAGIC = 257;
+static const size_t TAR_PREFIX = 345;
+
+static void PutOctal(unsigned char* field, size_t width, unsigned long long value) {
+    // width - 1 digits and a NUL, the form every reader accepts.
+    char text[24];
+    snprintf(text, sizeof(text), "%0*llo", (int)(width - 1), value);
+    memcpy(field, text, width - 1);
+    field[width - 1] = 0;
+}
+
+static void FinishHeader(unsigned char* block) {
+    memset(block + TAR_CHECKSUM, ' ', 8);
+    unsigned sum = 0;
+    for (size_t i = 0; i < TAR_BLOCK_BYTES; i++) sum += block[i];
+    char text[8];
+    snprintf(text, sizeof(text), "%06o", sum);
+    memcpy(block + TAR_CHECKSUM, text, 6);
+    block[TAR_CHECKSUM + 6] = 0;
+    block[TAR_CHECKSUM + 7] = ' ';
+}
+
+static void AppendBlock(std::vector<unsigned char>& out, const std::string& name, char type, unsigned long long size, unsigned long long modifiedAt) {
+    size_t start = out.size();
+    out.resize(start + TAR_BLOCK_BYTES, 0);
+    unsigned char* block = &out[start];
+    memcpy(block + TAR_NAME, name.data(), name.size() < TAR_NAME_BYTES ? name.size() : TAR_NAME_BYTES);
+    PutOctal(block + TAR_MODE, 8, type == '5' ? 0755 : 0644);
+    PutOctal(block + TAR_UID, 8, 0);
+    PutOctal(block + TAR_GID, 8, 0);
+    PutOctal(block + TAR_SIZE, 12, size);
+    PutOctal(block + TAR_MTIME, 12, modifiedAt);
+    block[TAR_TYPE] = (unsigned char)type;
+    memcpy(block + TAR_MAGIC, "ustar\0" "00", 8);
+    FinishHeader(block);
+}
+
+// "<length> <key>=<value>\n", where length counts its own digits.
+static void AppendPaxRecord(std::string& records, const char* key, const std::string& value) {
+    size_t body = 1 + strlen(key) + 1 + value.size() + 1;
+    size_t length = body + 1;
+    while (std::to_string(length).size() + body != length) length++;
+    records += std::to_string(length) + " " + key + "=" + value + "\n";
+}
+
+void TarAppendHeader(const TarEntry& entry, std::vector<unsigned char>& out) {
+    bool isDir = entry.type == TarEntryType::Directory;
+    std::string name = isDir ? entry.path + "/" : entry.path;
+    unsigned long long size = isDir ? 0 : entry.size;
+
+    std::string records;
+    if (name.size() > TAR_NAME_BYTES) AppendPaxRecord(records, "path", name);
+    if (size > TAR_MAX_OCTAL_SIZE) AppendPaxRecord(records, "size", std::to_string(size));
+    if (!records.empty()) {
+        AppendBlock(out, "././@PaxHeader", 'x', records.size(), entry.modifiedAt);
+        out.insert(out.end(), records.begin(), records.end());
+        out.resize(out.size() + TarPadding(records.size()), 0);
+    }
+    // Readers that take the PAX record ignore these; the rest get a cut name and size.
+    AppendBlock(out, name, isDir ? '5' : '0', size > TAR_MAX_OCTAL_SIZE ? 0 : size, entry.modifiedAt);
+}
+
+// Octal, or base-256 (GNU) when the top bit of the first byte is set.
+static bool ParseNumber(const unsigned char* field, size_t width, unsigned long long& value) {
+    value = 0;
+    if (field[0] & 0x80) {
+        if (field[0] != 0x80) return false;      // Negative, or too big for 64 bits
+        for (size_t i = 1; i < width; i++) {
+            if (value >> 56) return false;
+            value = (value << 8) | field[i];
+        }
+        return true;
+    }
+    size_t i = 0;
+    while (i < width && (field[i] == ' ' || field[i] == 0)) i++;
+    for (; i < width && field[i] >= '0' && field[i] <= '7'; i++) {
+        if (value >> 61) return false;
+        value = (value << 3) | (unsigned long long)(field[i] - '0');
+    }
+    return true;
+}
+
+static std::string ParseString(const unsigned char* field, size_t width) {
+    size_t length = 0;
+    while (length < width && field[length]) length++;
+    return std::string((const char*)field, length);
+}
+
+TarReader::TarReader(std::function<bool(const TarEntry&)> onEntry, std::function<bool(const unsigned char*, size_t)> onData)
+    : m_onEntry(std::move(onEntry)), m_onData(std::move(onData)) {
+}
+
+bool TarReader::Fail(const char* error) {
+    m_error = error;
+    return false;
+}
+
+bool TarReader::Complete() const {
+    return m_error.empty() && (m_state == State::End || (m_state == State::Header && m_headerFill == 0 && !m_extensionType));
+}
+
+// PAX records we act on are path and size; GNU 'L' data is the whole name.
+void TarReader::ParseExtension() {
+    if (m_extensionType == 'L') {
+        m_longPath = m_extension.c_str();
+        m_hasLongPath = true;
+        return;
+    }
+    size_t pos = 0;
+    while (pos < m_extension.size()) {
+        size_t space = m_extension.find(' ', pos);
+        if (space == std::string::npos) break;
+        size_t length = strtoull(m_extension.c_str() + pos, nullptr, 10);
+        if (length <= space - pos || pos + length > m_extension.size()) break;
+        std::string record = m_extension.substr(space + 1, pos + length - space - 2); // Drops the '\n'
+        size_t equals = record.find('=');
+        if (equals != std::string::npos) {
+            std::string key = record.substr(0, equals);
+            std::string value = record.substr(equals + 1);
+            if (key == "path") {
+                m_longPath = value;
+                m_hasLongPath = true;
+            } else if (key == "size") {
+                m_longSize = strtoull(value.c_str(), nullptr, 10);
+                m_hasLongSize = true;
+            }
+        }
+        pos += length;
+    }
+}
+
+bool TarReader::ParseHeader() {
+    bool zero = true;
+    for (size_t i = 0; i < TAR_BLOCK_BYTES && zero; i++) zero = m_header[i] == 0;
+    if (zero) {
+        // One zero block is enough; some writers stop there.
+        m_state = State::End;
+        return true;
+    }
+
+    unsigned long long checksum = 0;
+    if (!ParseNumber(m_header + TAR_CHECKSUM, 8, checksum)) return Fail("Corrupt tar header");
+    unsigned sum = 0;
+    for (size_t i = 0; i < TAR_BLOCK_BYTES; i++) sum += (i >= TAR_CHECKSUM && i < TAR_CHECKSUM + 8) ? ' ' : m_header[i];
+    if (sum != checksum) return Fail("Tar header checksum mismatch");
+
+    unsigned long long size = 0;
+    if (!ParseNumber(m_header + TAR_SIZE, 12, size)) return Fail("Corrupt tar header");
+    char type = (char)m_header[TAR_TYPE];
+
+    if (type == 'x' || type == 'L') {
+        if (size > TAR_MAX_EXTENSION_BYTES) return Fail("Tar extended header too large");
+        m_extensionType = type;
+        m_extension.clear();
+        m_remaining = size;
+        m_padding = TarPadding(size);
+        m_state = size ? State::Extension : State::Header;
+        if (!size) ParseExtension();
+        return true;
+    }
+    if (type == 'g') {
+        // Global PAX defaults (git archive writes its commit id here); nothing we use.
+        m_remaining = size;
+        m_padding = TarPadding(size);
+        m_state = size ? State::Skip : State::Header;
+        return true;
+    }
+
+    TarEntry entry;
+    if (m_hasLongPath) {
+        entry.path = m_longPath;
+    } else {
+        entry.path = ParseString(m_header + TAR_NAME, TAR_NAME_BYTES);
+        std::string prefix = memcmp(m_header + TAR_MAGIC, "ustar", 5) == 0 ? ParseString(m_header + TAR_PREFIX, 155) : std::string();
+        if (!prefix.empty()) entry.path = prefix + "/" + entry.path;
+    }
+    if (m_hasLongSize) size = m_longSize;
+    ParseNumber(m_header + TAR_MTIME, 12, entry.modifiedAt);
+    m_hasLongPath = false;
+    m_hasLongSize = false;
+    m_extensionType = 0;
+
+    if (type == '0' || type == '\0' || type == '7') {
+        entry.type = TarEntryType::File;
+    } else if (type == '5') {
+        entry.type = TarEntryType::Directory;
+    } else {
+        entry.type = TarEntryType::Other;
+    }
+    // Pre-POSIX archives mark directories only by the trailing slash.
+    if (!entry.path.empty() && entry.path.back() == '/') {
+        if (entry.type == TarEntryType::File) entry.type = TarEntryType::Directory;
+        while (!entry.path.empty() && entry.path.back() == '/') entry.path.pop_back();
+    }
+    // Links and devices carry no data; a directory's size field is ignored.
+    if (entry.type == TarEntryType::Directory || type == '1' || type == '2' || type == '3' || type == '4' || type == '6') size = 0;
+    entry.size = entry.type == TarEntryType::File ? size : 0;
+    if (!m_onEntry(entry)) return Fail("Extraction stopped");
+
+    m_remaining = size;
+    m_padding = TarPadding(size);
+    m_state = size == 0 ? State::Header : (entry.type == TarEntryType::File ? State::Data : State::Skip);
+    return true;
+}
+
+bool TarReader::Feed(const unsigned char* data, size_t len) {
+    if (!m_error.empty()) return false;
+    while (len > 0) {
+        switch (m_state) {
+        case State::Header: {
+            size_t take = TAR_BLOCK_BYTES - m_headerFill < len ? TAR_BLOCK_BYTES - m_headerFill : len;
+            memcpy(m_header + m_headerFill, data, take);
+            m_headerFill += take;
+            data += take;
+            len -= take;
+            if (m_headerFill == TAR_BLOCK_BYTES) {
+                m_headerFill = 0;
+                if (!ParseHeader()) return false;
+            }
+            break;
+        }
+        case State::Data:
+        case State::Extension:
+        case State::Skip: {
+            size_t take = m_remaining < len ? (size_t)m_remaining : len;
+            if (m_state == State::Data && !m_onData(data, take)) return Fail("Extraction stopped");
+            if (m_state == State::Extension) m_extension.append((const char*)data, take);
+            m_remaining -= take;
+            data += take;
+            len -= take;
+            if (m_remaining == 0) {
+                if (m_state == State::Extension) ParseExtension();
+                m_state = m_padding ? State::Padding : State::Header;
+            }
+            break;
+        }
+        case State::Padding: {
+            size_t take = m_padding < len ? m_padding : len;
+            m_padding -= take;
+            data += take;
+            len -= take;
+            if (m_padding == 0) m_state = State::Header;
+            break;
+        }
+        case State::End:
+            // Whatever follows the end marker (more zero blocks, record padding) is ignored.
+            return true;
+        }
+    }
+    return true;
+}
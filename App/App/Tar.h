@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// POSIX tar (ustar) for "pack" and "unpack". Paths are UTF-8 and '/'-separated. A path
+// longer than the 100-byte name field, or a file of 8 GiB or more, gets a PAX extended
+// header ("x") in front, which GNU tar, bsdtar (Windows' tar.exe) and 7-Zip all read.
+// The reader also takes GNU long names ("L") and base-256 sizes from other writers.
+
+const size_t TAR_BLOCK_BYTES = 512;
+
+enum class TarEntryType { File, Directory, Other };
+
+struct TarEntry {
+    std::string path;                            // Directories without the trailing '/'
+    TarEntryType type = TarEntryType::File;
+    unsigned long long size = 0;                 // Data bytes after the header; 0 for directories
+    unsigned long long modifiedAt = 0;           // Seconds since the Unix epoch
+};
+
+// Appends the header block(s) of entry; its data and TarPadding zero bytes follow.
+void TarAppendHeader(const TarEntry& entry, std::vector<unsigned char>& out);
+
+// Zero bytes that take size data bytes to a block boundary.
+inline size_t TarPadding(unsigned long long size) {
+    return (size_t)((TAR_BLOCK_BYTES - size % TAR_BLOCK_BYTES) % TAR_BLOCK_BYTES);
+}
+
+// Two zero blocks end an archive.
+const size_t TAR_END_BYTES = 2 * TAR_BLOCK_BYTES;
+
+// Parses an archive fed in pieces of any size. onEntry sees every member (links, devices and
+// the like as Other); onData then gets a File member's bytes in order. Either callback
+// returning false stops the reader.
+class TarReader {
+public:
+    TarReader(std::function<bool(const TarEntry&)> onEntry, std::function<bool(const unsigned char*, size_t)> onData);
+
+    // False on a malformed archive or a refused callback; error() says which.
+    bool Feed(const unsigned char* data, size_t len);
+
+    // True at a member boundary: after the end marker, or between members of an archive
+    // whose writer left the marker off.
+    bool Complete() const;
+
+    const std::string& error() const { return m_error; }
+
+private:
+    enum class State { Header, Data, Extension, Skip, Padding, End };
+
+    bool ParseHeader();
+    void ParseExtension();
+    bool Fail(const char* error);
+
+    std::function<bool(const TarEntry&)> m_onEntry;
+    std::function<bool(const unsigned char*, size_t)> m_onData;
+    State m_state = State::Header;
+    unsigned char m_header[TAR_BLOCK_BYTES];
+    size_t m_headerFill = 0;
+    unsigned long long m_remaining = 0;          // Bytes left in the current member's data
+    size_t m_padding = 0;                        // Zero bytes left after it
+    char m_extensionType = 0;                    // 'x' or 'L' while one is being collected
+    std::string m_extension;
+    std::string m_longPath;                      // Overrides from the last extension, for the next member
+    bool m_hasLongPath = false;
+    unsigned long long m_longSize = 0;
+    bool m_hasLongSize = false;
+    std::string m_error;
+};
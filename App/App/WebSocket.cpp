@@ -0,0 +1,617 @@
+#include "WebSocket.h"
+#include "Base64.h"
+#include "Hash.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+static const char* const WS_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+// ============ Framing ============
+
+size_t WsEncodeFrameHeader(unsigned char* out, unsigned char opcode, bool fin, unsigned long long length, uint32_t maskKey,
+    unsigned char rsv) {
+    size_t size = 0;
+    out[size++] = (fin ? 0x80 : 0x00) | (unsigned char)((rsv & 0x07) << 4) | opcode;
+    if (length < 126) {
+        out[size++] = 0x80 | (unsigned char)length;
+    } else if (length <= 0xFFFF) {
+        out[size++] = 0x80 | 126;
+        out[size++] = (unsigned char)(length >> 8);
+        out[size++] = (unsigned char)length;
+    } else {
+        out[size++] = 0x80 | 127;
+        for (int i = 7; i >= 0; i--) out[size++] = (unsigned char)(length >> (8 * i));
+    }
+    // Client frames are always masked (RFC 6455 section 5.3).
+    memcpy(out + size, &maskKey, sizeof(maskKey));
+    return size + sizeof(maskKey);
+}
+
+size_t WsParseFrameHeader(const unsigned char* data, size_t size, WsFrameHeader& header) {
+    if (size < 2) return 0;
+    header.fin = (data[0] & 0x80) != 0;
+    header.rsv = (data[0] >> 4) & 0x07;
+    header.opcode = data[0] & 0x0F;
+    header.masked = (data[1] & 0x80) != 0;
+    header.length = data[1] & 0x7F;
+
+    size_t used = 2;
+    size_t extended = header.length == 126 ? 2 : header.length == 127 ? 8 : 0;
+    if (size < used + extended + (header.masked ? 4 : 0)) return 0;
+    if (extended) {
+        header.length = 0;
+        for (size_t i = 0; i < extended; i++) header.length = (header.length << 8) | data[used++];
+    }
+    header.maskKey = 0;
+    if (header.masked) {
+        memcpy(&header.maskKey, data + used, sizeof(header.maskKey));
+        used += sizeof(header.maskKey);
+    }
+    return used;
+}
+
+// The key is kept in wire byte order, so the same bytes repeat through an 8-byte word
+// whatever the host endianness; the word loop is what the compiler vectorizes.
+void WsMask(unsigned char* data, size_t size, uint32_t maskKey, size_t offset) {
+    unsigned char key[4];
+    memcpy(key, &maskKey, sizeof(key));
+
+    size_t i = 0;
+    for (; i < size && ((uintptr_t)(data + i) & 7) != 0; i++) data[i] ^= key[(offset + i) & 3];
+
+    unsigned char pattern[8];
+    for (size_t j = 0; j < sizeof(pattern); j++) pattern[j] = key[(offset + i + j) & 3];
+    uint64_t word;
+    memcpy(&word, pattern, sizeof(word));
+    for (; i + 8 <= size; i += 8) {
+        uint64_t value;
+        memcpy(&value, data + i, sizeof(value));
+        value ^= word;
+        memcpy(data + i, &value, sizeof(value));
+    }
+
+    for (; i < size; i++) data[i] ^= key[(offset + i) & 3];
+}
+
+void WsMaskCopy(unsigned char* dst, const unsigned char* src, size_t size, uint32_t maskKey) {
+    uint64_t word = ((uint64_t)maskKey << 32) | maskKey;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t value;
+        memcpy(&value, src + i, sizeof(value));
+        value ^= word;
+        memcpy(dst + i, &value, sizeof(value));
+    }
+    unsigned char key[4];
+    memcpy(key, &maskKey, sizeof(key));
+    for (; i < size; i++) dst[i] = src[i] ^ key[i & 3];
+}
+
+// Table 3-7 of the Unicode standard: the second byte's range depends on the lead byte, the
+// rest are plain continuation bytes. Relay traffic is JSON, so ASCII is skipped a word at a time.
+bool WsValidUtf8(const unsigned char* data, size_t size) {
+    size_t i = 0;
+    while (i < size) {
+        if (i + 8 <= size) {
+            uint64_t word;
+            memcpy(&word, data + i, sizeof(word));
+            if ((word & 0x8080808080808080ull) == 0) {
+                i += 8;
+                continue;
+            }
+        }
+        unsigned char lead = data[i];
+        if (lead < 0x80) {
+            i++;
+            continue;
+        }
+
+        size_t length;
+        unsigned char low = 0x80, high = 0xBF;   // Range of the second byte
+        if (lead >= 0xC2 && lead <= 0xDF) {
+            length = 2;
+        } else if (lead >= 0xE0 && lead <= 0xEF) {
+            length = 3;
+            if (lead == 0xE0) low = 0xA0;        // Overlong
+            if (lead == 0xED) high = 0x9F;       // Surrogates
+        } else if (lead >= 0xF0 && lead <= 0xF4) {
+            length = 4;
+            if (lead == 0xF0) low = 0x90;        // Overlong
+            if (lead == 0xF4) high = 0x8F;       // Past U+10FFFF
+        } else {
+            return false;
+        }
+        if (size - i < length || data[i + 1] < low || data[i + 1] > high) return false;
+        for (size_t k = 2; k < length; k++) {
+            if ((data[i + k] & 0xC0) != 0x80) return false;
+        }
+        i += length;
+    }
+    return true;
+}
+
+// ============ Handshake ============
+
+std::string WsNewKey() {
+    unsigned char nonce[16];
+    std::random_device random;
+    for (unsigned char& byte : nonce) byte = (unsigned char)random();
+    return Base64Encode(nonce, sizeof(nonce));
+}
+
+std::string WsAcceptKey(const std::string& key) {
+    std::string input = key + WS_GUID;
+    unsigned char digest[SHA1_OUT_BYTES];
+    Sha1(input.data(), input.size(), digest);
+    return Base64Encode(digest, sizeof(digest));
+}
+
+std::string WsHeaderValue(const std::string& response, const std::string& name) {
+    std::istringstream lines(response);
+    std::string line;
+    while (std::getline(lines, line)) {
+        size_t colon = line.find(':');
+        if (colon == std::string::npos || colon != name.size()) continue;
+        bool same = std::equal(name.begin(), name.end(), line.begin(), [](char a, char b) {
+            return tolower((unsigned char)a) == tolower((unsigned char)b);
+        });
+        if (!same) continue;
+        std::string value = line.substr(colon + 1);
+        value.erase(0, value.find_first_not_of(" \t"));
+        while (!value.empty() && (value.back() == '\r' || value.back() == ' ')) value.pop_back();
+        return value;
+    }
+    return std::string();
+}
+
+// ============ Client ============
+
+static std::string TrimToken(const std::string& token) {
+    size_t begin = token.find_first_not_of(" \t");
+    if (begin == std::string::npos) return std::string();
+    size_t end = token.find_last_not_of(" \t");
+    return token.substr(begin, end - begin + 1);
+}
+
+WsClient::WsClient(const WsClientOptions& options) : m_options(options), m_random(std::random_device{}()) {}
+
+WsClient::~WsClient() {
+    Close();
+}
+
+void WsClient::Close() {
+    if (m_connected) NetClose();
+    m_connected = false;
+    m_readPending = false;
+    m_writePending = false;
+    m_writing.clear();
+}
+
+bool WsClient::Connect(const std::string& host, int port, bool useTls, const std::string& path, std::string& response) {
+    Close();
+    m_failed = false;
+    m_in.resize(m_options.readBufferBytes);
+    m_inBegin = m_inEnd = 0;
+    m_messageSize = 0;
+    m_inMessage = m_discarding = false;
+    m_payloadLeft = 0;
+    m_directRead = false;
+    m_control.clear();
+    m_closeSent = m_closeReceived = false;
+    m_deflater.reset();
+    m_inflater.reset();
+    m_deflatedIn = m_deflatedOut = 0;
+
+    if (!NetConnect(host, port, useTls)) return false;
+    m_connected = true;
+
+    std::string key = WsNewKey();
+    std::string request = "GET " + path + " HTTP/1.1\r\n"
+        "Host: " + host + ":" + std::to_string(port) + "\r\n"
+        "User-Agent: AgentHandler/2.0\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Key: " + key + "\r\n"
+        "Sec-WebSocket-Version: 13\r\n";
+    if (m_options.deflate.enabled) request += "Sec-WebSocket-Extensions: " + DeflateOffer() + "\r\n";
+    request += "\r\n";
+    NetBuffer buffer = { request.data(), request.size() };
+    size_t readBytes = 0;
+    m_writePending = NetStartWrite(&buffer, 1);
+    if (!m_writePending || !Await(readBytes, m_options.handshakeTimeoutMs)) {
+        printf("Sending the upgrade request failed\n");
+        Close();
+        return false;
+    }
+
+    // Whatever follows the blank line is the first frames; it stays in m_in for Run.
+    const unsigned char* headEnd = nullptr;
+    static const char terminator[] = "\r\n\r\n";
+    while (!headEnd) {
+        if (m_inEnd == m_in.size()) {
+            printf("Upgrade response too large\n");
+            Close();
+            return false;
+        }
+        m_readPending = NetStartRead(m_in.data() + m_inEnd, m_in.size() - m_inEnd);
+        if (!m_readPending || !Await(readBytes, m_options.handshakeTimeoutMs) || readBytes == 0) {
+            printf("No upgrade response\n");
+            Close();
+            return false;
+        }
+        m_inEnd += readBytes;
+        const unsigned char* found = std::search(m_in.data(), m_in.data() + m_inEnd, terminator, terminator + 4);
+        if (found != m_in.data() + m_inEnd) headEnd = found;
+    }
+    m_inBegin = (size_t)(headEnd - m_in.data()) + 4;
+    response.assign((const char*)m_in.data(), m_inBegin - 2);
+
+    if (response.compare(0, 12, "HTTP/1.1 101") != 0 || WsHeaderValue(response, "Sec-WebSocket-Accept") != WsAcceptKey(key)) {
+        printf("Upgrade refused: %s\n", response.substr(0, response.find('\r')).c_str());
+        Close();
+        return false;
+    }
+    if (!AcceptExtensions(response)) {
+        printf("Unexpected extension response: %s\n", WsHeaderValue(response, "Sec-WebSocket-Extensions").c_str());
+        Close();
+        return false;
+    }
+    return true;
+}
+
+// Window bits of 15 and context takeover are the RFC 7692 defaults and go unsaid. A bare
+// client_max_window_bits lets the server pick a smaller window for our compressor.
+std::string WsClient::DeflateOffer() const {
+    const WsDeflateOptions& deflate = m_options.deflate;
+    std::string offer = "permessage-deflate; client_max_window_bits";
+    if (deflate.clientWindowBits < DEFLATE_MAX_WINDOW_BITS) offer += "=" + std::to_string(deflate.clientWindowBits);
+    if (deflate.serverWindowBits < DEFLATE_MAX_WINDOW_BITS) offer += "; server_max_window_bits=" + std::to_string(deflate.serverWindowBits);
+    if (!deflate.clientContextTakeover) offer += "; client_no_context_takeover";
+    if (!deflate.serverContextTakeover) offer += "; server_no_context_takeover";
+    return offer;
+}
+
+// Sets up permessage-deflate as the server accepted it. An extension or parameter we did
+// not offer fails the connection (RFC 6455 section 9.1).
+bool WsClient::AcceptExtensions(const std::string& response) {
+    std::string accepted = WsHeaderValue(response, "Sec-WebSocket-Extensions");
+    if (accepted.empty()) return true;
+    if (!m_options.deflate.enabled || accepted.find(',') != std::string::npos) return false;
+
+    const WsDeflateOptions& deflate = m_options.deflate;
+    int clientBits = std::min(std::max(deflate.clientWindowBits, DEFLATE_MIN_WINDOW_BITS), DEFLATE_MAX_WINDOW_BITS);
+    bool clientTakeover = deflate.clientContextTakeover;
+    bool serverTakeover = true;
+
+    std::istringstream params(accepted);
+    std::string param;
+    std::getline(params, param, ';');
+    if (TrimToken(param) != "permessage-deflate") return false;
+    while (std::getline(params, param, ';')) {
+        size_t equals = param.find('=');
+        std::string name = TrimToken(param.substr(0, equals));
+        std::string value = equals == std::string::npos ? std::string() : TrimToken(param.substr(equals + 1));
+        if (value.size() >= 2 && value.front() == '"' && value.back() == '"') value = value.substr(1, value.size() - 2);
+
+        if (name == "client_no_context_takeover") {
+            clientTakeover = false;
+        } else if (name == "server_no_context_takeover") {
+            serverTakeover = false;
+        } else if (name == "client_max_window_bits" || name == "server_max_window_bits") {
+            // The inflater keeps a full 32 KB window, so any server window is fine.
+            int bits = atoi(value.c_str());
+            if (bits < DEFLATE_MIN_WINDOW_BITS || bits > DEFLATE_MAX_WINDOW_BITS) return false;
+            if (name == "client_max_window_bits") clientBits = std::min(clientBits, bits);
+        } else {
+            return false;
+        }
+    }
+
+    m_deflater.reset(new DeflateEncoder(clientBits, clientTakeover));
+    m_inflater.reset(new DeflateDecoder(serverTakeover));
+    m_inflaterTakesOver = serverTakeover;
+    printf("permessage-deflate on (window %d bits; context takeover: client %s, server %s)\n",
+        clientBits, clientTakeover ? "yes" : "no", serverTakeover ? "yes" : "no");
+    return true;
+}
+
+// Waits out the handshake's single outstanding read or write.
+bool WsClient::Await(size_t& readBytes, int timeoutMs) {
+    unsigned long long deadline = MonotonicMs() + timeoutMs;
+    while (m_readPending || m_writePending) {
+        unsigned long long now = MonotonicMs();
+        if (now >= deadline) {
+            printf("WebSocket handshake timed out\n");
+            return false;
+        }
+        NetEvents events;
+        NetWait((int)(deadline - now), events);
+        if (events.failed) return false;
+        if (events.writeDone) m_writePending = false;
+        if (events.readDone) {
+            m_readPending = false;
+            readBytes = events.readBytes;
+        }
+    }
+    return true;
+}
+
+void WsClient::Run(const WsCallbacks& callbacks) {
+    // Frames that arrived with the upgrade response are already buffered.
+    ProcessInput(callbacks);
+
+    while (m_connected) {
+        int sleepMs = callbacks.onTick();
+        if (sleepMs < 0 && !m_closeSent) {
+            unsigned char status[2] = { WS_CLOSE_NORMAL >> 8, WS_CLOSE_NORMAL & 0xFF };
+            QueueControl(WS_OP_CLOSE, status, sizeof(status));
+        }
+        if (m_closeSent) {
+            unsigned long long now = MonotonicMs();
+            if (now >= m_closeDeadline) break;
+            int left = (int)(m_closeDeadline - now);
+            sleepMs = sleepMs < 0 ? left : std::min(sleepMs, left);
+        }
+
+        if (!m_writePending && !StartWrite(callbacks)) break;
+        // Once both closes have been exchanged the server ends the TCP connection; waiting
+        // for that is pointless for a client that is about to drop it anyway.
+        if (m_closeSent && m_closeReceived && !m_writePending) break;
+        if (!m_readPending && !StartRead()) break;
+
+        NetEvents events;
+        NetWait(sleepMs, events);
+        if (events.failed) {
+            printf("WebSocket connection failed\n");
+            break;
+        }
+        if (events.writeDone) {
+            m_writePending = false;
+            m_writing.clear();
+        }
+        if (events.readDone) {
+            m_readPending = false;
+            if (events.readBytes == 0) {
+                if (!m_closeReceived) printf("WebSocket connection closed by the server\n");
+                break;
+            }
+            if (m_directRead) {
+                m_directRead = false;
+                m_messageSize += events.readBytes;
+                m_payloadLeft -= events.readBytes;
+                if (m_payloadLeft == 0 && m_frameFin) FinishMessage(callbacks);
+            } else {
+                m_inEnd += events.readBytes;
+            }
+            ProcessInput(callbacks);
+        }
+    }
+    if (m_deflatedIn) printf("permessage-deflate: %llu bytes sent as %llu\n", m_deflatedIn, m_deflatedOut);
+    Close();
+}
+
+void WsClient::QueueControl(unsigned char opcode, const void* data, size_t size) {
+    if (m_closeSent) return;
+    size = std::min(size, WS_MAX_CONTROL_PAYLOAD);
+    OutFrame frame;
+    uint32_t maskKey = m_random();
+    frame.headerSize = WsEncodeFrameHeader(frame.header, opcode, true, size, maskKey);
+    frame.payload.assign((const char*)data, size);
+    WsMask((unsigned char*)&frame.payload[0], size, maskKey);
+    m_control.push_back(std::move(frame));
+
+    if (opcode == WS_OP_CLOSE) {
+        m_closeSent = true;
+        m_closeDeadline = MonotonicMs() + m_options.closeTimeoutMs;
+    }
+}
+
+// Gathers pending control frames and then queued messages, up to maxBatchBytes, into one
+// write. Each payload is masked in place, so the only bytes written besides the payloads
+// are the frame headers.
+bool WsClient::StartWrite(const WsCallbacks& callbacks) {
+    m_writing.clear();
+    bool closing = m_closeSent;
+    for (OutFrame& frame : m_control) m_writing.push_back(std::move(frame));
+    m_control.clear();
+
+    size_t batchBytes = 0;
+    while (!closing && batchBytes < m_options.maxBatchBytes) {
+        WsMessageType type;
+        WsPayload payload;
+        bool compressible = true;
+        if (!callbacks.nextMessage(type, payload, compressible)) break;
+        const std::string& body = payload.View();
+
+        // A compressed message goes out compressed even if it grew: with context takeover
+        // the server's window has to see the bytes ours did.
+        OutFrame frame;
+        unsigned char rsv = 0;
+        if (m_deflater && compressible && body.size() >= m_options.deflate.minBytes) {
+            m_deflater->Compress((const unsigned char*)body.data(), body.size(), frame.payload);
+            m_deflatedIn += body.size();
+            m_deflatedOut += frame.payload.size();
+            rsv = WS_RSV_COMPRESSED;
+        } else if (payload.shared) {
+            frame.copySize = body.size();
+        } else {
+            frame.payload = std::move(payload.bytes);
+        }
+
+        uint32_t maskKey = m_random();
+        size_t size = frame.copySize ? frame.copySize : frame.payload.size();
+        frame.headerSize = WsEncodeFrameHeader(frame.header, type == WsMessageType::Binary ? WS_OP_BINARY : WS_OP_TEXT,
+            true, size, maskKey, rsv);
+        if (frame.copySize) {
+            frame.copy.reset(new unsigned char[frame.copySize]);
+            WsMaskCopy(frame.copy.get(), (const unsigned char*)body.data(), frame.copySize, maskKey);
+        } else {
+            WsMask((unsigned char*)&frame.payload[0], frame.payload.size(), maskKey);
+        }
+        batchBytes += frame.headerSize + size;
+        m_writing.push_back(std::move(frame));
+    }
+    if (m_writing.empty()) return true;
+
+    // Built only now: the frames no longer move.
+    m_buffers.clear();
+    for (const OutFrame& frame : m_writing) {
+        m_buffers.push_back({ frame.header, frame.headerSize });
+        if (frame.copySize) m_buffers.push_back({ frame.copy.get(), frame.copySize });
+        else if (!frame.payload.empty()) m_buffers.push_back({ frame.payload.data(), frame.payload.size() });
+    }
+    m_writePending = NetStartWrite(m_buffers.data(), m_buffers.size());
+    return m_writePending;
+}
+
+bool WsClient::StartRead() {
+    // The rest of a large payload is read straight into the reassembly buffer.
+    if (m_payloadLeft > 0 && m_inBegin == m_inEnd && !m_discarding && !m_failed) {
+        size_t want = (size_t)std::min<unsigned long long>(m_payloadLeft, m_options.maxMessageBytes);
+        if (m_message.size() < m_messageSize + want) m_message.resize(std::max(m_messageSize + want, m_message.size() * 2));
+        m_directRead = true;
+        m_readPending = NetStartRead(m_message.data() + m_messageSize, want);
+        return m_readPending;
+    }
+
+    // Unconsumed bytes are a partial frame; moving them down makes room for the rest of it.
+    if (m_inBegin == m_inEnd || m_failed) {
+        m_inBegin = m_inEnd = 0;
+    } else if (m_inBegin > 0 && (m_inEnd == m_in.size() || m_inBegin >= m_in.size() / 2)) {
+        memmove(m_in.data(), m_in.data() + m_inBegin, m_inEnd - m_inBegin);
+        m_inEnd -= m_inBegin;
+        m_inBegin = 0;
+    }
+    m_readPending = NetStartRead(m_in.data() + m_inEnd, m_in.size() - m_inEnd);
+    return m_readPending;
+}
+
+void WsClient::ProcessInput(const WsCallbacks& callbacks) {
+    while (!m_failed) {
+        size_t available = m_inEnd - m_inBegin;
+        const unsigned char* data = m_in.data() + m_inBegin;
+
+        if (m_payloadLeft > 0) {
+            size_t take = (size_t)std::min<unsigned long long>(m_payloadLeft, available);
+            if (take == 0) return;
+            AppendMessage(data, take);
+            m_inBegin += take;
+            m_payloadLeft -= take;
+            if (m_payloadLeft == 0 && m_frameFin) FinishMessage(callbacks);
+            continue;
+        }
+
+        WsFrameHeader header;
+        size_t headerSize = WsParseFrameHeader(data, available, header);
+        if (headerSize == 0) return;
+        // RSV1 may only mark the first frame of a data message, and only once deflate is on.
+        bool isData = header.opcode == WS_OP_TEXT || header.opcode == WS_OP_BINARY;
+        bool compressed = header.rsv == WS_RSV_COMPRESSED && m_inflater && isData;
+        if (header.rsv != 0 && !compressed) return FailConnection(WS_CLOSE_PROTOCOL_ERROR, "reserved bits set");
+        if (header.masked) return FailConnection(WS_CLOSE_PROTOCOL_ERROR, "masked server frame");
+
+        if (header.opcode >= WS_OP_CLOSE) {
+            if (!header.fin || header.length > WS_MAX_CONTROL_PAYLOAD) {
+                return FailConnection(WS_CLOSE_PROTOCOL_ERROR, "bad control frame");
+            }
+            if (available < headerSize + header.length) return;
+            HandleControl(header.opcode, data + headerSize, (size_t)header.length);
+            m_inBegin += headerSize + (size_t)header.length;
+            continue;
+        }
+
+        if (isData) {
+            if (m_inMessage) return FailConnection(WS_CLOSE_PROTOCOL_ERROR, "new message inside a fragmented one");
+            m_messageType = header.opcode == WS_OP_BINARY ? WsMessageType::Binary : WsMessageType::Text;
+            m_messageCompressed = compressed;
+
+            // The common case: one unfragmented frame, dispatched where it lies in the buffer.
+            if (header.fin && header.length <= m_options.maxMessageBytes) {
+                if (available >= headerSize + header.length) {
+                    m_inBegin += headerSize + (size_t)header.length;
+                    Deliver(callbacks, data + headerSize, (size_t)header.length, compressed);
+                    continue;
+                }
+                if (headerSize + header.length <= m_in.size()) return;   // It will fit; wait for the rest
+            }
+            m_inMessage = true;
+            m_discarding = false;
+            m_messageSize = 0;
+        } else if (header.opcode == WS_OP_CONTINUATION) {
+            if (!m_inMessage) return FailConnection(WS_CLOSE_PROTOCOL_ERROR, "continuation without a message");
+        } else {
+            return FailConnection(WS_CLOSE_PROTOCOL_ERROR, "unknown opcode");
+        }
+
+        if (!m_discarding && m_messageSize + header.length > m_options.maxMessageBytes) {
+            if (m_messageCompressed && m_inflaterTakesOver) return FailConnection(WS_CLOSE_TOO_BIG, "compressed message too large");
+            printf("Dropping inbound message larger than %zu bytes\n", m_options.maxMessageBytes);
+            m_discarding = true;
+        }
+        m_inBegin += headerSize;
+        m_payloadLeft = header.length;
+        m_frameFin = header.fin;
+        if (m_payloadLeft == 0 && m_frameFin) FinishMessage(callbacks);
+    }
+}
+
+void WsClient::HandleControl(unsigned char opcode, const unsigned char* payload, size_t size) {
+    if (opcode == WS_OP_PING) {
+        QueueControl(WS_OP_PONG, payload, size);
+    } else if (opcode == WS_OP_CLOSE) {
+        unsigned int status = size >= 2 ? (payload[0] << 8) | payload[1] : 0;
+        printf("WebSocket close received (status %u)\n", status);
+        m_closeReceived = true;
+        // Echo the status code, as RFC 6455 section 5.5.1 asks.
+        QueueControl(WS_OP_CLOSE, payload, std::min<size_t>(size, 2));
+    } else if (opcode != WS_OP_PONG) {
+        FailConnection(WS_CLOSE_PROTOCOL_ERROR, "unknown control opcode");
+    }
+}
+
+void WsClient::AppendMessage(const unsigned char* data, size_t size) {
+    if (m_discarding) return;
+    if (m_message.size() < m_messageSize + size) m_message.resize(std::max(m_messageSize + size, m_message.size() * 2));
+    memcpy(m_message.data() + m_messageSize, data, size);
+    m_messageSize += size;
+}
+
+void WsClient::FinishMessage(const WsCallbacks& callbacks) {
+    if (!m_discarding) Deliver(callbacks, m_message.data(), m_messageSize, m_messageCompressed);
+    m_inMessage = false;
+    m_discarding = false;
+    m_messageSize = 0;
+    if (m_message.size() > m_options.maxRetainedBytes) std::vector<unsigned char>().swap(m_message);
+}
+
+// Hands a complete message over, inflating it first if it came compressed.
+void WsClient::Deliver(const WsCallbacks& callbacks, const unsigned char* data, size_t size, bool compressed) {
+    if (m_closeSent) return;
+    if (compressed) {
+        const unsigned char* inflated = nullptr;
+        size_t inflatedSize = 0;
+        if (!m_inflater->Decompress(data, size, m_options.maxMessageBytes, inflated, inflatedSize)) {
+            return FailConnection(WS_CLOSE_INVALID_DATA, "compressed message is corrupt or too large");
+        }
+        data = inflated;
+        size = inflatedSize;
+    }
+    if (m_messageType == WsMessageType::Text && !WsValidUtf8(data, size)) {
+        return FailConnection(WS_CLOSE_INVALID_DATA, "text message is not valid UTF-8");
+    }
+    callbacks.onMessage(m_messageType, data, size);
+}
+
+// Stops reading input and starts the closing handshake; Run ends the connection once the
+// close is out and answered, or the close timeout passes.
+void WsClient::FailConnection(unsigned short status, const char* reason) {
+    printf("WebSocket protocol error: %s\n", reason);
+    m_failed = true;
+    m_payloadLeft = 0;
+    unsigned char payload[2] = { (unsigned char)(status >> 8), (unsigned char)(status & 0xFF) };
+    QueueControl(WS_OP_CLOSE, payload, sizeof(payload));
+}
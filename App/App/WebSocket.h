@@ -0,0 +1,197 @@
+#pragma once
+
+// RFC 6455 client on top of the platform network API (Platform.h). The codec functions are
+// pure; WsClient runs one connection from a single thread: it parses frames in place in its
+// read buffer, masks outbound payloads in place and writes each frame header and payload
+// together in one gathered write. permessage-deflate (RFC 7692) is negotiated when enabled.
+
+#include "Deflate.h"
+#include "Platform.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+enum class WsMessageType {
+    Text,
+    Binary,
+};
+
+// ============ Framing ============
+
+enum WsOpcode : unsigned char {
+    WS_OP_CONTINUATION = 0x0,
+    WS_OP_TEXT = 0x1,
+    WS_OP_BINARY = 0x2,
+    WS_OP_CLOSE = 0x8,
+    WS_OP_PING = 0x9,
+    WS_OP_PONG = 0xA,
+};
+
+const size_t WS_MAX_HEADER_BYTES = 14;           // 2 + 8 byte length + 4 byte mask
+const size_t WS_MAX_CONTROL_PAYLOAD = 125;
+
+enum WsCloseStatus : unsigned short {
+    WS_CLOSE_NORMAL = 1000,
+    WS_CLOSE_PROTOCOL_ERROR = 1002,
+    WS_CLOSE_INVALID_DATA = 1007,
+    WS_CLOSE_TOO_BIG = 1009,
+};
+
+const unsigned char WS_RSV_COMPRESSED = 0x4;     // RSV1: the message is deflated (RFC 7692)
+
+struct WsFrameHeader {
+    bool fin = true;
+    unsigned char rsv = 0;                       // RSV1-3 as the low three bits
+    unsigned char opcode = 0;
+    bool masked = false;
+    uint32_t maskKey = 0;
+    unsigned long long length = 0;
+};
+
+// Writes a masked client frame header into out (WS_MAX_HEADER_BYTES) and returns its size.
+size_t WsEncodeFrameHeader(unsigned char* out, unsigned char opcode, bool fin, unsigned long long length, uint32_t maskKey,
+    unsigned char rsv = 0);
+
+// Header size once data holds a whole header, otherwise 0.
+size_t WsParseFrameHeader(const unsigned char* data, size_t size, WsFrameHeader& header);
+
+// XORs data with the key in place (masking and unmasking are the same operation). offset is
+// the position of data within the payload, so a payload can be masked in pieces.
+void WsMask(unsigned char* data, size_t size, uint32_t maskKey, size_t offset = 0);
+// The same into dst, for a payload that must stay as it is.
+void WsMaskCopy(unsigned char* dst, const unsigned char* src, size_t size, uint32_t maskKey);
+
+// Whether data is well-formed UTF-8 (no overlong forms, surrogates or code points past
+// U+10FFFF), which every text message must be.
+bool WsValidUtf8(const unsigned char* data, size_t size);
+
+// ============ Handshake ============
+
+std::string WsNewKey();                          // Sec-WebSocket-Key: 16 random bytes, base64
+std::string WsAcceptKey(const std::string& key); // The Sec-WebSocket-Accept a server must answer with
+
+// Value of the first header called name in an HTTP response head, empty when there is none.
+std::string WsHeaderValue(const std::string& response, const std::string& name);
+
+// ============ Client ============
+
+struct WsDeflateOptions {
+    bool enabled = false;                        // Offered in the upgrade; used only if the server accepts
+    int clientWindowBits = DEFLATE_MAX_WINDOW_BITS;  // Our compressor's window; the server may lower it
+    int serverWindowBits = DEFLATE_MAX_WINDOW_BITS;  // Asked of the server's compressor
+    bool clientContextTakeover = true;           // Our compressor keeps its window between messages
+    bool serverContextTakeover = true;           // Asked of the server's compressor
+    size_t minBytes = 64;                        // Smaller messages go out uncompressed
+};
+
+struct WsClientOptions {
+    size_t readBufferBytes = 64 * 1024;          // Whole frames in here are handed over without a copy
+    size_t maxMessageBytes = 64 * 1024 * 1024;   // Larger messages are dropped
+    size_t maxRetainedBytes = 8 * 1024 * 1024;   // A bigger reassembly buffer is freed after use
+    size_t maxBatchBytes = 256 * 1024;           // Queued messages gathered into one write
+    int handshakeTimeoutMs = 10000;
+    int closeTimeoutMs = 2000;                   // How long a close waits for the server's
+    WsDeflateOptions deflate;
+};
+
+// A message body for nextMessage to hand over. bytes is taken over and masked in place; a
+// body the caller keeps as well (the agent's replay ring) goes in shared and is masked as it
+// is copied into the frame.
+struct WsPayload {
+    std::string bytes;
+    std::shared_ptr<const std::string> shared;
+
+    const std::string& View() const { return shared ? *shared : bytes; }
+};
+
+// Everything runs on the thread inside Run.
+struct WsCallbacks {
+    // One complete message; data is only valid during the call.
+    std::function<void(WsMessageType type, const unsigned char* data, size_t size)> onMessage;
+    // The next message to send without waiting; false when none is queued.
+    // Clearing compressible keeps an already-compressed payload out of permessage-deflate.
+    std::function<bool(WsMessageType& type, WsPayload& payload, bool& compressible)> nextMessage;
+    // Timers. Returns how long the loop may sleep before calling again; negative closes the connection.
+    std::function<int()> onTick;
+};
+
+class WsClient {
+public:
+    explicit WsClient(const WsClientOptions& options);
+    ~WsClient();
+
+    // Connects and upgrades. response receives the head of the server's 101 reply.
+    bool Connect(const std::string& host, int port, bool useTls, const std::string& path, std::string& response);
+
+    // Serves the connection until it closes or fails. Other threads queue messages through
+    // whatever nextMessage reads and call NetWake so the loop picks them up.
+    void Run(const WsCallbacks& callbacks);
+
+    void Close();                                // Drops the connection without a close handshake
+
+private:
+    struct OutFrame {
+        unsigned char header[WS_MAX_HEADER_BYTES];
+        size_t headerSize = 0;
+        std::string payload;                     // Masked in place
+        std::unique_ptr<unsigned char[]> copy;   // Or the masked copy of a shared payload
+        size_t copySize = 0;
+    };
+
+    std::string DeflateOffer() const;
+    bool AcceptExtensions(const std::string& response);
+    bool Await(size_t& readBytes, int timeoutMs);
+    void QueueControl(unsigned char opcode, const void* data, size_t size);
+    bool StartWrite(const WsCallbacks& callbacks);
+    bool StartRead();
+    void ProcessInput(const WsCallbacks& callbacks);
+    void HandleControl(unsigned char opcode, const unsigned char* payload, size_t size);
+    void AppendMessage(const unsigned char* data, size_t size);
+    void FinishMessage(const WsCallbacks& callbacks);
+    void Deliver(const WsCallbacks& callbacks, const unsigned char* data, size_t size, bool compressed);
+    void FailConnection(unsigned short status, const char* reason);
+
+    WsClientOptions m_options;
+    std::mt19937 m_random;
+    bool m_connected = false;
+    bool m_failed = false;                       // Input is ignored until the connection ends
+
+    // Input: frames are parsed straight out of m_in; a data frame that does not fit is
+    // streamed into m_message, reading the rest of its payload directly into place.
+    std::vector<unsigned char> m_in;
+    size_t m_inBegin = 0;
+    size_t m_inEnd = 0;
+    std::vector<unsigned char> m_message;
+    size_t m_messageSize = 0;
+    WsMessageType m_messageType = WsMessageType::Text;
+    bool m_messageCompressed = false;
+    bool m_inMessage = false;                    // A fragmented or partly received message is open
+    bool m_discarding = false;                   // ...and is over the size limit
+    bool m_frameFin = false;
+    unsigned long long m_payloadLeft = 0;        // Of the data frame being streamed
+    bool m_readPending = false;
+    bool m_directRead = false;                   // The pending read lands in m_message
+
+    // Output: control frames go ahead of queued messages at the next write.
+    std::vector<OutFrame> m_control;
+    std::vector<OutFrame> m_writing;
+    std::vector<NetBuffer> m_buffers;
+    bool m_writePending = false;
+
+    // permessage-deflate, when negotiated
+    std::unique_ptr<DeflateEncoder> m_deflater;
+    std::unique_ptr<DeflateDecoder> m_inflater;
+    bool m_inflaterTakesOver = false;            // Skipping a compressed message would desync its window
+    unsigned long long m_deflatedIn = 0;         // Payload bytes of the messages compressed so far
+    unsigned long long m_deflatedOut = 0;        // ...and what they compressed to
+
+    // Closing handshake
+    bool m_closeSent = false;                    // Queued; no data frame may follow it
+    bool m_closeReceived = false;
+    unsigned long long m_closeDeadline = 0;
+};
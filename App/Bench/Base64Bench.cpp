@@ -0,0 +1,158 @@
+// Base64 throughput: the original byte-at-a-time encoder and decoder from Main.cpp
+// against every kernel in Base64.cpp this CPU can run.
+
+#include "../App/Base64.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+static const std::string base64_chars =
+"ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+"abcdefghijklmnopqrstuvwxyz"
+"0123456789+/";
+
+// Kept verbatim as the baseline.
+static std::string LegacyBase64Encode(unsigned char const* bytes_to_encode, unsigned int in_len) {
+    std::string ret;
+    int i = 0;
+    int j = 0;
+    unsigned char char_array_3[3];
+    unsigned char char_array_4[4];
+
+    while (in_len--) {
+        char_array_3[i++] = *(bytes_to_encode++);
+        if (i == 3) {
+            char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
+            char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
+            char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
+            char_array_4[3] = char_array_3[2] & 0x3f;
+
+            for (i = 0; (i < 4); i++)
+                ret += base64_chars[char_array_4[i]];
+            i = 0;
+        }
+    }
+
+    if (i) {
+        for (j = i; j < 3; j++)
+            char_array_3[j] = '\0';
+
+        char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
+        char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
+        char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
+        char_array_4[3] = char_array_3[2] & 0x3f;
+
+        for (j = 0; (j < i + 1); j++)
+            ret += base64_chars[char_array_4[j]];
+
+        while (i++ < 3)
+            ret += '=';
+    }
+
+    return ret;
+}
+
+// The "write" action's decoder, also kept verbatim.
+static std::vector<unsigned char> LegacyBase64Decode(const std::string& encoded) {
+    std::vector<unsigned char> result;
+    static const std::string chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::vector<int> T(256, -1);
+    for (int i = 0; i < 64; i++) T[chars[i]] = i;
+
+    int val = 0, valb = -8;
+    for (unsigned char c : encoded) {
+        if (T[c] == -1) break;
+        val = (val << 6) + T[c];
+        valb += 6;
+        if (valb >= 0) {
+            result.push_back((unsigned char)((val >> valb) & 0xFF));
+            valb -= 8;
+        }
+    }
+    return result;
+}
+
+// Repeats fn until at least minSeconds have passed and returns input GB/s.
+template <typename Fn>
+static double MeasureGBps(size_t inputBytes, double minSeconds, Fn fn) {
+    using Clock = std::chrono::steady_clock;
+    fn(); // warm-up: page in the output, settle clocks
+
+    size_t iterations = 0;
+    auto start = Clock::now();
+    double elapsed = 0;
+    do {
+        fn();
+        iterations++;
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < minSeconds);
+
+    return (double)inputBytes * iterations / elapsed / 1e9;
+}
+
+int main() {
+    const size_t sizes[] = { 1024 * 1024, 64 * 1024 * 1024 };
+    const double minSeconds = 1.0;
+
+    std::vector<Base64Kernel> kernels = Base64AvailableKernels();
+    printf("Dispatching to: %s\n\n", Base64KernelName());
+    printf("%-12s %-8s %-12s %10s %10s\n", "input", "op", "kernel", "GB/s", "speedup");
+
+    std::mt19937_64 rng(0x4C594E58);
+    bool allMatch = true;
+
+    for (size_t size : sizes) {
+        std::vector<unsigned char> input(size);
+        for (unsigned char& b : input) b = (unsigned char)rng();
+
+        std::string expected = LegacyBase64Encode(input.data(), (unsigned int)input.size());
+        char label[32];
+        snprintf(label, sizeof(label), "%zu MiB", size / (1024 * 1024));
+
+        double legacy = MeasureGBps(size, minSeconds, [&] {
+            std::string out = LegacyBase64Encode(input.data(), (unsigned int)input.size());
+            if (out.size() != expected.size()) allMatch = false;
+        });
+        printf("%-12s %-8s %-12s %10.3f %9.1fx\n", label, "encode", "legacy", legacy, 1.0);
+
+        std::string output(Base64EncodedLength(size), '\0');
+        for (const Base64Kernel& kernel : kernels) {
+            kernel.encode(input.data(), input.size(), &output[0]);
+            bool match = output == expected;
+            allMatch = allMatch && match;
+
+            double gbps = MeasureGBps(size, minSeconds, [&] {
+                kernel.encode(input.data(), input.size(), &output[0]);
+            });
+            printf("%-12s %-8s %-12s %10.3f %9.1fx%s\n", label, "encode", kernel.name, gbps, gbps / legacy,
+                match ? "" : "  OUTPUT MISMATCH");
+        }
+
+        // Decode rates are also quoted in decoded (binary) bytes per second.
+        double legacyDecode = MeasureGBps(size, minSeconds, [&] {
+            std::vector<unsigned char> out = LegacyBase64Decode(expected);
+            if (out.size() != size) allMatch = false;
+        });
+        printf("%-12s %-8s %-12s %10.3f %9.1fx\n", label, "decode", "legacy", legacyDecode, 1.0);
+
+        std::vector<unsigned char> decoded(Base64DecodedMaxLength(expected.size()));
+        for (const Base64Kernel& kernel : kernels) {
+            Base64DecodeResult result = kernel.decode(expected.data(), expected.size(), decoded.data());
+            bool match = result.ok && result.size == size && std::equal(input.begin(), input.end(), decoded.begin());
+            allMatch = allMatch && match;
+
+            double gbps = MeasureGBps(size, minSeconds, [&] {
+                kernel.decode(expected.data(), expected.size(), decoded.data());
+            });
+            printf("%-12s %-8s %-12s %10.3f %9.1fx%s\n", label, "decode", kernel.name, gbps, gbps / legacyDecode,
+                match ? "" : "  OUTPUT MISMATCH");
+        }
+        printf("\n");
+    }
+
+    return allMatch ? 0 : 1;
+}
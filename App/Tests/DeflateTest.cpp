@@ -0,0 +1,330 @@
+// permessage-deflate codec checks: round trips through every block type and window setting,
+// streams zlib produced, and truncated or corrupt input, which must fail cleanly. Every
+// inflate reads its input from right before an unmapped page, so an over-read faults.
+
+#include "../App/Deflate.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+static int g_failures = 0;
+
+static void Check(bool ok, const char* what) {
+    if (ok) return;
+    g_failures++;
+    printf("FAIL %s\n", what);
+}
+
+// ============ Helpers ============
+
+// A copy of data that ends where an unreadable page begins.
+class GuardedInput {
+public:
+    explicit GuardedInput(const std::string& data) {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        m_size = (data.size() + page - 1) / page * page + page;
+        m_map = (unsigned char*)mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        mprotect(m_map + m_size - page, page, PROT_NONE);
+        m_data = m_map + m_size - page - data.size();
+        if (!data.empty()) memcpy(m_data, data.data(), data.size());
+    }
+    ~GuardedInput() { munmap(m_map, m_size); }
+
+    const unsigned char* data() const { return m_data; }
+
+private:
+    unsigned char* m_map;
+    size_t m_size;
+    unsigned char* m_data;
+};
+
+static bool Inflate(DeflateDecoder& decoder, const std::string& compressed, std::string& out, size_t maxSize = 1 << 24) {
+    GuardedInput input(compressed);
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+    if (!decoder.Decompress(input.data(), compressed.size(), maxSize, data, size)) return false;
+    out.assign((const char*)data, size);
+    return true;
+}
+
+static std::string Compress(DeflateEncoder& encoder, const std::string& message) {
+    std::string out;
+    encoder.Compress((const unsigned char*)message.data(), message.size(), out);
+    return out;
+}
+
+// BTYPE of the first block: 0 stored, 1 fixed, 2 dynamic.
+static int FirstBlockType(const std::string& compressed) {
+    return compressed.empty() ? -1 : ((unsigned char)compressed[0] >> 1) & 3;
+}
+
+// The same text the zlib vectors below were made from.
+static std::string Lines(int count, int first = 0) {
+    std::string text;
+    char line[96];
+    for (int i = first; i < first + count; i++) {
+        snprintf(line, sizeof(line), "line %d: the quick brown fox jumps over the lazy dog %d times\n", i, i * 7 % 13);
+        text += line;
+    }
+    return text;
+}
+
+static std::string RandomBytes(size_t size, std::mt19937& rng) {
+    std::string bytes(size, '\0');
+    for (char& b : bytes) b = (char)rng();
+    return bytes;
+}
+
+// Packs hand-made blocks, least significant bit first as DEFLATE does.
+struct Bits {
+    std::string bytes;
+    unsigned int pending = 0;
+    int count = 0;
+
+    Bits& Put(unsigned int value, int n) {
+        for (int i = 0; i < n; i++) {
+            pending |= ((value >> i) & 1) << count;
+            if (++count == 8) {
+                bytes.push_back((char)pending);
+                pending = 0;
+                count = 0;
+            }
+        }
+        return *this;
+    }
+
+    // A Huffman code goes out most significant bit first.
+    Bits& Code(unsigned int code, int length) {
+        for (int i = length - 1; i >= 0; i--) Put((code >> i) & 1, 1);
+        return *this;
+    }
+
+    Bits& FixedLiteral(unsigned char c) { return c < 144 ? Code(0x30 + c, 8) : Code(0x190 + c - 144, 9); }
+    Bits& SyncFlush() { return Put(0, 3); }
+
+    std::string Done() {
+        if (count) bytes.push_back((char)pending);
+        pending = 0;
+        count = 0;
+        return bytes;
+    }
+};
+
+// Every cut short of the whole message must fail. A cut right after a stored block's header
+// reads as a sync flush and is a well-formed shorter message, so with stored blocks a
+// prefix of the output is accepted too.
+static void ExpectTruncationsRejected(const std::string& compressed, const std::string& plain, bool stored, const char* what) {
+    for (size_t cut = 0; cut < compressed.size(); cut++) {
+        DeflateDecoder decoder(false);
+        std::string out;
+        if (!Inflate(decoder, compressed.substr(0, cut), out)) continue;
+        if (stored && out.size() < plain.size() && plain.compare(0, out.size(), out) == 0) continue;
+        printf("  cut at %zu of %zu\n", cut, compressed.size());
+        Check(false, what);
+        return;
+    }
+}
+
+// ============ Vectors ============
+
+struct Vector {
+    const char* compressed;
+    size_t compressedSize;
+    std::string plain;
+    bool stored;                                 // Has a stored block, where a cut may end early
+};
+
+#define VECTOR(bytes, plain, stored) { bytes, sizeof(bytes) - 1, plain, stored }
+
+// zlib, raw deflate with a sync flush, 00 00 FF FF stripped; the first five are RFC 7692 7.2.3.
+static const char HELLO_FIXED[] = "\xF2\x48\xCD\xC9\xC9\x07\x00";
+static const char HELLO_AGAIN[] = "\xF2\x00\x11\x00\x00";          // After HELLO_FIXED, with context takeover
+static const char HELLO_STORED[] = "\x00\x05\x00\xFA\xFF\x48\x65\x6C\x6C\x6F\x00";
+static const char HELLO_FINAL[] = "\xF3\x48\xCD\xC9\xC9\x07\x00\x00";
+static const char HELLO_TWO_BLOCKS[] = "\xF2\x48\x05\x00\x00\x00\xFF\xFF\xCA\xC9\xC9\x07\x00";
+static const char EMPTY[] = "\x00";
+
+// zlib level 9: Lines(60), then Lines(60, 30) on the same stream (dynamic blocks).
+static const char LINES_DYNAMIC[] =
+    "\xA4\xD7\x49\x4E\xC4\x30\x10\x40\xD1\x3D\xA7\xF0\x11\x52\x93\x07\x6E\xC3\x10\x20\xD0\xDD\x81\x1E"
+    "\x98\x4E\x8F\x60\xE5\x2C\xCD\x5F\x47\x5F\x91\x5C\xF5\x94\x78\xB7\x1C\xE6\x34\x5D\xA7\xF3\xD3\x9C"
+    "\xDE\x2E\xCB\xDD\x4B\xBA\x3D\xAE\x1F\x87\xF4\xB0\x7E\xA6\xE7\xCB\xFE\xF5\x94\xD6\xF7\xF9\xF8\xF7"
+    "\x78\x77\xF3\xFD\x95\xEE\xD7\xC7\x34\xA5\xF3\xB2\x9F\x4F\x57\xBB\xDF\x56\xC6\xDA\xD2\xB7\x3A\xD6"
+    "\x4A\xDF\xDA\x58\x5B\xFB\xD6\xC7\x5A\xED\xDB\x18\x6B\x5B\xDF\xE6\xB1\xD6\xFA\xB6\x0C\x9E\xD5\x66"
+    "\x48\x75\x2C\xF6\xBE\x6D\x83\x2F\xDE\x4C\x49\x06\x57\x2B\x36\xF1\xE0\x6E\xC9\x66\x50\x32\xB8\x5D"
+    "\x79\x13\x1B\x21\xE1\xC0\x84\x04\x40\x21\x19\xA8\x90\x02\x58\x48\x05\x2E\xA4\x01\x18\x3A\x11\x19"
+    "\x2A\x80\x86\x2A\xB1\xA1\x06\x6C\xA8\x13\x1B\x1A\xC0\x86\x66\x60\x43\x0B\xF9\x5E\x54\x60\x43\x1B"
+    "\xB0\x61\x13\xB0\x61\x02\x6C\x98\x02\x1B\x66\xC4\x86\x39\xB0\x61\x41\x6C\x58\x06\x36\xAC\x10\x1B"
+    "\x56\x81\x0D\x6B\xC0\x86\x4F\xC0\x86\x0B\xB0\xE1\x4A\xFE\xA6\x0C\xD8\x70\x07\x36\x3C\x80\x0D\xCF"
+    "\xC4\x86\x17\x60\xC3\x2B\xB1\xE1\x0D\xD8\x88\x89\xD8\x08\x01\x36\x42\x81\x8D\x30\x60\x23\x1C\xD8"
+    "\x88\x00\x36\x22\x93\xAB\x46\x01\x36\xA2\x02\x1B\xD1\xFE\x69\xE3\x07";
+static const char LINES_DYNAMIC_AGAIN[] =
+    "\xEC\xD9\x5B\x0D\x04\x41\x00\x02\x41\x4B\xF3\x04\xC6\xBF\xB1\xB5\x70\xB9\xFE\x45\x44\xA5\x13\x68"
+    "\x2C\x1B\xCB\xC6\xB2\xB1\x6C\x2C\x1B\xCB\xC6\xF2\x17\x1B\x1A\xC0\x86\x26\xB1\xA1\x05\x6C\x68\x13"
+    "\x1B\x3A\xC0\x86\x2E\xB0\x21\x01\x1B\x32\xB0\xA1\x00\x1B\x7A\xC0\x86\x07\xB0\xE1\x49\x56\xEB\x45"
+    "\x6C\x78\x03\x1B\x3E\xC4\x86\x2F\xB0\x61\x11\x1B\x36\xB0\xE1\x00\x1B\x7E\xC0\x46\x06\xB0\x91\x09"
+    "\x6C\x64\x01\x1B\xD9\xC0\x46\x0E\xB0\x91\x8B\x2E\x1D\x01\x1B\x31\xB1\x91\x00\x1B\x79\x7F\xDA\xF8"
+    "\x00";
+
+// zlib level 9 with a 512-byte window: Lines(40).
+static const char LINES_SMALL_WINDOW[] =
+    "\x94\xCF\x4B\x4E\x03\x51\x0C\x44\xD1\x39\xAB\xF0\x12\x6C\xBF\x3F\xBB\x01\xD2\x21\x0D\x9D\x34\xE4"
+    "\x43\x20\xAB\x47\xA0\x0C\x5C\xC3\x1A\x97\x8E\xAE\x6A\x99\x0F\x93\xE8\xA3\x9C\x77\x93\x7C\x5E\xE6"
+    "\x97\x77\x79\x3E\xAE\xD7\x83\x6C\xD7\x6F\x79\xBB\xEC\x3F\x4E\xB2\x7E\x4D\xC7\xFF\x79\x79\xBA\xFD"
+    "\xC8\x66\x7D\x15\x95\xF3\xBC\x9F\x4E\x0F\xCB\x9F\x35\xCE\xB6\x68\x9D\xB3\x16\x6D\xE2\x6C\x8F\x36"
+    "\x73\xD6\xA3\x2D\x9C\x1D\xD1\x56\xCE\xA6\x68\x1B\x67\x4D\x23\xEE\x1C\xCE\xD1\x0E\x32\x6C\x11\x9B"
+    "\x72\xBA\x00\x36\x32\xED\xA0\x9D\xD3\x15\x70\xE2\xB0\x02\xCE\x1C\x6E\x80\x0B\x79\x1A\x70\xE5\x70"
+    "\x07\xDC\x38\xEC\x80\x3B\x87\x07\xE0\xC1\xE1\x14\xB1\x2B\x87\x4D\x41\x1B\xA7\x33\x60\x27\xD3\x06"
+    "\x3A\x71\xBA\x00\xCE\x64\xDA\x41\x17\x4E\x57\xC0\x95\xC3\x0A\xB8\x71\xB8\x01\xEE\xE4\x69\xC0\x83"
+    "\xC3\x3D\xE2\xA4\x1C\x76\xC0\xC6\xE1\x01\xD8\x39\x9C\x00\x27\x0E\x9B\x82\xCE\x9C\xCE\x80\x0B\x99"
+    "\x36\xD0\x95\xD3\x05\x70\x23\xD3\x0E\xBA\x73\xBA\x02\x1E\x1C\xD6\x3B\xFE\x05";
+
+int main() {
+    std::mt19937 rng(0x4C594E58);
+
+    // Round trips: every window size and takeover setting, over messages that come out as
+    // stored (random, one over 64 KB), fixed (short) and dynamic (text) blocks.
+    std::vector<std::string> messages = {
+        "", "Hello", Lines(3), RandomBytes(1000, rng), Lines(400), Lines(60), Lines(60),
+        RandomBytes(70000, rng), std::string(200000, '\0'), Lines(1500),
+    };
+    bool seen[3] = {};
+    for (int windowBits : { 8, 9, 12, 15 }) {
+        for (bool takeover : { true, false }) {
+            DeflateEncoder encoder(windowBits, takeover);
+            DeflateDecoder decoder(takeover);
+            std::vector<size_t> sizes;
+            for (const std::string& message : messages) {
+                std::string compressed = Compress(encoder, message);
+                sizes.push_back(compressed.size());
+                int type = FirstBlockType(compressed);
+                if (type >= 0 && type < 3) seen[type] = true;
+                std::string out;
+                Check(Inflate(decoder, compressed, out) && out == message, "round trip");
+                // Without takeover every message stands on its own.
+                DeflateDecoder fresh(false);
+                if (!takeover) Check(Inflate(fresh, compressed, out) && out == message, "round trip without takeover");
+            }
+            // Lines(60) twice in a row: with takeover the second is mostly one back-reference.
+            DeflateEncoder alone(windowBits, false);
+            size_t standalone = Compress(alone, messages[6]).size();
+            if (takeover && windowBits == 15) Check(sizes[6] * 4 < standalone, "takeover refers back to the previous message");
+            if (!takeover) Check(sizes[6] >= standalone / 2, "no takeover: nothing borrowed from earlier messages");
+        }
+    }
+    Check(seen[0] && seen[1] && seen[2], "stored, fixed and dynamic blocks all written");
+
+    // Streams zlib wrote.
+    {
+        const Vector standalone[] = {
+            VECTOR(HELLO_FIXED, "Hello", false), VECTOR(HELLO_STORED, "Hello", true), VECTOR(HELLO_FINAL, "Hello", false),
+            VECTOR(HELLO_TWO_BLOCKS, "Hello", true), VECTOR(EMPTY, "", false), VECTOR(LINES_DYNAMIC, Lines(60), false),
+            VECTOR(LINES_SMALL_WINDOW, Lines(40), false),
+        };
+        for (const Vector& v : standalone) {
+            DeflateDecoder decoder(false);
+            std::string out;
+            Check(Inflate(decoder, std::string(v.compressed, v.compressedSize), out) && out == v.plain, "zlib vector");
+        }
+
+        DeflateDecoder decoder(true);
+        std::string out;
+        Check(Inflate(decoder, std::string(HELLO_FIXED, sizeof(HELLO_FIXED) - 1), out) && out == "Hello", "zlib takeover, first");
+        Check(Inflate(decoder, std::string(HELLO_AGAIN, sizeof(HELLO_AGAIN) - 1), out) && out == "Hello", "zlib takeover, second");
+        DeflateDecoder lines(true);
+        Check(Inflate(lines, std::string(LINES_DYNAMIC, sizeof(LINES_DYNAMIC) - 1), out) && out == Lines(60), "zlib dynamic takeover, first");
+        Check(Inflate(lines, std::string(LINES_DYNAMIC_AGAIN, sizeof(LINES_DYNAMIC_AGAIN) - 1), out) && out == Lines(60, 30),
+            "zlib dynamic takeover, second");
+
+        // Back-references into a previous message a fresh decoder never saw.
+        DeflateDecoder cold(true);
+        Check(!Inflate(cold, std::string(HELLO_AGAIN, sizeof(HELLO_AGAIN) - 1), out), "reference before the start rejected");
+
+        for (const Vector& v : standalone) {
+            std::string compressed(v.compressed, v.compressedSize);
+            ExpectTruncationsRejected(compressed, v.plain, v.stored, "truncated zlib vector rejected");
+        }
+    }
+
+    // Our own output cut short: Huffman blocks only, so every cut must fail.
+    for (const std::string& message : { std::string("Hello"), Lines(3), Lines(60), Lines(1500) }) {
+        DeflateEncoder encoder(15, false);
+        std::string compressed = Compress(encoder, message);
+        Check(FirstBlockType(compressed) != 0, "compressible message not stored");
+        ExpectTruncationsRejected(compressed, message, false, "truncated message rejected");
+    }
+
+    // Hand-made malformed blocks, each checked against a well-formed twin where there is one.
+    {
+        struct Case { std::string compressed; bool ok; const char* what; };
+        const Case cases[] = {
+            { Bits().Put(0, 1).Put(3, 2).Done(), false, "reserved block type" },
+            { std::string("\x00\x05\x00\xFB\xFF" "Hello" "\x00", 11), false, "stored LEN/NLEN mismatch" },
+            { std::string(HELLO_FIXED, 6), false, "no sync flush" },
+            { Bits().Put(0, 1).Put(1, 2).FixedLiteral('a').Code(1, 7).Code(0, 5).Code(0, 7).SyncFlush().Done(), true,
+              "fixed: distance 1" },
+            { Bits().Put(0, 1).Put(1, 2).FixedLiteral('a').Code(1, 7).Code(1, 5).Code(0, 7).SyncFlush().Done(), false,
+              "fixed: distance past the start" },
+            { Bits().Put(0, 1).Put(1, 2).FixedLiteral('a').Code(1, 7).Code(30, 5).Code(0, 7).SyncFlush().Done(), false,
+              "fixed: distance code 30" },
+            { Bits().Put(0, 1).Put(1, 2).Code(0xC0 + 6, 8).Code(0, 7).SyncFlush().Done(), false, "fixed: length code 286" },
+            { Bits().Put(0, 1).Put(2, 2).Put(30, 5).Put(0, 5).Put(0, 4).Done(), false, "dynamic: 287 literal/length codes" },
+            { Bits().Put(0, 1).Put(2, 2).Put(0, 5).Put(0, 5).Put(0, 4).Put(1, 3).Put(1, 3).Put(1, 3).Put(0, 3).Done(), false,
+              "dynamic: over-subscribed code length code" },
+            { Bits().Put(0, 1).Put(2, 2).Put(0, 5).Put(0, 5).Put(0, 4).Put(1, 3).Put(0, 3).Put(0, 3).Put(1, 3).Code(1, 1).Done(),
+              false, "dynamic: repeat with nothing to repeat" },
+            // Literals 0 and 1 of length 1, then 256 zeros: no end-of-block code.
+            { Bits().Put(0, 1).Put(2, 2).Put(0, 5).Put(0, 5).Put(14, 4).Put(0, 3).Put(0, 3).Put(1, 3)
+                  .Put(0, 3).Put(0, 3).Put(0, 3).Put(0, 3).Put(0, 3).Put(0, 3).Put(0, 3).Put(0, 3).Put(0, 3).Put(0, 3)
+                  .Put(0, 3).Put(0, 3).Put(0, 3).Put(0, 3).Put(1, 3)
+                  .Code(0, 1).Code(0, 1).Code(1, 1).Put(127, 7).Code(1, 1).Put(107, 7).Done(), false,
+              "dynamic: no end-of-block code" },
+        };
+        for (const Case& c : cases) {
+            DeflateDecoder decoder(false);
+            std::string out;
+            bool ok = Inflate(decoder, c.compressed, out);
+            if (ok != c.ok) printf("  %s\n", c.what);
+            Check(ok == c.ok, c.ok ? "well-formed block accepted" : "malformed block rejected");
+            if (c.ok) Check(out == "aaaa", "distance 1 repeats the last byte");
+        }
+
+        DeflateDecoder decoder(false);
+        std::string out;
+        Check(!Inflate(decoder, std::string(HELLO_FIXED, 7), out, 4), "over maxSize rejected");
+        Check(Inflate(decoder, std::string(HELLO_FIXED, 7), out, 5) && out == "Hello", "at maxSize accepted");
+
+        // A megabyte of zeros deflates to about a kilobyte; the limit must hold against it.
+        DeflateEncoder encoder(15, false);
+        std::string bomb = Compress(encoder, std::string(1 << 20, '\0'));
+        DeflateDecoder bounded(false);
+        Check(!Inflate(bounded, bomb, out, 64 * 1024), "expansion past maxSize rejected");
+    }
+
+    // Random damage: whatever the outcome, no read past the input and no output past maxSize.
+    {
+        std::vector<std::string> samples;
+        DeflateEncoder encoder(15, false);
+        for (const std::string& message : { Lines(5), Lines(200), RandomBytes(300, rng), std::string(5000, 'z') }) {
+            samples.push_back(Compress(encoder, message));
+        }
+        samples.push_back(std::string(LINES_DYNAMIC, sizeof(LINES_DYNAMIC) - 1));
+        for (int round = 0; round < 20000; round++) {
+            std::string damaged = samples[rng() % samples.size()];
+            for (int n = rng() % 4 + 1; n > 0; n--) damaged[rng() % damaged.size()] ^= (char)(1 << (rng() % 8));
+            if (rng() % 4 == 0) damaged.resize(rng() % (damaged.size() + 1));
+            DeflateDecoder decoder(false);
+            std::string out;
+            if (Inflate(decoder, damaged, out, 100000)) Check(out.size() <= 100000, "damaged output within maxSize");
+        }
+    }
+
+    printf(g_failures ? "%d failure(s)\n" : "All passed\n", g_failures);
+    return g_failures ? 1 : 0;
+}
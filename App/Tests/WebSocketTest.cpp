@@ -0,0 +1,379 @@
+// WsClient against an in-process server on 127.0.0.1, through the real Linux network backend.
+// The server echoes what the client sends; a prefix on the message picks how the echo is
+// framed, so each case exercises one part of the receive path. With permessage-deflate agreed
+// the server inflates what arrives and compresses its echoes.
+
+#include "../App/WebSocket.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+static int g_failures = 0;
+
+static void Check(bool ok, const char* what) {
+    if (ok) return;
+    g_failures++;
+    printf("FAIL %s\n", what);
+}
+
+// ============ Server ============
+
+struct ServerLog {
+    std::vector<std::string> pongs;              // Payloads of the client's pongs
+    int closeStatus = -1;                        // From the client's close frame
+    bool clientMasked = true;                    // Every client frame was masked
+    int compressedIn = 0;                        // Client messages that came deflated
+    int plainIn = 0;                             // ...and that came as they are
+    bool inflateFailed = false;
+};
+
+// One accepted connection, with the server's half of permessage-deflate when agreed.
+struct Connection {
+    int fd = -1;
+    std::unique_ptr<DeflateEncoder> deflater;
+    std::unique_ptr<DeflateDecoder> inflater;
+};
+
+static bool ReadExact(int fd, void* buffer, size_t size) {
+    unsigned char* out = (unsigned char*)buffer;
+    while (size > 0) {
+        ssize_t got = recv(fd, out, size, 0);
+        if (got <= 0) return false;
+        out += got;
+        size -= (size_t)got;
+    }
+    return true;
+}
+
+static void SendFrame(int fd, unsigned char opcode, bool fin, const std::string& payload, unsigned char rsv = 0) {
+    std::string frame;
+    frame.push_back((char)((fin ? 0x80 : 0x00) | rsv << 4 | opcode));
+    if (payload.size() < 126) {
+        frame.push_back((char)payload.size());
+    } else if (payload.size() <= 0xFFFF) {
+        frame.push_back((char)126);
+        frame.push_back((char)(payload.size() >> 8));
+        frame.push_back((char)payload.size());
+    } else {
+        frame.push_back((char)127);
+        for (int i = 7; i >= 0; i--) frame.push_back((char)((unsigned long long)payload.size() >> (8 * i)));
+    }
+    frame += payload;
+    if (send(fd, frame.data(), frame.size(), MSG_NOSIGNAL) < 0) {}
+}
+
+static bool ReadFrame(int fd, WsFrameHeader& header, std::string& payload, ServerLog& log) {
+    unsigned char head[WS_MAX_HEADER_BYTES];
+    size_t have = 2;
+    if (!ReadExact(fd, head, 2)) return false;
+    size_t headerSize;
+    while ((headerSize = WsParseFrameHeader(head, have, header)) == 0) {
+        if (!ReadExact(fd, head + have, 1)) return false;
+        have++;
+    }
+    if (!header.masked) log.clientMasked = false;
+    payload.resize((size_t)header.length);
+    if (!payload.empty() && !ReadExact(fd, &payload[0], payload.size())) return false;
+    if (header.masked) WsMask((unsigned char*)&payload[0], payload.size(), header.maskKey);
+    return true;
+}
+
+static bool StartsWith(const std::string& text, const char* prefix) {
+    return text.compare(0, strlen(prefix), prefix) == 0;
+}
+
+// Sends a message as pieces frames, with a ping after the first when asked. A compressed
+// message is split after compression and only its first frame carries RSV1.
+static void SendMessage(Connection& connection, unsigned char opcode, const std::string& message, int pieces = 1,
+    bool pingInside = false) {
+    std::string body = message;
+    unsigned char rsv = 0;
+    if (connection.deflater) {
+        body.clear();
+        connection.deflater->Compress((const unsigned char*)message.data(), message.size(), body);
+        rsv = WS_RSV_COMPRESSED;
+    }
+    size_t step = body.size() / pieces;
+    for (int i = 0; i < pieces; i++) {
+        size_t begin = i * step;
+        size_t end = i == pieces - 1 ? body.size() : begin + step;
+        SendFrame(connection.fd, i == 0 ? opcode : (unsigned char)WS_OP_CONTINUATION, i == pieces - 1, body.substr(begin, end - begin),
+            i == 0 ? rsv : 0);
+        if (i == 0 && pingInside) SendFrame(connection.fd, WS_OP_PING, true, "mid");
+    }
+}
+
+// frag:  echoed in three fragments
+// ping:  echoed in two fragments with a ping between them
+// big:N  answered with an N-byte binary message in two fragments
+// badutf8  answered with a text message that is not UTF-8
+// anything else is echoed as one frame
+static void Respond(Connection& connection, unsigned char opcode, const std::string& message) {
+    if (StartsWith(message, "frag:")) {
+        SendMessage(connection, opcode, message, 3);
+    } else if (StartsWith(message, "ping:")) {
+        SendMessage(connection, opcode, message, 2, true);
+    } else if (StartsWith(message, "big:")) {
+        SendMessage(connection, WS_OP_BINARY, std::string((size_t)atol(message.c_str() + 4), 'x'), 2);
+    } else if (message == "badutf8") {
+        SendMessage(connection, WS_OP_TEXT, "caf\xC3\x28");
+    } else {
+        SendMessage(connection, opcode, message);
+    }
+}
+
+// Serves one connection: the upgrade, then echoes until the client closes. extensions is the
+// permessage-deflate answer to give a client that offers it, empty to decline.
+static void Serve(int listenFd, ServerLog& log, std::string extensions) {
+    Connection connection;
+    int fd = connection.fd = accept(listenFd, nullptr, nullptr);
+    if (fd < 0) return;
+
+    std::string request;
+    char c;
+    while (request.size() < 8192 && request.find("\r\n\r\n") == std::string::npos && recv(fd, &c, 1, 0) == 1) request += c;
+    std::string accept = WsAcceptKey(WsHeaderValue(request, "Sec-WebSocket-Key"));
+    std::string response = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+        "Sec-WebSocket-Accept: " + accept + "\r\n";
+    if (!extensions.empty() && StartsWith(WsHeaderValue(request, "Sec-WebSocket-Extensions"), "permessage-deflate")) {
+        response += "Sec-WebSocket-Extensions: " + extensions + "\r\n";
+        bool serverTakeover = extensions.find("server_no_context_takeover") == std::string::npos;
+        bool clientTakeover = extensions.find("client_no_context_takeover") == std::string::npos;
+        connection.deflater.reset(new DeflateEncoder(DEFLATE_MAX_WINDOW_BITS, serverTakeover));
+        connection.inflater.reset(new DeflateDecoder(clientTakeover));
+    }
+    response += "\r\n";
+    if (send(fd, response.data(), response.size(), MSG_NOSIGNAL) < 0) {}
+
+    WsFrameHeader header;
+    std::string payload;
+    while (ReadFrame(fd, header, payload, log)) {
+        if ((header.opcode == WS_OP_TEXT || header.opcode == WS_OP_BINARY) && (header.rsv & WS_RSV_COMPRESSED)) {
+            const unsigned char* inflated = nullptr;
+            size_t inflatedSize = 0;
+            if (!connection.inflater ||
+                !connection.inflater->Decompress((const unsigned char*)payload.data(), payload.size(), 1 << 24, inflated, inflatedSize)) {
+                log.inflateFailed = true;
+                break;
+            }
+            payload.assign((const char*)inflated, inflatedSize);
+            log.compressedIn++;
+        } else if (header.opcode == WS_OP_TEXT || header.opcode == WS_OP_BINARY) {
+            log.plainIn++;
+        }
+
+        if (header.opcode == WS_OP_PONG) {
+            log.pongs.push_back(payload);
+        } else if (header.opcode == WS_OP_CLOSE) {
+            log.closeStatus = payload.size() >= 2 ? ((unsigned char)payload[0] << 8) | (unsigned char)payload[1] : 0;
+            SendFrame(fd, WS_OP_CLOSE, true, payload.substr(0, 2));
+            break;
+        } else if (header.opcode == WS_OP_TEXT || header.opcode == WS_OP_BINARY) {
+            Respond(connection, header.opcode, payload);
+        }
+    }
+    shutdown(fd, SHUT_RDWR);
+    close(fd);
+}
+
+static int Listen(int& port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (fd < 0 || bind(fd, (sockaddr*)&address, sizeof(address)) != 0 || listen(fd, 1) != 0 ||
+        getsockname(fd, (sockaddr*)&address, &length) != 0) {
+        return -1;
+    }
+    port = ntohs(address.sin_port);
+    return fd;
+}
+
+// ============ Client ============
+
+typedef std::pair<WsMessageType, std::string> Message;
+
+struct Script {
+    std::deque<Message> send;
+    std::vector<Message> expect;                 // In order; anything else is a failure
+    size_t received = 0;
+    bool unexpected = false;
+    bool closeWhenDone = true;                   // Close once everything expected has arrived
+    bool timedOut = false;
+};
+
+// Connects to a fresh server, runs the script and returns what the server saw.
+static ServerLog RunScript(const WsClientOptions& options, Script& script, const std::string& extensions = std::string()) {
+    ServerLog log;
+    int port = 0;
+    int listenFd = Listen(port);
+    if (listenFd < 0) {
+        Check(false, "listen on 127.0.0.1");
+        return log;
+    }
+    std::thread server(Serve, listenFd, std::ref(log), extensions);
+
+    WsClient client(options);
+    std::string response;
+    if (client.Connect("127.0.0.1", port, false, "/", response)) {
+        unsigned long long deadline = MonotonicMs() + 10000;
+        WsCallbacks callbacks;
+        callbacks.onMessage = [&](WsMessageType type, const unsigned char* data, size_t size) {
+            bool match = script.received < script.expect.size() && script.expect[script.received].first == type &&
+                script.expect[script.received].second == std::string((const char*)data, size);
+            if (!match) script.unexpected = true;
+            script.received++;
+        };
+        callbacks.nextMessage = [&](WsMessageType& type, WsPayload& payload, bool& /*compressible*/) {
+            if (script.send.empty()) return false;
+            // Binary messages go out as shared payloads, the way replayed agent frames do.
+            type = script.send.front().first;
+            if (type == WsMessageType::Binary) payload.shared = std::make_shared<const std::string>(std::move(script.send.front().second));
+            else payload.bytes = std::move(script.send.front().second);
+            script.send.pop_front();
+            return true;
+        };
+        callbacks.onTick = [&]() {
+            if (MonotonicMs() >= deadline) {
+                script.timedOut = true;
+                return -1;
+            }
+            return script.closeWhenDone && script.received >= script.expect.size() ? -1 : 50;
+        };
+        client.Run(callbacks);
+    } else {
+        Check(false, "connect and upgrade");
+        shutdown(listenFd, SHUT_RDWR);
+    }
+    server.join();
+    close(listenFd);
+    return log;
+}
+
+static std::string RandomBytes(size_t size, std::mt19937& rng) {
+    std::string bytes(size, '\0');
+    for (char& b : bytes) b = (char)rng();
+    return bytes;
+}
+
+int main() {
+    signal(SIGPIPE, SIG_IGN);
+    std::mt19937 rng(0x4C594E58);
+
+    WsClientOptions options;
+    options.readBufferBytes = 16 * 1024;
+    options.maxMessageBytes = 64 * 1024;
+
+    // Echoes of every framing, then a clean close.
+    {
+        std::string text = "frag:";
+        while (text.size() < 20000) text += "h\xC3\xA9llo w\xC3\xB6rld \xE2\x9C\x93 \xF0\x9F\x99\x82 ";
+        std::string binary = "frag:" + RandomBytes(30000, rng);
+        std::string pinged = "ping:" + RandomBytes(5000, rng);
+        std::string large = RandomBytes(40000, rng);   // Bigger than the read buffer
+
+        Script script;
+        script.send = {
+            { WsMessageType::Text, "hello" },
+            { WsMessageType::Text, text },
+            { WsMessageType::Binary, binary },
+            { WsMessageType::Binary, pinged },
+            { WsMessageType::Binary, large },
+            { WsMessageType::Text, "big:100000" },       // Over maxMessageBytes: dropped
+            { WsMessageType::Text, "after-big" },
+        };
+        script.expect = {
+            { WsMessageType::Text, "hello" },
+            { WsMessageType::Text, text },
+            { WsMessageType::Binary, binary },
+            { WsMessageType::Binary, pinged },
+            { WsMessageType::Binary, large },
+            { WsMessageType::Text, "after-big" },
+        };
+        ServerLog log = RunScript(options, script);
+        Check(!script.timedOut, "echo script finished in time");
+        Check(script.received == script.expect.size() && !script.unexpected, "echoes arrive whole and in order, oversized one dropped");
+        Check(log.pongs.size() == 1 && log.pongs[0] == "mid", "ping inside a fragmented message is answered");
+        Check(log.clientMasked, "client frames are masked");
+        Check(log.closeStatus == WS_CLOSE_NORMAL, "clean close sends status 1000");
+    }
+
+    // A text message that is not UTF-8 fails the connection.
+    {
+        Script script;
+        script.send = { { WsMessageType::Text, "badutf8" } };
+        script.closeWhenDone = false;
+        ServerLog log = RunScript(options, script);
+        Check(!script.timedOut, "invalid text ends the connection in time");
+        Check(script.received == 0, "invalid text is not delivered");
+        Check(log.closeStatus == WS_CLOSE_INVALID_DATA, "invalid text closes with status 1007");
+    }
+
+    // permessage-deflate with context takeover both ways: compressed fragments, a ping inside
+    // a compressed message, stored (random) and dynamic (text) blocks, a message repeated so
+    // the second refers back to the first, and short messages sent as they are.
+    WsClientOptions deflated = options;
+    deflated.deflate.enabled = true;
+    std::string prose = "frag:";
+    while (prose.size() < 20000) prose += "the relay passes compressed frames through the agent \xE2\x9C\x93 ";
+    {
+        std::string pinged = "ping:" + RandomBytes(5000, rng);
+        std::string large = RandomBytes(40000, rng);
+
+        Script script;
+        script.send = {
+            { WsMessageType::Text, "hello" },
+            { WsMessageType::Text, prose },
+            { WsMessageType::Binary, pinged },
+            { WsMessageType::Text, prose },
+            { WsMessageType::Binary, large },
+            { WsMessageType::Text, "after" },
+        };
+        script.expect.assign(script.send.begin(), script.send.end());
+        ServerLog log = RunScript(deflated, script, "permessage-deflate");
+        Check(!script.timedOut, "deflate script finished in time");
+        Check(script.received == script.expect.size() && !script.unexpected, "compressed echoes arrive whole and in order");
+        Check(!log.inflateFailed && log.compressedIn == 4 && log.plainIn == 2, "client compresses all but short messages");
+        Check(log.pongs.size() == 1 && log.pongs[0] == "mid", "ping inside a compressed message is answered");
+        Check(log.closeStatus == WS_CLOSE_NORMAL, "deflate connection closes with status 1000");
+    }
+
+    // Without context takeover and a smaller client window; invalid UTF-8 is caught after inflating.
+    {
+        Script script;
+        script.send = { { WsMessageType::Text, prose }, { WsMessageType::Text, prose }, { WsMessageType::Text, "badutf8" } };
+        script.expect = { { WsMessageType::Text, prose }, { WsMessageType::Text, prose } };
+        script.closeWhenDone = false;
+        ServerLog log = RunScript(deflated, script,
+            "permessage-deflate; client_max_window_bits=10; server_no_context_takeover; client_no_context_takeover");
+        Check(!script.timedOut, "no-takeover script finished in time");
+        Check(script.received == 2 && !script.unexpected, "no-takeover echoes arrive");
+        Check(!log.inflateFailed && log.compressedIn == 2, "no-takeover messages inflate on their own");
+        Check(log.closeStatus == WS_CLOSE_INVALID_DATA, "invalid compressed text closes with status 1007");
+    }
+
+    // The validator on its own.
+    const char* valid[] = { "", "plain ascii", "\xC2\x80", "\xE0\xA0\x80", "\xED\x9F\xBF", "\xF0\x90\x80\x80", "\xF4\x8F\xBF\xBF" };
+    const char* invalid[] = { "\x80", "\xC0\xAF", "\xC3\x28", "\xE0\x80\xAF", "\xED\xA0\x80", "\xF4\x90\x80\x80", "\xF5\x80\x80\x80",
+        "\xE2\x9C", "abcdefgh\xFF" };
+    for (const char* text : valid) Check(WsValidUtf8((const unsigned char*)text, strlen(text)), "valid UTF-8 accepted");
+    for (const char* text : invalid) Check(!WsValidUtf8((const unsigned char*)text, strlen(text)), "invalid UTF-8 rejected");
+
+    printf(g_failures ? "%d failure(s)\n" : "All passed\n", g_failures);
+    return g_failures ? 1 : 0;
+}
@@ -335,8 +335,550 @@ type WebSocketData = {
     os?: string;
     version?: string;
     userId?: string;
+    caps?: string[];
+    slices?: Map<number, SliceBuffer>;
+    requestIds?: Map<number, string>;
+    nextRequestId?: number;
+    outputDecoders?: Map<number, TextDecoder>;    // Per channel; 0 is the implicit terminal
+    channelAcks?: boolean;                        // Dashboard said it acknowledges channel messages
+    session?: AgentSession;
+    resumed?: boolean;
 };
 
+// Optional agent protocol features; the agent only uses those we echo back in X-Lynx-Caps
+const SUPPORTED_AGENT_CAPS = ["slice", "bin1", "lz4", "resume", "chan"];
+
+function negotiateCaps(requested: string | null): string[] {
+    if (!requested) return [];
+    return requested.split(",").map((cap) => cap.trim()).filter((cap) => SUPPORTED_AGENT_CAPS.includes(cap));
+}
+
+// Agents cut bulk messages into slice frames so terminal output can interleave with them:
+// [0x10][flags: 0x01 final, 0x02 text][uint32 LE slice id][payload...]
+const SLICE_FRAME_MARKER = 0x10;
+const SLICE_FLAG_FINAL = 0x01;
+const SLICE_FLAG_TEXT = 0x02;
+const SLICE_HEADER_SIZE = 6;
+const MAX_SLICED_MESSAGE_BYTES = 256 * 1024 * 1024;
+
+type SliceBuffer = { parts: Uint8Array[]; size: number };
+
+// Binary frame format v1 between relay and agents with the "bin1" cap. Dashboards keep speaking JSON;
+// the relay translates. [0xF1][type][varint channel][varint requestId] then fields of [varint length][bytes]
+const FRAME_MARKER_V1 = 0xf1;
+const FrameType = {
+    Output: 0x01,
+    Input: 0x02,
+    Ping: 0x03,
+    Pong: 0x04,
+    Metrics: 0x05,
+    FsRequest: 0x06,
+    FsReply: 0x07,
+    Screenshot: 0x08,
+} as const;
+
+type Frame = { type: number; channel: number; requestId: number; fields: Uint8Array[] };
+
+const MAX_PENDING_REQUEST_IDS = 10000;
+const textEncoder = new TextEncoder();
+
+function readVarint(buf: Uint8Array, pos: number): [number, number] | null {
+    let value = 0;
+    let scale = 1;
+    while (pos < buf.length && scale <= 2 ** 49) {
+        const byte = buf[pos++]!;
+        value += (byte & 0x7f) * scale;
+        if (!(byte & 0x80)) return [value, pos];
+        scale *= 0x80;
+    }
+    return null;
+}
+
+function writeVarint(out: number[], value: number) {
+    while (value >= 0x80) {
+        out.push((value % 0x80) | 0x80);
+        value = Math.floor(value / 0x80);
+    }
+    out.push(value);
+}
+
+function varintField(value: number): Uint8Array {
+    const out: number[] = [];
+    writeVarint(out, value);
+    return Uint8Array.from(out);
+}
+
+function fieldVarint(frame: Frame, index: number): number {
+    const field = frame.fields[index];
+    return field ? readVarint(field, 0)?.[0] ?? 0 : 0;
+}
+
+function parseFrame(buf: Uint8Array): Frame | null {
+    if (buf.length < 2 || buf[0] !== FRAME_MARKER_V1) return null;
+    const channel = readVarint(buf, 2);
+    if (!channel) return null;
+    const requestId = readVarint(buf, channel[1]);
+    if (!requestId) return null;
+
+    const fields: Uint8Array[] = [];
+    let pos = requestId[1];
+    while (pos < buf.length) {
+        const length = readVarint(buf, pos);
+        if (!length || length[1] + length[0] > buf.length) return null;
+        fields.push(buf.subarray(length[1], length[1] + length[0]));
+        pos = length[1] + length[0];
+    }
+    return { type: buf[1]!, channel: channel[0], requestId: requestId[0], fields };
+}
+
+// Agents may LZ4-compress file chunks (block format, header says encoding "lz4" and rawSize).
+// Dashboards always get plain data, so the relay inflates them here.
+const MAX_INFLATED_CHUNK_BYTES = 64 * 1024 * 1024;
+
+function readLz4Length(src: Uint8Array, pos: number, length: number): [number, number] | null {
+    let byte: number;
+    do {
+        if (pos >= src.length) return null;
+        byte = src[pos++]!;
+        length += byte;
+    } while (byte === 255);
+    return [length, pos];
+}
+
+function lz4Inflate(src: Uint8Array, rawSize: number): Uint8Array | null {
+    if (!Number.isInteger(rawSize) || rawSize < 0 || rawSize > MAX_INFLATED_CHUNK_BYTES) return null;
+    const out = new Uint8Array(rawSize);
+    let pos = 0;
+    let produced = 0;
+
+    while (pos < src.length) {
+        const token = src[pos++]!;
+        let literals = token >> 4;
+        if (literals === 15) {
+            const extended = readLz4Length(src, pos, literals);
+            if (!extended) return null;
+            [literals, pos] = extended;
+        }
+        if (pos + literals > src.length || produced + literals > rawSize) return null;
+        out.set(src.subarray(pos, pos + literals), produced);
+        pos += literals;
+        produced += literals;
+        if (pos === src.length) break;
+
+        if (pos + 2 > src.length) return null;
+        const offset = src[pos]! | (src[pos + 1]! << 8);
+        pos += 2;
+        if (offset === 0 || offset > produced) return null;
+
+        let matchLength = token & 15;
+        if (matchLength === 15) {
+            const extended = readLz4Length(src, pos, matchLength);
+            if (!extended) return null;
+            [matchLength, pos] = extended;
+        }
+        matchLength += 4;
+        if (produced + matchLength > rawSize) return null;
+
+        if (offset >= matchLength) {
+            out.copyWithin(produced, produced - offset, produced - offset + matchLength);
+            produced += matchLength;
+        } else {
+            for (let i = 0; i < matchLength; i++, produced++) out[produced] = out[produced - offset]!;
+        }
+    }
+    return produced === rawSize ? out : null;
+}
+
+function encodeFrame(type: number, channel: number, requestId: number, fields: Uint8Array[] = []): Uint8Array {
+    const header: number[] = [FRAME_MARKER_V1, type];
+    writeVarint(header, channel);
+    writeVarint(header, requestId);
+    const parts: Uint8Array[] = [Uint8Array.from(header)];
+    for (const field of fields) {
+        parts.push(varintField(field.length), field);
+    }
+    return new Uint8Array(Buffer.concat(parts));
+}
+
+function usesBinaryFrames(ws: ServerWebSocket<WebSocketData>): boolean {
+    return ws.data.caps?.includes("bin1") ?? false;
+}
+
+// Agents answer with integer request ids; dashboards use strings
+function mapRequestId(deviceWs: ServerWebSocket<WebSocketData>, requestId: unknown): number {
+    const ids = (deviceWs.data.requestIds ??= new Map());
+    const numericId = (deviceWs.data.nextRequestId = (deviceWs.data.nextRequestId ?? 0) + 1);
+    ids.set(numericId, String(requestId ?? ""));
+    if (ids.size > MAX_PENDING_REQUEST_IDS) {
+        ids.delete(ids.keys().next().value!);
+    }
+    return numericId;
+}
+
+function sendToDevice(deviceWs: ServerWebSocket<WebSocketData>, msg: any) {
+    if (!usesBinaryFrames(deviceWs)) {
+        deviceWs.send(JSON.stringify(msg));
+        return;
+    }
+
+    if (msg.type === "input" && typeof msg.data === "string") {
+        deviceWs.send(encodeFrame(FrameType.Input, msg.channel ?? 0, 0, [textEncoder.encode(msg.data)]));
+    } else if (msg.type === "filesystem") {
+        // Filesystem "data" is always base64 on the JSON side; agents get the raw bytes
+        const { type: _type, requestId, data, channel, ...params } = msg;
+        const fields = [textEncoder.encode(JSON.stringify(params))];
+        if (typeof data === "string") fields.push(Buffer.from(data, "base64"));
+        // Fire-and-forget requests (stream_credit, stream_cancel, search_cancel, operation_cancel, tail_cancel) get no reply, so nothing to map
+        const frameRequestId = requestId === undefined ? 0 : mapRequestId(deviceWs, requestId);
+        deviceWs.send(encodeFrame(FrameType.FsRequest, channel ?? 0, frameRequestId, fields));
+    } else {
+        deviceWs.send(JSON.stringify(msg));
+    }
+}
+
+function sendPong(ws: ServerWebSocket<WebSocketData>) {
+    if (usesBinaryFrames(ws)) {
+        ws.send(encodeFrame(FrameType.Pong, 0, 0));
+    } else {
+        ws.send(JSON.stringify({ type: "pong" }));
+    }
+}
+
+// Channels ("chan" cap): dashboards open terminals, transfer groups and media captures with
+// channel_open and get an agent-assigned id back; output and filesystem replies then carry it
+// (the frame channel field, or "channel" in JSON). The agent sends at most a window of bytes
+// per channel before we grant more, and we grant it as dashboards consume: each channel
+// message goes out with a per-channel channelSeq, dashboards that subscribed with
+// channelAcks answer with channel_ack {channel, channelSeq} (cumulative), and a message's
+// bytes go back once every such dashboard it reached has acknowledged it or gone. Messages
+// that reach none of them are released at once, since nobody else will ever acknowledge.
+const CHANNEL_CREDIT_BATCH_BYTES = 64 * 1024;
+const CHANNEL_CREDIT_DELAY_MS = 20;
+
+type ChannelDelivery = {
+    channelSeq: number;
+    bytes: number;                                // As the agent counted them
+    waiting: Set<ServerWebSocket<WebSocketData>>; // Dashboards that have not acknowledged it yet
+};
+
+type ChannelFlow = {
+    nextSeq: Map<number, number>;
+    deliveries: Map<number, ChannelDelivery[]>;   // Per channel, oldest first
+    credit: Map<number, number>;                  // Released, not granted to the agent yet
+    timer?: ReturnType<typeof setTimeout>;
+};
+
+// By device rather than by connection, so a resumed session keeps its credit
+const channelFlows = new Map<string, ChannelFlow>();
+
+function channelFlow(deviceId: string): ChannelFlow {
+    let flow = channelFlows.get(deviceId);
+    if (!flow) {
+        flow = { nextSeq: new Map(), deliveries: new Map(), credit: new Map() };
+        channelFlows.set(deviceId, flow);
+    }
+    return flow;
+}
+
+function flushChannelCredit(deviceId: string) {
+    const flow = channelFlows.get(deviceId);
+    if (!flow) return;
+    clearTimeout(flow.timer);
+    flow.timer = undefined;
+    // While the agent is away (or on a connection it already gave up on) the credit waits
+    // for the resumed connection
+    const deviceWs = deviceSockets.get(deviceId);
+    if (!deviceWs || (deviceWs.data.session && deviceWs.data.session.socket !== deviceWs)) return;
+    for (const [channel, bytes] of flow.credit) {
+        deviceWs.send(JSON.stringify({ type: "channel_credit", channel, bytes }));
+    }
+    flow.credit.clear();
+}
+
+function releaseChannelCredit(deviceId: string, channel: number, bytes: number) {
+    if (bytes <= 0) return;
+    const flow = channelFlow(deviceId);
+    const total = (flow.credit.get(channel) ?? 0) + bytes;
+    flow.credit.set(channel, total);
+    if (total >= CHANNEL_CREDIT_BATCH_BYTES) {
+        flushChannelCredit(deviceId);
+        return;
+    }
+    flow.timer ??= setTimeout(() => flushChannelCredit(deviceId), CHANNEL_CREDIT_DELAY_MS);
+}
+
+// Releases the deliveries of a channel no dashboard is waiting on any more
+function settleChannel(deviceId: string, channel: number) {
+    const pending = channelFlows.get(deviceId)?.deliveries.get(channel);
+    if (!pending) return;
+    let released = 0;
+    const rest = pending.filter(delivery => {
+        if (delivery.waiting.size > 0) return true;
+        released += delivery.bytes;
+        return false;
+    });
+    channelFlows.get(deviceId)!.deliveries.set(channel, rest);
+    releaseChannelCredit(deviceId, channel, released);
+}
+
+// Sends a channel message to the device's dashboards and waits for them to consume it
+function forwardChannelMessage(deviceId: string, msg: any, bytes: number) {
+    const flow = channelFlow(deviceId);
+    const channelSeq = (flow.nextSeq.get(msg.channel) ?? 0) + 1;
+    flow.nextSeq.set(msg.channel, channelSeq);
+    const data = JSON.stringify({ ...msg, channelSeq });
+
+    const waiting = new Set<ServerWebSocket<WebSocketData>>();
+    subscriptions.get(deviceId)?.forEach(client => {
+        // send returns 0 when Bun dropped the message
+        if (client.readyState === 1 && client.send(data) !== 0 && client.data.channelAcks) waiting.add(client);
+    });
+    if (waiting.size === 0) {
+        releaseChannelCredit(deviceId, msg.channel, bytes);
+        return;
+    }
+    let pending = flow.deliveries.get(msg.channel);
+    if (!pending) flow.deliveries.set(msg.channel, (pending = []));
+    pending.push({ channelSeq, bytes, waiting });
+}
+
+function acknowledgeChannel(deviceId: string, client: ServerWebSocket<WebSocketData>, channel: number, channelSeq: number) {
+    const pending = channelFlows.get(deviceId)?.deliveries.get(channel);
+    if (!pending) return;
+    for (const delivery of pending) {
+        if (delivery.channelSeq > channelSeq) break;
+        delivery.waiting.delete(client);
+    }
+    settleChannel(deviceId, channel);
+}
+
+// A dashboard that unsubscribed or disconnected will not acknowledge anything more
+function forgetChannelClient(deviceId: string, client: ServerWebSocket<WebSocketData>) {
+    const flow = channelFlows.get(deviceId);
+    if (!flow) return;
+    for (const [channel, pending] of flow.deliveries) {
+        pending.forEach(delivery => delivery.waiting.delete(client));
+        settleChannel(deviceId, channel);
+    }
+}
+
+function closeChannelFlow(deviceId: string, channel: number) {
+    const flow = channelFlows.get(deviceId);
+    if (!flow) return;
+    flow.nextSeq.delete(channel);
+    flow.deliveries.delete(channel);
+    flow.credit.delete(channel);
+}
+
+// The agent's channels are gone: a new session, or the device went offline
+function dropChannelFlows(deviceId: string) {
+    clearTimeout(channelFlows.get(deviceId)?.timer);
+    channelFlows.delete(deviceId);
+}
+
+// Translates an agent frame into the JSON message the rest of the relay (and the dashboard) expects
+function frameToMessage(ws: ServerWebSocket<WebSocketData>, frame: Frame): any | null {
+    const field = (index: number) => frame.fields[index] ?? new Uint8Array();
+
+    switch (frame.type) {
+        case FrameType.Output: {
+            const decoders = (ws.data.outputDecoders ??= new Map());
+            let decoder = decoders.get(frame.channel);
+            if (!decoder) decoders.set(frame.channel, (decoder = new TextDecoder()));
+            const msg: any = { type: "output", output: decoder.decode(field(0), { stream: true }) };
+            if (frame.channel) msg.channel = frame.channel;
+            return msg;
+        }
+        case FrameType.Ping:
+            return { type: "ping", uptime: fieldVarint(frame, 0) };
+        case FrameType.Metrics:
+            return {
+                type: "metrics",
+                data: {
+                    cpu: fieldVarint(frame, 0) / 100,
+                    ram: fieldVarint(frame, 1),
+                    disk: fieldVarint(frame, 2),
+                    netUp: fieldVarint(frame, 3) / 100,
+                    netDown: fieldVarint(frame, 4) / 100,
+                    sendQueueDepth: fieldVarint(frame, 5),
+                    sendQueueBytes: fieldVarint(frame, 6),
+                    sendQueueDropped: fieldVarint(frame, 7),
+                    sendQueueLanes: [8, 9, 10, 11].map((i) => fieldVarint(frame, i)),
+                },
+            };
+        case FrameType.Screenshot:
+            return { type: "screenshot", data: field(0) };
+        case FrameType.FsReply: {
+            let header: any;
+            try {
+                header = JSON.parse(Buffer.from(field(0)).toString("utf8"));
+            } catch (e) {
+                console.error(`[Relay] Invalid filesystem frame header from ${ws.data.id}:`, e);
+                return null;
+            }
+            const ids = ws.data.requestIds;
+            const requestId = ids?.get(frame.requestId);
+            if (!header.more) ids?.delete(frame.requestId);
+            const msg: any = { ...header, type: "filesystem", requestId };
+            if (frame.channel) msg.channel = frame.channel;
+            if (frame.fields.length > 1) {
+                let data: Uint8Array | null = field(1);
+                if (header.encoding === "lz4") {
+                    data = lz4Inflate(data, header.rawSize);
+                    delete msg.encoding;
+                    delete msg.rawSize;
+                    if (!data) {
+                        console.error(`[Relay] Corrupt lz4 chunk from ${ws.data.id}`);
+                        return { ...msg, success: false, error: "Corrupt compressed chunk", more: false };
+                    }
+                }
+                msg.data = Buffer.from(data).toString("base64");
+            }
+            return msg;
+        }
+        default:
+            console.log(`[Relay] Ignoring frame type ${frame.type} from ${ws.data.id}`);
+            return null;
+    }
+}
+
+// Session resumption ("resume" cap): agents put [0x11][flags: 0x02 text][uint32 LE seq] ahead of
+// every message but media. We acknowledge what arrived; an agent that reconnects with the same
+// session token replays only what we never acknowledged, and the connection's protocol state
+// (slices, request ids) carries over. The device only goes offline if it does not come back.
+const SEQUENCE_FRAME_MARKER = 0x11;
+const SEQUENCE_FLAG_TEXT = 0x02;
+const SEQUENCE_HEADER_SIZE = 6;
+const ACK_EVERY_MESSAGES = 64;
+const ACK_EVERY_BYTES = 1024 * 1024;
+const ACK_DELAY_MS = 200;
+const SESSION_RESUME_TIMEOUT_MS = 60_000; // Matches the agent's RESUME_TIMEOUT_MS
+
+type SessionCarry = Pick<WebSocketData, "slices" | "requestIds" | "nextRequestId" | "outputDecoders">;
+
+type AgentSession = {
+    token: string;
+    deviceId: string;
+    lastSeq: number;                  // Highest sequence number received
+    ackedSeq: number;                 // ...and acknowledged
+    unackedBytes: number;
+    ackTimer?: ReturnType<typeof setTimeout>;
+    expiry?: ReturnType<typeof setTimeout>;   // Runs while the agent is away
+    socket?: ServerWebSocket<WebSocketData>;
+    carry: SessionCarry;
+};
+
+const agentSessions = new Map<string, AgentSession>();
+
+function carryOf(data: WebSocketData): SessionCarry {
+    return {
+        slices: data.slices,
+        requestIds: data.requestIds,
+        nextRequestId: data.nextRequestId,
+        outputDecoders: data.outputDecoders,
+    };
+}
+
+// Resumes the agent's session if we still have everything before resumeFrom, the oldest
+// message the agent can replay; otherwise starts a new one under its token.
+function openAgentSession(deviceId: string, token: string | null, resumeFrom: number): { session: AgentSession; resumed: boolean } | undefined {
+    if (!token) return undefined;
+    const existing = agentSessions.get(token);
+    if (existing && existing.deviceId === deviceId && existing.lastSeq + 1 >= resumeFrom) {
+        clearTimeout(existing.expiry);
+        existing.expiry = undefined;
+        // A connection the agent already gave up on may not have closed here yet
+        if (existing.socket) {
+            existing.carry = carryOf(existing.socket.data);
+            existing.socket = undefined;
+        }
+        return { session: existing, resumed: true };
+    }
+
+    for (const session of agentSessions.values()) {
+        if (session.deviceId !== deviceId && session.token !== token) continue;
+        clearTimeout(session.expiry);
+        clearTimeout(session.ackTimer);
+        session.socket = undefined;           // Its connection closing is no longer ours to handle
+        agentSessions.delete(session.token);
+    }
+    const session: AgentSession = { token, deviceId, lastSeq: 0, ackedSeq: 0, unackedBytes: 0, carry: {} };
+    agentSessions.set(token, session);
+    return { session, resumed: false };
+}
+
+function sendAck(session: AgentSession) {
+    clearTimeout(session.ackTimer);
+    session.ackTimer = undefined;
+    if (!session.socket || session.ackedSeq === session.lastSeq) return;
+    session.socket.send(JSON.stringify({ type: "ack", seq: session.lastSeq }));
+    session.ackedSeq = session.lastSeq;
+    session.unackedBytes = 0;
+}
+
+// Returns the message inside a sequence frame, or null for one we already have
+function receiveSequenced(ws: ServerWebSocket<WebSocketData>, frame: Uint8Array): string | Uint8Array | null {
+    const session = ws.data.session!;
+    if (frame.length < SEQUENCE_HEADER_SIZE) return null;
+    const seq = new DataView(frame.buffer, frame.byteOffset, frame.byteLength).getUint32(2, true);
+    if (seq <= session.lastSeq) return null;
+    if (seq !== session.lastSeq + 1) {
+        console.error(`[Relay] Sequence gap from ${ws.data.id}: ${session.lastSeq} -> ${seq}`);
+    }
+    session.lastSeq = seq;
+    session.unackedBytes += frame.length;
+    if (session.lastSeq - session.ackedSeq >= ACK_EVERY_MESSAGES || session.unackedBytes >= ACK_EVERY_BYTES) {
+        sendAck(session);
+    } else {
+        session.ackTimer ??= setTimeout(() => sendAck(session), ACK_DELAY_MS);
+    }
+
+    const payload = frame.subarray(SEQUENCE_HEADER_SIZE);
+    return frame[1]! & SEQUENCE_FLAG_TEXT ? Buffer.from(payload).toString("utf8") : payload;
+}
+
+async function markDeviceOffline(id: string) {
+    const device = db.select().from(devices).where(eq(devices.id, id)).get();
+    if (device) {
+        await triggerWebhooks(device.userId, "device.disconnect", { ...device, status: "offline" });
+    }
+
+    // Update registry to offline immediately
+    const reg = deviceRegistry.get(id);
+    if (reg) {
+        deviceRegistry.set(id, { ...reg, status: "offline", lastSeen: new Date() });
+    }
+
+    upsertDevice({ id, status: "offline", lastSeen: new Date() });
+}
+
+// Returns the reassembled message once its final slice arrives, otherwise null
+function reassembleSlice(ws: ServerWebSocket<WebSocketData>, frame: Uint8Array): string | Uint8Array | null {
+    if (frame.length < SLICE_HEADER_SIZE) return null;
+    const flags = frame[1]!;
+    const sliceId = new DataView(frame.buffer, frame.byteOffset, frame.byteLength).getUint32(2, true);
+    const slices = (ws.data.slices ??= new Map());
+
+    const pending = slices.get(sliceId) ?? { parts: [], size: 0 };
+    const part = frame.subarray(SLICE_HEADER_SIZE);
+    pending.parts.push(part);
+    pending.size += part.length;
+
+    if (pending.size > MAX_SLICED_MESSAGE_BYTES) {
+        slices.delete(sliceId);
+        console.error(`[Relay] Dropping oversized sliced message ${sliceId} from ${ws.data.id}`);
+        return null;
+    }
+    if (!(flags & SLICE_FLAG_FINAL)) {
+        slices.set(sliceId, pending);
+        return null;
+    }
+
+    slices.delete(sliceId);
+    const whole = Buffer.concat(pending.parts, pending.size);
+    return flags & SLICE_FLAG_TEXT ? whole.toString("utf8") : new Uint8Array(whole);
+}
+
 const welcomingMessage = {
     type: "input",
     data:
@@ -656,6 +1198,14 @@ const server = serve<WebSocketData>({
         const type = url.searchParams.get("type") as "device" | "client";
         const id = url.searchParams.get("id");
         if (type && id) {
+            let caps = type === "device" ? negotiateCaps(url.searchParams.get("caps")) : [];
+            const resume = caps.includes("resume")
+                ? openAgentSession(id, url.searchParams.get("session"), Number(url.searchParams.get("resumeFrom") ?? 1))
+                : undefined;
+            if (!resume) caps = caps.filter((cap) => cap !== "resume");
+            const headers: Record<string, string> = {};
+            if (caps.length) headers["X-Lynx-Caps"] = caps.join(",");
+            if (resume?.resumed) headers["X-Lynx-Resume"] = String(resume.session.lastSeq);
             const success = server.upgrade(req, {
                 data: {
                     type, id,
@@ -663,7 +1213,11 @@ const server = serve<WebSocketData>({
                     os: url.searchParams.get("os") || undefined,
                     version: url.searchParams.get("version") || undefined,
                     userId: url.searchParams.get("userId") || undefined,
+                    caps,
+                    session: resume?.session,
+                    resumed: resume?.resumed,
                 },
+                headers: Object.keys(headers).length ? headers : undefined,
             });
 if (success) return undefined;
         }
@@ -671,6 +1225,11 @@ if (success) return undefined;
         return new Response("Not found", { status: 404 });
     },
     websocket: {
+        // Matches the agent's inbound message cap so large uploads can go out as a few big messages
+        maxPayloadLength: 64 * 1024 * 1024,
+        // permessage-deflate. A dedicated decompressor keeps each agent's window, so agents
+        // can compress with context takeover; the shared compressor keeps memory flat.
+        perMessageDeflate: { compress: "shared", decompress: "dedicated" },
         async open(ws) {
             const { type, id, name, os, version, userId } = ws.data;
             console.log(`[${type}] connected: ${id} (${name})`);
@@ -678,6 +1237,20 @@ if (success) return undefined;
             if (type === "device") {
                 deviceSockets.set(id, ws);
 
+                const session = ws.data.session;
+                if (session) {
+                    session.socket = ws;
+                    if (ws.data.resumed) {
+                        // Back within the timeout: the dashboard never saw it go
+                        Object.assign(ws.data, session.carry);
+                        flushChannelCredit(id);
+                        console.log(`[device] session resumed: ${id} at ${session.lastSeq}`);
+                        return;
+                    }
+                }
+                // A new session: the agent closed whatever channels it had
+                dropChannelFlows(id);
+
                 const updates = {
                     id,
                     userId,
@@ -720,8 +1293,36 @@ if (success) return undefined;
         async message(ws, message) {
             const { type, id } = ws.data;
 
+            // 0. Sequenced messages (resume cap) are acknowledged and unwrapped first
+            if (typeof message !== "string" && type === "device" && ws.data.session && message[0] === SEQUENCE_FRAME_MARKER) {
+                const inner = receiveSequenced(ws, message as Uint8Array);
+                if (inner === null) return;
+                message = inner as any;
+            }
+
+            // Sliced bulk messages (Device only) are handled once complete
+            if (typeof message !== "string" && type === "device" && message[0] === SLICE_FRAME_MARKER) {
+                const whole = reassembleSlice(ws, message as Uint8Array);
+                if (whole === null) return;
+                message = whole as any;
+            }
+
+            // What the agent counts against a channel's window: the message as it queued it
+            const messageBytes = typeof message === "string" ? Buffer.byteLength(message) : message.length;
+
+            let frameMsg: any = null;
+            if (typeof message !== "string" && type === "device" && message[0] === FRAME_MARKER_V1) {
+                const frame = parseFrame(message as Uint8Array);
+                if (!frame) {
+                    console.error(`[Relay] Malformed frame from ${id}`);
+                    return;
+                }
+                frameMsg = frameToMessage(ws, frame);
+                if (!frameMsg) return;
+            }
+
             // 1. Binary Media Handling (Device -> Clients)
-            if (typeof message !== "string") {
+            if (!frameMsg && typeof message !== "string") {
                 const buffer = message as Uint8Array;
                 if (buffer.length > 0 && type === "device") {
                     const mediaTypeByte = buffer[0];
@@ -743,16 +1344,25 @@ if (success) return undefined;
 
             // 2. JSON Message Handling
             try {
-                const msg = JSON.parse(typeof message === "string" ? message : message.toString());
+                const msg = frameMsg ?? JSON.parse(typeof message === "string" ? message : message.toString());
 
                 if (type === "client") {
                     if (msg.type === "subscribe") {
                         const targetDeviceId = msg.deviceId;
+                        const previousDeviceId = ws.data.deviceId;
+                        const channelAcks = msg.channelAcks === true;
+                        if (previousDeviceId && previousDeviceId !== targetDeviceId) {
+                            subscriptions.get(previousDeviceId)?.delete(ws);
+                        }
+                        if (previousDeviceId && (previousDeviceId !== targetDeviceId || !channelAcks)) {
+                            forgetChannelClient(previousDeviceId, ws);
+                        }
                         if (!subscriptions.has(targetDeviceId)) {
                             subscriptions.set(targetDeviceId, new Set());
                         }
                         subscriptions.get(targetDeviceId)?.add(ws);
                         ws.data.deviceId = targetDeviceId;
+                        ws.data.channelAcks = channelAcks;
 
                         const isOnline = deviceSockets.has(targetDeviceId);
                         ws.send(JSON.stringify({ type: "status", status: isOnline ? "online" : "offline", deviceId: targetDeviceId }));
@@ -760,15 +1370,20 @@ if (success) return undefined;
                         if (isOnline) {
                             deviceSockets.get(targetDeviceId)?.send(JSON.stringify({ type: "action", action: "list_media_devices" }));
                         }
-                    } else if (["action", "command", "input", "resize", "filesystem", "update"].includes(msg.type)) {
+                    } else if (msg.type === "channel_ack") {
+                        if (ws.data.deviceId) acknowledgeChannel(ws.data.deviceId, ws, msg.channel, msg.channelSeq);
+                    } else if (["action", "command", "input", "resize", "filesystem", "update", "channel_open", "channel_close", "channel_stats"].includes(msg.type)) {
                         const targetDeviceId = ws.data.deviceId;
                         if (targetDeviceId) {
                             const deviceWs = deviceSockets.get(targetDeviceId);
-                            if (deviceWs) {
+                            if (deviceWs && msg.type.startsWith("channel_") && !deviceWs.data.caps?.includes("chan")) {
+                                const reply = msg.type === "channel_open" ? "channel_opened" : msg.type;
+                                ws.send(JSON.stringify({ type: reply, requestId: msg.requestId, channel: msg.channel, success: false, error: "Agent does not support channels" }));
+                            } else if (deviceWs) {
                                 if (msg.type === "filesystem") {
                                     console.log(`[Relay] Forwarding filesystem command: ${msg.action} to ${targetDeviceId}`);
                                 }
-                                deviceWs.send(JSON.stringify(msg));
+                                sendToDevice(deviceWs, msg);
                             } else {
                                 console.log(`[Relay] Target device ${targetDeviceId} not found or disconnected`);
                             }
@@ -782,9 +1397,13 @@ if (success) return undefined;
                     }
                 } else if (type === "device") {
                     if (msg.type === "output") {
-                        subscriptions.get(id)?.forEach(c => c.send(JSON.stringify({ type: "output", output: msg.output })));
+                        if (msg.channel) {
+                            forwardChannelMessage(id, { type: "output", output: msg.output, channel: msg.channel }, messageBytes);
+                        } else {
+                            subscriptions.get(id)?.forEach(c => c.send(JSON.stringify({ type: "output", output: msg.output })));
+                        }
                     } else if (msg.type === "ping") {
-                        ws.send(JSON.stringify({ type: "pong" }));
+                        sendPong(ws);
                         const device = deviceRegistry.get(id);
                         if (device) {
                             device.lastSeen = new Date();
@@ -808,7 +1427,7 @@ if (success) return undefined;
                         const data = { ...msg.data, videoBitrate: stream?.videoBitrate || 0, audioBitrate: stream?.audioBitrate || 0 };
                         subscriptions.get(id)?.forEach(c => c.send(JSON.stringify({ type: "metrics", data, deviceId: id })));
                     } else if (msg.type === "screenshot" && msg.data) {
-                        const buffer = Buffer.from(msg.data, "base64");
+                        const buffer = typeof msg.data === "string" ? Buffer.from(msg.data, "base64") : msg.data;
                         const timestamp = Date.now();
                         await Bun.write(`images/${id}/${timestamp}.png`, buffer);
                         subscriptions.get(id)?.forEach(c => c.send(JSON.stringify({ 
@@ -816,8 +1435,14 @@ if (success) return undefined;
                             url: `/images/${id}/${timestamp}.png`, 
                             filename: `${timestamp}.png` 
                         })));
-                    } else if (["filesystem", "media_devices_list", "screenshot_saved", "update_status"].includes(msg.type)) {
+                    } else if (msg.type === "filesystem" && msg.channel) {
+                        forwardChannelMessage(id, msg, messageBytes);
+                    } else if (["filesystem", "media_devices_list", "screenshot_saved", "update_status", "stream_status", "channel_opened", "channel_closed", "channel_stats"].includes(msg.type)) {
                         subscriptions.get(id)?.forEach(c => c.send(JSON.stringify(msg)));
+                        if (msg.type === "channel_closed") {
+                            ws.data.outputDecoders?.delete(msg.channel);
+                            closeChannelFlow(id, msg.channel);
+                        }
                     }
                 }
             } catch (e) {
@@ -830,22 +1455,36 @@ if (success) return undefined;
             console.log(`[${type}] disconnected: ${id}`);
 
             if (type === "device") {
-                deviceSockets.delete(id);
-                const device = db.select().from(devices).where(eq(devices.id, id)).get();
-                if (device) {
-                    await triggerWebhooks(device.userId, "device.disconnect", { ...device, status: "offline" });
-                }
-                
-                // Update registry to offline immediately
-                const reg = deviceRegistry.get(id);
-                if (reg) {
-                    deviceRegistry.set(id, { ...reg, status: "offline", lastSeen: new Date() });
+                const session = ws.data.session;
+                if (!session) {
+                    deviceSockets.delete(id);
+                    dropChannelFlows(id);
+                    await markDeviceOffline(id);
+                    return;
                 }
 
-                upsertDevice({ id, status: "offline", lastSeen: new Date() });
+                // Superseded by a resumed connection, which now owns the session
+                if (session.socket !== ws) return;
+                session.carry = carryOf(ws.data);
+                session.socket = undefined;
+                clearTimeout(session.ackTimer);
+                session.ackTimer = undefined;
+                if (deviceSockets.get(id) === ws) deviceSockets.delete(id);
+
+                // Hold the device online while the agent may still resume
+                session.expiry = setTimeout(() => {
+                    if (agentSessions.get(session.token) === session) agentSessions.delete(session.token);
+                    if (!deviceSockets.has(id)) {
+                        dropChannelFlows(id);
+                        markDeviceOffline(id);
+                    }
+                }, SESSION_RESUME_TIMEOUT_MS);
             } else if (type === "client") {
                 const targetDeviceId = ws.data.deviceId;
-                if (targetDeviceId) subscriptions.get(targetDeviceId)?.delete(ws);
+                if (targetDeviceId) {
+                    subscriptions.get(targetDeviceId)?.delete(ws);
+                    forgetChannelClient(targetDeviceId, ws);
+                }
             }
         },
     },